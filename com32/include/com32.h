@@ -125,6 +125,12 @@ void *lzalloc(size_t);
 void lfree(void *);
 char *lstrdup(const char *);
 
+/*
+ * Allocation as high as possible within constraints on where, for data
+ * loaded straight to where the next stage wants it
+ */
+void *hmalloc(size_t, size_t, size_t, uintptr_t);
+
 /*
  * These functions convert between linear pointers in the range
  * 0..0xFFFFF and real-mode style SEG:OFFS pointers.  Note that a
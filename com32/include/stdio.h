@@ -88,6 +88,12 @@ __extern size_t fwrite(const void *, size_t, size_t, FILE *);
 /* No seek, but we can tell */
 __extern long ftell(FILE *);
 
+/* Read-ahead of input files; must be set before the first read */
+#define _IOFBF	0
+#define _IOLBF	1
+#define _IONBF	2
+__extern int setvbuf(FILE *, char *, int, size_t);
+
 __extern int printf(const char *, ...);
 __extern int vprintf(const char *, va_list);
 __extern int fprintf(FILE *, const char *, ...);
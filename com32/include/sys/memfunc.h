@@ -0,0 +1,38 @@
+/*
+ * sys/memfunc.h
+ *
+ * The CPU-specific versions of memcpy() and memset(), and the pointers
+ * through which memcpy(), memmove() and memset() reach them.
+ */
+
+#ifndef _SYS_MEMFUNC_H
+#define _SYS_MEMFUNC_H
+
+#include <stddef.h>
+
+typedef void *(*memcpy_func_t)(void *, const void *, size_t);
+typedef void *(*memset_func_t)(void *, int, size_t);
+
+extern memcpy_func_t __memcpy_func;
+extern memset_func_t __memset_func;
+
+/* memcpy.S */
+void *__memcpy_movsl(void *, const void *, size_t);
+void *__memcpy_movsl_nt(void *, const void *, size_t);
+void *__memcpy_erms(void *, const void *, size_t);
+void *__memcpy_erms_nt(void *, const void *, size_t);
+void *__memcpy_movnti(void *, const void *, size_t);
+
+/* memset.S */
+void *__memset_stosl(void *, int, size_t);
+void *__memset_stosl_nt(void *, int, size_t);
+void *__memset_erms(void *, int, size_t);
+void *__memset_erms_nt(void *, int, size_t);
+void *__memset_movnti(void *, int, size_t);
+
+/* memfunc.c */
+void __mem_select(void);
+int __mem_has_erms(void);
+int __mem_has_movnti(void);
+
+#endif /* _SYS_MEMFUNC_H */
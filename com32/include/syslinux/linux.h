@@ -52,6 +52,14 @@ struct initramfs {
 };
 #define INITRAMFS_MAX_ALIGN	4096
 
+/*
+ * An initramfs which is read into memory ending below this, where
+ * every kernel can take it, and with room after it for a few small
+ * additions, can normally be booted from where it is.
+ */
+#define INITRAMFS_TARGET_LIMIT	0x38000000
+#define INITRAMFS_HEADROOM	(64 << 10)
+
 struct setup_data_header {
 	uint64_t next;
 	uint32_t type;
@@ -72,10 +80,13 @@ int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
 			struct initramfs *initramfs,
 			struct setup_data *setup_data,
 			char *cmdline);
+int syslinux_load_linux(const char *filename, void **kernel_buf,
+			size_t *kernel_size);
 
 /* Initramfs manipulation functions */
 
 struct initramfs *initramfs_init(void);
+size_t initramfs_size(struct initramfs *ihead);
 int initramfs_add_data(struct initramfs *ihead, const void *data,
 		       size_t data_len, size_t len, size_t align);
 int initramfs_mknod(struct initramfs *ihead, const char *filename,
@@ -11,5 +11,6 @@
 int loadfile(const char *, void **, size_t *);
 int zloadfile(const char *, void **, size_t *);
 int floadfile(FILE *, void **, size_t *, const void *, size_t);
+int floadfile_chunks(FILE *, int (*)(void *, void *, size_t), void *);
 
 #endif
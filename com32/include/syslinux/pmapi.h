@@ -46,7 +46,7 @@ struct _DIR_;
 struct dirent;
 
 struct com32_filedata {
-    size_t size;		/* File size */
+    size_t size;		/* File size, or -1 if unknown or >= 4 GiB */
     int blocklg2;		/* log2(block size) */
     uint16_t handle;		/* File handle */
 };
@@ -10,12 +10,14 @@
 static struct free_arena_header *__free_block(struct free_arena_header *ah)
 {
     struct free_arena_header *pah, *nah;
+    int bin = -1;		/* Bin ah is in, if any */
 
     pah = ah->a.prev;
     nah = ah->a.next;
     if (pah->a.type == ARENA_TYPE_FREE &&
 	(char *)pah + pah->a.size == (char *)ah) {
-	/* Coalesce into the previous block */
+	/* Coalesce into the previous block, which stays in its bin */
+	bin = __malloc_bin(pah->a.size);
 	pah->a.size += ah->a.size;
 	pah->a.next = nah;
 	nah->a.prev = pah;
@@ -27,24 +29,16 @@ static struct free_arena_header *__free_block(struct free_arena_header *ah)
 	ah = pah;
 	pah = ah->a.prev;
     } else {
-	/* Need to add this block to the free chain */
 	ah->a.type = ARENA_TYPE_FREE;
-
-	ah->next_free = __malloc_head.next_free;
-	ah->prev_free = &__malloc_head;
-	__malloc_head.next_free = ah;
-	ah->next_free->prev_free = ah;
     }
 
     /* In either of the previous cases, we might be able to merge
        with the subsequent block... */
     if (nah->a.type == ARENA_TYPE_FREE &&
 	(char *)ah + ah->a.size == (char *)nah) {
-	ah->a.size += nah->a.size;
-
 	/* Remove the old block from the chains */
-	nah->next_free->prev_free = nah->prev_free;
-	nah->prev_free->next_free = nah->next_free;
+	__malloc_bin_del(nah);
+	ah->a.size += nah->a.size;
 	ah->a.next = nah->a.next;
 	nah->a.next->a.prev = ah;
 
@@ -53,6 +47,13 @@ static struct free_arena_header *__free_block(struct free_arena_header *ah)
 #endif
     }
 
+    /* File the whole block under its final size, if that has moved it */
+    if (bin != __malloc_bin(ah->a.size)) {
+	if (bin >= 0)
+	    __malloc_bin_unlink(ah, bin);
+	__malloc_bin_add(ah);
+    }
+
     /* Return the block that contains the called block */
     return ah;
 }
@@ -0,0 +1,114 @@
+/*
+ * hmalloc.c
+ *
+ * Allocate a block at the highest address which meets a caller's
+ * constraints on where it has to be, so that data which will be used
+ * from a particular kind of place by the next stage, such as a Linux
+ * kernel or initramfs, can be read straight there.
+ */
+
+#include <stdlib.h>
+#include <com32.h>
+#include "malloc.h"
+
+/*
+ * Make the part of the free block fp starting with the header hp and
+ * usize bytes long a used block, leaving the rest on either side free.
+ */
+static void *__hmalloc_carve(struct free_arena_header *fp,
+			     struct free_arena_header *hp, size_t usize)
+{
+    struct free_arena_header *na, *nfp;
+    size_t front, back;
+
+    front = (char *)hp - (char *)fp;
+    back = fp->a.size - front - usize;
+    if (back < sizeof(struct free_arena_header)) {
+	usize += back;		/* Too small to be a free block */
+	back = 0;
+    }
+
+    na = fp->a.next;
+    __malloc_bin_del(fp);
+
+    if (front) {
+	fp->a.size = front;
+	hp->a.prev = fp;
+	fp->a.next = hp;
+	__malloc_bin_add(fp);
+    }
+
+    hp->a.type = ARENA_TYPE_USED;
+    hp->a.size = usize;
+
+    if (back) {
+	nfp = (struct free_arena_header *)((char *)hp + usize);
+	nfp->a.type = ARENA_TYPE_FREE;
+	nfp->a.size = back;
+	nfp->a.prev = hp;
+	nfp->a.next = na;
+	na->a.prev = nfp;
+	hp->a.next = nfp;
+	__malloc_bin_add(nfp);
+    } else {
+	hp->a.next = na;
+	na->a.prev = hp;
+    }
+
+    return (void *)(&hp->a + 1);
+}
+
+/*
+ * Allocate size bytes ending at or below limit, such that the address
+ * of the block plus offset is a multiple of align, at the highest
+ * address that allows.  align must be a power of two and offset a
+ * multiple of 16.  The block is freed with free() like any other.
+ */
+void *hmalloc(size_t size, size_t align, size_t offset, uintptr_t limit)
+{
+    struct free_arena_header *fp, *hp;
+    uintptr_t start, end, p, skew;
+    size_t usize;
+
+    if (size == 0 || size > (size_t)-1 >> 1 ||
+	(align & (align - 1)) || (offset & ~ARENA_SIZE_MASK))
+	return NULL;
+
+    if (align < sizeof(struct arena_header))
+	align = sizeof(struct arena_header);
+
+    usize = (size + 2 * sizeof(struct arena_header) - 1) & ARENA_SIZE_MASK;
+
+    /* The all-block chain is in address order, so go down it backwards */
+    for (fp = __malloc_head.a.prev; fp->a.type != ARENA_TYPE_HEAD;
+	 fp = fp->a.prev) {
+	if (fp->a.type != ARENA_TYPE_FREE)
+	    continue;
+
+	start = (uintptr_t)fp + sizeof(struct arena_header);
+	end = (uintptr_t)fp + fp->a.size;
+	if (end > limit)
+	    end = limit;
+	if (end < start || end - start < size)
+	    continue;
+
+	/* Highest place in the block, then down to the alignment */
+	p = end - size;
+	skew = (p + offset) & (align - 1);
+	if (p - start < skew)
+	    continue;
+	p -= skew;
+
+	/* The space left in front has to be nothing or a free block */
+	if (p - start == sizeof(struct arena_header)) {
+	    if (align != sizeof(struct arena_header))
+		continue;
+	    p = start;
+	}
+
+	hp = (struct free_arena_header *)((struct arena_header *)p - 1);
+	return __hmalloc_carve(fp, hp, usize);
+    }
+
+    return NULL;
+}
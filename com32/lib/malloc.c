@@ -1,107 +1,81 @@
 /*
  * malloc.c
  *
- * Very simple linked-list based malloc()/free().
+ * Simple linked-list based malloc()/free(), with the free blocks kept
+ * in power-of-two size bins (see malloc.h).
  */
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
-#include <com32.h>
-#include <syslinux/memscan.h>
-#include "init.h"
 #include "malloc.h"
 
-struct free_arena_header __malloc_head = {
-    {
-     ARENA_TYPE_HEAD,
-     0,
-     &__malloc_head,
-     &__malloc_head,
-     },
-    &__malloc_head,
-    &__malloc_head
-};
-
-/* This is extern so it can be overridden by the user application */
-extern size_t __stack_size;
-extern void *__mem_end;		/* Produced after argv parsing */
-
-static inline size_t sp(void)
+static struct free_arena_header *__malloc_bin_head(size_t size)
 {
-    size_t sp;
-    asm volatile ("movl %%esp,%0":"=rm" (sp));
-    return sp;
-}
-
-#define E820_MEM_MAX 0xfff00000	/* 4 GB - 1 MB */
-
-static int consider_memory_area(void *dummy, addr_t start,
-				addr_t len, bool valid)
-{
-    struct free_arena_header *fp;
-    addr_t end;
-
-    (void)dummy;
-
-    if (valid && start < E820_MEM_MAX) {
-	if (len > E820_MEM_MAX - start)
-	    len = E820_MEM_MAX - start;
-
-	end = start + len;
+    int bin = __malloc_bin(size);
+    struct free_arena_header *head = &__malloc_bins[bin];
 
-	if (end > __com32.cs_memsize) {
-	    if (start <= __com32.cs_memsize) {
-		start = __com32.cs_memsize;
-		len = end - start;
-	    }
-
-	    if (len >= 2 * sizeof(struct arena_header)) {
-		fp = (struct free_arena_header *)start;
-		fp->a.size = len;
-		__inject_free_block(fp);
-	    }
-	}
+    if (!(__malloc_bin_map & ((size_t)1 << bin))) {
+	head->next_free = head->prev_free = head;
+	__malloc_bin_map |= (size_t)1 << bin;
     }
-
-    return 0;
+    return head;
 }
 
-static void __constructor init_memory_arena(void)
+/* Put a free block at the front of its bin */
+void __malloc_bin_add(struct free_arena_header *ah)
 {
-    struct free_arena_header *fp;
-    size_t start, total_space;
+    struct free_arena_header *head = __malloc_bin_head(ah->a.size);
 
-    start = (size_t) ARENA_ALIGN_UP(__mem_end);
-    total_space = sp() - start;
-
-    if (__stack_size == 0 || __stack_size > total_space >> 1)
-	__stack_size = total_space >> 1;	/* Half for the stack, half for the heap... */
+    ah->next_free = head->next_free;
+    ah->prev_free = head;
+    head->next_free = ah;
+    ah->next_free->prev_free = ah;
+}
 
-    if (total_space < __stack_size + 4 * sizeof(struct arena_header))
-	__stack_size = total_space - 4 * sizeof(struct arena_header);
+/* Put a free block at the back of its bin, to be used last */
+void __malloc_bin_add_tail(struct free_arena_header *ah)
+{
+    struct free_arena_header *head = __malloc_bin_head(ah->a.size);
 
-    fp = (struct free_arena_header *)start;
-    fp->a.size = total_space - __stack_size;
+    ah->prev_free = head->prev_free;
+    ah->next_free = head;
+    head->prev_free = ah;
+    ah->prev_free->next_free = ah;
+}
 
-    __inject_free_block(fp);
+/* Take a free block out of bin, which it was filed in */
+void __malloc_bin_unlink(struct free_arena_header *ah, int bin)
+{
+    ah->next_free->prev_free = ah->prev_free;
+    ah->prev_free->next_free = ah->next_free;
 
-    /* Scan the memory map to look for other suitable regions */
-    if (!__com32.cs_memsize)
-	return;			/* Old Syslinux core, can't do this... */
+    /* Both neighbours are the head only if this was the last block */
+    if (ah->next_free == ah->prev_free)
+	__malloc_bin_map &= ~((size_t)1 << bin);
+}
 
-    syslinux_scan_memory(consider_memory_area, NULL);
+/* Take a free block out of its bin; a.size must not have changed */
+void __malloc_bin_del(struct free_arena_header *ah)
+{
+    __malloc_bin_unlink(ah, __malloc_bin(ah->a.size));
 }
 
 static void *__malloc_from_block(struct free_arena_header *fp, size_t size)
 {
     size_t fsize;
     struct free_arena_header *nfp, *na;
+    bool same_bin;
 
     fsize = fp->a.size;
 
     /* We need the 2* to account for the larger requirements of a free block */
     if (fsize >= size + 2 * sizeof(struct arena_header)) {
 	/* Bigger block than required -- split block */
+	same_bin = __malloc_bin(fsize - size) == __malloc_bin(fsize);
+	if (!same_bin)
+	    __malloc_bin_del(fp);
+
 	nfp = (struct free_arena_header *)((char *)fp + size);
 	na = fp->a.next;
 
@@ -116,18 +90,20 @@ static void *__malloc_from_block(struct free_arena_header *fp, size_t size)
 	na->a.prev = nfp;
 	fp->a.next = nfp;
 
-	/* Replace current block on free chain */
-	nfp->next_free = fp->next_free;
-	nfp->prev_free = fp->prev_free;
-	fp->next_free->prev_free = nfp;
-	fp->prev_free->next_free = nfp;
+	if (same_bin) {
+	    /* The rest takes our place in the bin, as it is still the same */
+	    nfp->next_free = fp->next_free;
+	    nfp->prev_free = fp->prev_free;
+	    nfp->next_free->prev_free = nfp;
+	    nfp->prev_free->next_free = nfp;
+	} else {
+	    /* The rest goes in the bin for its size */
+	    __malloc_bin_add(nfp);
+	}
     } else {
 	/* Allocate the whole block */
+	__malloc_bin_del(fp);
 	fp->a.type = ARENA_TYPE_USED;
-
-	/* Remove from free chain */
-	fp->next_free->prev_free = fp->prev_free;
-	fp->prev_free->next_free = fp->next_free;
     }
 
     return (void *)(&fp->a + 1);
@@ -135,19 +111,50 @@ static void *__malloc_from_block(struct free_arena_header *fp, size_t size)
 
 void *malloc(size_t size)
 {
-    struct free_arena_header *fp;
+    struct free_arena_header *fp, *head;
+    size_t map;
+    int bin, fit, n;
 
-    if (size == 0)
+    if (size == 0 || size > (size_t)-1 >> 1)
 	return NULL;
 
     /* Add the obligatory arena header, and round up */
     size = (size + 2 * sizeof(struct arena_header) - 1) & ARENA_SIZE_MASK;
 
-    for (fp = __malloc_head.next_free; fp->a.type != ARENA_TYPE_HEAD;
-	 fp = fp->next_free) {
-	if (fp->a.size >= size) {
-	    /* Found fit -- allocate out of this block */
-	    return __malloc_from_block(fp, size);
+    bin = __malloc_bin(size);
+    fit = bin + !!(size & (size - 1));
+
+    /*
+     * A small block is best taken from the front of its own bin, which
+     * holds the blocks of this size freed last; only a few sizes share
+     * a small bin, so one of the first few usually fits.
+     */
+    if (bin < MALLOC_SMALL_BINS && (__malloc_bin_map & ((size_t)1 << bin))) {
+	head = &__malloc_bins[bin];
+	n = MALLOC_SMALL_SCAN;
+	for (fp = head->next_free; fp != head && n--; fp = fp->next_free) {
+	    if (fp->a.size >= size)
+		return __malloc_from_block(fp, size);
+	}
+    }
+
+    /*
+     * Every block in a bin above the one for this size is big enough,
+     * as are those in its own bin if size is a power of two: take the
+     * first block from the smallest such bin that has one.
+     */
+    map = fit < (int)MALLOC_BINS ? __malloc_bin_map & ((size_t)-1 << fit) : 0;
+    if (map) {
+	fp = __malloc_bins[__builtin_ctzl(map)].next_free;
+	return __malloc_from_block(fp, size);
+    }
+
+    /* Failing that, look for a fit among the blocks of the same bin */
+    if (fit != bin && (__malloc_bin_map & ((size_t)1 << bin))) {
+	head = &__malloc_bins[bin];
+	for (fp = head->next_free; fp != head; fp = fp->next_free) {
+	    if (fp->a.size >= size)
+		return __malloc_from_block(fp, size);
 	}
     }
 
@@ -4,6 +4,9 @@
  * Internals for the memory allocator
  */
 
+#ifndef MALLOC_H
+#define MALLOC_H
+
 #include <stdint.h>
 #include <stddef.h>
 
@@ -51,5 +54,34 @@ struct free_arena_header {
     struct free_arena_header *next_free, *prev_free;
 };
 
+/*
+ * All blocks, free or used, are on the address-ordered chain headed by
+ * __malloc_head, which is what lets free() coalesce a block with its
+ * neighbours.  Free blocks are also kept in bins by size: bin n holds
+ * the blocks of 2^n to 2^(n+1)-1 bytes, as a circular list through
+ * next_free/prev_free headed by __malloc_bins[n].  Bit n of
+ * __malloc_bin_map is set when bin n is not empty; a bin's head is only
+ * valid while it is, so the bins need no initialization.
+ */
+#define MALLOC_BINS	(8 * sizeof(size_t))
+#define MALLOC_SMALL_BINS	9	/* Bins of blocks under 512 bytes... */
+#define MALLOC_SMALL_SCAN	4	/* ...are searched this far first */
+
 extern struct free_arena_header __malloc_head;
+extern struct free_arena_header __malloc_bins[MALLOC_BINS];
+extern size_t __malloc_bin_map;
+
 void __inject_free_block(struct free_arena_header *ah);
+
+static inline int __malloc_bin(size_t size)
+{
+    return (MALLOC_BINS - 1) - __builtin_clzl(size);
+}
+
+/* malloc.c */
+void __malloc_bin_add(struct free_arena_header *ah);
+void __malloc_bin_add_tail(struct free_arena_header *ah);
+void __malloc_bin_unlink(struct free_arena_header *ah, int bin);
+void __malloc_bin_del(struct free_arena_header *ah);
+
+#endif /* MALLOC_H */
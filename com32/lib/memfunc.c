@@ -0,0 +1,82 @@
+/*
+ * memfunc.c
+ *
+ * Pick the memcpy() and memset() loops for this CPU.  Both function
+ * pointers start out at a stub which makes the choice on first use,
+ * so this works the same in the core, which has no constructors, and
+ * in a module, without any setup call.
+ *
+ * ERMS (CPUID leaf 7, EBX bit 9) makes a plain "rep movsb" the fastest
+ * copy for all sizes.  MOVNTI comes with SSE2, but unlike the rest of
+ * SSE doesn't need CR4.OSFXSR set, so we can use it without touching
+ * the FPU state.  Without CPUID, or either feature, we keep the
+ * original rep movsl/stosl loops.
+ */
+
+#include <stdbool.h>
+#include <com32.h>
+#include <cpufeature.h>
+#include <sys/cpu.h>
+#include <sys/memfunc.h>
+
+static void *memcpy_select(void *, const void *, size_t);
+static void *memset_select(void *, int, size_t);
+
+memcpy_func_t __memcpy_func = memcpy_select;
+memset_func_t __memset_func = memset_select;
+
+static int has_erms = -1, has_movnti;
+
+static void mem_probe(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    has_erms = has_movnti = 0;
+
+    if (!cpu_has_eflag(EFLAGS_ID))
+	return;
+
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 7) {
+	cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+	has_erms = !!(ebx & (1 << 9));
+    }
+    has_movnti = !!(cpuid_edx(1) & (1 << (X86_FEATURE_XMM2 & 31)));
+}
+
+int __mem_has_erms(void)
+{
+    if (has_erms < 0)
+	mem_probe();
+    return has_erms;
+}
+
+int __mem_has_movnti(void)
+{
+    if (has_erms < 0)
+	mem_probe();
+    return has_movnti;
+}
+
+void __mem_select(void)
+{
+    if (__mem_has_erms()) {
+	__memcpy_func = has_movnti ? __memcpy_erms_nt : __memcpy_erms;
+	__memset_func = has_movnti ? __memset_erms_nt : __memset_erms;
+    } else {
+	__memcpy_func = has_movnti ? __memcpy_movsl_nt : __memcpy_movsl;
+	__memset_func = has_movnti ? __memset_stosl_nt : __memset_stosl;
+    }
+}
+
+static void *memcpy_select(void *dst, const void *src, size_t n)
+{
+    __mem_select();
+    return __memcpy_func(dst, src, n);
+}
+
+static void *memset_select(void *dst, int c, size_t n)
+{
+    __mem_select();
+    return __memset_func(dst, c, n);
+}
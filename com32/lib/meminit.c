@@ -0,0 +1,98 @@
+/*
+ * meminit.c
+ *
+ * Set up the malloc() arena: the space between the end of the program
+ * and the stack, and whatever the memory map has above the core.  The
+ * allocator's list heads live here too, which is what pulls this file,
+ * and its constructor, into anything that uses malloc().
+ */
+
+#include <stdlib.h>
+#include <com32.h>
+#include <syslinux/memscan.h>
+#include "init.h"
+#include "malloc.h"
+
+struct free_arena_header __malloc_head = {
+    {
+     ARENA_TYPE_HEAD,
+     0,
+     &__malloc_head,
+     &__malloc_head,
+     },
+    &__malloc_head,
+    &__malloc_head
+};
+
+struct free_arena_header __malloc_bins[MALLOC_BINS];
+size_t __malloc_bin_map;
+
+/* This is extern so it can be overridden by the user application */
+extern size_t __stack_size;
+extern void *__mem_end;		/* Produced after argv parsing */
+
+static inline size_t sp(void)
+{
+    size_t sp;
+    asm volatile ("movl %%esp,%0":"=rm" (sp));
+    return sp;
+}
+
+#define E820_MEM_MAX 0xfff00000	/* 4 GB - 1 MB */
+
+static int consider_memory_area(void *dummy, addr_t start,
+				addr_t len, bool valid)
+{
+    struct free_arena_header *fp;
+    addr_t end;
+
+    (void)dummy;
+
+    if (valid && start < E820_MEM_MAX) {
+	if (len > E820_MEM_MAX - start)
+	    len = E820_MEM_MAX - start;
+
+	end = start + len;
+
+	if (end > __com32.cs_memsize) {
+	    if (start <= __com32.cs_memsize) {
+		start = __com32.cs_memsize;
+		len = end - start;
+	    }
+
+	    if (len >= 2 * sizeof(struct arena_header)) {
+		fp = (struct free_arena_header *)start;
+		fp->a.size = len;
+		__inject_free_block(fp);
+	    }
+	}
+    }
+
+    return 0;
+}
+
+static void __constructor init_memory_arena(void)
+{
+    struct free_arena_header *fp;
+    size_t start, total_space;
+
+    start = (size_t) ARENA_ALIGN_UP(__mem_end);
+    total_space = sp() - start;
+
+    if (__stack_size == 0 || __stack_size > total_space >> 1)
+	__stack_size = total_space >> 1;	/* Half for the stack, half for the heap... */
+
+    if (total_space < __stack_size + 4 * sizeof(struct arena_header))
+	__stack_size = total_space - 4 * sizeof(struct arena_header);
+
+    fp = (struct free_arena_header *)start;
+    fp->a.size = total_space - __stack_size;
+
+    __inject_free_block(fp);
+
+    /* Scan the memory map to look for other suitable regions */
+    if (!__com32.cs_memsize)
+	return;			/* Old Syslinux core, can't do this... */
+
+    syslinux_scan_memory(consider_memory_area, NULL);
+}
@@ -43,10 +43,9 @@ void *realloc(void *ptr, size_t size)
 	    nah->a.type == ARENA_TYPE_FREE &&
 	    oldsize + nah->a.size >= newsize) {
 	    /* Merge in subsequent free block */
+	    __malloc_bin_del(nah);
 	    ah->a.next = nah->a.next;
 	    ah->a.next->a.prev = ah;
-	    nah->next_free->prev_free = nah->prev_free;
-	    nah->prev_free->next_free = nah->next_free;
 	    xsize = (ah->a.size += nah->a.size);
 	}
 
@@ -69,17 +68,11 @@ void *realloc(void *ptr, size_t size)
 		if (newsize > oldsize) {
 		    /* Hack: this free block is in the path of a memory object
 		       which has already been grown at least once.  As such, put
-		       it at the *end* of the freelist instead of the beginning;
+		       it at the *end* of its bin instead of the beginning;
 		       trying to save it for future realloc()s of the same block. */
-		    nah->prev_free = __malloc_head.prev_free;
-		    nah->next_free = &__malloc_head;
-		    __malloc_head.prev_free = nah;
-		    nah->prev_free->next_free = nah;
+		    __malloc_bin_add_tail(nah);
 		} else {
-		    nah->next_free = __malloc_head.next_free;
-		    nah->prev_free = &__malloc_head;
-		    __malloc_head.next_free = nah;
-		    nah->next_free->prev_free = nah;
+		    __malloc_bin_add(nah);
 		}
 	    }
 	    /* otherwise, use up the whole block */
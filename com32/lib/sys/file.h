@@ -76,6 +76,7 @@ struct output_dev {
 
 #define NFILES 32		/* Number of files to support */
 #define MAXBLOCK 16384		/* Defined by ABI */
+#define READAHEAD_MAX (256 << 10) /* Default limit for read-ahead growth */
 
 struct file_info {
     const struct input_dev *iop;	/* Input operations */
@@ -93,11 +94,19 @@ struct file_info {
 	size_t nbytes;		/* Number of bytes available in buffer */
 	char *datap;		/* Current data pointer */
 	void *pvt;		/* Private pointer for driver */
+	char *rabuf;		/* Read-ahead buffer, once first filled */
+	size_t rasize;		/* Bytes asked for per fill of rabuf */
+	size_t ramax;		/* Limit for rasize to grow to */
+	void *raheap;		/* rabuf, if we allocated it */
 	char buf[MAXBLOCK];
     } i;
 };
 
 extern struct file_info __file_info[NFILES];
+extern size_t __file_readahead;
+
+/* Block input for files */
+int __file_get_block(struct file_info *fp);
 
 /* Line input discipline */
 ssize_t __line_input(struct file_info *fp, char *buf, size_t bufsize,
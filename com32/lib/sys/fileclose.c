@@ -34,6 +34,7 @@
 #include <errno.h>
 #include <com32.h>
 #include <string.h>
+#include <stdlib.h>
 #include "file.h"
 
 int __file_close(struct file_info *fp)
@@ -41,5 +42,6 @@ int __file_close(struct file_info *fp)
     if (fp->i.fd.handle)
 	__com32.cs_pm->close_file(fp->i.fd.handle);
 
+    free(fp->i.raheap);
     return 0;
 }
@@ -33,24 +33,56 @@
 
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
 #include <com32.h>
 #include <syslinux/pmapi.h>
 #include <minmax.h>
 #include "file.h"
 
+/* Default limit for the read-ahead of a newly opened file; see setvbuf() */
+size_t __file_readahead = READAHEAD_MAX;
+
+/*
+ * A file which is read into the buffer a second time is being read
+ * through, so make the next fill twice as big, up to i.ramax.  Each
+ * fill is a trip into the core, so fewer, larger ones are cheaper.
+ */
+static void __file_grow_buffer(struct file_info *fp)
+{
+    size_t size = min(fp->i.rasize << 1, fp->i.ramax);
+    char *buf;
+
+    if (size <= fp->i.rasize ||
+	(fp->i.rabuf != fp->i.buf && fp->i.rabuf != fp->i.raheap))
+	return;			/* At the limit, or not our buffer */
+
+    buf = malloc(size);
+    if (!buf)
+	return;			/* Carry on with what we have */
+
+    free(fp->i.raheap);
+    fp->i.rabuf = fp->i.raheap = buf;
+    fp->i.rasize = size;
+}
+
 int __file_get_block(struct file_info *fp)
 {
     ssize_t bytes_read;
 
-    bytes_read = __com32.cs_pm->read_file(&fp->i.fd.handle, fp->i.buf,
-					  MAXBLOCK >> fp->i.fd.blocklg2);
+    if (!fp->i.rabuf)
+	fp->i.rabuf = fp->i.buf;
+    else
+	__file_grow_buffer(fp);
+
+    bytes_read = __com32.cs_pm->read_file(&fp->i.fd.handle, fp->i.rabuf,
+					  fp->i.rasize >> fp->i.fd.blocklg2);
     if (!bytes_read) {
 	errno = EIO;
 	return -1;
     }
     
     fp->i.nbytes = bytes_read;
-    fp->i.datap  = fp->i.buf;
+    fp->i.datap  = fp->i.rabuf;
     return 0;
 }
 
@@ -62,11 +94,19 @@ ssize_t __file_read(struct file_info * fp, void *buf, size_t count)
 
     while (count) {
 	if (fp->i.nbytes == 0) {
-	    if (fp->i.offset >= fp->i.fd.size || !fp->i.fd.handle)
+	    /* A size of -1 means the file has to be read to the end */
+	    if ((fp->i.fd.size != (size_t)-1 &&
+		 fp->i.offset >= fp->i.fd.size) || !fp->i.fd.handle)
 		return n;	/* As good as it gets... */
 
-	    if (count > MAXBLOCK) {
-		/* Large transfer: copy directly, without buffering */
+	    /*
+	     * Read straight into the caller's buffer, without copying,
+	     * when that takes no more trips into the core than the
+	     * read-ahead would: for at least a full read-ahead block,
+	     * or at least MAXBLOCK into a dword-aligned buffer.
+	     */
+	    if (count >= fp->i.rasize ||
+		(count >= MAXBLOCK && !((uintptr_t)bufp & 3))) {
 		ncopy = __com32.cs_pm->read_file(&fp->i.fd.handle, bufp,
 						 count >> fp->i.fd.blocklg2);
 		if (!ncopy) {
@@ -74,6 +114,7 @@ ssize_t __file_read(struct file_info * fp, void *buf, size_t count)
 		    return n ? n : -1;
 		}
 
+		fp->i.offset += ncopy;
 		goto got_data;
 	    } else {
 		if (__file_get_block(fp))
@@ -30,6 +30,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <minmax.h>
 #include "file.h"
 
 /*
@@ -70,6 +71,9 @@ int open(const char *pathname, int flags, ...)
 
     fp->i.offset = 0;
     fp->i.nbytes = 0;
+    fp->i.rasize = MAXBLOCK;
+    fp->i.ramax = max(__file_readahead, (size_t)MAXBLOCK) &
+	~(((size_t)1 << fp->i.fd.blocklg2) - 1);
 
     return fd;
 }
@@ -0,0 +1,64 @@
+/*
+ * sys/setvbuf.c
+ *
+ * Set up the read-ahead of an input file.  With _IOFBF or _IOLBF and
+ * no buffer, size is the limit the read-ahead may grow to; with a
+ * buffer, that buffer is used at a fixed size instead.  _IONBF keeps
+ * it at a single MAXBLOCK.  Output is never buffered.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "sys/file.h"
+
+int setvbuf(FILE * stream, char *buf, int mode, size_t size)
+{
+    int fd = fileno(stream);
+    struct file_info *fp;
+    size_t sector_mask;
+
+    if (fd < 0 || fd >= NFILES) {
+	errno = EBADF;
+	return -1;
+    }
+
+    fp = &__file_info[fd];
+    if (!fp->iop || !(fp->iop->flags & __DEV_FILE)) {
+	errno = EBADF;
+	return -1;
+    }
+
+    /* Too late once something has been read */
+    if (fp->i.rabuf || fp->i.raheap || !fp->i.fd.handle) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    sector_mask = ((size_t)1 << fp->i.fd.blocklg2) - 1;
+
+    switch (mode) {
+    case _IONBF:
+	fp->i.ramax = MAXBLOCK;
+	break;
+    case _IOFBF:
+    case _IOLBF:
+	if (buf) {
+	    size &= ~sector_mask;
+	    if (!size) {
+		errno = EINVAL;
+		return -1;
+	    }
+	    fp->i.rabuf = buf;
+	    fp->i.rasize = fp->i.ramax = size;
+	} else {
+	    fp->i.ramax = (size > MAXBLOCK ? size : MAXBLOCK) & ~sector_mask;
+	}
+	break;
+    default:
+	errno = EINVAL;
+	return -1;
+    }
+
+    return 0;
+}
@@ -42,7 +42,6 @@
  * an appropriate decompressor.
  */
 
-int __file_get_block(struct file_info *fp);
 int __file_close(struct file_info *fp);
 
 static ssize_t gzip_file_read(struct file_info *, void *, size_t);
@@ -155,9 +154,9 @@ int zopen(const char *pathname, int flags, ...)
 	goto err;
 
     if (fp->i.nbytes >= 14 &&
-	(uint8_t) fp->i.buf[0] == 037 &&
-	(uint8_t) fp->i.buf[1] == 0213 &&	/* gzip */
-	fp->i.buf[2] == 8)	/* deflate */
+	(uint8_t) fp->i.datap[0] == 037 &&
+	(uint8_t) fp->i.datap[1] == 0213 &&	/* gzip */
+	fp->i.datap[2] == 8)	/* deflate */
 	rv = gzip_file_init(fp);
     else
 	rv = 0;			/* Plain file */
@@ -41,6 +41,7 @@
 #include <syslinux/loadfile.h>
 
 #define INCREMENTAL_CHUNK 1024*1024
+#define MAX_CHUNK (16*1024*1024)	/* Largest piece for floadfile_chunks() */
 
 int floadfile(FILE * f, void **ptr, size_t * len, const void *prefix,
 	      size_t prefix_len)
@@ -66,8 +67,18 @@ int floadfile(FILE * f, void **ptr, size_t * len, const void *prefix,
 	    memcpy(data, prefix, prefix_len);
 	}
 
+	/*
+	 * Grow by half of what we have, but at least INCREMENTAL_CHUNK,
+	 * so a large file is copied a bounded number of times over
+	 * rather than once per chunk; the excess goes again at the end.
+	 */
 	do {
-	    alen += INCREMENTAL_CHUNK;
+	    xlen = alen >> 1;
+	    if (xlen < INCREMENTAL_CHUNK)
+		xlen = INCREMENTAL_CHUNK;
+	    if (alen + xlen < alen)
+		goto err;
+	    alen += xlen;
 	    dp = realloc(data, alen);
 	    if (!dp)
 		goto err;
@@ -82,6 +93,8 @@ int floadfile(FILE * f, void **ptr, size_t * len, const void *prefix,
 	dp = realloc(data, xlen);
 	if (dp)
 	    data = dp;
+	else if (xlen > alen)
+	    goto err;
 	*ptr = data;
     } else {
 	*len = clen = st.st_size + prefix_len - ftell(f);
@@ -106,3 +119,51 @@ err:
 	free(data);
     return -1;
 }
+
+/*
+ * Read a file of any size as a series of separately allocated pieces,
+ * for a caller which doesn't need the data to be contiguous, such as
+ * one that passes it on through a movelist.  The pieces start at
+ * INCREMENTAL_CHUNK and double up to MAX_CHUNK; each is zero-padded
+ * like a loadfile() buffer and given to add(), which from then on owns
+ * it.  Returns 0 on success or -1 on error, in which case any pieces
+ * already handed to add() are the caller's to undo.
+ */
+int floadfile_chunks(FILE * f, int (*add)(void *, void *, size_t),
+		     void *pvt)
+{
+    size_t alen, rlen, xlen;
+    void *data, *dp;
+
+    alen = INCREMENTAL_CHUNK;
+    for (;;) {
+	data = malloc(alen);
+	if (!data)
+	    return -1;
+
+	rlen = fread(data, 1, alen, f);
+	if (!rlen) {
+	    free(data);		/* The last piece came out even */
+	    return 0;
+	}
+
+	xlen = (rlen + LOADFILE_ZERO_PAD - 1) & ~(LOADFILE_ZERO_PAD - 1);
+	if (xlen < alen) {
+	    /* The last piece: give back what it didn't use */
+	    dp = realloc(data, xlen);
+	    if (dp)
+		data = dp;
+	}
+	memset((char *)data + rlen, 0, xlen - rlen);
+
+	if (add(pvt, data, rlen)) {
+	    free(data);
+	    return -1;
+	}
+
+	if (rlen < alen)
+	    return 0;
+	if (alen < MAX_CHUNK)
+	    alen <<= 1;
+    }
+}
@@ -46,6 +46,23 @@ struct initramfs *initramfs_init(void)
     return ir;
 }
 
+/* Get the combined size of the initramfs */
+size_t initramfs_size(struct initramfs *ihead)
+{
+    struct initramfs *ip;
+    size_t size = 0;
+
+    if (!ihead)
+	return 0;
+
+    for (ip = ihead->next; ip->len; ip = ip->next) {
+	size = (size + ip->align - 1) & ~(ip->align - 1);	/* Alignment */
+	size += ip->len;
+    }
+
+    return size;
+}
+
 int initramfs_add_data(struct initramfs *ihead, const void *data,
 		       size_t data_len, size_t len, size_t align)
 {
@@ -31,17 +31,102 @@
  * Utility function to load an initramfs archive.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <com32.h>
+#include <sys/stat.h>
 #include <syslinux/loadfile.h>
 #include <syslinux/linux.h>
 
+struct chunk_state {
+    struct initramfs *ihead;
+    size_t align;
+};
+
+static int add_chunk(void *pvt, void *data, size_t len)
+{
+    struct chunk_state *cs = pvt;
+
+    if (initramfs_add_data(cs->ihead, data, len, len, cs->align))
+	return -1;
+
+    cs->align = 1;		/* Only the first piece needs aligning */
+    return 0;
+}
+
+/*
+ * An archive of unknown size, such as one fetched over TFTP without
+ * tsize, is loaded as a run of pieces, each its own initramfs entry.
+ * The pieces are only put together when the movelist is carried out,
+ * so the archive never needs one buffer of its full size in the heap.
+ */
+static int initramfs_load_chunks(struct initramfs *ihead, FILE *f)
+{
+    struct initramfs *last = ihead->prev, *in;
+    struct chunk_state cs = { ihead, 4 };
+
+    if (!floadfile_chunks(f, add_chunk, &cs))
+	return 0;
+
+    /* Take back whatever part of the archive did get added */
+    while ((in = ihead->prev) != last) {
+	in->prev->next = ihead;
+	ihead->prev = in->prev;
+	free((void *)in->data);
+	free(in);
+    }
+    return -1;
+}
+
+/*
+ * An archive of known size is read straight to a block where it can be
+ * booted from, following on from what is in the initramfs already, so
+ * that syslinux_boot_linux() can leave it where it is.  NULL if there is
+ * no such block, in which case it has to be read the usual way.
+ */
+#define TARGET_ALIGN	16	/* So that the offset suits hmalloc() */
+
+static void *initramfs_target(struct initramfs *ihead, size_t len)
+{
+    size_t offset;
+
+    if (!len)
+	return NULL;
+
+    offset = (initramfs_size(ihead) + TARGET_ALIGN - 1) & ~(TARGET_ALIGN - 1);
+    return hmalloc(len + INITRAMFS_HEADROOM, INITRAMFS_MAX_ALIGN, offset,
+		   INITRAMFS_TARGET_LIMIT);
+}
+
 int initramfs_load_archive(struct initramfs *ihead, const char *filename)
 {
     void *data;
     size_t len;
+    struct stat st;
+    FILE *f;
+    int rv;
 
-    if (loadfile(filename, &data, &len))
+    f = fopen(filename, "r");
+    if (!f)
 	return -1;
 
-    return initramfs_add_data(ihead, data, len, len, 4);
+    if (fstat(fileno(f), &st)) {
+	rv = -1;
+    } else if (!S_ISREG(st.st_mode)) {
+	rv = initramfs_load_chunks(ihead, f);
+    } else if ((data = initramfs_target(ihead, st.st_size))) {
+	len = st.st_size;
+	rv = (fread(data, 1, len, f) == len) ? 0 : -1;
+	if (!rv)
+	    rv = initramfs_add_data(ihead, data, len, len, TARGET_ALIGN);
+	if (rv)
+	    free(data);
+    } else {
+	rv = floadfile(f, &data, &len, NULL, 0);
+	if (!rv)
+	    rv = initramfs_add_data(ihead, data, len, len, 4);
+    }
+
+    fclose(f);
+    return rv;
 }
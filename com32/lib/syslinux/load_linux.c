@@ -34,14 +34,18 @@
 
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <string.h>
 #include <minmax.h>
 #include <errno.h>
 #include <suffix_number.h>
+#include <com32.h>
+#include <sys/stat.h>
 #include <syslinux/align.h>
 #include <syslinux/linux.h>
+#include <syslinux/loadfile.h>
 #include <syslinux/bootrm.h>
 #include <syslinux/movebits.h>
 #include <dprintf.h>
@@ -128,21 +132,37 @@ static inline uint32_t saturate32(unsigned long long v)
     return (v > 0xffffffff) ? 0xffffffff : (uint32_t) v;
 }
 
-/* Get the combined size of the initramfs */
-static addr_t initramfs_size(struct initramfs *initramfs)
+/*
+ * If some part of the initramfs, such as an archive which
+ * initramfs_load_archive() read to where it would go, is at a place
+ * which the whole of it can be put around, return the address that
+ * leaves it there; of those, the one which leaves the most data alone.
+ */
+static addr_t initramfs_in_place(struct initramfs *initramfs,
+				 struct syslinux_memmap *amap,
+				 addr_t size, addr_t addr_max)
 {
+    const addr_t align_mask = INITRAMFS_MAX_ALIGN - 1;
     struct initramfs *ip;
-    addr_t size = 0;
-
-    if (!initramfs)
-	return 0;
+    addr_t offset, addr, best_addr = 0;
+    size_t best_len = 0;
 
+    offset = 0;
     for (ip = initramfs->next; ip->len; ip = ip->next) {
-	size = (size + ip->align - 1) & ~(ip->align - 1);	/* Alignment */
-	size += ip->len;
+	offset = (offset + ip->align - 1) & ~(ip->align - 1);
+	addr = (addr_t) ip->data - offset;
+
+	if (ip->data_len > best_len && (addr_t) ip->data >= offset &&
+	    !(addr & align_mask) && addr <= addr_max &&
+	    size - 1 <= addr_max - addr &&
+	    syslinux_memmap_type(amap, addr, size) == SMT_FREE) {
+	    best_addr = addr;
+	    best_len = ip->data_len;
+	}
+	offset += ip->len;
     }
 
-    return size;
+    return best_addr;
 }
 
 /* Create the appropriate mappings for the initramfs */
@@ -187,7 +207,8 @@ int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
 {
     struct linux_header hdr, *whdr;
     size_t real_mode_size, prot_mode_size;
-    addr_t real_mode_base, prot_mode_base;
+    size_t prot_mode_span;
+    addr_t real_mode_base, prot_mode_base, kernel_addr;
     addr_t irf_size;
     size_t cmdline_size, cmdline_offset;
     struct setup_data *sdp;
@@ -273,6 +294,7 @@ int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
     real_mode_base = (hdr.loadflags & LOAD_HIGH) ? 0x10000 : 0x90000;
     prot_mode_base = (hdr.loadflags & LOAD_HIGH) ? 0x100000 : 0x10000;
     prot_mode_size = kernel_size - real_mode_size;
+    prot_mode_span = prot_mode_size;
 
     if (hdr.version < 0x020a) {
 	/*
@@ -326,9 +348,23 @@ int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
 
     /* Place the kernel in memory */
 
-    /* First, find a suitable place for the protected-mode code */
-    if (syslinux_memmap_type(amap, prot_mode_base, prot_mode_size)
-	!= SMT_FREE) {
+    /*
+     * A relocatable kernel which syslinux_load_linux() read to a place
+     * it can run from, with room to unpack itself, stays there
+     */
+    kernel_addr = (addr_t) kernel_buf + real_mode_size;
+    if (hdr.relocatable_kernel && kernel_addr >= prot_mode_base &&
+	hdr.kernel_alignment &&
+	!(kernel_addr & (hdr.kernel_alignment - 1)) &&
+	syslinux_memmap_type(amap, kernel_addr,
+			     max(hdr.init_size, prot_mode_size)) == SMT_FREE) {
+	whdr->code32_start += kernel_addr - prot_mode_base;
+	prot_mode_base = kernel_addr;
+	prot_mode_span = max(hdr.init_size, prot_mode_size);
+    }
+    /* Otherwise, find a suitable place for the protected-mode code */
+    else if (syslinux_memmap_type(amap, prot_mode_base, prot_mode_size)
+	     != SMT_FREE) {
 	const struct syslinux_memmap *mp;
 	if (!hdr.relocatable_kernel)
 	    goto bail;		/* Can't relocate - no hope */
@@ -417,7 +453,7 @@ int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
 			      (addr_t) kernel_buf + real_mode_size,
 			      prot_mode_size))
 	goto bail;
-    if (syslinux_add_memmap(&amap, prot_mode_base, prot_mode_size, SMT_ALLOC))
+    if (syslinux_add_memmap(&amap, prot_mode_base, prot_mode_span, SMT_ALLOC))
 	goto bail;
 
     /* Figure out the size of the initramfs, and where to put it.
@@ -427,7 +463,7 @@ int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
     irf_size = initramfs_size(initramfs);	/* Handles initramfs == NULL */
 
     if (irf_size) {
-	addr_t best_addr = 0;
+	addr_t best_addr = 0, in_place;
 	struct syslinux_memmap *ml;
 	const addr_t align_mask = INITRAMFS_MAX_ALIGN - 1;
 
@@ -439,6 +475,12 @@ int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
 		    best_addr = (adj_end - irf_size) & ~align_mask;
 	    }
 
+	    /* Better yet, where most of it is already */
+	    in_place = initramfs_in_place(initramfs, amap, irf_size,
+					  hdr.initrd_addr_max);
+	    if (in_place)
+		best_addr = in_place;
+
 	    if (!best_addr)
 		goto bail;	/* Insufficient memory for initramfs */
 
@@ -521,3 +563,82 @@ bail:
     syslinux_free_memmap(amap);
     return -1;
 }
+
+/*
+ * Find a block for a relocatable kernel of len bytes to be read to and
+ * run from where it is: protected-mode code aligned as it needs, with
+ * room after it to unpack itself, and low enough for a 32-bit kernel.
+ */
+static void *linux_target(const struct linux_header *hdr, size_t len)
+{
+    size_t real_mode_size, prot_mode_size, init_size;
+
+    if (hdr->boot_flag != BOOT_MAGIC || hdr->header != LINUX_MAGIC ||
+	hdr->version < 0x0205 || !(hdr->loadflags & LOAD_HIGH) ||
+	!hdr->relocatable_kernel || !hdr->kernel_alignment ||
+	(hdr->kernel_alignment & (hdr->kernel_alignment - 1)))
+	return NULL;
+
+    real_mode_size = ((hdr->setup_sects ? hdr->setup_sects : 4) + 1) << 9;
+    if (len <= real_mode_size)
+	return NULL;
+    prot_mode_size = len - real_mode_size;
+
+    /* As in syslinux_boot_linux() */
+    if (hdr->version < 0x020a)
+	init_size = 3 * prot_mode_size;
+    else
+	init_size = max(hdr->init_size, prot_mode_size);
+
+    return hmalloc(real_mode_size + init_size, hdr->kernel_alignment,
+		   real_mode_size, INITRAMFS_TARGET_LIMIT);
+}
+
+/*
+ * Load a kernel image for syslinux_boot_linux().  A relocatable one is
+ * read straight to a place it can be booted from as it is, so that
+ * only its real-mode code has to be moved; anything else is read like
+ * loadfile() would.
+ */
+int syslinux_load_linux(const char *filename, void **kernel_buf,
+			size_t *kernel_size)
+{
+    struct linux_header hdr;
+    struct stat st;
+    size_t hlen, len;
+    char *data = NULL;
+    FILE *f;
+    int rv, e;
+
+    f = fopen(filename, "r");
+    if (!f)
+	return -1;
+
+    hlen = fread(&hdr, 1, sizeof hdr, f);
+    if (hlen == sizeof hdr && !fstat(fileno(f), &st) &&
+	S_ISREG(st.st_mode) && st.st_size > (off_t) sizeof hdr)
+	data = linux_target(&hdr, st.st_size);
+
+    if (data) {
+	len = st.st_size;
+	memcpy(data, &hdr, sizeof hdr);
+	if (fread(data + sizeof hdr, 1, len - sizeof hdr, f)
+	    != len - sizeof hdr) {
+	    free(data);
+	    rv = -1;
+	} else {
+	    *kernel_buf = data;
+	    *kernel_size = len;
+	    rv = 0;
+	}
+    } else {
+	rv = floadfile(f, kernel_buf, kernel_size, &hdr, hlen);
+    }
+    e = errno;
+
+    fclose(f);
+
+    if (rv)
+	errno = e;
+    return rv;
+}
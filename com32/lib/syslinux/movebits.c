@@ -46,12 +46,21 @@
 #include <setjmp.h>
 #include <minmax.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include <syslinux/movebits.h>
 #include <dprintf.h>
 
 static jmp_buf new_movelist_bail;
 
+static void *xrealloc(void *ptr, size_t size)
+{
+    ptr = realloc(ptr, size);
+    if (!ptr)
+	longjmp(new_movelist_bail, 1);
+    return ptr;
+}
+
 static struct syslinux_movelist *new_movelist(addr_t dst, addr_t src,
 					      addr_t len)
 {
@@ -68,294 +77,424 @@ static struct syslinux_movelist *new_movelist(addr_t dst, addr_t src,
     return ml;
 }
 
-static struct syslinux_movelist *dup_movelist(struct syslinux_movelist *src)
+static void delete_movelist(struct syslinux_movelist **parentptr)
 {
-    struct syslinux_movelist *dst = NULL, **dstp = &dst, *ml;
-
-    while (src) {
-	ml = new_movelist(src->dst, src->src, src->len);
-	*dstp = ml;
-	dstp = &ml->next;
-	src = src->next;
-    }
-
-    return dst;
+    struct syslinux_movelist *o = *parentptr;
+    *parentptr = o->next;
+    free(o);
 }
 
-static void
-add_freelist(struct syslinux_memmap **mmap, addr_t start,
-	     addr_t len, enum syslinux_memmap_types type)
+static void free_movelist(struct syslinux_movelist **parentptr)
 {
-    if (syslinux_add_memmap(mmap, start, len, type))
-	longjmp(new_movelist_bail, 1);
+    while (*parentptr)
+	delete_movelist(parentptr);
 }
 
 /*
- * Take a chunk, entirely confined in **parentptr, and split it off so that
- * it has its own structure.
+ * A fragment still to be moved.  The fragments left after alias
+ * resolution each get a slot, in order of destination; when one has to
+ * be moved in parts, the parts all stay on the list of its slot.
  */
-static struct syslinux_movelist **split_movelist(addr_t start, addr_t len,
-						 struct syslinux_movelist
-						 **parentptr)
-{
-    struct syslinux_movelist *m, *ml = *parentptr;
+struct frag {
+    addr_t dst, src, len;
+    struct frag *next;
+    size_t slot;
+};
+
+struct slot {
+    addr_t dst, last;		/* Destination of the whole fragment */
+    addr_t maxlast;		/* Highest "last" of this and earlier slots */
+    struct frag *frags;
+    bool dirty;
+};
 
-    assert(start >= ml->src);
-    assert(start < ml->src + ml->len);
-
-    /* Split off the beginning */
-    if (start > ml->src) {
-	addr_t l = start - ml->src;
-
-	m = new_movelist(ml->dst + l, start, ml->len - l);
-	m->next = ml->next;
-	ml->len = l;
-	ml->next = m;
+/*
+ * The memory map is kept as an array of zones in address order, each
+ * running up to the start of the next; the last is SMT_END and starts
+ * at 0, that is, 2^32.  An allocated zone which holds the source data
+ * of a fragment points to it, so zones are only merged if they agree
+ * on that as well.  Allocated zones without an owner are fragments
+ * which have reached their destination.
+ */
+struct zone {
+    addr_t start;
+    enum syslinux_memmap_types type;
+    struct frag *owner;
+};
+
+struct zonemap {
+    struct zone *z;
+    size_t n;			/* Zones, not counting SMT_END */
+    size_t size;
+};
+
+struct movestate {
+    struct zonemap map;		/* What memory holds right now */
+    struct zonemap free;	/* What memory is usable, after all is done */
+    struct slot *slots;
+    size_t nslots;
+    size_t *dirty;		/* Slots which might now be movable */
+    size_t ndirty;
+    size_t live;		/* Fragments left to move */
+    struct syslinux_movelist **moves;
+
+    /* Kept here, rather than in locals, so that a bail-out frees them */
+    struct syslinux_movelist **frags;	/* Input, sorted by source */
+    struct syslinux_movelist **kept;	/* Disjoint sources */
+    size_t nkept;
+    struct syslinux_movelist *postcopy;
+};
+
+static addr_t zone_last(const struct zonemap *zm, size_t i)
+{
+    return zm->z[i + 1].start - 1;
+}
 
-	parentptr = &ml->next;
-	ml = m;			/* Continue processing the new node */
+/* Find the zone holding a particular address */
+static size_t zone_find(const struct zonemap *zm, addr_t addr)
+{
+    size_t lo = 0, hi = zm->n, mid;
+
+    while (hi - lo > 1) {
+	mid = (lo + hi) >> 1;
+	if (zm->z[mid].start <= addr)
+	    lo = mid;
+	else
+	    hi = mid;
     }
+    return lo;
+}
 
-    /* Split off the end */
-    if (ml->len > len) {
-	addr_t l = ml->len - len;
-
-	m = new_movelist(ml->dst + len, ml->src + len, l);
-	m->next = ml->next;
-	ml->len = len;
-	ml->next = m;
+static void zonemap_init(struct zonemap *zm,
+			 const struct syslinux_memmap *memmap)
+{
+    const struct syslinux_memmap *mp;
+    enum syslinux_memmap_types type;
+
+    zm->n = 0;
+    for (mp = memmap; mp->type != SMT_END; mp = mp->next)
+	zm->n++;
+
+    zm->size = zm->n + 1;
+    zm->z = xrealloc(NULL, zm->size * sizeof *zm->z);
+
+    zm->n = 0;
+    for (mp = memmap; ; mp = mp->next) {
+	/* Memory to be zeroed is free for us to use until then */
+	type = mp->type == SMT_ZERO ? SMT_FREE : mp->type;
+	if (zm->n && zm->z[zm->n - 1].type == type)
+	    continue;		/* Free zones have to be merged */
+	zm->z[zm->n].start = mp->start;
+	zm->z[zm->n].type = type;
+	zm->z[zm->n].owner = NULL;
+	if (type == SMT_END)
+	    break;
+	zm->n++;
     }
-
-    return parentptr;
 }
 
-static void delete_movelist(struct syslinux_movelist **parentptr)
+static void zonemap_dup(struct zonemap *dst, const struct zonemap *src)
 {
-    struct syslinux_movelist *o = *parentptr;
-    *parentptr = o->next;
-    free(o);
+    dst->n = src->n;
+    dst->size = src->n + 1;
+    dst->z = xrealloc(NULL, dst->size * sizeof *dst->z);
+    memcpy(dst->z, src->z, dst->size * sizeof *dst->z);
 }
 
-static void free_movelist(struct syslinux_movelist **parentptr)
+static inline bool zone_same(const struct zone *a, const struct zone *b)
 {
-    while (*parentptr)
-	delete_movelist(parentptr);
+    return a->type == b->type && a->owner == b->owner;
 }
 
 /*
- * Scan the freelist looking for a particular chunk of memory
+ * Set the type and owner of a range of memory, like
+ * syslinux_add_memmap() does for a list
  */
-static const struct syslinux_memmap *is_free_zone(const struct syslinux_memmap
-						  *list, addr_t start,
-						  addr_t len)
+static void zone_set(struct zonemap *zm, addr_t start, addr_t len,
+		     enum syslinux_memmap_types type, struct frag *owner)
 {
-    dprintf("f: 0x%08x bytes at 0x%08x\n", len, start);
+    struct zone new[3];
+    size_t i, j, k, nnew, p;
+    addr_t last;
 
-    addr_t last, llast;
+    if (!len)
+	return;
 
     last = start + len - 1;
+    if (last < start)
+	last = -1;		/* Up to the end of memory */
+
+    i = zone_find(zm, start);
+    j = zone_find(zm, last);
+
+    /* Zones i..j are replaced with up to three new ones */
+    nnew = 0;
+    if (zm->z[i].start < start)
+	new[nnew++] = zm->z[i];
+    p = i + nnew;
+    new[nnew].start = start;
+    new[nnew].type = type;
+    new[nnew].owner = owner;
+    nnew++;
+    if (last != zone_last(zm, j)) {
+	new[nnew] = zm->z[j];
+	new[nnew].start = last + 1;
+	nnew++;
+    }
 
-    while (list->type != SMT_END) {
-	llast = list->next->start - 1;
-	if (list->start <= start) {
-	    if (llast >= last) {
-		/* Chunk has a single, well-defined type */
-		if (list->type == SMT_FREE) {
-		    dprintf("F: 0x%08x bytes at 0x%08x\n",
-			    list->next->start, list->start);
-		    return list;	/* It's free */
-		}
-		return NULL;	/* Not free */
-	    } else if (llast >= start) {
-		return NULL;	/* Crosses region boundary */
-	    }
-	}
-	list = list->next;
+    if (zm->n + nnew - (j - i + 1) + 1 > zm->size) {
+	zm->size = zm->size * 2 + 4;
+	zm->z = xrealloc(zm->z, zm->size * sizeof *zm->z);
+    }
+    memmove(&zm->z[i + nnew], &zm->z[j + 1],
+	    (zm->n - j) * sizeof *zm->z);
+    memcpy(&zm->z[i], new, nnew * sizeof *new);
+    zm->n += nnew - (j - i + 1);
+
+    /* Merge with the neighbours, if they are the same */
+    k = 0;
+    if (p + 1 < zm->n && zone_same(&zm->z[p], &zm->z[p + 1]))
+	k = 1;
+    if (p > 0 && zone_same(&zm->z[p - 1], &zm->z[p])) {
+	p--;
+	k++;
     }
+    if (k) {
+	memmove(&zm->z[p + 1], &zm->z[p + 1 + k],
+		(zm->n - p - k) * sizeof *zm->z);
+	zm->n -= k;
+    }
+}
+
+/*
+ * Is a range of memory entirely free?  Free zones are always merged,
+ * so it has to be inside a single one.
+ */
+static bool is_free_zone(const struct zonemap *zm, addr_t start, addr_t len)
+{
+    size_t i = zone_find(zm, start);
 
-    return NULL;		/* Internal error? */
+    return zm->z[i].type == SMT_FREE && len - 1 <= zone_last(zm, i) - start;
 }
 
 /*
- * Scan the freelist looking for the smallest chunk of memory which
- * can fit X bytes; returns the length of the block on success.
+ * Scan the map looking for the smallest free zone which can fit len
+ * bytes; returns the length of the zone on success.
  */
-static addr_t free_area(const struct syslinux_memmap *mmap,
-			addr_t len, addr_t * start)
+static addr_t free_area(const struct zonemap *zm, addr_t len, addr_t * start)
 {
-    const struct syslinux_memmap *best = NULL;
-    const struct syslinux_memmap *s;
-    addr_t slen, best_len = -1;
+    addr_t zlen, best_len = 0;
+    size_t i;
 
-    for (s = mmap; s->type != SMT_END; s = s->next) {
-	if (s->type != SMT_FREE)
+    for (i = 0; i < zm->n; i++) {
+	if (zm->z[i].type != SMT_FREE)
 	    continue;
-	slen = s->next->start - s->start;
-	if (slen >= len) {
-	    if (!best || best_len > slen) {
-		best = s;
-		best_len = slen;
-	    }
+	zlen = zone_last(zm, i) - zm->z[i].start + 1;
+	if (zlen >= len && (!best_len || zlen < best_len)) {
+	    *start = zm->z[i].start;
+	    best_len = zlen;
 	}
     }
 
-    if (best) {
-	*start = best->start;
-	return best_len;
-    } else {
-	return 0;
+    return best_len;
+}
+
+/* The largest free zone, or 0 if there is none */
+static addr_t largest_area(const struct zonemap *zm, addr_t * start)
+{
+    addr_t zlen, best_len = 0;
+    size_t i;
+
+    for (i = 0; i < zm->n; i++) {
+	if (zm->z[i].type != SMT_FREE)
+	    continue;
+	zlen = zone_last(zm, i) - zm->z[i].start + 1;
+	if (zlen > best_len) {
+	    *start = zm->z[i].start;
+	    best_len = zlen;
+	}
     }
+
+    return best_len;
 }
 
-/*
- * Remove a chunk from the freelist
- */
-static void
-allocate_from(struct syslinux_memmap **mmap, addr_t start, addr_t len)
+static void mark_dirty(struct movestate *ms, size_t s)
 {
-    syslinux_add_memmap(mmap, start, len, SMT_ALLOC);
+    if (!ms->slots[s].dirty) {
+	ms->slots[s].dirty = true;
+	ms->dirty[ms->ndirty++] = s;
+    }
 }
 
 /*
- * Find chunks of a movelist which are one-to-many (one source, multiple
- * destinations.)  Those chunks can get turned into post-shuffle copies,
- * to avoid confusing the shuffler.
+ * Memory which held source data has been vacated: it goes back to
+ * what it was to begin with, and any fragment whose destination is
+ * there might now be movable.
  */
-static void shuffle_dealias(struct syslinux_movelist **fraglist,
-			    struct syslinux_movelist **postcopy)
+static void vacate(struct movestate *ms, addr_t start, addr_t len)
 {
-    struct syslinux_movelist *mp, **mpp, *mx, *np;
-    addr_t ps, pe, xs, xe, delta;
-    bool advance;
+    const struct zonemap *fm = &ms->free;
+    addr_t last = start + len - 1, zs, zl;
+    size_t i, lo, hi, mid;
+
+    if (!len)
+	return;
+
+    for (i = zone_find(fm, start); i < fm->n; i++) {
+	zs = max(fm->z[i].start, start);
+	zl = min(zone_last(fm, i), last);
+	zone_set(&ms->map, zs, zl - zs + 1, fm->z[i].type, NULL);
+	if (zl == last)
+	    break;
+    }
 
-    dprintf("Before alias resolution:\n");
-    syslinux_dump_movelist(*fraglist);
+    /* The first slot that could reach this far up */
+    lo = 0;
+    hi = ms->nslots;
+    while (lo < hi) {
+	mid = (lo + hi) >> 1;
+	if (ms->slots[mid].maxlast < start)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
 
-    *postcopy = NULL;
+    for (i = lo; i < ms->nslots && ms->slots[i].dst <= last; i++) {
+	if (ms->slots[i].frags && ms->slots[i].last >= start)
+	    mark_dirty(ms, i);
+    }
+}
 
-    /*
-     * Note: as written, this is an O(n^2) algorithm; by producing a list
-     * sorted by destination address we could reduce it to O(n log n).
-     */
-    mpp = fraglist;
-    while ((mp = *mpp)) {
-	dprintf("mp -> (%#x,%#x,%#x)\n", mp->dst, mp->src, mp->len);
-	ps = mp->src;
-	pe = mp->src + mp->len - 1;
-	for (mx = *fraglist; mx != mp; mx = mx->next) {
-	    dprintf("mx -> (%#x,%#x,%#x)\n", mx->dst, mx->src, mx->len);
-	    /*
-	     * If there is any overlap between mx and mp, mp should be
-	     * modified and possibly split.
-	     */
-	    xs = mx->src;
-	    xe = mx->src + mx->len - 1;
-
-	    dprintf("?: %#x..%#x (inside %#x..%#x)\n", ps, pe, xs, xe);
-
-	    if (pe <= xs || ps >= xe)
-		continue;	/* No overlap */
-
-	    advance = false;
-	    *mpp = mp->next;	/* Remove from list */
-
-	    if (pe > xe) {
-		delta = pe - xe;
-		np = new_movelist(mp->dst + mp->len - delta,
-				  mp->src + mp->len - delta, delta);
-		mp->len -= delta;
-		pe = xe;
-		np->next = *mpp;
-		*mpp = np;
-		advance = true;
-	    }
-	    if (ps < xs) {
-		delta = xs - ps;
-		np = new_movelist(mp->dst, ps, delta);
-		mp->src += delta;
-		ps = mp->src;
-		mp->dst += delta;
-		mp->len -= delta;
-		np->next = *mpp;
-		*mpp = np;
-		advance = true;
-	    }
+static void emit_move(struct movestate *ms, addr_t dst, addr_t src,
+		      addr_t len)
+{
+    struct syslinux_movelist *mv = new_movelist(dst, src, len);
 
-	    assert(ps >= xs && pe <= xe);
+    dprintf("M: 0x%08x bytes at 0x%08x -> 0x%08x\n", len, src, dst);
+    *ms->moves = mv;
+    ms->moves = &mv->next;
+}
 
-	    dprintf("Overlap: %#x..%#x (inside %#x..%#x)\n", ps, pe, xs, xe);
+static struct frag *new_frag(struct movestate *ms, addr_t dst, addr_t src,
+			     addr_t len, size_t slot)
+{
+    struct frag *f = malloc(sizeof *f);
 
-	    mp->src = mx->dst + (ps - xs);
-	    mp->next = *postcopy;
-	    *postcopy = mp;
+    if (!f)
+	longjmp(new_movelist_bail, 1);
 
-	    mp = *mpp;
+    f->dst = dst;
+    f->src = src;
+    f->len = len;
+    f->slot = slot;
+    ms->live++;
 
-	    if (!advance)
-		goto restart;
-	}
+    /* The fragment owns its source data */
+    zone_set(&ms->map, src, len, SMT_ALLOC, f);
+    return f;
+}
 
-	mpp = &mp->next;
-restart:
-	;
-    }
+static void delete_frag(struct movestate *ms, struct frag **parentptr)
+{
+    struct frag *f = *parentptr;
 
-    dprintf("After alias resolution:\n");
-    syslinux_dump_movelist(*fraglist);
-    dprintf("Post-shuffle copies:\n");
-    syslinux_dump_movelist(*postcopy);
+    *parentptr = f->next;
+    free(f);
+    ms->live--;
 }
 
 /*
- * The code to actually emit moving of a chunk into its final place.
+ * Take a chunk of source data, entirely confined in **parentptr, and
+ * split it off so that it is a fragment of its own.
  */
-static void
-move_chunk(struct syslinux_movelist ***moves,
-	   struct syslinux_memmap **mmap,
-	   struct syslinux_movelist **fp, addr_t copylen)
+static struct frag **split_frag(struct movestate *ms, addr_t start,
+				addr_t len, struct frag **parentptr)
 {
-    addr_t copydst, copysrc;
-    addr_t freebase, freelen;
-    addr_t needlen;
-    int reverse;
-    struct syslinux_movelist *f = *fp, *mv;
+    struct frag *m, *f = *parentptr;
+
+    assert(start >= f->src);
+    assert(start - f->src < f->len && len <= f->len - (start - f->src));
+
+    /* Split off the beginning */
+    if (start > f->src) {
+	addr_t l = start - f->src;
+
+	m = new_frag(ms, f->dst + l, start, f->len - l, f->slot);
+	m->next = f->next;
+	f->len = l;
+	f->next = m;
 
+	parentptr = &f->next;
+	f = m;			/* Continue processing the new node */
+    }
+
+    /* Split off the end */
+    if (f->len > len) {
+	addr_t l = f->len - len;
+
+	m = new_frag(ms, f->dst + len, f->src + len, l, f->slot);
+	m->next = f->next;
+	f->len = len;
+	f->next = m;
+    }
+
+    return parentptr;
+}
+
+/*
+ * Work out the part of the destination of a fragment which is not
+ * also its source, and so has to be free before it can be moved in:
+ * when the two overlap, the fragment has to be moved from the end if
+ * it is going up ("reverse"), and from the start if it is going down.
+ * The "critical byte" is the first one which has to be written.
+ */
+static void need_zone(const struct frag *f, addr_t * needbase,
+		      addr_t * needlen, addr_t * cbyte, int *reverse)
+{
     if (f->src < f->dst && (f->dst - f->src) < f->len) {
 	/* "Shift up" type overlap */
-	needlen = f->dst - f->src;
-	reverse = 1;
+	*needlen = f->dst - f->src;
+	*needbase = f->dst + (f->len - *needlen);
+	*reverse = 1;
+	*cbyte = f->dst + f->len - 1;
     } else if (f->src > f->dst && (f->src - f->dst) < f->len) {
 	/* "Shift down" type overlap */
-	needlen = f->src - f->dst;
-	reverse = 0;
+	*needlen = f->src - f->dst;
+	*needbase = f->dst;
+	*reverse = 0;
+	*cbyte = f->dst;
     } else {
-	needlen = f->len;
-	reverse = 0;
+	*needlen = f->len;
+	*needbase = f->dst;
+	*reverse = 0;
+	*cbyte = f->dst;
     }
+}
 
-    copydst = f->dst;
-    copysrc = f->src;
+/*
+ * The code to actually emit moving of a chunk into its final place.
+ * Only copylen bytes of the part which needs free memory are taken,
+ * from the end if the chunk is moved backwards, which has to be that
+ * much room at the destination.
+ */
+static void move_chunk(struct movestate *ms, struct frag **fp,
+		       addr_t copylen)
+{
+    addr_t needbase, needlen, cbyte;
+    addr_t freebase, freelen;
+    int reverse;
+    struct frag *f = *fp;
 
-    dprintf("Q: copylen = 0x%08x, needlen = 0x%08x\n", copylen, needlen);
+    need_zone(f, &needbase, &needlen, &cbyte, &reverse);
 
     if (copylen < needlen) {
-	if (reverse) {
-	    copydst += (f->len - copylen);
-	    copysrc += (f->len - copylen);
-	}
-
-	dprintf("X: 0x%08x bytes at 0x%08x -> 0x%08x\n",
-		copylen, copysrc, copydst);
-
 	/* Didn't get all we wanted, so we have to split the chunk */
-	fp = split_movelist(copysrc, copylen, fp);	/* Is this right? */
+	fp = split_frag(ms, reverse ? f->src + f->len - copylen : f->src,
+			copylen, fp);
 	f = *fp;
     }
 
-    mv = new_movelist(f->dst, f->src, f->len);
-    dprintf("A: 0x%08x bytes at 0x%08x -> 0x%08x\n", mv->len, mv->src, mv->dst);
-    **moves = mv;
-    *moves = &mv->next;
+    emit_move(ms, f->dst, f->src, f->len);
 
     /* Figure out what memory we just freed up */
     if (f->dst > f->src) {
@@ -369,120 +508,270 @@ move_chunk(struct syslinux_movelist ***moves,
 	freebase = f->dst + f->len;
     }
 
-    dprintf("F: 0x%08x bytes at 0x%08x\n", freelen, freebase);
+    /* The destination is done with; then the rest of the source is free */
+    zone_set(&ms->map, f->dst, f->len, SMT_ALLOC, NULL);
+    delete_frag(ms, fp);
+    vacate(ms, freebase, freelen);
+}
 
-    add_freelist(mmap, freebase, freelen, SMT_FREE);
+/*
+ * Move (part of) the fragment o, which holds the critical byte of
+ * another one, out of the way to wherever there is room.
+ */
+static int evict(struct movestate *ms, struct frag *o, addr_t cbyte,
+		 int reverse)
+{
+    struct frag **op;
+    addr_t copysrc, copydst = 0, copylen, flen;
+
+    dprintf("O: 0x%08x bytes at 0x%08x -> 0x%08x\n", o->len, o->src, o->dst);
+
+    if (free_area(&ms->map, o->len, &copydst)) {
+	/* We can move the whole chunk */
+	copysrc = o->src;
+	copylen = o->len;
+    } else {
+	/* Well, copy as much as we can... */
+	flen = largest_area(&ms->map, &copydst);
+	if (!flen) {
+	    dprintf("No free memory at all!\n");
+	    return -1;		/* Stuck! */
+	}
+
+	/* Make sure we include the critical byte */
+	if (reverse) {
+	    copysrc = (cbyte - o->src >= flen) ? cbyte + 1 - flen : o->src;
+	    copylen = cbyte + 1 - copysrc;
+	} else {
+	    copysrc = cbyte;
+	    copylen = min(flen, o->len - (cbyte - o->src));
+	}
+    }
 
-    delete_movelist(fp);
+    for (op = &ms->slots[o->slot].frags; *op != o; op = &(*op)->next) ;
+    op = split_frag(ms, copysrc, copylen, op);
+    o = *op;
+
+    emit_move(ms, copydst, copysrc, copylen);
+    zone_set(&ms->map, copydst, copylen, SMT_ALLOC, o);
+    o->src = copydst;
+    vacate(ms, copysrc, copylen);
+
+    if (o->src == o->dst) {
+	/* It went straight to where it belongs */
+	zone_set(&ms->map, o->dst, o->len, SMT_ALLOC, NULL);
+	delete_frag(ms, op);
+    } else {
+	mark_dirty(ms, o->slot);
+    }
+    return 0;
+}
+
+static int cmp_src(const void *a, const void *b)
+{
+    const struct syslinux_movelist *const *x = a, *const *y = b;
+
+    if ((*x)->src != (*y)->src)
+	return (*x)->src < (*y)->src ? -1 : 1;
+    return *x < *y ? -1 : *x > *y;	/* Keep the order of the list */
+}
+
+static int cmp_dst(const void *a, const void *b)
+{
+    const struct syslinux_movelist *const *x = a, *const *y = b;
+
+    if ((*x)->dst != (*y)->dst)
+	return (*x)->dst < (*y)->dst ? -1 : 1;
+    return 0;
 }
 
 /*
- * moves is computed from "frags" and "freemem".  "space" lists
- * free memory areas at our disposal, and is (src, cnt) only.
+ * Find chunks of a movelist which are one-to-many (one source, multiple
+ * destinations.)  Those chunks can get turned into post-shuffle copies,
+ * to avoid confusing the shuffler.
+ *
+ * The fragments are taken in order of source address; the ones kept
+ * have disjoint sources, so the ones which overlap the source of a new
+ * fragment are found by binary search.  The kept fragments are left
+ * in ms->kept, sorted by destination, and the copies in ms->postcopy.
+ */
+static void shuffle_dealias(struct movestate *ms,
+			    struct syslinux_movelist *fraglist)
+{
+    struct syslinux_movelist **frags, **kept, *mp, *mx, *np;
+    size_t nfrags, n, i, lo, hi, mid;
+    addr_t ps, pe, xs, xe, os, oe, cover = 0;
+
+    dprintf("Before alias resolution:\n");
+    syslinux_dump_movelist(fraglist);
+
+    nfrags = 0;
+    for (mp = fraglist; mp; mp = mp->next)
+	nfrags++;
+
+    frags = ms->frags = xrealloc(NULL, (nfrags + 1) * sizeof *frags);
+    kept = ms->kept = xrealloc(NULL, (nfrags + 1) * sizeof *kept);
+
+    n = 0;
+    for (mp = fraglist; mp; mp = mp->next) {
+	if (mp->len)
+	    frags[n++] = mp;
+    }
+    nfrags = n;
+    qsort(frags, nfrags, sizeof *frags, cmp_src);
+
+    n = 0;
+    for (i = 0; i < nfrags; i++) {
+	mp = frags[i];
+	ps = mp->src;
+	pe = mp->src + mp->len - 1;
+
+	if (n && cover >= ps) {
+	    /* The first kept fragment which reaches this far */
+	    lo = 0;
+	    hi = n;
+	    while (lo < hi) {
+		mid = (lo + hi) >> 1;
+		if (kept[mid]->src + kept[mid]->len - 1 < ps)
+		    lo = mid + 1;
+		else
+		    hi = mid;
+	    }
+
+	    for (; lo < n && kept[lo]->src <= pe; lo++) {
+		mx = kept[lo];
+		xs = mx->src;
+		xe = mx->src + mx->len - 1;
+		os = max(ps, xs);
+		oe = min(pe, xe);
+
+		dprintf("Overlap: %#x..%#x (inside %#x..%#x)\n", os, oe,
+			xs, xe);
+
+		np = new_movelist(mp->dst + (os - ps), mx->dst + (os - xs),
+				  oe - os + 1);
+		np->next = ms->postcopy;
+		ms->postcopy = np;
+	    }
+
+	    if (pe <= cover)
+		continue;	/* Nothing of it left */
+
+	    kept[n] = new_movelist(mp->dst + (cover + 1 - ps), cover + 1,
+				   pe - cover);
+	} else {
+	    kept[n] = new_movelist(mp->dst, mp->src, mp->len);
+	}
+	cover = pe;
+	ms->nkept = ++n;
+    }
+
+    free(frags);
+    ms->frags = NULL;
+    qsort(kept, n, sizeof *kept, cmp_dst);
+
+    dprintf("Post-shuffle copies:\n");
+    syslinux_dump_movelist(ms->postcopy);
+}
+
+/*
+ * moves is computed from "ifrags" and "memmap", the memory which may
+ * be written to.
+ *
+ * Each round, a fragment whose destination is free is moved there.
+ * Only the slots of fragments whose destination has had memory freed
+ * under it, or which have themselves been moved, can have become
+ * movable, so only those are looked at again.  If there are none, the
+ * first fragment left is moved as far as it can go, which might first
+ * mean evicting whatever is in its way to somewhere else.
  */
 int
 syslinux_compute_movelist(struct syslinux_movelist **moves,
 			  struct syslinux_movelist *ifrags,
 			  struct syslinux_memmap *memmap)
 {
-    struct syslinux_memmap *mmap = NULL;
-    const struct syslinux_memmap *mm, *ep;
-    struct syslinux_movelist *frags = NULL;
-    struct syslinux_movelist *postcopy = NULL;
-    struct syslinux_movelist *mv;
-    struct syslinux_movelist *f, **fp;
-    struct syslinux_movelist *o, **op;
-    addr_t needbase, needlen, copysrc, copydst, copylen;
-    addr_t avail;
-    addr_t fstart, flen;
-    addr_t cbyte;
-    addr_t ep_len;
+    struct movestate ms;
+    struct syslinux_movelist *mp;
+    struct frag *f, **fp;
+    struct slot *sp;
+    addr_t needbase, needlen, cbyte, avail;
+    size_t i, first, s;
     int rv = -1;
     int reverse;
 
     dprintf("entering syslinux_compute_movelist()...\n");
 
+    memset(&ms, 0, sizeof ms);
+    *moves = NULL;
+    ms.moves = moves;
+
     if (setjmp(new_movelist_bail)) {
-nomem:
 	dprintf("Out of working memory!\n");
 	goto bail;
     }
 
-    *moves = NULL;
-
-    /* Create our memory map.  Anything that is SMT_FREE or SMT_ZERO is
-       fair game, but mark anything used by source material as SMT_ALLOC. */
-    mmap = syslinux_init_memmap();
-    if (!mmap)
-	goto nomem;
-
-    frags = dup_movelist(ifrags);
-
     /* Process one-to-many conditions */
-    shuffle_dealias(&frags, &postcopy);
-
-    for (mm = memmap; mm->type != SMT_END; mm = mm->next)
-	add_freelist(&mmap, mm->start, mm->next->start - mm->start,
-		     mm->type == SMT_ZERO ? SMT_FREE : mm->type);
-
-    for (f = frags; f; f = f->next)
-	add_freelist(&mmap, f->src, f->len, SMT_ALLOC);
-
-    /* As long as there are unprocessed fragments in the chain... */
-    while ((fp = &frags, f = *fp)) {
-
-	dprintf("Current free list:\n");
-	syslinux_dump_memmap(mmap);
-	dprintf("Current frag list:\n");
-	syslinux_dump_movelist(frags);
-
-	/* Scan for fragments which can be discarded without action. */
-	if (f->src == f->dst) {
-	    delete_movelist(fp);
-	    continue;
-	}
-	op = &f->next;
-	while ((o = *op)) {
-	    if (o->src == o->dst)
-		delete_movelist(op);
-	    else
-		op = &o->next;
+    shuffle_dealias(&ms, ifrags);
+
+    /* Our memory map: anything that is SMT_FREE or SMT_ZERO is fair
+       game, but anything used by source material is SMT_ALLOC. */
+    zonemap_init(&ms.free, memmap);
+    zonemap_dup(&ms.map, &ms.free);
+
+    ms.slots = xrealloc(NULL, (ms.nkept + 1) * sizeof *ms.slots);
+    ms.dirty = xrealloc(NULL, (ms.nkept + 1) * sizeof *ms.dirty);
+
+    for (i = 0; i < ms.nkept; i++) {
+	mp = ms.kept[i];
+	sp = &ms.slots[i];
+	sp->dst = mp->dst;
+	sp->last = mp->dst + mp->len - 1;
+	sp->maxlast = i ? max(ms.slots[i - 1].maxlast, sp->last) : sp->last;
+	sp->frags = NULL;
+	sp->dirty = false;
+
+	/* Every destination has to be somewhere we may write */
+	if (!is_free_zone(&ms.free, mp->dst, mp->len)) {
+	    dprintf("Destination not free: 0x%08x bytes at 0x%08x\n",
+		    mp->len, mp->dst);
+	    ms.nslots = i;
+	    goto bail;
 	}
 
-	/* Scan for fragments which can be immediately moved
-	   to their final destination, if so handle them now */
-	for (op = fp; (o = *op); op = &o->next) {
-	    if (o->src < o->dst && (o->dst - o->src) < o->len) {
-		/* "Shift up" type overlap */
-		needlen = o->dst - o->src;
-		needbase = o->dst + (o->len - needlen);
-		reverse = 1;
-		cbyte = o->dst + o->len - 1;
-	    } else if (o->src > o->dst && (o->src - o->dst) < o->len) {
-		/* "Shift down" type overlap */
-		needlen = o->src - o->dst;
-		needbase = o->dst;
-		reverse = 0;
-		cbyte = o->dst;	/* "Critical byte" */
-	    } else {
-		needlen = o->len;
-		needbase = o->dst;
-		reverse = 0;
-		cbyte = o->dst;	/* "Critical byte" */
-	    }
-
-	    if (is_free_zone(mmap, needbase, needlen)) {
-		fp = op, f = o;
-		dprintf("!: 0x%08x bytes at 0x%08x -> 0x%08x\n",
-			f->len, f->src, f->dst);
-		copysrc = f->src;
-		copylen = needlen;
-		allocate_from(&mmap, needbase, copylen);
-		goto move_chunk;
+	if (mp->src == mp->dst) {
+	    /* Discard fragments which are already in place */
+	    zone_set(&ms.map, mp->src, mp->len, SMT_ALLOC, NULL);
+	} else {
+	    sp->frags = new_frag(&ms, mp->dst, mp->src, mp->len, i);
+	    sp->frags->next = NULL;
+	    mark_dirty(&ms, i);
+	}
+    }
+    ms.nslots = ms.nkept;
+
+    first = 0;
+    while (ms.live) {
+	/* Look for fragments which can be moved to their final
+	   destination right away, and handle them now */
+	while (ms.ndirty) {
+	    s = ms.dirty[--ms.ndirty];
+	    ms.slots[s].dirty = false;
+
+	    for (fp = &ms.slots[s].frags; (f = *fp); fp = &f->next) {
+		need_zone(f, &needbase, &needlen, &cbyte, &reverse);
+		if (is_free_zone(&ms.map, needbase, needlen)) {
+		    mark_dirty(&ms, s);	/* For the rest of the slot */
+		    move_chunk(&ms, fp, needlen);
+		    goto next;
+		}
 	    }
 	}
 
 	/* Ok, bother.  Need to do real work at least with one chunk. */
+	while (!ms.slots[first].frags)
+	    first++;
+	fp = &ms.slots[first].frags;
+	f = *fp;
 
 	dprintf("@: 0x%08x bytes at 0x%08x -> 0x%08x\n",
 		f->len, f->src, f->dst);
@@ -490,187 +779,429 @@ nomem:
 	/* See if we can move this chunk into place by claiming
 	   the destination, or in the case of partial overlap, the
 	   missing portion. */
+	need_zone(f, &needbase, &needlen, &cbyte, &reverse);
 
-	if (f->src < f->dst && (f->dst - f->src) < f->len) {
-	    /* "Shift up" type overlap */
-	    needlen = f->dst - f->src;
-	    needbase = f->dst + (f->len - needlen);
-	    reverse = 1;
-	    cbyte = f->dst + f->len - 1;
-	} else if (f->src > f->dst && (f->src - f->dst) < f->len) {
-	    /* "Shift down" type overlap */
-	    needlen = f->src - f->dst;
-	    needbase = f->dst;
-	    reverse = 0;
-	    cbyte = f->dst;	/* "Critical byte" */
-	} else {
-	    needlen = f->len;
-	    needbase = f->dst;
-	    reverse = 0;
-	    cbyte = f->dst;
-	}
-
-	dprintf("need: base = 0x%08x, len = 0x%08x, "
-		"reverse = %d, cbyte = 0x%08x\n",
-		needbase, needlen, reverse, cbyte);
-
-	ep = is_free_zone(mmap, cbyte, 1);
-	if (ep) {
-	    ep_len = ep->next->start - ep->start;
-	    if (reverse)
-		avail = needbase + needlen - ep->start;
-	    else
-		avail = ep_len - (needbase - ep->start);
-	} else {
-	    avail = 0;
-	}
-
-	if (avail) {
+	i = zone_find(&ms.map, cbyte);
+	if (ms.map.z[i].type == SMT_FREE) {
 	    /* We can move at least part of this chunk into place without
 	       further ado */
-	    dprintf("space: start 0x%08x, len 0x%08x, free 0x%08x\n",
-		    ep->start, ep_len, avail);
-	    copylen = min(needlen, avail);
-
 	    if (reverse)
-		allocate_from(&mmap, needbase + needlen - copylen, copylen);
+		avail = needbase + needlen - max(ms.map.z[i].start, needbase);
 	    else
-		allocate_from(&mmap, needbase, copylen);
-
-	    goto move_chunk;
+		avail = zone_last(&ms.map, i) - needbase + 1;
+	    move_chunk(&ms, fp, min(needlen, avail));
+	    continue;
 	}
 
 	/* At this point, we need to evict something out of our space.
-	   Find the object occupying the critical byte of our target space,
-	   and move it out (the whole object if we can, otherwise a subset.)
-	   Then move a chunk of ourselves into place. */
-	for (op = &f->next, o = *op; o; op = &o->next, o = *op) {
-
-	    dprintf("O: 0x%08x bytes at 0x%08x -> 0x%08x\n",
-		    o->len, o->src, o->dst);
-
-	    if (!(o->src <= cbyte && o->src + o->len > cbyte))
-		continue;	/* Not what we're looking for... */
-
-	    /* Find somewhere to put it... */
-
-	    if (is_free_zone(mmap, o->dst, o->len)) {
-		/* Score!  We can move it into place directly... */
-		copydst = o->dst;
-		copysrc = o->src;
-		copylen = o->len;
-	    } else if (free_area(mmap, o->len, &fstart)) {
-		/* We can move the whole chunk */
-		copydst = fstart;
-		copysrc = o->src;
-		copylen = o->len;
-	    } else {
-		/* Well, copy as much as we can... */
-		if (syslinux_memmap_largest(mmap, SMT_FREE, &fstart, &flen)) {
-		    dprintf("No free memory at all!\n");
-		    goto bail;	/* Stuck! */
-		}
-
-		/* Make sure we include the critical byte */
-		copydst = fstart;
-		if (reverse) {
-		    copysrc = max(o->src, cbyte + 1 - flen);
-		    copylen = cbyte + 1 - copysrc;
-		} else {
-		    copysrc = cbyte;
-		    copylen = min(flen, o->len - (cbyte - o->src));
-		}
-	    }
-	    allocate_from(&mmap, copydst, copylen);
-
-	    if (copylen < o->len) {
-		op = split_movelist(copysrc, copylen, op);
-		o = *op;
-	    }
-
-	    mv = new_movelist(copydst, copysrc, copylen);
-	    dprintf("C: 0x%08x bytes at 0x%08x -> 0x%08x\n",
-		    mv->len, mv->src, mv->dst);
-	    *moves = mv;
-	    moves = &mv->next;
-
-	    o->src = copydst;
-
-	    if (copylen > needlen) {
-		/* We don't need all the memory we freed up.  Mark it free. */
-		if (copysrc < needbase) {
-		    add_freelist(&mmap, copysrc, needbase - copysrc, SMT_FREE);
-		    copylen -= (needbase - copysrc);
-		}
-		if (copylen > needlen) {
-		    add_freelist(&mmap, copysrc + needlen, copylen - needlen,
-				 SMT_FREE);
-		    copylen = needlen;
-		}
-	    }
-	    reverse = 0;
-	    goto move_chunk;
+	   Move the fragment occupying the critical byte of our target
+	   space out of the way (the whole of it if we can), so as to be
+	   able to move a chunk of ourselves into place next time. */
+	if (ms.map.z[i].type != SMT_ALLOC || !ms.map.z[i].owner ||
+	    ms.map.z[i].owner == f) {
+	    dprintf("Cannot find the chunk containing the critical byte\n");
+	    goto bail;		/* Stuck! */
 	}
-	dprintf("Cannot find the chunk containing the critical byte\n");
-	goto bail;		/* Stuck! */
-
-move_chunk:
-	move_chunk(&moves, &mmap, fp, copylen);
+	if (evict(&ms, ms.map.z[i].owner, cbyte, reverse))
+	    goto bail;
+next:
+	;
     }
 
     /* Finally, append the postcopy chain to the end of the moves list */
-    for (op = moves; (o = *op); op = &o->next) ;	/* Locate the end of the list */
-    *op = postcopy;
-    postcopy = NULL;
+    *ms.moves = ms.postcopy;
+    ms.postcopy = NULL;
 
     rv = 0;
 bail:
-    if (mmap)
-	syslinux_free_memmap(mmap);
-    if (frags)
-	free_movelist(&frags);
-    if (postcopy)
-	free_movelist(&postcopy);
+    if (rv) {
+	free_movelist(moves);
+	free_movelist(&ms.postcopy);
+    }
+    for (i = 0; i < ms.nslots; i++) {
+	while (ms.slots[i].frags)
+	    delete_frag(&ms, &ms.slots[i].frags);
+    }
+    for (i = 0; i < ms.nkept; i++)
+	free(ms.kept[i]);
+    free(ms.kept);
+    free(ms.frags);
+    free(ms.slots);
+    free(ms.dirty);
+    free(ms.map.z);
+    free(ms.free.z);
     return rv;
 }
 
 #ifdef TEST
 
-#include <stdio.h>
+/*
+ * Host-side test driver; see the "movebits" target in utils/Makefile.
+ *
+ *   movebits <file>		compute the moves for a case in a file
+ *   movebits -f [cases [seed]]	fuzz: check the moves for random cases
+ *   movebits -b [reps]		time some cases shaped like real ones
+ *
+ * A case file has one line per fragment, "<src> <dst> <len>" in hex;
+ * a dst of 0 instead makes the range free memory, and a src of -1
+ * memory to zero.  The fuzzer prints any case it finds wrong that way.
+ */
 
-int main(int argc, char *argv[])
+#include <string.h>
+#include <time.h>
+
+static int load_case(const char *file, struct syslinux_movelist **frags,
+		     struct syslinux_memmap **memmap)
 {
-    FILE *f;
+    struct syslinux_movelist **fep = frags, *mv;
     unsigned long d, s, l;
-    struct syslinux_movelist *frags;
-    struct syslinux_movelist **fep = &frags;
-    struct syslinux_movelist *mv, *moves;
-    struct syslinux_memmap *memmap;
     char line[BUFSIZ];
+    FILE *f;
 
-    (void)argc;
-
-    memmap = syslinux_init_memmap();
+    f = fopen(file, "r");
+    if (!f) {
+	perror(file);
+	return -1;
+    }
 
-    f = fopen(argv[1], "r");
+    *memmap = syslinux_init_memmap();
     while (fgets(line, sizeof line, f) != NULL) {
 	if (sscanf(line, "%lx %lx %lx", &s, &d, &l) == 3) {
 	    if (d) {
-		if (s == -1UL) {
-		    syslinux_add_memmap(&memmap, d, l, SMT_ZERO);
+		if (s == (addr_t)-1) {
+		    syslinux_add_memmap(memmap, d, l, SMT_ZERO);
 		} else {
 		    mv = new_movelist(d, s, l);
 		    *fep = mv;
 		    fep = &mv->next;
 		}
 	    } else {
-		syslinux_add_memmap(&memmap, s, l, SMT_FREE);
+		syslinux_add_memmap(memmap, s, l, SMT_FREE);
 	    }
 	}
     }
     fclose(f);
 
     *fep = NULL;
+    return 0;
+}
+
+static void print_case(FILE *f, struct syslinux_movelist *frags,
+		       struct syslinux_memmap *memmap)
+{
+    for (; memmap->type != SMT_END; memmap = memmap->next) {
+	if (memmap->type == SMT_FREE)
+	    fprintf(f, "%x 0 %x\n", memmap->start,
+		    memmap->next->start - memmap->start);
+	else if (memmap->type == SMT_ZERO)
+	    fprintf(f, "-1 %x %x\n", memmap->start,
+		    memmap->next->start - memmap->start);
+    }
+    for (; frags; frags = frags->next)
+	fprintf(f, "%x %x %x\n", frags->src, frags->dst, frags->len);
+}
+
+static void print_moves(FILE *f, struct syslinux_movelist *moves)
+{
+    fprintf(f, "%10s %10s %10s\n"
+	    "--------------------------------\n", "Dest", "Src", "Length");
+    for (; moves; moves = moves->next)
+	fprintf(f, "0x%08x 0x%08x 0x%08x\n", moves->dst, moves->src,
+		moves->len);
+}
+
+/* The fuzzer works in a small address space which it can simulate */
+#define FUZZ_MEM	(1 << 16)
+
+static uint8_t fuzz_orig[FUZZ_MEM], fuzz_mem[FUZZ_MEM], fuzz_ok[FUZZ_MEM];
+
+static addr_t rnd(addr_t n)
+{
+    return n ? (addr_t)(((uint64_t)rand() << 16 ^ rand()) % n) : 0;
+}
+
+static bool fuzz_range_ok(addr_t start, addr_t len, const uint8_t *map)
+{
+    while (len--) {
+	if (!map[start++])
+	    return false;
+    }
+    return true;
+}
+
+/*
+ * Make up a case: free memory with a few holes, and fragments with
+ * distinct destinations in free memory.  Some of the sources alias
+ * each other, some overlap their own destinations, and all of them
+ * are in free memory, as they are in practice (the heap.)
+ */
+static void fuzz_make(struct syslinux_movelist **frags,
+		      struct syslinux_memmap **memmap)
+{
+    static uint8_t free_map[FUZZ_MEM], dst_map[FUZZ_MEM];
+    struct syslinux_movelist *mv, **fep = frags, *prev[512];
+    addr_t nfrags, maxlen, len, dst, src, start, hlen;
+    int i, tries, nprev = 0;
+
+    *memmap = syslinux_init_memmap();
+    syslinux_add_memmap(memmap, 0, FUZZ_MEM, SMT_FREE);
+    for (i = rnd(4); i; i--) {
+	start = rnd(FUZZ_MEM);
+	hlen = 1 + rnd(FUZZ_MEM / 16);
+	if (hlen > FUZZ_MEM - start)
+	    hlen = FUZZ_MEM - start;
+	syslinux_add_memmap(memmap, start, hlen,
+			    rnd(4) ? SMT_RESERVED : SMT_ZERO);
+    }
+    for (start = 0; start < FUZZ_MEM; start++) {
+	enum syslinux_memmap_types t = syslinux_memmap_type(*memmap, start, 1);
+	free_map[start] = (t == SMT_FREE);
+	fuzz_ok[start] = (t == SMT_FREE || t == SMT_ZERO);
+	dst_map[start] = fuzz_ok[start];
+    }
+
+    maxlen = 1 << (2 + rnd(11));
+    nfrags = 1 + rnd(rnd(4) ? 32 : 512);
+
+    for (i = 0; i < (int)nfrags; i++) {
+	len = 1 + rnd(maxlen);
+	for (tries = 0; tries < 16; tries++) {
+	    dst = rnd(FUZZ_MEM - len + 1);
+	    if (fuzz_range_ok(dst, len, dst_map))
+		break;
+	}
+	if (tries == 16)
+	    continue;
+
+	switch (rnd(8)) {
+	case 0:
+	    src = dst;		/* Already in place */
+	    break;
+	case 1:
+	    src = dst + rnd(2 * len + 1) - len;	/* Shifted */
+	    break;
+	case 2:
+	    if (nprev) {	/* Aliased */
+		mv = prev[rnd(nprev)];
+		src = mv->src + rnd(mv->len) - rnd(len);
+		break;
+	    }
+	    /* fall through */
+	default:
+	    src = rnd(FUZZ_MEM - len + 1);
+	    break;
+	}
+	if (src > FUZZ_MEM - len || !fuzz_range_ok(src, len, free_map))
+	    continue;
+
+	memset(dst_map + dst, 0, len);
+	mv = new_movelist(dst, src, len);
+	*fep = mv;
+	fep = &mv->next;
+	if (nprev < 512)
+	    prev[nprev++] = mv;
+    }
+    *fep = NULL;
+}
+
+/*
+ * Carry out the moves on the simulated memory, and check that they
+ * only write to free memory, and put every fragment in place.
+ */
+static bool fuzz_check(struct syslinux_movelist *frags,
+		       struct syslinux_movelist *moves)
+{
+    struct syslinux_movelist *mv;
+
+    memcpy(fuzz_mem, fuzz_orig, FUZZ_MEM);
+
+    for (mv = moves; mv; mv = mv->next) {
+	if (mv->dst > FUZZ_MEM || mv->len > FUZZ_MEM - mv->dst ||
+	    mv->src > FUZZ_MEM || mv->len > FUZZ_MEM - mv->src ||
+	    !fuzz_range_ok(mv->dst, mv->len, fuzz_ok)) {
+	    printf("Bad move: 0x%x bytes at 0x%x -> 0x%x\n",
+		   mv->len, mv->src, mv->dst);
+	    return false;
+	}
+	memmove(fuzz_mem + mv->dst, fuzz_mem + mv->src, mv->len);
+    }
+
+    for (mv = frags; mv; mv = mv->next) {
+	if (memcmp(fuzz_mem + mv->dst, fuzz_orig + mv->src, mv->len)) {
+	    printf("Wrong data: 0x%x bytes at 0x%x -> 0x%x\n",
+		   mv->len, mv->src, mv->dst);
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+static int fuzz(unsigned long cases, unsigned long seed)
+{
+    struct syslinux_movelist *frags, *moves, *mv;
+    struct syslinux_memmap *memmap;
+    unsigned long n, stuck = 0, nmoves = 0;
+    addr_t i;
+
+    for (n = 0; n < cases; n++) {
+	srand(seed + n);
+	for (i = 0; i < FUZZ_MEM; i++)
+	    fuzz_orig[i] = rand();
+
+	fuzz_make(&frags, &memmap);
+
+	if (syslinux_compute_movelist(&moves, frags, memmap)) {
+	    stuck++;
+	} else {
+	    if (!fuzz_check(frags, moves)) {
+		printf("Case %lu (seed %lu) failed:\n", n, seed + n);
+		print_case(stdout, frags, memmap);
+		printf("Moves:\n");
+		print_moves(stdout, moves);
+		return 1;
+	    }
+	    for (mv = moves; mv; mv = mv->next)
+		nmoves++;
+	    syslinux_free_movelist(moves);
+	}
+
+	syslinux_free_movelist(frags);
+	syslinux_free_memmap(memmap);
+    }
+
+    printf("%lu cases ok, %lu stuck, %lu moves\n", cases - stuck, stuck,
+	   nmoves);
+    return 0;
+}
+
+/*
+ * Benchmark cases, with n fragments of 64K:
+ *
+ *   initrd	pieces of an initramfs scattered over the heap, going to
+ *		one place out of their way
+ *   overlap	the same, but going to where the heap is, so that they
+ *		get in each other's way
+ *   reverse	a contiguous image moved up by half its size, in pieces
+ *		listed back to front
+ */
+enum bench_shape { BENCH_INITRD, BENCH_OVERLAP, BENCH_REVERSE };
+
+static const char *const bench_names[] = { "initrd", "overlap", "reverse" };
+
+#define BENCH_PIECE	(64 << 10)
+#define BENCH_HEAP	(16 << 20)
+
+static void bench_make(enum bench_shape shape, addr_t n,
+		       struct syslinux_movelist **frags,
+		       struct syslinux_memmap **memmap)
+{
+    struct syslinux_movelist *mv;
+    addr_t *slot, i, j, t, dst;
+
+    *memmap = syslinux_init_memmap();
+    syslinux_add_memmap(memmap, 1 << 20, 0xfff00000 - (1 << 20), SMT_FREE);
+
+    /* Every other 64K slot of the heap, in a random order */
+    slot = malloc(n * sizeof *slot);
+    for (i = 0; i < n; i++)
+	slot[i] = i;
+    for (i = n - 1; i > 0; i--) {
+	j = rnd(i + 1);
+	t = slot[i], slot[i] = slot[j], slot[j] = t;
+    }
+
+    *frags = NULL;
+    for (i = n; i-- > 0;) {
+	switch (shape) {
+	case BENCH_INITRD:
+	    dst = 0x80000000 + i * BENCH_PIECE;
+	    mv = new_movelist(dst, BENCH_HEAP + 2 * slot[i] * BENCH_PIECE,
+			      BENCH_PIECE);
+	    break;
+	case BENCH_OVERLAP:
+	    dst = BENCH_HEAP + n * BENCH_PIECE / 2 + i * BENCH_PIECE;
+	    mv = new_movelist(dst, BENCH_HEAP + 2 * slot[i] * BENCH_PIECE,
+			      BENCH_PIECE);
+	    break;
+	default:
+	    dst = BENCH_HEAP + (n / 2 + (n - 1 - i)) * BENCH_PIECE;
+	    mv = new_movelist(dst, dst - n / 2 * BENCH_PIECE, BENCH_PIECE);
+	    break;
+	}
+	mv->next = *frags;
+	*frags = mv;
+    }
+
+    free(slot);
+}
+
+static int bench(unsigned long reps)
+{
+    static const addr_t sizes[] = { 16, 64, 256, 1024, 4096 };
+    struct syslinux_movelist *frags, *moves, *mv;
+    struct syslinux_memmap *memmap;
+    enum bench_shape shape;
+    unsigned long r, nmoves;
+    unsigned int k;
+    clock_t t0, t;
+
+    printf("%-8s %6s %8s %12s\n", "case", "frags", "moves", "us/call");
+    for (shape = BENCH_INITRD; shape <= BENCH_REVERSE; shape++) {
+	for (k = 0; k < sizeof sizes / sizeof sizes[0]; k++) {
+	    srand(k);
+	    bench_make(shape, sizes[k], &frags, &memmap);
+
+	    nmoves = 0;
+	    t = 0;
+	    for (r = 0; r < reps; r++) {
+		t0 = clock();
+		if (syslinux_compute_movelist(&moves, frags, memmap)) {
+		    printf("%-8s %6u failed\n", bench_names[shape], sizes[k]);
+		    break;
+		}
+		t += clock() - t0;
+		nmoves = 0;
+		for (mv = moves; mv; mv = mv->next)
+		    nmoves++;
+		syslinux_free_movelist(moves);
+
+		/* Don't spend all day on the slow ones */
+		if (t > 2 * CLOCKS_PER_SEC) {
+		    r++;
+		    break;
+		}
+	    }
+	    if (r)
+		printf("%-8s %6u %8lu %12.1f\n", bench_names[shape], sizes[k],
+		       nmoves, 1e6 * t / CLOCKS_PER_SEC / r);
+
+	    syslinux_free_movelist(frags);
+	    syslinux_free_memmap(memmap);
+	}
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct syslinux_movelist *frags, *moves;
+    struct syslinux_memmap *memmap;
+
+    if (argc > 1 && !strcmp(argv[1], "-f"))
+	return fuzz(argc > 2 ? strtoul(argv[2], NULL, 0) : 10000,
+		    argc > 3 ? strtoul(argv[3], NULL, 0) : (unsigned long)time(NULL));
+    if (argc > 1 && !strcmp(argv[1], "-b"))
+	return bench(argc > 2 ? strtoul(argv[2], NULL, 0) : 10);
+
+    if (argc != 2) {
+	fprintf(stderr, "Usage: %s file | -f [cases [seed]] | -b [reps]\n",
+		argv[0]);
+	return 1;
+    }
+
+    if (load_case(argv[1], &frags, &memmap))
+	return 1;
 
     dprintf("Input move list:\n");
     syslinux_dump_movelist(frags);
@@ -681,8 +1212,7 @@ int main(int argc, char *argv[])
 	printf("Failed to compute a move sequence\n");
 	return 1;
     } else {
-	dprintf("Final move list:\n");
-	syslinux_dump_movelist(stdout, moves);
+	print_moves(stdout, moves);
 	return 0;
     }
 }
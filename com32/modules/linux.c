@@ -185,7 +185,7 @@ int main(int argc, char *argv[])
     if (!opt_quiet)
 	printf("Loading %s... ", kernel_name);
     errno = 0;
-    if (loadfile(kernel_name, &kernel_data, &kernel_len)) {
+    if (syslinux_load_linux(kernel_name, &kernel_data, &kernel_len)) {
 	if (opt_quiet)
 	    printf("Loading %s ", kernel_name);
 	printf("failed: ");
@@ -0,0 +1,148 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * membench.c
+ *
+ * Time each of the memcpy() and memset() loops in the library on this
+ * machine, for a few block sizes, and show which ones memcpy() and
+ * memset() picked.
+ *
+ * Usage: membench.c32 [milliseconds per test]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <console.h>
+#include <sys/times.h>
+#include <sys/memfunc.h>
+
+static const size_t sizes[] = {
+    64, 1 << 10, 16 << 10, 256 << 10, 4 << 20
+};
+#define NSIZES (sizeof sizes / sizeof sizes[0])
+
+static const struct {
+    const char *name;
+    memcpy_func_t cpy;
+    memset_func_t set;
+    int need_erms, need_movnti;
+} funcs[] = {
+    { "movsl/stosl", __memcpy_movsl, __memset_stosl, 0, 0 },
+    { "erms",        __memcpy_erms,  __memset_erms,  1, 0 },
+    { "movnti",      __memcpy_movnti, __memset_movnti, 0, 1 },
+    { "movsl+nt",    __memcpy_movsl_nt, __memset_stosl_nt, 0, 1 },
+    { "erms+nt",     __memcpy_erms_nt, __memset_erms_nt, 1, 1 },
+};
+#define NFUNCS (sizeof funcs / sizeof funcs[0])
+
+static clock_t test_ms = 200;
+
+/* Run one copy or fill repeatedly for test_ms, and return MB/s */
+static unsigned int bench(memcpy_func_t cpy, memset_func_t set,
+			  char *dst, const char *src, size_t size)
+{
+    unsigned long long bytes = 0;
+    clock_t start, now;
+    unsigned int i;
+
+    /* Wait for a clock edge, since it only ticks every 55 ms or so */
+    start = times(NULL);
+    while ((now = times(NULL)) == start)
+	;
+    start = now;
+
+    do {
+	for (i = 0; i < 16; i++) {
+	    if (cpy)
+		cpy(dst, src, size);
+	    else
+		set(dst, i, size);
+	}
+	bytes += 16 * size;
+	now = times(NULL);
+    } while (now - start < test_ms);
+
+    return bytes * CLK_TCK / ((now - start) << 20);
+}
+
+static const char *func_name(memcpy_func_t cpy, memset_func_t set)
+{
+    unsigned int i;
+
+    for (i = 0; i < NFUNCS; i++) {
+	if (cpy ? funcs[i].cpy == cpy : funcs[i].set == set)
+	    return funcs[i].name;
+    }
+    return "?";
+}
+
+int main(int argc, char *argv[])
+{
+    char *src, *dst;
+    unsigned int i, j, op;
+    int erms, movnti;
+
+    openconsole(&dev_null_r, &dev_stdcon_w);
+
+    if (argc > 1)
+	test_ms = atoi(argv[1]);
+    if (!test_ms)
+	test_ms = 200;
+
+    src = malloc(sizes[NSIZES - 1]);
+    dst = malloc(sizes[NSIZES - 1]);
+    if (!src || !dst) {
+	printf("membench: out of memory\n");
+	return 1;
+    }
+
+    /* This also makes memset() and memcpy() pick their loops */
+    memset(src, 0x5a, sizes[NSIZES - 1]);
+
+    erms = __mem_has_erms();
+    movnti = __mem_has_movnti();
+
+    printf("ERMS: %s, MOVNTI: %s\n", erms ? "yes" : "no",
+	   movnti ? "yes" : "no");
+    printf("memcpy() uses %s, memset() uses %s\n",
+	   func_name(__memcpy_func, NULL), func_name(NULL, __memset_func));
+
+    for (op = 0; op < 2; op++) {
+	printf("\n%-8s %-12s", op ? "memset" : "memcpy", "MB/s");
+	for (j = 0; j < NSIZES; j++) {
+	    if (sizes[j] >= 1 << 20)
+		printf(" %7zuM", sizes[j] >> 20);
+	    else if (sizes[j] >= 1 << 10)
+		printf(" %7zuK", sizes[j] >> 10);
+	    else
+		printf(" %8zu", sizes[j]);
+	}
+	printf("\n");
+
+	for (i = 0; i < NFUNCS; i++) {
+	    /* MOVNTI faults on a CPU without SSE2; skip rather than crash */
+	    if (funcs[i].need_movnti && !movnti)
+		continue;
+
+	    printf("%-8s %-12s", "", funcs[i].name);
+	    for (j = 0; j < NSIZES; j++) {
+		printf(" %8u", op ? bench(NULL, funcs[i].set, dst, src, sizes[j])
+		       : bench(funcs[i].cpy, NULL, dst, src, sizes[j]));
+	    }
+	    printf("%s\n", funcs[i].need_erms && !erms ? "  (no ERMS)" : "");
+	}
+    }
+
+    free(src);
+    free(dst);
+    return 0;
+}
@@ -19,6 +19,10 @@
 #include <disk.h>
 #include <fs.h>
 #include <dirent.h>
+#include <minmax.h>
+#include <ilog2.h>
+#include <zlib.h>
+#include <lzo/lzo1x.h>
 #include "btrfs.h"
 
 /* compare function used for bin_search */
@@ -101,14 +105,45 @@ static void insert_map(struct btrfs_chunk_map_item *item)
 	chunk_map.cur_length++;
 }
 
+static struct btrfs_device devices[BTRFS_MAX_DEVICES];
+static int num_devices;
+
+static struct btrfs_device *find_device(u64 devid)
+{
+	int i;
+
+	for (i = 0; i < num_devices; i++)
+		if (devices[i].devid == devid)
+			return &devices[i];
+	return NULL;
+}
+
+static struct btrfs_device *add_device(u64 devid, struct disk *disk)
+{
+	struct btrfs_device *dev;
+
+	if (num_devices == BTRFS_MAX_DEVICES)
+		return NULL;
+	dev = &devices[num_devices++];
+	dev->devid = devid;
+	dev->disk = disk;
+	dev->speed = 1;
+	return dev;
+}
+
 /*
- * from sys_chunk_array or chunk_tree, we can convert a logical address to
- * a physical address we can not support multi device case yet
+ * from sys_chunk_array or chunk_tree, we can convert a logical address
+ * to the copies of it on the member devices.  Fills in io[] with up to
+ * BTRFS_MAX_MIRRORS copies, fastest device first, and returns how many
+ * there are; *len is clipped to what is contiguous on all of them.
  */
-static u64 logical_physical(u64 logical)
+static int map_logical(u64 logical, u64 *len, struct btrfs_io *io)
 {
-	struct btrfs_chunk_map_item item;
-	int slot, ret;
+	struct btrfs_chunk_map_item item, *map;
+	struct btrfs_io tmp;
+	struct btrfs_device *dev;
+	u64 offset, stripe_nr, stripe_off, stripe_len;
+	int slot, ret, first, copies, factor, i, j, n;
 
 	item.logical = logical;
 	ret = bin_search(chunk_map.map, sizeof(*chunk_map.map), &item,
@@ -117,12 +152,110 @@ static u64 logical_physical(u64 logical)
 	if (ret == 0)
 		slot++;
 	else if (slot == 0)
-		return -1;
-	if (logical >=
-		chunk_map.map[slot-1].logical + chunk_map.map[slot-1].length)
-		return -1;
-	return chunk_map.map[slot-1].physical + logical -
-			chunk_map.map[slot-1].logical;
+		return 0;
+	map = &chunk_map.map[slot-1];
+	if (logical >= map->logical + map->length)
+		return 0;
+
+	offset = logical - map->logical;
+	if (*len > map->length - offset)
+		*len = map->length - offset;
+
+	if (map->type & (BTRFS_BLOCK_GROUP_RAID0 | BTRFS_BLOCK_GROUP_RAID10)) {
+		copies = (map->type & BTRFS_BLOCK_GROUP_RAID10) ?
+			map->sub_stripes : 1;
+		factor = map->num_stripes / copies;
+		stripe_len = 1ULL << map->stripe_shift;
+		stripe_nr = offset >> map->stripe_shift;
+		stripe_off = offset & (stripe_len - 1);
+		first = (stripe_nr % factor) * copies;
+		offset = ((stripe_nr / factor) << map->stripe_shift) +
+			stripe_off;
+		if (*len > stripe_len - stripe_off)
+			*len = stripe_len - stripe_off;
+	} else if (map->type & (BTRFS_BLOCK_GROUP_RAID5 |
+				BTRFS_BLOCK_GROUP_RAID6)) {
+		printf("btrfs: RAID5/6 chunks are not supported\n");
+		return 0;
+	} else {
+		/* single, DUP and the RAID1 variants: every stripe is a copy */
+		first = 0;
+		copies = map->num_stripes;
+	}
+
+	n = 0;
+	for (i = first; i < first + copies && n < BTRFS_MAX_MIRRORS; i++) {
+		dev = find_device(map->stripes[i].devid);
+		if (!dev)
+			continue;	/* Missing device */
+		io[n].dev = dev;
+		io[n].physical = map->stripes[i].physical + offset;
+		/* Keep the copies sorted, fastest device first */
+		for (j = n++; j > 0 && io[j-1].dev->speed < io[j].dev->speed;
+		     j--) {
+			tmp = io[j-1];
+			io[j-1] = io[j];
+			io[j] = tmp;
+		}
+	}
+	return n;
+}
+
+/* read sectors covering [physical, physical + count) from one device */
+static int read_device(struct btrfs_device *dev, char *buf, u64 physical,
+		       u32 count)
+{
+	struct disk *disk = dev->disk;
+	u32 shift = disk->sector_shift;
+	u32 mask = disk->sector_size - 1;
+	sector_t sector = physical >> shift;
+	u32 skip = physical & mask;
+	u32 sectors = (skip + count + mask) >> shift;
+	char *tmp = buf;
+	int ok;
+
+	if (skip || (count & mask)) {
+		tmp = malloc(sectors << shift);	/* Unaligned */
+		if (!tmp)
+			malloc_error("btrfs read buffer");
+	}
+	ok = disk->rdwr_sectors(disk, tmp, sector, sectors, 0) == sectors;
+	if (tmp != buf) {
+		memcpy(buf, tmp + skip, count);
+		free(tmp);
+	}
+	return ok;
+}
+
+/*
+ * read count bytes at a logical address, from the fastest copy that
+ * can be read; returns the number of bytes read
+ */
+static u64 btrfs_read_logical(char *buf, u64 logical, u64 count)
+{
+	struct btrfs_io io[BTRFS_MAX_MIRRORS];
+	u64 total = count, len;
+	int copies, i;
+
+	while (count > 0) {
+		len = count;
+		copies = map_logical(logical, &len, io);
+		for (i = 0; i < copies; i++) {
+			if (read_device(io[i].dev, buf, io[i].physical, len))
+				break;
+			printf("btrfs: read error on device %llu, "
+			       "trying another copy\n", io[i].dev->devid);
+			io[i].dev->speed = 0;	/* Use as a last resort */
+		}
+		if (i == copies) {
+			printf("btrfs: cannot read logical %llu\n", logical);
+			break;
+		}
+		count -= len;
+		buf += len;
+		logical += len;
+	}
+	return total - count;
 }
 
 /* cache read from disk, offset and count are bytes */
@@ -201,6 +334,169 @@ static void btrfs_read_super_block(struct fs_info *fs)
 	}
 }
 
+/* a primary partition entry in an MBR */
+struct mbr_part {
+	u8 status;
+	u8 chs_start[3];
+	u8 type;
+	u8 chs_end[3];
+	u32 start;
+	u32 length;
+} __attribute__ ((__packed__));
+
+#define MBR_PART_TABLE	446
+#define MBR_TYPE_GPT	0xee
+#define GPT_MAX_PARTS	128
+
+/*
+ * check for a member device of this filesystem, which we don't have
+ * yet, at sector start of the whole BIOS drive disk
+ */
+static void probe_member(struct disk *disk, sector_t start, char *buf)
+{
+	struct btrfs_super_block *msb = (struct btrfs_super_block *)buf;
+	u32 shift = disk->sector_shift;
+	u32 sectors = BTRFS_SUPER_INFO_SIZE >> shift;
+	struct disk *member;
+
+	if (disk->rdwr_sectors(disk, buf,
+			       start + (BTRFS_SUPER_INFO_OFFSET >> shift),
+			       sectors, 0) != sectors)
+		return;
+	if (msb->bytenr != BTRFS_SUPER_INFO_OFFSET ||
+	    strncmp((char *)&msb->magic, BTRFS_MAGIC, sizeof(msb->magic)) ||
+	    memcmp(msb->fsid, sb.fsid, sizeof(sb.fsid)) ||
+	    find_device(msb->dev_item.devid))
+		return;
+
+	member = malloc(sizeof *member);
+	if (!member)
+		malloc_error("btrfs device");
+	*member = *disk;
+	member->part_start = start;
+	if (!add_device(msb->dev_item.devid, member)) {
+		free(member);
+		return;
+	}
+	dprintf("btrfs: device %llu on drive %02x at sector %llu\n",
+		msb->dev_item.devid, disk->disk_number, start);
+}
+
+/*
+ * look for member devices on a BIOS drive: the whole drive, its MBR
+ * primary partitions or its GPT partitions.  The first 4K of buf is
+ * used for superblocks, the rest for the partition tables.
+ */
+static void scan_drive(uint8_t drive, char *buf)
+{
+	struct disk *disk;
+	struct mbr_part *part;
+	char *tbl = buf + BTRFS_SUPER_INFO_SIZE;
+	u32 shift, mask, nparts, esize, i;
+	sector_t sector, last = 0;
+	u64 lba, *ent;
+
+	disk = disk_open(drive, 0);
+	if (!disk)
+		return;
+	shift = disk->sector_shift;
+	mask = disk->sector_size - 1;
+
+	probe_member(disk, 0, buf);
+	if (disk->rdwr_sectors(disk, tbl, 0, 1, 0) != 1 ||
+	    *(u16 *)(tbl + 510) != 0xaa55)
+		goto out;
+
+	part = (struct mbr_part *)(tbl + MBR_PART_TABLE);
+	if (part[0].type != MBR_TYPE_GPT) {
+		for (i = 0; i < 4; i++)
+			if (part[i].type && part[i].start)
+				probe_member(disk, part[i].start, buf);
+		goto out;
+	}
+
+	/* GPT header in sector 1 */
+	if (disk->rdwr_sectors(disk, tbl, 1, 1, 0) != 1 ||
+	    memcmp(tbl, "EFI PART", 8))
+		goto out;
+	lba = *(u64 *)(tbl + 72);
+	nparts = min(*(u32 *)(tbl + 80), (u32)GPT_MAX_PARTS);
+	esize = *(u32 *)(tbl + 84);
+	if (esize < 128 || esize > disk->sector_size || (esize & (esize - 1)))
+		goto out;
+
+	for (i = 0; i < nparts; i++) {
+		sector = lba + ((i * esize) >> shift);
+		if (!i || sector != last) {
+			if (disk->rdwr_sectors(disk, tbl, sector, 1, 0) != 1)
+				break;
+			last = sector;
+		}
+		ent = (u64 *)(tbl + ((i * esize) & mask));
+		/* Type GUID in bytes 0-15, first LBA at 32 */
+		if (ent[0] || ent[1])
+			probe_member(disk, ent[4], buf);
+	}
+out:
+	free(disk);
+}
+
+/*
+ * time reads from the start of a device, so that reads go to the
+ * fastest copy of mirrored data
+ */
+static void measure_device(struct btrfs_device *dev, char *buf)
+{
+	struct disk *disk = dev->disk;
+	u32 sectors = BTRFS_PROBE_CHUNK >> disk->sector_shift;
+	u32 bytes = 0, start, ms;
+	sector_t sector = 0;
+
+	start = ms_timer();
+	do {
+		if (disk->rdwr_sectors(disk, buf, sector, sectors, 0)
+		    != sectors) {
+			dev->speed = 0;
+			return;
+		}
+		sector += sectors;
+		bytes += BTRFS_PROBE_CHUNK;
+		ms = ms_timer() - start;
+	} while (ms < BTRFS_PROBE_MS && bytes < BTRFS_PROBE_BYTES);
+
+	dev->speed = max(bytes / max(ms, 1U), 1U);
+	dprintf("btrfs: device %llu reads %u bytes/ms\n",
+		dev->devid, dev->speed);
+}
+
+/*
+ * find the member devices: the one we booted from and, if there are
+ * more, the others among the BIOS hard disks
+ */
+static void btrfs_scan_devices(struct fs_info *fs)
+{
+	extern uint8_t BIOS_hd_count;
+	int drives = BIOS_hd_count;
+	char *buf;
+	int i;
+
+	add_device(sb.dev_item.devid, fs->fs_dev->disk);
+	if (sb.num_devices < 2)
+		return;
+
+	buf = malloc(BTRFS_PROBE_CHUNK);
+	if (!buf)
+		malloc_error("btrfs probe buffer");
+	for (i = 0; i < drives && num_devices < sb.num_devices; i++)
+		scan_drive(0x80 + i, buf);
+	if (num_devices < sb.num_devices)
+		printf("btrfs: found only %d of %llu devices\n",
+		       num_devices, sb.num_devices);
+	for (i = 0; i < num_devices; i++)
+		measure_device(&devices[i], buf);
+	free(buf);
+}
+
 static inline unsigned long btrfs_chunk_item_size(int num_stripes)
 {
 	return sizeof(struct btrfs_chunk) +
@@ -244,55 +540,105 @@ static int btrfs_comp_keys_type(struct btrfs_disk_key *k1,
 	return 0;
 }
 
-/* seach tree directly on disk ... */
-static int search_tree(struct fs_info *fs, u64 loffset,
+/*
+ * Tree node cache.  Nodes and leaves are kept whole, keyed by logical
+ * address, so a search can bin_search their key arrays in place
+ * instead of copying them out of the block cache again on every
+ * descent.
+ */
+struct btrfs_node_cache {
+	u64 bytenr;		/* Logical address of the node */
+	unsigned int lru;	/* Last use; 0 if never used */
+	u8 *data;		/* The node, sb.nodesize bytes */
+};
+
+static struct btrfs_node_cache node_cache[BTRFS_NODE_CACHE_ENTRIES];
+static unsigned int node_cache_lru;
+
+static const u8 *get_node(u64 loffset)
+{
+	struct btrfs_node_cache *nc, *victim = node_cache;
+	u32 size = max(sb.nodesize, sb.leafsize);
+	int i;
+
+	for (i = 0; i < BTRFS_NODE_CACHE_ENTRIES; i++) {
+		nc = &node_cache[i];
+		if (nc->lru && nc->bytenr == loffset) {
+			nc->lru = ++node_cache_lru;
+			return nc->data;
+		}
+		if (nc->lru < victim->lru)
+			victim = nc;
+	}
+
+	if (!victim->data) {
+		victim->data = malloc(size);
+		if (!victim->data)
+			malloc_error("btrfs node cache");
+	}
+	victim->bytenr = loffset;
+	victim->lru = ++node_cache_lru;
+	if (btrfs_read_logical((char *)victim->data, loffset, size) < size)
+		victim->lru = 0;	/* Don't keep a bad node around */
+	return victim->data;
+}
+
+/* copy the item in a leaf slot, and its data, into the path */
+static void path_set_item(struct btrfs_path *path,
+			  const struct btrfs_leaf *leaf, int slot)
+{
+	path->item = leaf->items[slot];
+	memcpy(path->data, (const u8 *)leaf + sizeof(struct btrfs_header)
+	       + path->item.offset, min(path->item.size, sizeof(path->data)));
+}
+
+/* seach tree, through the node cache ... */
+static int search_tree(u64 loffset,
 		struct btrfs_disk_key *key, struct btrfs_path *path)
 {
-	u8 buf[BTRFS_MAX_LEAF_SIZE];
-	struct btrfs_header *header = (struct btrfs_header *)buf;
-	struct btrfs_node *node = (struct btrfs_node *)buf;
-	struct btrfs_leaf *leaf = (struct btrfs_leaf *)buf;
+	const u8 *buf = get_node(loffset);
+	const struct btrfs_header *header = (const struct btrfs_header *)buf;
+	const struct btrfs_node *node = (const struct btrfs_node *)buf;
+	const struct btrfs_leaf *leaf = (const struct btrfs_leaf *)buf;
 	int slot, ret;
-	u64 offset;
 
-	offset = logical_physical(loffset);
-	btrfs_read(fs, (char *)header, offset, sizeof(*header));
 	if (header->level) {/*node*/
-		btrfs_read(fs, (char *)&node->ptrs[0], offset + sizeof(*header),
-			sb.nodesize - sizeof(*header));
 		path->itemsnr[header->level] = header->nritems;
 		path->offsets[header->level] = loffset;
-		ret = bin_search(&node->ptrs[0], sizeof(struct btrfs_key_ptr),
+		ret = bin_search((void *)&node->ptrs[0],
+			sizeof(struct btrfs_key_ptr),
 			key, (cmp_func)btrfs_comp_keys,
 			path->slots[header->level], header->nritems, &slot);
 		if (ret && slot > path->slots[header->level])
 			slot--;
 		path->slots[header->level] = slot;
-		ret = search_tree(fs, node->ptrs[slot].blockptr, key, path);
+		ret = search_tree(node->ptrs[slot].blockptr, key, path);
 	} else {/*leaf*/
-		btrfs_read(fs, (char *)&leaf->items, offset + sizeof(*header),
-			sb.leafsize - sizeof(*header));
 		path->itemsnr[header->level] = header->nritems;
 		path->offsets[0] = loffset;
-		ret = bin_search(&leaf->items[0], sizeof(struct btrfs_item),
+		ret = bin_search((void *)&leaf->items[0],
+			sizeof(struct btrfs_item),
 			key, (cmp_func)btrfs_comp_keys, path->slots[0],
 			header->nritems, &slot);
 		if (ret && slot > path->slots[header->level])
 			slot--;
 		path->slots[0] = slot;
-		path->item = leaf->items[slot];
-		btrfs_read(fs, (char *)&path->data,
-			offset + sizeof(*header) + leaf->items[slot].offset,
-			leaf->items[slot].size);
+		path_set_item(path, leaf, slot);
 	}
 	return ret;
 }
 
-/* return 0 if leaf found */
-static int next_leaf(struct fs_info *fs, struct btrfs_disk_key *key, struct btrfs_path *path)
+/*
+ * Move the path to the first item of the next leaf, stepping across
+ * the lowest node which has a next slot; return 0 if leaf found
+ */
+static int next_leaf(struct btrfs_path *path)
 {
+	const struct btrfs_node *node;
+	const struct btrfs_leaf *leaf;
 	int slot;
 	int level = 1;
+	u64 loffset;
 
 	while (level < BTRFS_MAX_LEVEL) {
 		if (!path->itemsnr[level]) /* no more nodes */
@@ -302,18 +648,35 @@ static int next_leaf(struct fs_info *fs, struct btrfs_disk_key *key, struct btrf
 			level++;
 			continue;;
 		}
-		path->slots[level] = slot;
-		path->slots[level-1] = 0; /* reset low level slots info */
-		search_tree(fs, path->offsets[level], key, path);
 		break;
 	}
 	if (level == BTRFS_MAX_LEVEL)
 		return 1;
+
+	/* and then down the leftmost branch */
+	path->slots[level] = slot;
+	node = (const struct btrfs_node *)get_node(path->offsets[level]);
+	loffset = node->ptrs[slot].blockptr;
+	while (--level) {
+		node = (const struct btrfs_node *)get_node(loffset);
+		path->offsets[level] = loffset;
+		path->itemsnr[level] = node->header.nritems;
+		path->slots[level] = 0;
+		loffset = node->ptrs[0].blockptr;
+	}
+
+	leaf = (const struct btrfs_leaf *)get_node(loffset);
+	path->offsets[0] = loffset;
+	path->itemsnr[0] = leaf->header.nritems;
+	path->slots[0] = 0;
+	if (!leaf->header.nritems)
+		return 1;
+	path_set_item(path, leaf, 0);
 	return 0;
 }
 
-/* return 0 if slot found */
-static int next_slot(struct fs_info *fs, struct btrfs_disk_key *key, struct btrfs_path *path)
+/* return 0 if slot found; resumes in the path's current leaf */
+static int next_slot(struct btrfs_path *path)
 {
 	int slot;
 
@@ -323,16 +686,41 @@ static int next_slot(struct fs_info *fs, struct btrfs_disk_key *key, struct btrf
 	if (slot >= path->itemsnr[0])
 		return 1;
 	path->slots[0] = slot;
-	search_tree(fs, path->offsets[0], key, path);
+	path_set_item(path, (const struct btrfs_leaf *)
+		      get_node(path->offsets[0]), slot);
 	return 0;
 }
 
+/* add a chunk item, with all its stripes, to the chunk map */
+static void insert_chunk(u64 logical, struct btrfs_chunk *chunk)
+{
+	struct btrfs_chunk_map_item item;
+	struct btrfs_stripe *stripe = &chunk->stripe;
+	int i;
+
+	if (chunk->num_stripes > BTRFS_MAX_STRIPES) {
+		printf("btrfs: chunk with %d stripes not supported\n",
+		       chunk->num_stripes);
+		return;
+	}
+	item.logical = logical;
+	item.length = chunk->length;
+	item.type = chunk->type;
+	item.stripe_shift = ilog2(chunk->stripe_len);
+	item.num_stripes = chunk->num_stripes;
+	item.sub_stripes = chunk->sub_stripes ? chunk->sub_stripes : 1;
+	for (i = 0; i < chunk->num_stripes; i++) {
+		item.stripes[i].devid = stripe[i].devid;
+		item.stripes[i].physical = stripe[i].offset;
+	}
+	insert_map(&item);
+}
+
 /*
  * read chunk_array in super block
  */
 static void btrfs_read_sys_chunk_array(void)
 {
-	struct btrfs_chunk_map_item item;
 	struct btrfs_disk_key *key;
 	struct btrfs_chunk *chunk;
 	int cur;
@@ -344,48 +732,34 @@ static void btrfs_read_sys_chunk_array(void)
 		cur += sizeof(*key);
 		chunk = (struct btrfs_chunk *)(sb.sys_chunk_array + cur);
 		cur += btrfs_chunk_item_size(chunk->num_stripes);
-		/* insert to mapping table, ignore multi stripes */
-		item.logical = key->offset;
-		item.length = chunk->length;
-		item.devid = chunk->stripe.devid;
-		item.physical = chunk->stripe.offset;/*ignore other stripes */
-		insert_map(&item);
+		insert_chunk(key->offset, chunk);
 	}
 }
 
 /* read chunk items from chunk_tree and insert them to chunk map */
-static void btrfs_read_chunk_tree(struct fs_info *fs)
+static void btrfs_read_chunk_tree(void)
 {
 	struct btrfs_disk_key search_key;
-	struct btrfs_chunk *chunk;
-	struct btrfs_chunk_map_item item;
 	struct btrfs_path path;
 
 	if (!(sb.flags & BTRFS_SUPER_FLAG_METADUMP)) {
-		if (sb.num_devices > 1)
-			printf("warning: only support single device btrfs\n");
 		/* read chunk from chunk_tree */
 		search_key.objectid = BTRFS_FIRST_CHUNK_TREE_OBJECTID;
 		search_key.type = BTRFS_CHUNK_ITEM_KEY;
 		search_key.offset = 0;
 		clear_path(&path);
-		search_tree(fs, sb.chunk_root, &search_key, &path);
+		search_tree(sb.chunk_root, &search_key, &path);
 		do {
 			do {
 				if (btrfs_comp_keys_type(&search_key,
 							&path.item.key))
 					break;
-				chunk = (struct btrfs_chunk *)(path.data);
-				/* insert to mapping table, ignore stripes */
-				item.logical = path.item.key.offset;
-				item.length = chunk->length;
-				item.devid = chunk->stripe.devid;
-				item.physical = chunk->stripe.offset;
-				insert_map(&item);
-			} while (!next_slot(fs, &search_key, &path));
+				insert_chunk(path.item.key.offset,
+					     (struct btrfs_chunk *)path.data);
+			} while (!next_slot(&path));
 			if (btrfs_comp_keys_type(&search_key, &path.item.key))
 				break;
-		} while (!next_leaf(fs, &search_key, &path));
+		} while (!next_leaf(&path));
 	}
 }
 
@@ -408,7 +782,7 @@ static struct inode *btrfs_iget_by_inr(struct fs_info *fs, u64 inr)
 	search_key.type = BTRFS_INODE_ITEM_KEY;
 	search_key.offset = 0;
 	clear_path(&path);
-	ret = search_tree(fs, fs_tree, &search_key, &path);
+	ret = search_tree(fs_tree, &search_key, &path);
 	if (ret)
 		return NULL;
 	inode_item = *(struct btrfs_inode_item *)path.data;
@@ -426,7 +800,7 @@ static struct inode *btrfs_iget_by_inr(struct fs_info *fs, u64 inr)
 		search_key.type = BTRFS_EXTENT_DATA_KEY;
 		search_key.offset = 0;
 		clear_path(&path);
-		ret = search_tree(fs, fs_tree, &search_key, &path);
+		ret = search_tree(fs_tree, &search_key, &path);
 		if (ret)
 			return NULL; /* impossible */
 		extent_item = *(struct btrfs_file_extent_item *)path.data;
@@ -459,7 +833,7 @@ static struct inode *btrfs_iget(const char *name, struct inode *parent)
 	search_key.type = BTRFS_DIR_ITEM_KEY;
 	search_key.offset = btrfs_name_hash(name, strlen(name));
 	clear_path(&path);
-	ret = search_tree(fs, fs_tree, &search_key, &path);
+	ret = search_tree(fs_tree, &search_key, &path);
 	if (ret)
 		return NULL;
 	dir_item = *(struct btrfs_dir_item *)path.data;
@@ -469,14 +843,13 @@ static struct inode *btrfs_iget(const char *name, struct inode *parent)
 
 static int btrfs_readlink(struct inode *inode, char *buf)
 {
-	btrfs_read(inode->fs, buf, logical_physical(PVT(inode)->offset), inode->size);
+	btrfs_read_logical(buf, PVT(inode)->offset, inode->size);
 	buf[inode->size] = '\0';
 	return inode->size;
 }
 
 static int btrfs_readdir(struct file *file, struct dirent *dirent)
 {
-	struct fs_info *fs = file->fs;
 	struct inode *inode = file->inode;
 	struct btrfs_disk_key search_key;
 	struct btrfs_path path;
@@ -492,7 +865,7 @@ static int btrfs_readdir(struct file *file, struct dirent *dirent)
 	search_key.type = BTRFS_DIR_ITEM_KEY;
 	search_key.offset = file->offset - 1;
 	clear_path(&path);
-	ret = search_tree(fs, fs_tree, &search_key, &path);
+	ret = search_tree(fs_tree, &search_key, &path);
 
 	if (ret) {
 		if (btrfs_comp_keys_type(&search_key, &path.item.key))
@@ -512,79 +885,251 @@ static int btrfs_readdir(struct file *file, struct dirent *dirent)
 	return 0;
 }
 
-static int btrfs_next_extent(struct inode *inode, uint32_t lstart)
+/*
+ * Look up the file extent covering file offset pos and remember it in
+ * the private inode.  Returns 0 on success.
+ */
+static int btrfs_find_file_extent(struct inode *inode, u64 pos)
 {
+	struct btrfs_pvt_inode *pvt = PVT(inode);
 	struct btrfs_disk_key search_key;
-	struct btrfs_file_extent_item extent_item;
 	struct btrfs_path path;
 	int ret;
-	u64 offset;
-	struct fs_info *fs = inode->fs;
-	u32 sec_shift = SECTOR_SHIFT(fs);
-	u32 sec_size = SECTOR_SIZE(fs);
+
+	if (pos >= pvt->ext_start && pos < pvt->ext_end)
+		return 0;
 
 	search_key.objectid = inode->ino;
 	search_key.type = BTRFS_EXTENT_DATA_KEY;
-	search_key.offset = lstart << sec_shift;
+	search_key.offset = pos;
 	clear_path(&path);
-	ret = search_tree(fs, fs_tree, &search_key, &path);
-	if (ret) { /* impossible */
-		printf("btrfs: search extent data error!\n");
+	ret = search_tree(fs_tree, &search_key, &path);
+	if (ret && btrfs_comp_keys_type(&search_key, &path.item.key))
+		return -1;
+
+	pvt->ext = *(struct btrfs_file_extent_item *)path.data;
+	pvt->ext_start = path.item.key.offset;
+	if (pvt->ext.type == BTRFS_FILE_EXTENT_INLINE) {
+		pvt->ext_addr = path.offsets[0] + sizeof(struct btrfs_header)
+			+ path.item.offset
+			+ offsetof(struct btrfs_file_extent_item, disk_bytenr);
+		pvt->ext_len = path.item.size
+			- offsetof(struct btrfs_file_extent_item, disk_bytenr);
+		pvt->ext_end = pvt->ext_start + pvt->ext.ram_bytes;
+	} else {
+		pvt->ext_addr = pvt->ext.disk_bytenr;
+		pvt->ext_len = pvt->ext.disk_num_bytes;
+		pvt->ext_end = pvt->ext_start + pvt->ext.num_bytes;
+	}
+
+	if (pos >= pvt->ext_end) {
+		pvt->ext_end = 0;	/* Not found; forget it */
+		return -1;
+	}
+	return 0;
+}
+
+/* Decompress a zlib stream; returns the decompressed length or -1 */
+static int btrfs_inflate(char *in, u32 in_len, char *out, u32 out_len)
+{
+	z_stream zs;
+	int rv;
+
+	memset(&zs, 0, sizeof zs);
+	zs.next_in = (Bytef *)in;
+	zs.avail_in = in_len;
+	zs.next_out = (Bytef *)out;
+	zs.avail_out = out_len;
+
+	if (inflateInit(&zs) != Z_OK)
+		return -1;
+	rv = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+
+	if (rv != Z_STREAM_END && zs.avail_out)
+		return -1;
+	return out_len - zs.avail_out;
+}
+
+/*
+ * Decompress btrfs LZO data: a total length, then segments of LZO1X
+ * data, each with a length header which never straddles a page.
+ * out_len is the expected length, buf_size the size of the buffer.
+ * Returns the decompressed length or -1.
+ */
+static int btrfs_unlzo(char *in, u32 in_len, char *out, u32 out_len,
+		       u32 buf_size)
+{
+	u32 tot_len, seg_len;
+	u32 pos = BTRFS_LZO_LEN;
+	u32 done = 0;
+	lzo_uint len;
+
+	if (in_len < BTRFS_LZO_LEN)
+		return -1;
+	tot_len = *(u32 *)in;
+	if (tot_len > in_len)
 		return -1;
+
+	while (done < out_len) {
+		if (BTRFS_LZO_PAGE - pos % BTRFS_LZO_PAGE < BTRFS_LZO_LEN)
+			pos += BTRFS_LZO_PAGE - pos % BTRFS_LZO_PAGE;
+		if (pos + BTRFS_LZO_LEN > tot_len)
+			break;
+		seg_len = *(u32 *)(in + pos);
+		pos += BTRFS_LZO_LEN;
+		if (seg_len > tot_len - pos)
+			return -1;
+
+		/* Only the last segment may be short, so the buffer is
+		 * only padded for that; don't trust a corrupt one */
+		len = min((u32)BTRFS_LZO_PAGE, buf_size - done);
+		if (lzo1x_decompress_safe((lzo_bytep)in + pos, seg_len,
+					  (lzo_bytep)out + done, &len,
+					  NULL) != LZO_E_OK)
+			return -1;
+		done += len;
+		pos += seg_len;
 	}
-	extent_item = *(struct btrfs_file_extent_item *)path.data;
 
-	if (extent_item.encryption) {
-	    printf("btrfs: found encrypted data, cannot continue!\n");
-	    return -1;
+	return done < out_len ? done : out_len;
+}
+
+/*
+ * Make sure the data of the current file extent (inline and/or
+ * compressed) is in the private inode's zbuf.  The last extent stays
+ * there, so sequential reads through it only decompress it once.
+ */
+static int btrfs_load_extent(struct inode *inode)
+{
+	struct btrfs_pvt_inode *pvt = PVT(inode);
+	u32 ram = pvt->ext.ram_bytes;
+	u32 clen = pvt->ext_len;
+	u32 size;
+	char *cbuf;
+	int len;
+
+	if (pvt->zaddr == pvt->ext_addr)
+		return 0;
+
+	if (pvt->ext.ram_bytes > BTRFS_MAX_UNCOMPRESSED ||
+	    pvt->ext_len > BTRFS_MAX_COMPRESSED) {
+		printf("btrfs: extent too large\n");
+		return -1;
 	}
-	if (extent_item.compression) {
-	    printf("btrfs: found compressed data, cannot continue!\n");
-	    return -1;
+	if (pvt->ext.type != BTRFS_FILE_EXTENT_INLINE &&
+	    pvt->ext.offset + pvt->ext.num_bytes > ram) {
+		printf("btrfs: bad file extent\n");
+		return -1;
 	}
 
-	if (extent_item.type == BTRFS_FILE_EXTENT_INLINE) {/* inline file */
-		/* we fake a extent here, and PVT of inode will tell us */
-		offset = path.offsets[0] + sizeof(struct btrfs_header)
-			+ path.item.offset
-			+ offsetof(struct btrfs_file_extent_item, disk_bytenr);
-		inode->next_extent.len =
-			(inode->size + sec_size -1) >> sec_shift;
-	} else {
-		offset = extent_item.disk_bytenr + extent_item.offset;
-		inode->next_extent.len =
-			(extent_item.num_bytes + sec_size - 1) >> sec_shift;
+	/* LZO may write a whole page past the end of the data */
+	size = (ram + BTRFS_LZO_PAGE - 1) & ~(BTRFS_LZO_PAGE - 1);
+	if (pvt->zbuf_size < size) {
+		free(pvt->zbuf);
+		pvt->zbuf = malloc(size);
+		if (!pvt->zbuf)
+			malloc_error("btrfs extent buffer");
+		pvt->zbuf_size = size;
+	}
+	pvt->zaddr = 0;
+
+	cbuf = malloc(clen);
+	if (!cbuf)
+		malloc_error("btrfs compressed data");
+	if (btrfs_read_logical(cbuf, pvt->ext_addr, clen) < clen) {
+		free(cbuf);
+		return -1;
 	}
-	inode->next_extent.pstart =
-		logical_physical(offset) >> sec_shift;
-	PVT(inode)->offset = offset;
+
+	switch (pvt->ext.compression) {
+	case BTRFS_COMPRESS_NONE:
+		len = min(clen, ram);
+		memcpy(pvt->zbuf, cbuf, len);
+		break;
+	case BTRFS_COMPRESS_ZLIB:
+		len = btrfs_inflate(cbuf, clen, pvt->zbuf, ram);
+		break;
+	case BTRFS_COMPRESS_LZO:
+		len = btrfs_unlzo(cbuf, clen, pvt->zbuf, ram,
+				  pvt->zbuf_size);
+		break;
+	default:
+		printf("btrfs: unsupported compression type %d\n",
+		       pvt->ext.compression);
+		len = -1;
+		break;
+	}
+	free(cbuf);
+
+	if (len < 0) {
+		printf("btrfs: bad compressed extent\n");
+		return -1;
+	}
+	memset(pvt->zbuf + len, 0, ram - len);
+	pvt->zaddr = pvt->ext_addr;
 	return 0;
 }
 
 static uint32_t btrfs_getfssec(struct file *file, char *buf, int sectors,
 					bool *have_more)
 {
-	u32 ret;
+	struct inode *inode = file->inode;
+	struct btrfs_pvt_inode *pvt = PVT(inode);
 	struct fs_info *fs = file->fs;
-	u32 off = PVT(file->inode)->offset % SECTOR_SIZE(fs);
-	bool handle_inline = false;
+	u32 sec_shift = SECTOR_SHIFT(fs);
+	u32 bytes_read = 0;
+	u32 ret, skip;
+	u64 left, addr, len;
 
-	if (off && !file->offset) {/* inline file first read patch */
-		file->inode->size += off;
-		handle_inline = true;
-	}
-	ret = generic_getfssec(file, buf, sectors, have_more);
-	if (!ret)
-		return ret;
-	off = PVT(file->inode)->offset % SECTOR_SIZE(fs);
-	if (handle_inline) {/* inline file patch */
-		ret -= off;
-		memcpy(buf, buf + off, ret);
+	while (sectors > 0 && file->offset < inode->size) {
+		if (btrfs_find_file_extent(inode, file->offset))
+			break;
+
+		left = min(pvt->ext_end, (u64)inode->size) - file->offset;
+		if (pvt->ext.type != BTRFS_FILE_EXTENT_INLINE &&
+		    !pvt->ext.disk_bytenr) {
+			/* A hole */
+			ret = min(left, (u64)sectors << sec_shift);
+			memset(buf, 0, ret);
+			file->offset += ret;
+		} else if (pvt->ext.compression ||
+		    pvt->ext.type == BTRFS_FILE_EXTENT_INLINE) {
+			/* Serve from the decompressed extent */
+			if (btrfs_load_extent(inode))
+				break;
+			skip = file->offset - pvt->ext_start;
+			if (pvt->ext.type != BTRFS_FILE_EXTENT_INLINE)
+				skip += pvt->ext.offset;
+			ret = min(left, (u64)sectors << sec_shift);
+			memcpy(buf, pvt->zbuf + skip, ret);
+			file->offset += ret;
+		} else {
+			/* Read straight from whichever copy is fastest */
+			ret = min(left, (u64)sectors << sec_shift);
+			addr = pvt->ext.disk_bytenr + pvt->ext.offset +
+				(file->offset - pvt->ext_start);
+			len = (ret + SECTOR_SIZE(fs) - 1) & ~(SECTOR_SIZE(fs) - 1);
+			if (btrfs_read_logical(buf, addr, len) < len)
+				break;
+			file->offset += ret;
+		}
+
+		buf += ret;
+		bytes_read += ret;
+		sectors -= (ret + SECTOR_SIZE(fs) - 1) >> sec_shift;
 	}
-	return ret;
+
+	*have_more = file->offset < inode->size;
+	return bytes_read;
+}
+
+static void btrfs_free_inode(struct inode *inode)
+{
+	free(PVT(inode)->zbuf);
 }
 
-static void btrfs_get_fs_tree(struct fs_info *fs)
+static void btrfs_get_fs_tree(void)
 {
 	struct btrfs_disk_key search_key;
 	struct btrfs_path path;
@@ -597,8 +1142,8 @@ static void btrfs_get_fs_tree(struct fs_info *fs)
 		search_key.type = BTRFS_ROOT_REF_KEY;
 		search_key.offset = 0;
 		clear_path(&path);
-		if (search_tree(fs, sb.root, &search_key, &path))
-			next_slot(fs, &search_key, &path);
+		if (search_tree(sb.root, &search_key, &path))
+			next_slot(&path);
 		do {
 			do {
 				struct btrfs_root_ref *ref;
@@ -614,12 +1159,12 @@ static void btrfs_get_fs_tree(struct fs_info *fs)
 					subvol_ok = true;
 					break;
 				}
-			} while (!next_slot(fs, &search_key, &path));
+			} while (!next_slot(&path));
 			if (subvol_ok)
 				break;
 			if (btrfs_comp_keys_type(&search_key, &path.item.key))
 				break;
-		} while (!next_leaf(fs, &search_key, &path));
+		} while (!next_leaf(&path));
 		if (!subvol_ok) /* should be impossible */
 			printf("no subvol found!\n");
 	}
@@ -631,7 +1176,7 @@ static void btrfs_get_fs_tree(struct fs_info *fs)
 	search_key.type = BTRFS_ROOT_ITEM_KEY;
 	search_key.offset = -1;
 	clear_path(&path);
-	search_tree(fs, sb.root, &search_key, &path);
+	search_tree(sb.root, &search_key, &path);
 	tree = (struct btrfs_root_item *)path.data;
 	fs_tree = tree->bytenr;
 }
@@ -654,9 +1199,10 @@ static int btrfs_fs_init(struct fs_info *fs)
 	btrfs_read_super_block(fs);
 	if (strncmp((char *)(&sb.magic), BTRFS_MAGIC, sizeof(sb.magic)))
 		return -1;
+	btrfs_scan_devices(fs);
 	btrfs_read_sys_chunk_array();
-	btrfs_read_chunk_tree(fs);
-	btrfs_get_fs_tree(fs);
+	btrfs_read_chunk_tree();
+	btrfs_get_fs_tree();
 
 	return fs->block_shift;
 }
@@ -668,10 +1214,10 @@ const struct fs_ops btrfs_fs_ops = {
     .iget_root     = btrfs_iget_root,
     .iget          = btrfs_iget,
     .readlink      = btrfs_readlink,
+    .free_inode    = btrfs_free_inode,
     .getfssec      = btrfs_getfssec,
     .close_file    = generic_close_file,
     .mangle_name   = generic_mangle_name,
-    .next_extent   = btrfs_next_extent,
     .readdir       = btrfs_readdir,
     .load_config   = generic_load_config
 };
@@ -33,6 +33,16 @@ typedef u64 __le64;
 
 #define BTRFS_SUPER_FLAG_METADUMP	(1ULL << 33)
 
+/* Chunk (block group) allocation profiles */
+#define BTRFS_BLOCK_GROUP_RAID0		(1ULL << 3)
+#define BTRFS_BLOCK_GROUP_RAID1		(1ULL << 4)
+#define BTRFS_BLOCK_GROUP_DUP		(1ULL << 5)
+#define BTRFS_BLOCK_GROUP_RAID10	(1ULL << 6)
+#define BTRFS_BLOCK_GROUP_RAID5		(1ULL << 7)
+#define BTRFS_BLOCK_GROUP_RAID6		(1ULL << 8)
+#define BTRFS_BLOCK_GROUP_RAID1C3	(1ULL << 9)
+#define BTRFS_BLOCK_GROUP_RAID1C4	(1ULL << 10)
+
 #define BTRFS_DEV_ITEM_KEY	216
 #define BTRFS_CHUNK_ITEM_KEY	228
 #define BTRFS_ROOT_REF_KEY	156
@@ -50,8 +60,29 @@ typedef u64 __le64;
 #define BTRFS_FILE_EXTENT_REG 1
 #define BTRFS_FILE_EXTENT_PREALLOC 2
 
+#define BTRFS_COMPRESS_NONE 0
+#define BTRFS_COMPRESS_ZLIB 1
+#define BTRFS_COMPRESS_LZO  2
+
+/* Largest compressed extent, on disk and decompressed */
+#define BTRFS_MAX_COMPRESSED	(128 * 1024)
+#define BTRFS_MAX_UNCOMPRESSED	(128 * 1024)
+
+/* LZO extents are split in segments of at most one page */
+#define BTRFS_LZO_PAGE	4096
+#define BTRFS_LZO_LEN	4	/* Size of the length headers */
+
 #define BTRFS_MAX_LEVEL 8
+#define BTRFS_NODE_CACHE_ENTRIES 16
 #define BTRFS_MAX_CHUNK_ENTRIES 256
+#define BTRFS_MAX_STRIPES 8	/* Per chunk map item */
+#define BTRFS_MAX_MIRRORS 4	/* Copies of any one block (RAID1C4) */
+#define BTRFS_MAX_DEVICES 16
+
+/* Read this much from each member device to rank them by speed */
+#define BTRFS_PROBE_CHUNK	(64 * 1024)
+#define BTRFS_PROBE_BYTES	(1024 * 1024)
+#define BTRFS_PROBE_MS		20
 
 #define BTRFS_FT_REG_FILE	1
 #define BTRFS_FT_DIR		2
@@ -191,11 +222,19 @@ struct btrfs_path {
 };
 
 /* store logical offset to physical offset mapping */
+struct btrfs_map_stripe {
+	u64 devid;
+	u64 physical;
+};
+
 struct btrfs_chunk_map_item {
 	u64 logical;
 	u64 length;
-	u64 devid;
-	u64 physical;
+	u64 type;		/* BTRFS_BLOCK_GROUP_* */
+	u32 stripe_shift;	/* log2 of the stripe length */
+	u16 num_stripes;
+	u16 sub_stripes;
+	struct btrfs_map_stripe stripes[BTRFS_MAX_STRIPES];
 };
 
 struct btrfs_chunk_map {
@@ -204,6 +243,19 @@ struct btrfs_chunk_map {
 	u32 cur_length;
 };
 
+/* A member device of the filesystem, found among the BIOS drives */
+struct btrfs_device {
+	u64 devid;
+	struct disk *disk;
+	u32 speed;		/* Measured read rate, bytes/ms; 0 after errors */
+};
+
+/* One copy of a logical range: where it is and on which device */
+struct btrfs_io {
+	struct btrfs_device *dev;
+	u64 physical;
+};
+
 struct btrfs_timespec {
 	__le64 sec;
 	__le32 nsec;
@@ -285,6 +337,17 @@ struct btrfs_root_ref {
  */
 struct btrfs_pvt_inode {
     uint64_t offset;
+
+    /* The file extent item last looked up by btrfs_getfssec() */
+    struct btrfs_file_extent_item ext;
+    uint64_t ext_start, ext_end;	/* File range it covers */
+    uint64_t ext_addr;		/* Logical address of its data */
+    uint32_t ext_len;		/* Size of its data on disk */
+
+    /* Decompressed (or inline) extent data, if any */
+    char *zbuf;
+    uint32_t zbuf_size;		/* Allocated size of zbuf */
+    uint64_t zaddr;		/* ext_addr of the data in zbuf, 0 if none */
 };
 
 #define PVT(i) ((struct btrfs_pvt_inode *)((i)->pvt))
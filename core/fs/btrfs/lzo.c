@@ -0,0 +1,5 @@
+/*
+ * The LZO1X decompressor from the in-tree copy of LZO (also used by
+ * prepcore), for LZO-compressed btrfs extents.
+ */
+#include "../../../lzo/src/lzo1x_d2.c"
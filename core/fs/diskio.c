@@ -298,11 +298,10 @@ void getoneblk(struct disk *disk, char *buf, block_t block, int block_size)
 }
 
 
-struct disk *disk_init(uint8_t devno, bool cdrom, sector_t part_start,
-                       uint16_t bsHeads, uint16_t bsSecPerTrack,
-		       uint32_t MaxTransfer)
+static void disk_setup(struct disk *disk, uint8_t devno, bool cdrom,
+		       sector_t part_start, uint16_t bsHeads,
+		       uint16_t bsSecPerTrack, uint32_t MaxTransfer)
 {
-    static struct disk disk;
     static __lowmem struct edd_disk_params edd_params;
     com32sys_t ireg, oreg;
     bool ebios;
@@ -326,8 +325,8 @@ struct disk *disk_init(uint8_t devno, bool cdrom, sector_t part_start,
 	hard_max_transfer = 63;
 
 	/* CBIOS parameters */
-	disk.h = bsHeads;
-	disk.s = bsSecPerTrack;
+	disk->h = bsHeads;
+	disk->s = bsSecPerTrack;
 
 	if ((int8_t)devno < 0) {
 	    /* Get hard disk geometry from BIOS */
@@ -336,8 +335,8 @@ struct disk *disk_init(uint8_t devno, bool cdrom, sector_t part_start,
 	    __intcall(0x13, &ireg, &oreg);
 	    
 	    if (!(oreg.eflags.l & EFLAGS_CF)) {
-		disk.h = oreg.edx.b[1] + 1;
-		disk.s = oreg.ecx.b[0] & 63;
+		disk->h = oreg.edx.b[1] + 1;
+		disk->s = oreg.ecx.b[0] & 63;
 	    }
 	}
 
@@ -354,9 +353,7 @@ struct disk *disk_init(uint8_t devno, bool cdrom, sector_t part_start,
 	    hard_max_transfer = 127;
 
 	    /* Query EBIOS parameters */
-	    /* The memset() is needed once this function can be called
-	       more than once */
-	    /* memset(&edd_params, 0, sizeof edd_params);  */
+	    memset(&edd_params, 0, sizeof edd_params);
 	    edd_params.len = sizeof edd_params;
 
 	    ireg.eax.b[1] = 0x48;
@@ -377,25 +374,51 @@ struct disk *disk_init(uint8_t devno, bool cdrom, sector_t part_start,
 
     }
 
-    disk.disk_number   = devno;
-    disk.sector_size   = sector_size;
-    disk.sector_shift  = ilog2(sector_size);
-    disk.part_start    = part_start;
-    disk.secpercyl     = disk.h * disk.s;
-    disk.rdwr_sectors  = ebios ? edd_rdwr_sectors : chs_rdwr_sectors;
+    disk->disk_number   = devno;
+    disk->sector_size   = sector_size;
+    disk->sector_shift  = ilog2(sector_size);
+    disk->part_start    = part_start;
+    disk->secpercyl     = disk->h * disk->s;
+    disk->rdwr_sectors  = ebios ? edd_rdwr_sectors : chs_rdwr_sectors;
 
     if (!MaxTransfer || MaxTransfer > hard_max_transfer)
 	MaxTransfer = hard_max_transfer;
 
-    disk.maxtransfer   = MaxTransfer;
+    disk->maxtransfer   = MaxTransfer;
 
     dprintf("disk %02x cdrom %d type %d sector %u/%u offset %llu limit %u\n",
-	    devno, cdrom, ebios, sector_size, disk.sector_shift,
-	    part_start, disk.maxtransfer);
+	    devno, cdrom, ebios, sector_size, disk->sector_shift,
+	    part_start, disk->maxtransfer);
+}
+
+struct disk *disk_init(uint8_t devno, bool cdrom, sector_t part_start,
+                       uint16_t bsHeads, uint16_t bsSecPerTrack,
+		       uint32_t MaxTransfer)
+{
+    static struct disk disk;
 
+    disk_setup(&disk, devno, cdrom, part_start,
+	       bsHeads, bsSecPerTrack, MaxTransfer);
     return &disk;
 }
 
+/*
+ * Set up another BIOS hard disk besides the one we booted from, e.g. a
+ * further member of a multi-device filesystem.  The geometry comes
+ * from the BIOS.  Returns NULL if out of memory.
+ */
+struct disk *disk_open(uint8_t devno, sector_t part_start)
+{
+    struct disk *disk;
+
+    disk = zalloc(sizeof *disk);
+    if (!disk)
+	return NULL;
+
+    disk_setup(disk, devno, false, part_start, 0, 0, 0);
+    return disk;
+}
+
 
 /*
  * Initialize the device structure.
@@ -12,71 +12,151 @@
 #include <cache.h>
 #include "ext2_fs.h"
 
+/*
+ * Binary search for the last index entry starting at or before block
+ */
+static int ext4_find_index(const struct ext4_extent_idx *index, int entries,
+			   uint32_t block)
+{
+    int lo = 0, hi = entries, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) >> 1;
+	if (index[mid].ei_block <= block)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo - 1;
+}
+
+/*
+ * Binary search for the last extent starting at or before block
+ */
+static int ext4_find_extent(const struct ext4_extent *ext, int entries,
+			    uint32_t block)
+{
+    int lo = 0, hi = entries, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) >> 1;
+	if (ext[mid].ee_block <= block)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo - 1;
+}
+
+/*
+ * Find the leaf responsible for block, starting from the cursor left
+ * by the previous lookup if it covers the block.  The leaf is not
+ * locked in the cache: inodes are freed without telling the
+ * filesystem, so the cursor only remembers where the leaf lives.
+ * *end is set to the last logical block the leaf is responsible for.
+ */
 static const struct ext4_extent_header *
-ext4_find_leaf(struct fs_info *fs, const struct ext4_extent_header *eh,
-	       block_t block)
+ext4_find_leaf(struct inode *inode, uint32_t block, uint32_t *end)
 {
-    struct ext4_extent_idx *index;
-    block_t blk;
+    struct fs_info *fs = inode->fs;
+    struct ext2_pvt_inode *pvt = PVT(inode);
+    const struct ext4_extent_header *eh;
+    const struct ext4_extent_idx *index;
+    uint32_t start = 0;
+    block_t blk = 0;
     int i;
 
+    *end = 0xffffffff;
+
+    if (pvt->i_leaf_block &&
+	block >= pvt->i_leaf_start && block <= pvt->i_leaf_end) {
+	eh = get_cache(fs->fs_dev, pvt->i_leaf_block);
+	if (eh->eh_magic == EXT4_EXT_MAGIC && eh->eh_depth == 0) {
+	    *end = pvt->i_leaf_end;
+	    return eh;
+	}
+    }
+
+    eh = &pvt->i_extent_hdr;
     while (1) {
 	if (eh->eh_magic != EXT4_EXT_MAGIC)
 	    return NULL;
 	if (eh->eh_depth == 0)
-	    return eh;
+	    break;
 
 	index = EXT4_FIRST_INDEX(eh);
-	for (i = 0; i < (int)eh->eh_entries; i++) {
-	    if (block < index[i].ei_block)
-		break;
-	}
-	if (--i < 0)
+	i = ext4_find_index(index, eh->eh_entries, block);
+	if (i < 0)
 	    return NULL;
 
+	/* Narrow the range this subtree is responsible for */
+	if (index[i].ei_block > start)
+	    start = index[i].ei_block;
+	if (i + 1 < (int)eh->eh_entries && index[i+1].ei_block - 1 < *end)
+	    *end = index[i+1].ei_block - 1;
+
 	blk = index[i].ei_leaf_hi;
 	blk = (blk << 32) + index[i].ei_leaf_lo;
 	eh = get_cache(fs->fs_dev, blk);
     }
+
+    if (blk) {
+	pvt->i_leaf_block = blk;
+	pvt->i_leaf_start = start;
+	pvt->i_leaf_end   = *end;
+    }
+    return eh;
 }
 
-/* handle the ext4 extents to get the phsical block number */
-/* XXX: still need to handle sparse files with extents */
+/*
+ * Handle the ext4 extents to get the physical block number.  Holes and
+ * uninitialized extents map to block 0, which reads as zeroes.
+ */
 static block_t
 bmap_extent(struct inode *inode, uint32_t block, size_t *nblocks)
 {
     struct fs_info *fs = inode->fs;
     const struct ext4_extent_header *leaf;
     const struct ext4_extent *ext;
+    uint32_t end, len, offset, eof;
     int i;
     block_t start;
 
-    leaf = ext4_find_leaf(fs, &PVT(inode)->i_extent_hdr, block);
+    leaf = ext4_find_leaf(inode, block, &end);
     if (!leaf) {
 	printf("ERROR, extent leaf not found\n");
 	return 0;
     }
 
     ext = EXT4_FIRST_EXTENT(leaf);
-    for (i = 0; i < leaf->eh_entries; i++) {
-	if (block < ext[i].ee_block)
-	    break;
-    }
-    if (--i < 0) {
-	printf("ERROR, not find the right block\n");
-	return 0;
-    }
-
-    /* got it */
-    block -= ext[i].ee_block;
-    if (block >= ext[i].ee_len)
-	return 0;
-    start = ((block_t)ext[i].ee_start_hi << 32) + ext[i].ee_start_lo;
+    i = ext4_find_extent(ext, leaf->eh_entries, block);
+    if (i >= 0) {
+	len = ext[i].ee_len;
+	if (len > EXT4_INIT_MAX_LEN)
+	    len -= EXT4_INIT_MAX_LEN;
+	offset = block - ext[i].ee_block;
+
+	if (offset < len) {
+	    if (nblocks)
+		*nblocks = len - offset;
+	    if (ext[i].ee_len > EXT4_INIT_MAX_LEN)
+		return 0;	/* Uninitialized */
 
-    if (nblocks)
-	*nblocks = ext[i].ee_len - block;
+	    start = ((block_t)ext[i].ee_start_hi << 32) + ext[i].ee_start_lo;
+	    return start + offset;
+	}
+    }
 
-    return start + block;
+    /* A hole, running up to the next extent (or the end of the file) */
+    if (nblocks) {
+	if (i + 1 < (int)leaf->eh_entries)
+	    end = ext[i+1].ee_block - 1;
+	eof = (inode->size + BLOCK_SIZE(fs) - 1) >> BLOCK_SHIFT(fs);
+	if (eof && end > eof - 1)
+	    end = eof - 1;
+	*nblocks = (end >= block) ? end - block + 1 : 1;
+    }
+    return 0;
 }
 
 /*
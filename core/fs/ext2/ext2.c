@@ -86,33 +86,191 @@ ext2_get_cache(struct inode *inode, block_t lblock)
 }
 
 /*
- * find a dir entry, return it if found, or return NULL.
+ * Search one directory block for an entry; len is the number of valid
+ * bytes in the block.
  */
 static const struct ext2_dir_entry *
-ext2_find_entry(struct fs_info *fs, struct inode *inode, const char *dname)
+ext2_find_in_block(struct inode *inode, block_t index, uint32_t len,
+		   const char *dname, size_t dname_len)
 {
-    block_t index = 0;
-    uint32_t i = 0, offset, maxoffset;
     const struct ext2_dir_entry *de;
     const char *data;
-    size_t dname_len = strlen(dname);
+    uint32_t offset = 0;
 
-    while (i < inode->size) {
-	data = ext2_get_cache(inode, index++);
-	offset = 0;
-	maxoffset =  min(BLOCK_SIZE(fs), i-inode->size);
+    data = ext2_get_cache(inode, index);
 
-	/* The smallest possible size is 9 bytes */
-	while (offset < maxoffset-8) {
-	    de = (const struct ext2_dir_entry *)(data + offset);
-	    if (de->d_rec_len > maxoffset - offset)
-		break;
+    /* The smallest possible size is 9 bytes */
+    while (offset + 8 < len) {
+	de = (const struct ext2_dir_entry *)(data + offset);
+	if (!de->d_rec_len || de->d_rec_len > len - offset)
+	    break;
 
-	    if (ext2_match_entry(dname, dname_len, de))
-		return de;
+	if (ext2_match_entry(dname, dname_len, de))
+	    return de;
 
-	    offset += de->d_rec_len;
+	offset += de->d_rec_len;
+    }
+
+    return NULL;
+}
+
+/*
+ * One level of an htree lookup path.  Only block numbers and indices
+ * are kept, since cached block data may be evicted by later reads.
+ */
+struct ext2_dx_frame {
+    block_t block;		/* Logical block of this index node */
+    uint32_t offset;		/* Offset of the index entries */
+    uint32_t count;		/* Number of index entries */
+    uint32_t at;		/* Entry being followed */
+};
+
+static const struct ext2_dx_entry *
+ext2_dx_entries(struct inode *inode, const struct ext2_dx_frame *frame)
+{
+    const char *data = ext2_get_cache(inode, frame->block);
+    return (const struct ext2_dx_entry *)(data + frame->offset);
+}
+
+/*
+ * Read the count of an index node, and find the entry covering hash
+ */
+static bool ext2_dx_probe(struct inode *inode, struct ext2_dx_frame *frame,
+			  uint32_t hash)
+{
+    const struct ext2_dx_entry *entries = ext2_dx_entries(inode, frame);
+    const struct ext2_dx_countlimit *cl = (const void *)entries;
+    uint32_t lo, hi, mid;
+
+    if (!cl->count || cl->count > cl->limit ||
+	frame->offset + cl->limit * sizeof *entries > BLOCK_SIZE(inode->fs))
+	return false;
+    frame->count = cl->count;
+
+    /* Find the last entry whose hash is <= ours; entry 0 has none */
+    lo = 1;
+    hi = cl->count;
+    while (lo < hi) {
+	mid = (lo + hi) >> 1;
+	if (entries[mid].hash > hash)
+	    hi = mid;
+	else
+	    lo = mid + 1;
+    }
+    frame->at = lo - 1;
+
+    return true;
+}
+
+/*
+ * Hashed lookup in an htree directory.  Only the leaf block(s) whose
+ * hash range covers the name are searched.  Sets *fallback if the
+ * index can't be used, in which case the caller should scan linearly.
+ */
+static const struct ext2_dir_entry *
+ext2_dx_find_entry(struct inode *inode, const char *dname, size_t dname_len,
+		   bool *fallback)
+{
+    struct ext2_sb_info *sbi = EXT2_SB(inode->fs);
+    struct ext2_dx_frame frames[EXT2_HTREE_LEVELS], *frame, *p;
+    const struct ext2_dx_root_info *info;
+    const struct ext2_dir_entry *de;
+    const struct ext2_dx_entry *entries;
+    uint32_t hash, block;
+    int version, levels;
+
+    *fallback = true;
+
+    info = (const struct ext2_dx_root_info *)
+	((const char *)ext2_get_cache(inode, 0) + EXT2_DX_ROOT_INFO_OFFSET);
+    if (info->reserved_zero || info->info_length < sizeof *info ||
+	info->indirect_levels >= EXT2_HTREE_LEVELS)
+	return NULL;
+
+    version = info->hash_version;
+    if (version <= EXT2_HASH_TEA)
+	version += sbi->s_hash_unsigned;
+    hash = ext2_dirhash(dname, dname_len, version, sbi->s_hash_seed);
+    if (hash == EXT2_HTREE_BAD_HASH)
+	return NULL;
+    levels = info->indirect_levels;
+
+    /* Walk down the index to the bottom level */
+    frame = frames;
+    frame->block = 0;
+    frame->offset = EXT2_DX_ROOT_INFO_OFFSET + info->info_length;
+    for (;;) {
+	if (!ext2_dx_probe(inode, frame, hash))
+	    return NULL;
+	if (frame == &frames[levels])
+	    break;
+	entries = ext2_dx_entries(inode, frame);
+	block = entries[frame->at].block & EXT2_DX_BLOCK_MASK;
+	frame++;
+	frame->block = block;
+	frame->offset = EXT2_DX_NODE_OFFSET;
+    }
+
+    *fallback = false;
+
+    for (;;) {
+	entries = ext2_dx_entries(inode, frame);
+	block = entries[frame->at].block & EXT2_DX_BLOCK_MASK;
+	de = ext2_find_in_block(inode, block, BLOCK_SIZE(inode->fs),
+				dname, dname_len);
+	if (de)
+	    return de;
+
+	/*
+	 * Names with colliding hashes may spill into the next leaf,
+	 * which is then marked by the low bit of its index hash.
+	 */
+	for (p = frame; ++p->at >= p->count; p--) {
+	    if (p == frames)
+		return NULL;
 	}
+	entries = ext2_dx_entries(inode, p);
+	if ((entries[p->at].hash & ~1) != hash)
+	    return NULL;
+
+	/* Descend to the first leaf below the new index entry */
+	while (p < frame) {
+	    entries = ext2_dx_entries(inode, p);
+	    block = entries[p->at].block & EXT2_DX_BLOCK_MASK;
+	    p++;
+	    p->block = block;
+	    p->offset = EXT2_DX_NODE_OFFSET;
+	    if (!ext2_dx_probe(inode, p, 0))
+		return NULL;
+	}
+    }
+}
+
+/*
+ * find a dir entry, return it if found, or return NULL.
+ */
+static const struct ext2_dir_entry *
+ext2_find_entry(struct fs_info *fs, struct inode *inode, const char *dname)
+{
+    block_t index = 0;
+    uint32_t i = 0;
+    const struct ext2_dir_entry *de;
+    size_t dname_len = strlen(dname);
+    bool fallback;
+
+    if (inode->flags & EXT2_INDEX_FL) {
+	de = ext2_dx_find_entry(inode, dname, dname_len, &fallback);
+	if (!fallback)
+	    return de;
+	dprintf("ext2: bad htree index, falling back to linear scan\n");
+    }
+
+    while (i < inode->size) {
+	de = ext2_find_in_block(inode, index++,
+				min(BLOCK_SIZE(fs), inode->size - i),
+				dname, dname_len);
+	if (de)
+	    return de;
 	i += BLOCK_SIZE(fs);
     }
 
@@ -148,6 +306,8 @@ static void fill_inode(struct inode *inode, const struct ext2_inode *e_inode)
 {
     inode->mode    = IFTODT(e_inode->i_mode);
     inode->size    = e_inode->i_size;
+    if (inode->mode == DT_REG)	/* i_size_high is i_dir_acl on a directory */
+	inode->size |= (uint64_t)e_inode->i_size_high << 32;
     inode->atime   = e_inode->i_atime;
     inode->ctime   = e_inode->i_ctime;
     inode->mtime   = e_inode->i_mtime;
@@ -311,6 +471,9 @@ static int ext2_fs_init(struct fs_info *fs)
 	                      / EXT2_BLOCKS_PER_GROUP(fs);
     sbi->s_first_data_block = sb.s_first_data_block;
     sbi->s_inode_size = sb.s_inode_size;
+    memcpy(sbi->s_hash_seed, sb.s_hash_seed, sizeof sbi->s_hash_seed);
+    sbi->s_hash_unsigned = (sb.s_flags & EXT2_FLAGS_UNSIGNED_HASH) ?
+	EXT2_HASH_LEGACY_UNSIGNED : 0;
 
     /* Initialize the cache, and force block zero to all zero */
     cache_init(fs->fs_dev, fs->block_shift);
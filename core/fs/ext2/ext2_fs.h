@@ -35,6 +35,26 @@
 /* for EXT4 extent */
 #define EXT4_EXT_MAGIC     0xf30a
 #define EXT4_EXTENTS_FLAG  0x00080000
+#define EXT4_INIT_MAX_LEN  (1 << 15)	/* Longer extents are uninitialized */
+
+/* for htree (hash-indexed) directories */
+#define EXT2_INDEX_FL		0x00001000
+
+/* s_flags: how chars were treated when the htree hashes were built */
+#define EXT2_FLAGS_SIGNED_HASH		0x0001
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+
+/* htree hash versions */
+#define EXT2_HASH_LEGACY		0
+#define EXT2_HASH_HALF_MD4		1
+#define EXT2_HASH_TEA			2
+#define EXT2_HASH_LEGACY_UNSIGNED	3
+#define EXT2_HASH_HALF_MD4_UNSIGNED	4
+#define EXT2_HASH_TEA_UNSIGNED		5
+
+#define EXT2_HTREE_EOF		0x7fffffff
+#define EXT2_HTREE_BAD_HASH	1	/* Real hashes are always even */
+#define EXT2_HTREE_LEVELS	3	/* Including the root */
 
 /*
  * File types and file modes
@@ -188,7 +208,7 @@ struct ext2_inode {
     uint32_t i_block[EXT2_N_BLOCKS];	/* 40: Pointers to blocks */
     uint32_t i_version;		/* File version (for NFS) */
     uint32_t i_file_acl;	/* File ACL */
-    uint32_t i_dir_acl;		/* Directory ACL */
+    uint32_t i_size_high;	/* High 32 bits of a file's size */
     uint32_t i_faddr;		/* Fragment address */
     uint8_t  l_i_frag;	        /* Fragment number */
     uint8_t  l_i_fsize;	        /* Fragment size */
@@ -226,6 +246,36 @@ struct ext2_dir_entry {
 
 
 
+/*
+ * htree directory index structures.  Block 0 of an indexed directory
+ * holds the "." and ".." entries, followed by ext2_dx_root_info and
+ * then the index entries; interior nodes hold a single empty
+ * directory entry spanning the block, followed by the index entries.
+ * In each case the first index entry's hash field is replaced by an
+ * ext2_dx_countlimit, and the entry covers all hashes below the next.
+ */
+struct ext2_dx_root_info {
+    uint32_t reserved_zero;
+    uint8_t  hash_version;
+    uint8_t  info_length;	/* 8 */
+    uint8_t  indirect_levels;
+    uint8_t  unused_flags;
+};
+
+struct ext2_dx_countlimit {
+    uint16_t limit;
+    uint16_t count;
+};
+
+struct ext2_dx_entry {
+    uint32_t hash;
+    uint32_t block;
+};
+
+#define EXT2_DX_ROOT_INFO_OFFSET	24
+#define EXT2_DX_NODE_OFFSET		8
+#define EXT2_DX_BLOCK_MASK		0x0fffffff
+
 /*
  * This is the extent on-disk structure.
  * It's used at the bottom of the tree.
@@ -277,6 +327,8 @@ struct ext2_sb_info {
     uint32_t s_groups_count;    /* Number of groups in the fs */
     uint32_t s_first_data_block;	/* First Data Block */
     int      s_inode_size;
+    uint32_t s_hash_seed[4];	/* htree hash seed */
+    int      s_hash_unsigned;	/* 3 if hash should use unsigned chars */
 };
 
 static inline struct ext2_sb_info *EXT2_SB(struct fs_info *fs)
@@ -297,6 +349,14 @@ struct ext2_pvt_inode {
 	uint32_t i_block[EXT2_N_BLOCKS];
 	struct ext4_extent_header i_extent_hdr;
     };
+
+    /*
+     * Extent tree cursor: the last leaf block found by walking the
+     * index, and the range of logical blocks it is responsible for.
+     */
+    block_t  i_leaf_block;	/* 0 if none */
+    uint32_t i_leaf_start;
+    uint32_t i_leaf_end;	/* Inclusive */
 };
 
 #define PVT(i) ((struct ext2_pvt_inode *)((i)->pvt))
@@ -306,5 +366,6 @@ struct ext2_pvt_inode {
  */
 block_t ext2_bmap(struct inode *, block_t, size_t *);
 int ext2_next_extent(struct inode *, uint32_t);
+uint32_t ext2_dirhash(const char *, int, int, const uint32_t *);
 
 #endif /* ext2_fs.h */
@@ -83,59 +83,174 @@ static uint32_t get_next_cluster(struct fs_info *fs, uint32_t clust_num)
     return next_cluster;
 }
 
-static int fat_next_extent(struct inode *inode, uint32_t lstart)
+/*
+ * Count the clusters physically contiguous with pcluster, up to max.
+ * The cluster which follows the run in the chain is stored in *next.
+ *
+ * For FAT16 and FAT32 whole FAT sectors are scanned at a time, so a
+ * long contiguous file costs one cache lookup per FAT sector rather
+ * than one per cluster.
+ */
+static uint32_t fat_run_length(struct fs_info *fs, uint32_t pcluster,
+			       uint32_t max, uint32_t *next)
 {
-    struct fs_info *fs = inode->fs;
     struct fat_sb_info *sbi = FAT_SB(fs);
-    uint32_t mcluster = lstart >> sbi->clust_shift;
-    uint32_t lcluster;
-    uint32_t pcluster;
-    uint32_t tcluster;
-    uint32_t xcluster;
-    const uint32_t cluster_bytes = UINT32_C(1) << sbi->clust_byte_shift;
-    const uint32_t cluster_secs  = UINT32_C(1) << sbi->clust_shift;
-    sector_t data_area = sbi->data;
+    uint32_t sector_mask = SECTOR_SIZE(fs) - 1;
+    uint32_t len = 1;
+    uint32_t cluster, offset, index, n, m;
+    const uint8_t *data;
+    int shift;
 
-    tcluster = (inode->size + cluster_bytes - 1) >> sbi->clust_byte_shift;
-    if (mcluster >= tcluster)
-	goto err;		/* Requested cluster beyond end of file */
+    /* Never run off the end of the volume, even if the FAT says so */
+    if (max > sbi->clusters + 2 - pcluster)
+	max = sbi->clusters + 2 - pcluster;
+
+    switch (sbi->fat_type) {
+    case FAT12:
+	/* Entries straddle sectors; not worth a bulk scan */
+	while (len < max &&
+	       get_next_cluster(fs, pcluster + len - 1) == pcluster + len)
+	    len++;
+	break;
+
+    case FAT16:
+    case FAT32:
+	shift = (sbi->fat_type == FAT32) ? 2 : 1;
+	while (len < max) {
+	    cluster = pcluster + len - 1;
+	    offset = cluster << shift;
+	    data = get_fat_sector(fs, offset >> SECTOR_SHIFT(fs));
+	    index = (offset & sector_mask) >> shift;
+	    n = (SECTOR_SIZE(fs) >> shift) - index;
+	    if (n > max - len)
+		n = max - len;
+
+	    if (shift == 2)
+		m = fat32_scan_run((const uint32_t *)data + index, n,
+				   cluster + 1);
+	    else
+		m = fat16_scan_run((const uint16_t *)data + index, n,
+				   cluster + 1);
+
+	    len += m;
+	    if (m < n)
+		break;		/* Not contiguous */
+	}
+	break;
+    }
 
-    lcluster = PVT(inode)->offset >> sbi->clust_shift;
-    pcluster = ((PVT(inode)->here - data_area) >> sbi->clust_shift) + 2;
+    *next = get_next_cluster(fs, pcluster + len - 1);
+    return len;
+}
 
-    if (lcluster > mcluster || PVT(inode)->here < data_area) {
+/*
+ * Append a run to the inode's run table, growing it as needed
+ */
+static struct fat_run *fat_add_run(struct inode *inode, uint32_t lcluster,
+				   uint32_t pcluster, uint32_t len)
+{
+    struct fat_pvt_inode *pvt = PVT(inode);
+    struct fat_run *runs;
+    int maxruns;
+
+    if (pvt->nruns == pvt->maxruns) {
+	maxruns = pvt->maxruns ? pvt->maxruns << 1 : FAT_MIN_RUNS;
+	runs = malloc(maxruns * sizeof *runs);
+	if (!runs)
+	    malloc_error("FAT run table");
+	if (pvt->runs) {
+	    memcpy(runs, pvt->runs, pvt->nruns * sizeof *runs);
+	    free(pvt->runs);
+	}
+	pvt->runs = runs;
+	pvt->maxruns = maxruns;
+    }
+
+    runs = &pvt->runs[pvt->nruns++];
+    runs->lcluster = lcluster;
+    runs->pcluster = pcluster;
+    runs->len      = len;
+    return runs;
+}
+
+/*
+ * Find the run containing logical cluster mcluster, which must be
+ * below tcluster (the cluster count of the file).  The runs already
+ * mapped are binary searched; otherwise the chain is followed from the
+ * end of the last run, one run at a time, until mcluster is covered.
+ */
+static struct fat_run *fat_find_run(struct inode *inode, uint32_t mcluster,
+				    uint32_t tcluster)
+{
+    struct fs_info *fs = inode->fs;
+    struct fat_sb_info *sbi = FAT_SB(fs);
+    struct fat_pvt_inode *pvt = PVT(inode);
+    struct fat_run *run;
+    uint32_t lcluster, pcluster, len;
+    int lo, hi, mid;
+
+    if (pvt->nruns) {
+	run = &pvt->runs[pvt->nruns - 1];
+	lcluster = run->lcluster + run->len;
+	if (mcluster < lcluster) {
+	    lo = 0;
+	    hi = pvt->nruns - 1;
+	    while (lo < hi) {
+		mid = (lo + hi + 1) >> 1;
+		if (pvt->runs[mid].lcluster <= mcluster)
+		    lo = mid;
+		else
+		    hi = mid - 1;
+	    }
+	    return &pvt->runs[lo];
+	}
+	pcluster = pvt->run_next;
+    } else {
 	lcluster = 0;
-	pcluster = PVT(inode)->start_cluster;
+	pcluster = pvt->start_cluster;
     }
 
-    for (;;) {
+    do {
 	if (pcluster-2 >= sbi->clusters) {
-	    inode->size = lcluster << sbi->clust_shift;
-	    goto err;
+	    /* Chain ends before the file does */
+	    inode->size = lcluster << sbi->clust_byte_shift;
+	    return NULL;
 	}
 
-	if (lcluster >= mcluster)
-	    break;
+	len = fat_run_length(fs, pcluster, tcluster - lcluster,
+			     &pvt->run_next);
+	run = fat_add_run(inode, lcluster, pcluster, len);
+	lcluster += len;
+	pcluster = pvt->run_next;
+    } while (lcluster <= mcluster);
 
-	lcluster++;
-	pcluster = get_next_cluster(fs, pcluster);
-    }
+    return run;
+}
 
-    inode->next_extent.pstart =
-	((sector_t)(pcluster-2) << sbi->clust_shift) + data_area;
-    inode->next_extent.len = cluster_secs;
-    xcluster = 0;		/* Nonsense */
-
-    while (++lcluster < tcluster) {
-	xcluster = get_next_cluster(fs, pcluster);
-	if (xcluster != ++pcluster)
-	    break;		/* Not contiguous */
-	inode->next_extent.len += cluster_secs;
-    }
+static int fat_next_extent(struct inode *inode, uint32_t lstart)
+{
+    struct fs_info *fs = inode->fs;
+    struct fat_sb_info *sbi = FAT_SB(fs);
+    uint32_t mcluster = lstart >> sbi->clust_shift;
+    uint32_t tcluster;
+    uint32_t offset;
+    const uint32_t cluster_bytes = UINT32_C(1) << sbi->clust_byte_shift;
+    const struct fat_run *run;
 
-    /* Note: ->here is bogus if ->offset >= EOF, but that's okay */
-    PVT(inode)->offset = lcluster << sbi->clust_shift;
-    PVT(inode)->here   = ((xcluster-2) << sbi->clust_shift) + data_area;
+    tcluster = (inode->size + cluster_bytes - 1) >> sbi->clust_byte_shift;
+    if (mcluster >= tcluster)
+	goto err;		/* Requested cluster beyond end of file */
+
+    run = fat_find_run(inode, mcluster, tcluster);
+    if (!run)
+	goto err;
+
+    offset = mcluster - run->lcluster;
+    inode->next_extent.pstart =
+	((sector_t)(run->pcluster + offset - 2) << sbi->clust_shift)
+	+ sbi->data + (lstart & sbi->clust_mask);
+    inode->next_extent.len =
+	((run->len - offset) << sbi->clust_shift) - (lstart & sbi->clust_mask);
 
     return 0;
 
@@ -433,18 +548,21 @@ static inline enum dirent_type get_inode_mode(uint8_t attr)
 }
 
 
-static struct inode *vfat_find_entry(const char *dname, struct inode *dir)
+/*
+ * Look for dname in up to count entries of a directory, starting at
+ * entry number "entry" of dir_sector; a negative count means up to the
+ * end of the directory.  Returns the matching short entry, or NULL.
+ */
+static const struct fat_dir_entry *
+vfat_match_entry(struct fs_info *fs, const char *dname,
+		 const char *mangled_name, sector_t dir_sector,
+		 int entry, int count)
 {
-    struct fs_info *fs = dir->fs;
-    struct inode *inode;
     const struct fat_dir_entry *de;
-    struct fat_long_name_entry *long_de;
-
-    char mangled_name[12];
+    const struct fat_long_name_entry *long_de;
     uint16_t long_name[260];	/* == 20*13 */
     int long_len;
 
-    sector_t dir_sector = PVT(dir)->start;
     uint8_t vfat_init, vfat_next, vfat_csum = 0;
     uint8_t id;
     int slots;
@@ -453,21 +571,20 @@ static struct inode *vfat_find_entry(const char *dname, struct inode *dir)
     int long_match = 0;
 
     slots = (strlen(dname) + 12) / 13;
-    if (slots > 20)
-	return NULL;		/* Name too long */
-
     slots |= 0x40;
     vfat_init = vfat_next = slots;
     long_len = slots*13;
 
-    /* Produce the shortname version, in case we need it. */
-    mangle_dos_name(mangled_name, dname);
-
     while (dir_sector) {
 	de = get_cache(fs->fs_dev, dir_sector);
-	entries = 1 << (fs->sector_shift - 5);
+	entries = (1 << (fs->sector_shift - 5)) - entry;
+	de += entry;
+	entry = 0;
 
 	while (entries--) {
+	    if (!count--)
+		return NULL;
+
 	    if (de->name[0] == 0)
 		return NULL;
 
@@ -475,7 +592,7 @@ static struct inode *vfat_find_entry(const char *dname, struct inode *dir)
 		/*
 		 * It's a long name entry.
 		 */
-		long_de = (struct fat_long_name_entry *)de;
+		long_de = (const struct fat_long_name_entry *)de;
 		id = long_de->id;
 		if (id != vfat_next)
 		    goto not_match;
@@ -523,10 +640,10 @@ static struct inode *vfat_find_entry(const char *dname, struct inode *dir)
 		     */
 		    checksum = get_checksum(de->name);
 		    if (checksum == vfat_csum)
-			goto found;  /* Got it */
+			return de;  /* Got it */
 		} else {
 		    if (!memcmp(mangled_name, de->name, 11))
-			goto found;
+			return de;
 		}
 	    }
 
@@ -541,8 +658,302 @@ static struct inode *vfat_find_entry(const char *dname, struct inode *dir)
 	dir_sector = get_next_sector(fs, dir_sector);
     }
     return NULL;		/* Nothing found... */
+}
+
+/*
+ * FNV-1a, folding ASCII letters to upper case
+ */
+static inline uint32_t vfat_hash_char(uint32_t hash, unsigned int c)
+{
+    if (c >= 'a' && c <= 'z')
+	c -= 'a' - 'A';
+    return (hash ^ c) * 16777619;
+}
+
+#define VFAT_HASH_INIT	2166136261U
+
+static uint32_t vfat_hash_short(const char *name)
+{
+    uint32_t hash = VFAT_HASH_INIT;
+    int i;
+
+    for (i = 0; i < 11; i++)
+	hash = (hash ^ (uint8_t)name[i]) * 16777619;
+    return hash;
+}
+
+/*
+ * Hash a long name.  Names outside ASCII can match more than one
+ * spelling through the codepage tables, so they are not hashed;
+ * for those, return false and store the length instead.
+ */
+static bool vfat_hash_longname(const uint16_t *long_name, uint32_t *hash)
+{
+    const uint16_t *p;
+    uint32_t h = VFAT_HASH_INIT;
+    bool ascii = true;
+
+    for (p = long_name; *p; p++) {
+	if (*p >= 0x80)
+	    ascii = false;
+	h = vfat_hash_char(h, *p);
+    }
+
+    *hash = ascii ? h : (uint32_t)(p - long_name);
+    return ascii;
+}
+
+static struct fat_dir_slot *vfat_index_add(struct fat_dir_index *dx)
+{
+    struct fat_dir_slot *slots;
+    int maxslots;
+
+    if (dx->nslots == dx->maxslots) {
+	maxslots = dx->maxslots ? dx->maxslots << 1 : FAT_MIN_SLOTS;
+	slots = malloc(maxslots * sizeof *slots);
+	if (!slots)
+	    malloc_error("FAT directory index");
+	if (dx->slots) {
+	    memcpy(slots, dx->slots, dx->nslots * sizeof *slots);
+	    free(dx->slots);
+	}
+	dx->slots = slots;
+	dx->maxslots = maxslots;
+    }
+
+    return &dx->slots[dx->nslots++];
+}
+
+/*
+ * Read a whole directory once and index every entry set in it by the
+ * hashes of its long and short names.
+ */
+static struct fat_dir_index *vfat_build_index(struct inode *dir)
+{
+    struct fs_info *fs = dir->fs;
+    struct fat_dir_index *dx;
+    struct fat_dir_slot *slot;
+    const struct fat_dir_entry *de;
+    const struct fat_long_name_entry *long_de;
+    uint16_t long_name[261];	/* == 20*13 + 1 (to guarantee null) */
+    sector_t sector = PVT(dir)->start;
+    sector_t set_sector = 0;
+    int set_entry = 0, set_count = 0;
+    uint8_t vfat_next = 0xff, vfat_csum = 0xff;
+    uint8_t id;
+    bool long_entry = false;
+    int entries, entry;
+    uint32_t nbuckets;
+    int i;
+
+    dx = zalloc(sizeof *dx);
+    if (!dx)
+	malloc_error("FAT directory index");
+
+    while (sector) {
+	de = get_cache(fs->fs_dev, sector);
+	entries = 1 << (fs->sector_shift - 5);
+
+	for (entry = 0; entry < entries; entry++, de++) {
+	    if (de->name[0] == 0)
+		goto done;	/* End of directory */
+	    if ((uint8_t)de->name[0] == 0xe5)
+		goto invalid;
+
+	    if (de->attr == 0x0f) {
+		long_de = (const struct fat_long_name_entry *)de;
+		id = long_de->id;
+
+		if (id & 0x40) {
+		    vfat_csum = long_de->checksum;
+		    id &= 0x3f;
+		    if (!id || id > 20)
+			goto invalid;
+
+		    memset(long_name, 0, sizeof long_name);
+		    set_sector = sector;
+		    set_entry = entry;
+		    set_count = 0;
+		} else {
+		    /* after the last slot of a set vfat_next is 0 */
+		    if (!id || long_de->checksum != vfat_csum ||
+			id != vfat_next)
+			goto invalid;
+		}
+
+		vfat_next = --id;
+		copy_long_chunk(long_name + id*13, de);
+		set_count++;
+		long_entry = (id == 0);
+		continue;
+	    }
+
+	    if (!(de->attr & 0x08)) {	/* ignore volume labels */
+		slot = vfat_index_add(dx);
+		slot->shash = vfat_hash_short(de->name);
+		slot->kind = FAT_SLOT_SHORT;
+
+		if (long_entry && get_checksum(de->name) == vfat_csum) {
+		    slot->sector = set_sector;
+		    slot->entry  = set_entry;
+		    slot->count  = set_count + 1;
+		    slot->kind = vfat_hash_longname(long_name, &slot->lhash)
+			? FAT_SLOT_ASCII : FAT_SLOT_NONASCII;
+		} else {
+		    slot->sector = sector;
+		    slot->entry  = entry;
+		    slot->count  = 1;
+		}
+	    }
+
+	invalid:
+	    long_entry = false;
+	    vfat_next = 0xff;
+	}
+
+	sector = get_next_sector(fs, sector);
+    }
+
+done:
+    for (nbuckets = 16; nbuckets < (uint32_t)dx->nslots; nbuckets <<= 1)
+	;
+    dx->mask = nbuckets - 1;
+    dx->lbuckets = malloc(2 * nbuckets * sizeof(int));
+    if (!dx->lbuckets)
+	malloc_error("FAT directory index");
+    dx->sbuckets = dx->lbuckets + nbuckets;
+    memset(dx->lbuckets, 0xff, 2 * nbuckets * sizeof(int));
+    dx->nonascii = -1;
+
+    /* Insert backwards so that every chain ends up in directory order */
+    for (i = dx->nslots - 1; i >= 0; i--) {
+	slot = &dx->slots[i];
+	switch (slot->kind) {
+	case FAT_SLOT_ASCII:
+	    slot->lnext = dx->lbuckets[slot->lhash & dx->mask];
+	    dx->lbuckets[slot->lhash & dx->mask] = i;
+	    break;
+	case FAT_SLOT_NONASCII:
+	    slot->lnext = dx->nonascii;
+	    dx->nonascii = i;
+	    break;
+	}
+	slot->snext = dx->sbuckets[slot->shash & dx->mask];
+	dx->sbuckets[slot->shash & dx->mask] = i;
+    }
+
+    dprintf("vfat: indexed %d entries in %u buckets\n", dx->nslots, nbuckets);
+    return dx;
+}
+
+static void vfat_free_index(struct fat_dir_index *dx)
+{
+    if (!dx)
+	return;
+    free(dx->lbuckets);
+    free(dx->slots);
+    free(dx);
+}
+
+/*
+ * Look dname up through a directory's name index.  Only the slots on
+ * the relevant hash chains are read back and checked, and the first of
+ * them in directory order wins, as with a linear scan.  The matching
+ * short entry is copied to *dep.
+ */
+static bool vfat_index_lookup(struct inode *dir, const char *dname,
+			      const char *mangled_name,
+			      struct fat_dir_entry *dep)
+{
+    struct fs_info *fs = dir->fs;
+    const struct fat_dir_index *dx = PVT(dir)->dindex;
+    const struct fat_dir_slot *slot;
+    const struct fat_dir_entry *de;
+    const char *p;
+    uint32_t lhash, shash, len;
+    int best = dx->nslots;
+    int i, pass;
+
+    lhash = VFAT_HASH_INIT;
+    for (p = dname; *p; p++)
+	lhash = vfat_hash_char(lhash, (uint8_t)*p);
+    len = p - dname;
+    shash = vfat_hash_short(mangled_name);
+
+    for (pass = 0; pass < 3; pass++) {
+	switch (pass) {
+	case 0:
+	    i = dx->lbuckets[lhash & dx->mask];
+	    break;
+	case 1:
+	    i = dx->nonascii;
+	    break;
+	default:
+	    i = dx->sbuckets[shash & dx->mask];
+	    break;
+	}
+
+	/* Chains are in directory order, so stop at the best match yet */
+	for (; i >= 0 && i < best; i = pass < 2 ? slot->lnext : slot->snext) {
+	    slot = &dx->slots[i];
+	    if ((pass == 0 && slot->lhash != lhash) ||
+		(pass == 1 && slot->lhash != len) ||
+		(pass == 2 && slot->shash != shash))
+		continue;
+
+	    de = vfat_match_entry(fs, dname, mangled_name, slot->sector,
+				  slot->entry, slot->count);
+	    if (de) {
+		*dep = *de;
+		best = i;
+		break;
+	    }
+	}
+    }
+
+    return best < dx->nslots;
+}
+
+static struct inode *vfat_find_entry(const char *dname, struct inode *dir)
+{
+    struct fs_info *fs = dir->fs;
+    struct inode *inode;
+    const struct fat_dir_entry *de;
+    struct fat_dir_entry dentry;
+    char mangled_name[12];
+    const char *p;
+    bool ascii = true;
+
+    if (strlen(dname) > 20*13)
+	return NULL;		/* Name too long */
+
+    /* Produce the shortname version, in case we need it. */
+    mangle_dos_name(mangled_name, dname);
+
+    /*
+     * A non-ASCII name can match long names in more than one way, so
+     * look for it the slow way; otherwise use the name index, built
+     * once this directory has been searched more than once.
+     */
+    for (p = dname; *p; p++)
+	if ((uint8_t)*p >= 0x80)
+	    ascii = false;
+
+    if (ascii && !PVT(dir)->dindex &&
+	++PVT(dir)->lookups >= FAT_INDEX_LOOKUPS)
+	PVT(dir)->dindex = vfat_build_index(dir);
+
+    if (ascii && PVT(dir)->dindex) {
+	if (!vfat_index_lookup(dir, dname, mangled_name, &dentry))
+	    return NULL;
+	de = &dentry;
+    } else {
+	de = vfat_match_entry(fs, dname, mangled_name, PVT(dir)->start,
+			      0, -1);
+	if (!de)
+	    return NULL;
+    }
 
-found:
     inode = new_fat_inode(fs);
     inode->size = de->file_size;
     PVT(inode)->start_cluster = 
@@ -717,6 +1128,12 @@ got:
     return 0;
 }
 
+static void vfat_free_inode(struct inode *inode)
+{
+    free(PVT(inode)->runs);
+    vfat_free_index(PVT(inode)->dindex);
+}
+
 /* init. the fs meta data, return the block size in bits */
 static int vfat_fs_init(struct fs_info *fs)
 {
@@ -753,6 +1170,7 @@ static int vfat_fs_init(struct fs_info *fs)
     sbi->clust_byte_shift = sbi->clust_shift + fs->sector_shift;
     sbi->clust_mask       = fat.bxSecPerClust - 1;
     sbi->clust_size       = fat.bxSecPerClust << fs->sector_shift;
+    sbi->root_cluster     = 0;
 
     clusters = (total_sectors - sbi->data) >> sbi->clust_shift;
     if (clusters <= 0xff4) {
@@ -771,6 +1189,7 @@ static int vfat_fs_init(struct fs_info *fs)
 	}
 
 	/* FAT32: root directory is a cluster chain */
+	sbi->root_cluster = fat.fat32.root_cluster;
 	sbi->root = sbi->data
 	    + ((fat.fat32.root_cluster-2) << sbi->clust_shift);
     }
@@ -795,4 +1214,5 @@ const struct fs_ops vfat_fs_ops = {
     .iget_root     = vfat_iget_root,
     .iget          = vfat_iget,
     .next_extent   = fat_next_extent,
+    .free_inode    = vfat_free_inode,
 };
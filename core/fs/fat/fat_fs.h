@@ -143,6 +143,55 @@ static inline int root_dir_size(struct fs_info *fs, struct fat_bpb *fat)
 	>> (SECTOR_SHIFT(fs) - 5);
 }
 
+/*
+ * A run of physically contiguous clusters within a file
+ */
+struct fat_run {
+    uint32_t lcluster;		/* First logical cluster */
+    uint32_t pcluster;		/* First physical cluster */
+    uint32_t len;		/* Number of clusters */
+};
+
+#define FAT_MIN_RUNS	8	/* Initial size of a run table */
+
+/*
+ * One directory entry set (optional long name slots plus the short
+ * entry) in a directory name index
+ */
+struct fat_dir_slot {
+    sector_t sector;		/* Sector holding the first entry of the set */
+    uint16_t entry;		/* Entry number within that sector */
+    uint8_t  count;		/* Number of entries in the set */
+    uint8_t  kind;		/* FAT_SLOT_* */
+    uint32_t lhash;		/* Hash of the case-folded long name
+				   (length only for FAT_SLOT_NONASCII) */
+    uint32_t shash;		/* Hash of the 11-byte short name */
+    int      lnext;		/* Next slot on the same long name chain */
+    int      snext;		/* Next slot on the same short name chain */
+};
+
+enum fat_slot_kind {
+    FAT_SLOT_SHORT,		/* No long name */
+    FAT_SLOT_ASCII,		/* Long name hashed in lhash */
+    FAT_SLOT_NONASCII,		/* Long name not hashable, always checked */
+};
+
+/*
+ * Name index of a directory: slots in directory order, and hash chains
+ * (in ascending slot order) through them, terminated by -1.
+ */
+struct fat_dir_index {
+    struct fat_dir_slot *slots;
+    int nslots, maxslots;
+    int *lbuckets;		/* Long name hash chains */
+    int *sbuckets;		/* Short name hash chains */
+    uint32_t mask;		/* Number of buckets - 1 */
+    int nonascii;		/* Chain of FAT_SLOT_NONASCII slots */
+};
+
+#define FAT_MIN_SLOTS		32	/* Initial size of a slot array */
+#define FAT_INDEX_LOOKUPS	2	/* Index a directory on this lookup */
+
 /*
  * FAT private inode information
  */
@@ -151,8 +200,25 @@ struct fat_pvt_inode {
     sector_t start;		/* Starting sector */
     sector_t offset;		/* Current sector offset */
     sector_t here;		/* Sector corresponding to offset */
+
+    /*
+     * Run table for the part of the cluster chain mapped so far,
+     * sorted by logical cluster, and the physical cluster that
+     * follows the last run in the chain.
+     */
+    struct fat_run *runs;
+    int nruns, maxruns;
+    uint32_t run_next;
+
+    /* Name index, for directories looked up in more than once */
+    struct fat_dir_index *dindex;
+    int lookups;
 };
 
 #define PVT(i) ((struct fat_pvt_inode *)((i)->pvt))
 
+/* fatscan.c */
+uint32_t fat32_scan_run(const uint32_t *ent, uint32_t n, uint32_t next);
+uint32_t fat16_scan_run(const uint16_t *ent, uint32_t n, uint32_t next);
+
 #endif /* fat_fs.h */
@@ -0,0 +1,73 @@
+/*
+ * fatscan.c
+ *
+ * Bulk scanning of a FAT sector for runs of contiguous clusters,
+ * i.e. entries for which entry[c] == c+1.  The entries are compared a
+ * machine word at a time, four or eight entries per loop iteration.
+ *
+ * These routines only look at the buffer they are handed, so they can
+ * also be built into host-side test programs (see utils/fatscanbench.c).
+ */
+
+#include <stdint.h>
+
+/*
+ * Return how many of the n FAT32 entries at ent continue the run,
+ * where ent[0] is expected to contain the cluster number next.
+ */
+uint32_t fat32_scan_run(const uint32_t *ent, uint32_t n, uint32_t next)
+{
+    uint32_t i = 0;
+
+    while (n - i >= 4) {
+	if (((ent[i] ^ next) | (ent[i+1] ^ (next+1)) |
+	     (ent[i+2] ^ (next+2)) | (ent[i+3] ^ (next+3))) & 0x0fffffff)
+	    break;
+	i += 4;
+	next += 4;
+    }
+
+    while (i < n && !((ent[i] ^ next) & 0x0fffffff)) {
+	i++;
+	next++;
+    }
+
+    return i;
+}
+
+/*
+ * Same for FAT16, comparing two entries per 32-bit word.  The caller
+ * must make sure that next+n-1 still fits in 16 bits.
+ */
+uint32_t fat16_scan_run(const uint16_t *ent, uint32_t n, uint32_t next)
+{
+    const uint32_t *w;
+    uint32_t pair;
+    uint32_t i = 0;
+
+    /* Get to a word boundary */
+    if (n && ((uintptr_t)ent & 2)) {
+	if (ent[0] != next)
+	    return 0;
+	i++;
+	next++;
+    }
+
+    w = (const uint32_t *)(ent + i);
+    pair = next | ((next + 1) << 16);
+    while (n - i >= 4) {
+	if ((w[0] ^ pair) | (w[1] ^ (pair + 0x00020002)))
+	    break;
+	w += 2;
+	i += 4;
+	next += 4;
+	pair += 0x00040004;
+    }
+
+    while (i < n && ent[i] == next) {
+	i++;
+	next++;
+    }
+
+    return i;
+}
@@ -11,16 +11,30 @@ struct fs_info *this_fs = NULL;		/* Root filesystem */
 /* Actual file structures (we don't have malloc yet...) */
 struct file files[MAX_OPEN];
 
+/* Path strings of the lookup in progress, reset after each one */
+static struct mem_arena path_arena;
+
 /* Symlink hard limits */
 #define MAX_SYMLINK_CNT	20
 #define MAX_SYMLINK_BUF 4096
 
+/*
+ * The file size as reported through the 32-bit interfaces.  A file of
+ * 4 GiB or more is reported as being of unknown size, (uint32_t)-1, so
+ * that it is read until EOF rather than cut short.
+ */
+static inline uint32_t file_size32(const struct inode *inode)
+{
+    return inode->size > (uint32_t)-1 ? (uint32_t)-1 : inode->size;
+}
+
 /*
  * Get a new inode structure
  */
 struct inode *alloc_inode(struct fs_info *fs, uint32_t ino, size_t data)
 {
-    struct inode *inode = zalloc(sizeof(struct inode) + data);
+    struct inode *inode = arena_zalloc(&fs->arena,
+				       sizeof(struct inode) + data);
     if (inode) {
 	inode->fs = fs;
 	inode->ino = ino;
@@ -37,9 +51,10 @@ void put_inode(struct inode *inode)
     while (inode && --inode->refcnt == 0) {
 	struct inode *dead = inode;
 	inode = inode->parent;
-	if (dead->name)
-	    free((char *)dead->name);
-	free(dead);
+	if (dead->fs->fs_ops->free_inode)
+	    dead->fs->fs_ops->free_inode(dead);
+	arena_free(&dead->fs->arena, (char *)dead->name);
+	arena_free(&dead->fs->arena, dead);
     }
 }
 
@@ -195,7 +210,7 @@ void pm_searchdir(com32sys_t *regs)
 	regs->eflags.l |= EFLAGS_ZF;
     } else {
 	regs->esi.w[0]  = rv;
-	regs->eax.l     = handle_to_file(rv)->inode->size;
+	regs->eax.l     = file_size32(handle_to_file(rv)->inode);
 	regs->eflags.l &= ~EFLAGS_ZF;
     }
 }
@@ -228,7 +243,7 @@ int searchdir(const char *name)
     /* else, try the generic-path-lookup method */
 
     /* Copy the path */
-    path = strdup(name);
+    path = arena_strdup(&path_arena, name);
     if (!path) {
 	dprintf("searchdir: Couldn't copy path\n");
 	goto err_path;
@@ -313,7 +328,7 @@ int searchdir(const char *name)
 	    break;
 	}
 	inode->parent = tmp;
-	inode->name = strdup(inode_name);
+	inode->name = arena_strdup(&inode->fs->arena, inode_name);
 	dprintf("searchdir: path component: %s\n", inode->name);
 
 	/* Symlink handling */
@@ -335,7 +350,7 @@ int searchdir(const char *name)
 		new_len > MAX_SYMLINK_BUF)
 		goto err_new_len;
 
-	    new_path = malloc(new_len);
+	    new_path = arena_alloc(&path_arena, new_len);
 	    if (!new_path)
 		goto err_new_path;
 
@@ -351,7 +366,7 @@ int searchdir(const char *name)
 		dprintf("searchdir: New path: %s\n", new_path);
 	    }
 
-	    free(path);
+	    arena_free(&path_arena, path);
 	    path = next_inode_name = new_path;
 
             /* Add a reference to the parent so we can release the child */
@@ -363,7 +378,7 @@ int searchdir(const char *name)
             inode = tmp;
 	    continue;
 err_copied:
-	    free(new_path);
+	    arena_free(&path_arena, new_path);
 err_new_path:
 err_new_len:
 	    put_inode(inode);
@@ -380,7 +395,7 @@ err_new_len:
 	}
     }
 err_curdir:
-    free(path);
+    arena_reset(&path_arena);
 err_path:
     if (!inode) {
 	dprintf("searchdir: Not found\n");
@@ -419,7 +434,7 @@ int open_file(const char *name, struct com32_filedata *filedata)
 	return -1;
     }
 
-    filedata->size	= file->inode->size;
+    filedata->size	= file_size32(file->inode);
     filedata->blocklg2	= SECTOR_SHIFT(file->fs);
     filedata->handle	= rv;
 
@@ -442,7 +457,7 @@ void pm_open_file(com32sys_t *regs)
     } else {
 	file = handle_to_file(rv);
 	regs->eflags.l &= ~EFLAGS_CF;
-	regs->eax.l = file->inode->size;
+	regs->eax.l = file_size32(file->inode);
 	regs->ecx.w[0] = SECTOR_SIZE(file->fs);
 	regs->esi.w[0] = rv;
     }
@@ -490,6 +505,8 @@ void fs_init(com32sys_t *regs)
 
     /* Initialize malloc() */
     mem_init();
+    arena_init(&fs.arena, MALLOC_CORE);
+    arena_init(&path_arena, MALLOC_CORE);
 
     /* Default name for the root directory */
     fs.cwd_name[0] = '/';
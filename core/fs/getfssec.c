@@ -92,9 +92,9 @@ uint32_t generic_getfssec(struct file *file, char *buf,
     struct fs_info *fs = file->fs;
     struct disk *disk = fs->fs_dev->disk;
     uint32_t bytes_read = 0;
-    uint32_t bytes_left = inode->size - file->offset;
-    uint32_t sectors_left =
-	(bytes_left + SECTOR_SIZE(fs) - 1) >> SECTOR_SHIFT(fs);
+    uint64_t bytes_left = inode->size - file->offset;
+    uint64_t sectors_left = (bytes_left >> SECTOR_SHIFT(fs)) +
+	!!(bytes_left & (SECTOR_SIZE(fs) - 1));
     uint32_t lsector;
 
     if (sectors > sectors_left)
@@ -104,7 +104,7 @@ uint32_t generic_getfssec(struct file *file, char *buf,
 	return 0;
 
     lsector = file->offset >> SECTOR_SHIFT(fs);
-    dprintf("Offset: %u  lsector: %u\n", file->offset, lsector);
+    dprintf("Offset: %llu  lsector: %u\n", file->offset, lsector);
 
     if (lsector < inode->this_extent.lstart ||
 	lsector >= inode->this_extent.lstart + inode->this_extent.len) {
@@ -1,11 +1,13 @@
 #include <dprintf.h>
 #include <stdio.h>
 #include <string.h>
+#include <minmax.h>
 #include <sys/dirent.h>
 #include <core.h>
 #include <cache.h>
 #include <disk.h>
 #include <fs.h>
+#include "codepage.h"
 #include "iso9660_fs.h"
 
 /* Convert to lower case string */
@@ -27,6 +29,16 @@ static inline struct iso_sb_info *ISO_SB(struct fs_info *fs)
     return fs->fs_info;
 }
 
+static inline uint16_t get_le16(const uint8_t *p)
+{
+    return p[0] + (p[1] << 8);
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+    return get_le16(p) + ((uint32_t)get_le16(p + 2) << 16);
+}
+
 static size_t iso_convert_name(char *dst, const char *src, int len)
 {
     char *p = dst;
@@ -61,24 +73,283 @@ done:
     return p - dst;
 }
 
+/*
+ * Convert a Joliet (UCS-2, big endian) name to the system codepage.
+ * Characters the codepage cannot represent become '_'.
+ */
+static size_t iso_convert_joliet_name(char *dst, const char *src, int len)
+{
+    const uint8_t *s = (const uint8_t *)src;
+    char *p = dst;
+    uint16_t uc;
+    unsigned int c;
+
+    if (len == 1)
+	return iso_convert_name(dst, src, len);	/* "." and ".." */
+
+    for (; len >= 2; len -= 2, s += 2) {
+	uc = (s[0] << 8) + s[1];
+	if (!uc || uc == ';')	/* Remove any filename version suffix */
+	    break;
+
+	if (uc < 0x80) {
+	    *p++ = uc;
+	    continue;
+	}
+
+	/* As in vfat_cvt_longname(), this runs on into uni[1] */
+	for (c = 0; c < 512; c++) {
+	    if (codepage.uni[0][c] == uc)
+		break;
+	}
+	*p++ = c < 512 ? (char)c : '_';
+    }
+
+    /* Then remove any terminal dots */
+    while (p > dst+1 && p[-1] == '.')
+	p--;
+
+    *p = '\0';
+    return p - dst;
+}
+
+/*
+ * Iterator over the SUSP entries of a directory record: its own System
+ * Use area, then any continuation areas it points to.
+ */
+struct iso_susp_iter {
+    struct fs_info *fs;
+    const uint8_t *p, *end;
+    uint32_t ce_block, ce_offset, ce_len;	/* Pending continuation area */
+    int ce_count;
+};
+
+static void iso_susp_init(struct iso_susp_iter *it, struct fs_info *fs,
+			  const struct iso_dir_entry *de, uint8_t skip)
+{
+    /* The System Use area follows the name, padded to an even offset */
+    it->fs  = fs;
+    it->p   = (const uint8_t *)de + 33 + de->name_len +
+	!(de->name_len & 1) + skip;
+    it->end = (const uint8_t *)de + de->length;
+    it->ce_len = 0;
+    it->ce_count = 0;
+}
+
+/* Return the next SUSP entry, or NULL at the end */
+static const uint8_t *iso_susp_next(struct iso_susp_iter *it)
+{
+    struct fs_info *fs = it->fs;
+    const uint8_t *e;
+    const char *data;
+
+    for (;;) {
+	if (it->p + 4 <= it->end && it->p[2] >= 4 &&
+	    it->p + it->p[2] <= it->end) {
+	    e = it->p;
+	    it->p += e[2];
+
+	    switch (get_le16(e)) {
+	    case SUSP_CE:
+		if (e[2] >= 28) {
+		    it->ce_block  = get_le32(e + 4);
+		    it->ce_offset = get_le32(e + 12);
+		    it->ce_len    = get_le32(e + 20);
+		}
+		continue;
+	    case SUSP_ST:
+		it->p = it->end;
+		continue;
+	    default:
+		return e;
+	    }
+	}
+
+	/* This area is done; move on to the continuation area, if any */
+	if (!it->ce_len || ++it->ce_count > SUSP_MAX_CE ||
+	    it->ce_offset + it->ce_len > BLOCK_SIZE(fs))
+	    return NULL;
+
+	data = get_cache(fs->fs_dev, it->ce_block);
+	it->p   = (const uint8_t *)data + it->ce_offset;
+	it->end = it->p + it->ce_len;
+	it->ce_len = 0;
+    }
+}
+
+/*
+ * Get the Rock Ridge name of a directory record from its NM entries.
+ * Returns the length, or -1 if the record has no (usable) NM entry.
+ */
+static int iso_rr_name(struct fs_info *fs, const struct iso_dir_entry *de,
+		       char *name)
+{
+    struct iso_susp_iter it;
+    const uint8_t *e;
+    int len = 0, n;
+    bool found = false;
+
+    iso_susp_init(&it, fs, de, ISO_SB(fs)->susp_skip);
+    while ((e = iso_susp_next(&it))) {
+	if (get_le16(e) != RRIP_NM || e[2] < 5)
+	    continue;
+
+	if (e[4] & (RRIP_CURRENT | RRIP_PARENT))
+	    return -1;		/* Let the ISO 9660 name say "." or ".." */
+
+	n = e[2] - 5;
+	if (len + n > NAME_MAX)
+	    return -1;
+
+	memcpy(name + len, e + 5, n);
+	len += n;
+	found = true;
+
+	if (!(e[4] & RRIP_CONTINUE))
+	    break;
+    }
+
+    if (!found || !len)
+	return -1;
+
+    name[len] = '\0';
+    return len;
+}
+
+/*
+ * Get the target of a Rock Ridge symlink from its SL entries into a
+ * buffer of size bytes.  Returns the length, or -1 if the record is
+ * not a symlink.
+ */
+static int iso_rr_link(struct fs_info *fs, const struct iso_dir_entry *de,
+		       char *buf, int size)
+{
+    struct iso_susp_iter it;
+    const uint8_t *e, *c, *end;
+    const char *part;
+    int len = 0, n;
+    bool found = false, sep = false;
+
+    iso_susp_init(&it, fs, de, ISO_SB(fs)->susp_skip);
+    while ((e = iso_susp_next(&it))) {
+	if (get_le16(e) != RRIP_SL || e[2] < 5)
+	    continue;
+
+	found = true;
+	end = e + e[2];
+	for (c = e + 5; c + 2 <= end && c + 2 + c[1] <= end; c += 2 + c[1]) {
+	    if (c[0] & RRIP_ROOT) {
+		part = "/";
+		n = 1;
+	    } else if (c[0] & RRIP_PARENT) {
+		part = "..";
+		n = 2;
+	    } else if (c[0] & RRIP_CURRENT) {
+		part = ".";
+		n = 1;
+	    } else {
+		part = (const char *)c + 2;
+		n = c[1];
+	    }
+
+	    if (len + sep + n >= size)
+		return -1;
+
+	    if (sep)
+		buf[len++] = '/';
+	    memcpy(buf + len, part, n);
+	    len += n;
+
+	    /* A continued component goes on without a separator */
+	    sep = !(c[0] & (RRIP_CONTINUE | RRIP_ROOT));
+	}
+
+	if (!(e[4] & RRIP_CONTINUE))
+	    break;
+    }
+
+    if (!found)
+	return -1;
+
+    buf[len] = '\0';
+    return len;
+}
+
+/*
+ * Look for a ZF entry marking a file as zisofs compressed, and if there
+ * is one, set up the state to decompress it; the inode then has the
+ * uncompressed size.
+ */
+static void iso_rr_zisofs(struct inode *inode, const struct iso_dir_entry *de)
+{
+    struct fs_info *fs = inode->fs;
+    struct iso_susp_iter it;
+    struct iso_zisofs *zf;
+    const uint8_t *e;
+
+    iso_susp_init(&it, fs, de, ISO_SB(fs)->susp_skip);
+    while ((e = iso_susp_next(&it))) {
+	if (get_le16(e) != RRIP_ZF || e[2] < 16 || e[4] != 'p' || e[5] != 'z')
+	    continue;
+
+	zf = zalloc(sizeof *zf);
+	if (!zf) {
+	    malloc_error("zisofs state");
+	    return;
+	}
+	zf->csize = de->size_le;
+	zf->block_shift = e[7];
+	zf->block = -1;
+
+	PVT(inode)->zf = zf;
+	inode->size = get_le32(e + 8);
+	return;
+    }
+}
+
+/*
+ * Get the name of a directory record as lookups compare it and readdir
+ * returns it, in the flavour the filesystem was mounted with.
+ */
+static size_t iso_get_name(struct fs_info *fs, const struct iso_dir_entry *de,
+			   char *name)
+{
+    int len;
+
+    switch (ISO_SB(fs)->names) {
+    case ISO_NAMES_ROCKRIDGE:
+	len = iso_rr_name(fs, de, name);
+	if (len >= 0)
+	    return len;
+	break;
+    case ISO_NAMES_JOLIET:
+	return iso_convert_joliet_name(name, de->name, de->name_len);
+    default:
+	break;
+    }
+
+    return iso_convert_name(name, de->name, de->name_len);
+}
+
 /* 
  * Unlike strcmp, it does return 1 on match, or reutrn 0 if not match.
  */
-static bool iso_compare_name(const char *de_name, size_t len,
+static bool iso_compare_name(struct fs_info *fs,
+			     const struct iso_dir_entry *de,
 			     const char *file_name)
 {
-    char iso_file_name[256];
+    char iso_file_name[NAME_MAX + 1];
     char *p = iso_file_name;
     char c1, c2;
     int i;
-    
-    i = iso_convert_name(iso_file_name, de_name, len);
+
+    i = iso_get_name(fs, de, iso_file_name);
     (void)i;
     dprintf("Compare: \"%s\" to \"%s\" (len %zu)\n",
 	    file_name, iso_file_name, i);
 
     do {
-	c1 = *p++;
+	c1 = iso_tolower(*p++);
 	c2 = iso_tolower(*file_name++);
 
 	/* compare equal except for case? */
@@ -90,58 +361,236 @@ static bool iso_compare_name(const char *de_name, size_t len,
 }
 
 /*
- * Find a entry in the specified dir with name _dname_.
+ * FNV-1a, folding ASCII letters to lower case as iso_compare_name() does
+ */
+#define ISO_HASH_INIT	2166136261U
+
+static uint32_t iso_hash_name(const char *name)
+{
+    uint32_t hash = ISO_HASH_INIT;
+
+    while (*name)
+	hash = (hash ^ (uint8_t)iso_tolower(*name++)) * 16777619;
+
+    return hash;
+}
+
+/*
+ * Get the directory record at a byte offset into a directory, or NULL
+ * if there is no valid record there.
  */
 static const struct iso_dir_entry *
-iso_find_entry(const char *dname, struct inode *inode)
+iso_dir_record(struct inode *inode, uint32_t offset)
 {
     struct fs_info *fs = inode->fs;
-    block_t dir_block = PVT(inode)->lba;
-    int i = 0, offset = 0;
-    const char *de_name;
-    int de_name_len, de_len;
+    uint32_t i = offset >> BLOCK_SHIFT(fs);
     const struct iso_dir_entry *de;
-    const char *data = NULL;
+    const char *data;
 
-    dprintf("iso_find_entry: \"%s\"\n", dname);
-    
-    while (1) {
-	if (!data) {
-	    dprintf("Getting block %d from block %llu\n", i, dir_block);
-	    if (++i > inode->blocks)
-		return NULL;	/* End of directory */
-	    data = get_cache(fs->fs_dev, dir_block++);
-	    offset = 0;
+    if (i >= inode->blocks)
+	return NULL;
+
+    data = get_cache(fs->fs_dev, PVT(inode)->lba + i);
+    offset &= BLOCK_SIZE(fs) - 1;
+    de = (const struct iso_dir_entry *)(data + offset);
+
+    /*
+     * Zero = end of sector, or corrupt directory entry
+     *
+     * ECMA-119:1987 6.8.1.1: "Each Directory Record shall end
+     * in the Logical Sector in which it begins.
+     */
+    if (de->length < 33 || offset + de->length > BLOCK_SIZE(fs) ||
+	33 + de->name_len > de->length)
+	return NULL;
+
+    return de;
+}
+
+/*
+ * Get the first record at or after *offset, skipping the unused space
+ * at the end of each block, and move *offset to it.  Returns NULL at
+ * the end of the directory.
+ */
+static const struct iso_dir_entry *
+iso_next_record(struct inode *inode, uint32_t *offset)
+{
+    struct fs_info *fs = inode->fs;
+    const struct iso_dir_entry *de;
+
+    while ((*offset >> BLOCK_SHIFT(fs)) < inode->blocks) {
+	de = iso_dir_record(inode, *offset);
+	if (de)
+	    return de;
+
+	/* Start of the next block */
+	*offset = (*offset + BLOCK_SIZE(fs)) & ~(BLOCK_SIZE(fs) - 1);
+    }
+
+    return NULL;
+}
+
+static struct iso_dir_slot *iso_index_add(struct iso_dir_index *dx)
+{
+    struct iso_dir_slot *slots;
+    int maxslots;
+
+    if (dx->nslots == dx->maxslots) {
+	maxslots = dx->maxslots ? dx->maxslots << 1 : ISO_MIN_SLOTS;
+	slots = malloc(maxslots * sizeof *slots);
+	if (!slots)
+	    malloc_error("ISO directory index");
+	if (dx->slots) {
+	    memcpy(slots, dx->slots, dx->nslots * sizeof *slots);
+	    free(dx->slots);
 	}
+	dx->slots = slots;
+	dx->maxslots = maxslots;
+    }
 
-	de = (const struct iso_dir_entry *)(data + offset);
-	de_len = de->length;
-	offset += de_len;
-	
-	/* Make sure we have a full directory entry */
-	if (de_len < 33 || offset > BLOCK_SIZE(fs)) {
-	    /*
-	     * Zero = end of sector, or corrupt directory entry
-	     *
-	     * ECMA-119:1987 6.8.1.1: "Each Directory Record shall end
-	     * in the Logical Sector in which it begins.
-	     */
-	    data = NULL;
-	    continue;
+    return &dx->slots[dx->nslots++];
+}
+
+/*
+ * Read a whole directory once and index every record in it by the
+ * hash of its name.
+ */
+static struct iso_dir_index *iso_build_index(struct inode *inode)
+{
+    struct fs_info *fs = inode->fs;
+    struct iso_dir_index *dx;
+    struct iso_dir_slot *slot;
+    const struct iso_dir_entry *de;
+    char name[NAME_MAX + 1];
+    uint32_t offset = 0;
+    uint32_t nbuckets;
+    bool cont = false;
+    int i;
+
+    dx = zalloc(sizeof *dx);
+    if (!dx)
+	malloc_error("ISO directory index");
+
+    while ((de = iso_next_record(inode, &offset))) {
+	/*
+	 * Skip "." and "..", which the path walk handles itself, and
+	 * all but the first record of a multi-extent file.
+	 */
+	if (!cont && (de->name_len != 1 || (uint8_t)de->name[0] > 1)) {
+	    iso_get_name(fs, de, name);
+	    slot = iso_index_add(dx);
+	    slot->offset = offset;
+	    slot->hash = iso_hash_name(name);
 	}
-	
-	de_name_len = de->name_len;
-	de_name = de->name;
-	if (iso_compare_name(de_name, de_name_len, dname)) {
+
+	cont = de->flags & ISO_FLAG_MULTI_EXTENT;
+	offset += de->length;
+    }
+
+    for (nbuckets = 16; nbuckets < (uint32_t)dx->nslots; nbuckets <<= 1)
+	;
+    dx->mask = nbuckets - 1;
+    dx->buckets = malloc(nbuckets * sizeof(int));
+    if (!dx->buckets)
+	malloc_error("ISO directory index");
+    memset(dx->buckets, 0xff, nbuckets * sizeof(int));
+
+    /* Insert backwards so that every chain ends up in directory order */
+    for (i = dx->nslots - 1; i >= 0; i--) {
+	slot = &dx->slots[i];
+	slot->next = dx->buckets[slot->hash & dx->mask];
+	dx->buckets[slot->hash & dx->mask] = i;
+    }
+
+    dprintf("iso: indexed %d entries in %u buckets\n", dx->nslots, nbuckets);
+    return dx;
+}
+
+static void iso_free_index(struct iso_dir_index *dx)
+{
+    if (!dx)
+	return;
+    free(dx->buckets);
+    free(dx->slots);
+    free(dx);
+}
+
+/*
+ * Find a entry in the specified dir by reading it from the start; this
+ * stops at the first match, so costs less than building an index for
+ * a directory only looked up in once.
+ */
+static const struct iso_dir_entry *
+iso_scan_entry(const char *dname, struct inode *inode, uint32_t *offset)
+{
+    struct fs_info *fs = inode->fs;
+    const struct iso_dir_entry *de;
+    uint32_t off = 0;
+    bool cont = false;
+
+    while ((de = iso_next_record(inode, &off))) {
+	if (!cont && (de->name_len != 1 || (uint8_t)de->name[0] > 1) &&
+	    iso_compare_name(fs, de, dname)) {
 	    dprintf("Found.\n");
+	    *offset = off;
 	    return de;
 	}
+
+	cont = de->flags & ISO_FLAG_MULTI_EXTENT;
+	off += de->length;
     }
+
+    return NULL;
+}
+
+/*
+ * Find a entry in the specified dir with name _dname_, and its byte
+ * offset in the directory.  The path walk gets a fresh inode for each
+ * directory on the way, so the first lookup in one is a plain scan;
+ * a directory looked up in again (the root, the current directory) is
+ * read once to build its name index, and after that only the records
+ * on one hash chain are read back and compared.  Chains are in
+ * directory order, so the first match wins, as with a linear scan.
+ */
+static const struct iso_dir_entry *
+iso_find_entry(const char *dname, struct inode *inode, uint32_t *offset)
+{
+    struct fs_info *fs = inode->fs;
+    const struct iso_dir_index *dx;
+    const struct iso_dir_slot *slot;
+    const struct iso_dir_entry *de;
+    uint32_t hash;
+    int i;
+
+    dprintf("iso_find_entry: \"%s\"\n", dname);
+
+    if (!PVT(inode)->dindex) {
+	if (++PVT(inode)->lookups < ISO_INDEX_LOOKUPS)
+	    return iso_scan_entry(dname, inode, offset);
+	PVT(inode)->dindex = iso_build_index(inode);
+    }
+    dx = PVT(inode)->dindex;
+
+    hash = iso_hash_name(dname);
+    for (i = dx->buckets[hash & dx->mask]; i >= 0; i = slot->next) {
+	slot = &dx->slots[i];
+	if (slot->hash != hash)
+	    continue;
+
+	de = iso_dir_record(inode, slot->offset);
+	if (de && iso_compare_name(fs, de, dname)) {
+	    dprintf("Found.\n");
+	    *offset = slot->offset;
+	    return de;
+	}
+    }
+
+    return NULL;
 }
 
 static inline enum dirent_type get_inode_mode(uint8_t flags)
 {
-    return (flags & 0x02) ? DT_DIR : DT_REG;
+    return (flags & ISO_FLAG_DIR) ? DT_DIR : DT_REG;
 }
 
 static struct inode *iso_get_inode(struct fs_info *fs,
@@ -149,6 +598,8 @@ static struct inode *iso_get_inode(struct fs_info *fs,
 {
     struct inode *inode = new_iso_inode(fs);
     int blktosec = BLOCK_SHIFT(fs) - SECTOR_SHIFT(fs);
+    char link[NAME_MAX + 1];
+    int len;
 
     if (!inode)
 	return NULL;
@@ -164,9 +615,103 @@ static struct inode *iso_get_inode(struct fs_info *fs,
     inode->next_extent.pstart = (sector_t)de->extent_le << blktosec;
     inode->next_extent.len    = (sector_t)inode->blocks << blktosec;
 
+    if (ISO_SB(fs)->names == ISO_NAMES_ROCKRIDGE &&
+	!(de->flags & ISO_FLAG_DIR)) {
+	len = iso_rr_link(fs, de, link, sizeof link);
+	if (len > 0) {
+	    PVT(inode)->link = strdup(link);
+	    if (!PVT(inode)->link)
+		malloc_error("ISO symlink target");
+	    inode->mode = DT_LNK;
+	    inode->size = len;
+	} else if (!(de->flags & ISO_FLAG_MULTI_EXTENT)) {
+	    iso_rr_zisofs(inode, de);
+	}
+    }
+
     return inode;
 }
 
+/*
+ * A file of more than one extent has a directory record for each, all
+ * but the last flagged ISO_FLAG_MULTI_EXTENT.  Collect the extents from
+ * the records starting at offset in the parent directory; every extent
+ * but the last has to be a whole number of blocks, so the file is cut
+ * short at one that is not.
+ */
+static void iso_map_extents(struct inode *inode, struct inode *parent,
+			    uint32_t offset)
+{
+    struct fs_info *fs = inode->fs;
+    int blktosec = BLOCK_SHIFT(fs) - SECTOR_SHIFT(fs);
+    const struct iso_dir_entry *de;
+    struct iso_extent *ext;
+    uint32_t off, lstart = 0;
+    uint64_t size = 0;
+    int n = 0, i;
+    bool more;
+
+    off = offset;
+    do {
+	de = iso_next_record(parent, &off);
+	if (!de)
+	    break;
+	n++;
+	more = (de->flags & ISO_FLAG_MULTI_EXTENT) &&
+	    !(de->size_le & (BLOCK_SIZE(fs) - 1));
+	off += de->length;
+    } while (more);
+
+    ext = malloc(n * sizeof *ext);
+    if (!ext) {
+	malloc_error("ISO extent list");
+	return;
+    }
+
+    off = offset;
+    for (i = 0; i < n; i++) {
+	de = iso_next_record(parent, &off);
+	ext[i].lstart = lstart;
+	ext[i].lba    = de->extent_le;
+	ext[i].len    = ((de->size_le + BLOCK_SIZE(fs) - 1)
+			 >> BLOCK_SHIFT(fs)) << blktosec;
+	lstart += ext[i].len;
+	size   += de->size_le;
+	off    += de->length;
+    }
+
+    dprintf("iso: %d extents, %llu bytes\n", n, size);
+
+    PVT(inode)->extents  = ext;
+    PVT(inode)->nextents = n;
+    inode->size   = size;
+    inode->blocks = lstart >> blktosec;
+    inode->next_extent.pstart = (sector_t)ext[0].lba << blktosec;
+    inode->next_extent.len    = ext[0].len;
+}
+
+/* Map the extent holding lstart, for a multi-extent file */
+static int iso_next_extent(struct inode *inode, uint32_t lstart)
+{
+    struct fs_info *fs = inode->fs;
+    int blktosec = BLOCK_SHIFT(fs) - SECTOR_SHIFT(fs);
+    const struct iso_extent *ext = PVT(inode)->extents;
+    uint32_t skip;
+    int i;
+
+    for (i = 0; i < PVT(inode)->nextents; i++, ext++) {
+	skip = lstart - ext->lstart;
+	if (lstart >= ext->lstart && skip < ext->len) {
+	    inode->next_extent.pstart = ((sector_t)ext->lba << blktosec) +
+		skip;
+	    inode->next_extent.len = ext->len - skip;
+	    return 0;
+	}
+    }
+
+    return -1;
+}
+
 static struct inode *iso_iget_root(struct fs_info *fs)
 {
     const struct iso_dir_entry *root = &ISO_SB(fs)->root;
@@ -177,14 +722,221 @@ static struct inode *iso_iget_root(struct fs_info *fs)
 static struct inode *iso_iget(const char *dname, struct inode *parent)
 {
     const struct iso_dir_entry *de;
+    struct inode *inode;
+    uint32_t offset;
+    bool multi;
     
     dprintf("iso_iget %p %s\n", parent, dname);
 
-    de = iso_find_entry(dname, parent);
+    de = iso_find_entry(dname, parent, &offset);
     if (!de)
 	return NULL;
+    multi = de->flags & ISO_FLAG_MULTI_EXTENT;
     
-    return iso_get_inode(parent->fs, de);
+    inode = iso_get_inode(parent->fs, de);
+    if (inode && multi)
+	iso_map_extents(inode, parent, offset);
+
+    return inode;
+}
+
+static int iso_readlink(struct inode *inode, char *buf)
+{
+    if (!PVT(inode)->link)
+	return -1;
+
+    memcpy(buf, PVT(inode)->link, inode->size);
+    return inode->size;
+}
+
+/*
+ * Read the header and block pointers of a zisofs file, and check that
+ * the pointers are sane before any of them is trusted.
+ */
+static int iso_zf_load(struct inode *inode)
+{
+    struct fs_info *fs = inode->fs;
+    struct iso_zisofs *zf = PVT(inode)->zf;
+    const uint8_t *data;
+    uint32_t size, i, offset, max_len;
+    unsigned int header_size, block_shift;
+
+    data = get_cache(fs->fs_dev, PVT(inode)->lba);
+    if (zf->csize < 16 ||
+	zisofs_parse_header(data, &size, &header_size, &block_shift) ||
+	size != inode->size || block_shift != zf->block_shift) {
+	printf("iso: bad zisofs header\n");
+	return -1;
+    }
+
+    zf->nblocks = (size + (1 << block_shift) - 1) >> block_shift;
+    if (header_size + ((zf->nblocks + 1) << 2) > zf->csize) {
+	printf("iso: zisofs block table past the end of the file\n");
+	return -1;
+    }
+
+    zf->ptrs = malloc((zf->nblocks + 1) << 2);
+    zf->buf  = malloc(1 << block_shift);
+    zf->cbuf = malloc(ZISOFS_READAHEAD);
+    if (!zf->ptrs || !zf->buf || !zf->cbuf) {
+	malloc_error("zisofs buffers");
+	return -1;
+    }
+
+    /* The pointers are 4-byte aligned, so never straddle a block */
+    offset = header_size;
+    for (i = 0; i <= zf->nblocks; i++, offset += 4) {
+	data = get_cache(fs->fs_dev,
+			 PVT(inode)->lba + (offset >> BLOCK_SHIFT(fs)));
+	zf->ptrs[i] = get_le32(data + (offset & (BLOCK_SIZE(fs) - 1)));
+    }
+
+    /* A block must fit in the read-ahead window wherever it starts */
+    max_len = ZISOFS_READAHEAD - BLOCK_SIZE(fs);
+    for (i = 0; i < zf->nblocks; i++) {
+	if (zf->ptrs[i + 1] < zf->ptrs[i] ||
+	    zf->ptrs[i + 1] - zf->ptrs[i] > max_len) {
+	    printf("iso: bad zisofs block pointer\n");
+	    return -1;
+	}
+    }
+    if (zf->ptrs[zf->nblocks] > zf->csize) {
+	printf("iso: bad zisofs block pointer\n");
+	return -1;
+    }
+
+    if (inflateInit(&zf->zs) != Z_OK)
+	return -1;
+    zf->zs_init = true;
+
+    return 0;
+}
+
+/*
+ * Return a pointer to len bytes of the compressed file at offset,
+ * reading a whole window ahead if they are not in the buffer already.
+ */
+static const uint8_t *iso_zf_data(struct inode *inode, uint32_t offset,
+				  uint32_t len)
+{
+    struct fs_info *fs = inode->fs;
+    struct disk *disk = fs->fs_dev->disk;
+    struct iso_zisofs *zf = PVT(inode)->zf;
+    int blktosec = BLOCK_SHIFT(fs) - SECTOR_SHIFT(fs);
+    uint32_t start, end, blocks;
+
+    if (offset < zf->cstart || offset + len > zf->cstart + zf->clen) {
+	start = offset & ~(BLOCK_SIZE(fs) - 1);
+	end = min(zf->csize, start + ZISOFS_READAHEAD);
+	blocks = (end - start + BLOCK_SIZE(fs) - 1) >> BLOCK_SHIFT(fs);
+
+	zf->clen = 0;
+	if (disk->rdwr_sectors(disk, zf->cbuf,
+			       (sector_t)(PVT(inode)->lba +
+					  (start >> BLOCK_SHIFT(fs))) << blktosec,
+			       blocks << blktosec, false) != blocks << blktosec)
+	    return NULL;
+	zf->cstart = start;
+	zf->clen = end - start;
+    }
+
+    return zf->cbuf + (offset - zf->cstart);
+}
+
+/* Decompress block blk of a zisofs file into out */
+static int iso_zf_inflate(struct inode *inode, uint32_t blk, void *out,
+			  uint32_t out_len)
+{
+    struct iso_zisofs *zf = PVT(inode)->zf;
+    uint32_t in_len = zf->ptrs[blk + 1] - zf->ptrs[blk];
+    const uint8_t *in = NULL;
+
+    if (in_len) {
+	in = iso_zf_data(inode, zf->ptrs[blk], in_len);
+	if (!in)
+	    return -1;
+    }
+
+    if (zisofs_inflate_block(&zf->zs, in, in_len, out, out_len) !=
+	(int)out_len) {
+	printf("iso: corrupt zisofs block %u\n", blk);
+	return -1;
+    }
+
+    return 0;
+}
+
+static void iso_free_zisofs(struct iso_zisofs *zf)
+{
+    if (!zf)
+	return;
+
+    if (zf->zs_init)
+	inflateEnd(&zf->zs);
+    free(zf->ptrs);
+    free(zf->buf);
+    free(zf->cbuf);
+    free(zf);
+}
+
+/*
+ * Read a file, decompressing it on the way if it is zisofs compressed.
+ * Whole blocks are inflated straight into the caller's buffer; a block
+ * that is only partly wanted goes through zf->buf, and stays there for
+ * the next call, which usually wants the rest of it.
+ */
+static uint32_t iso_getfssec(struct file *file, char *buf, int sectors,
+			     bool *have_more)
+{
+    struct inode *inode = file->inode;
+    struct iso_zisofs *zf = PVT(inode)->zf;
+    uint32_t bytes, blk, skip, blk_len, chunk, bytes_read = 0;
+
+    if (!zf)
+	return generic_getfssec(file, buf, sectors, have_more);
+
+    if (!zf->zs_init && iso_zf_load(inode)) {
+	/* Don't keep trying a broken file */
+	iso_free_zisofs(zf);
+	PVT(inode)->zf = NULL;
+	inode->size = file->offset;
+	goto done;
+    }
+
+    bytes = min((uint32_t)sectors << SECTOR_SHIFT(file->fs),
+		inode->size - file->offset);
+
+    while (bytes) {
+	blk = file->offset >> zf->block_shift;
+	skip = file->offset & ((1 << zf->block_shift) - 1);
+	blk_len = min(1U << zf->block_shift,
+		      inode->size - (blk << zf->block_shift));
+	chunk = min(blk_len - skip, bytes);
+
+	if (blk == (uint32_t)zf->block) {
+	    memcpy(buf, zf->buf + skip, chunk);
+	} else if (!skip && chunk == blk_len) {
+	    if (iso_zf_inflate(inode, blk, buf, blk_len))
+		break;
+	} else {
+	    zf->block = -1;
+	    if (iso_zf_inflate(inode, blk, zf->buf, blk_len))
+		break;
+	    zf->block = blk;
+	    memcpy(buf, zf->buf + skip, chunk);
+	}
+
+	buf += chunk;
+	bytes -= chunk;
+	bytes_read += chunk;
+	file->offset += chunk;
+    }
+
+done:
+    if (have_more)
+	*have_more = file->offset < inode->size;
+
+    return bytes_read;
 }
 
 static int iso_readdir(struct file *file, struct dirent *dirent)
@@ -192,39 +944,38 @@ static int iso_readdir(struct file *file, struct dirent *dirent)
     struct fs_info *fs = file->fs;
     struct inode *inode = file->inode;
     const struct iso_dir_entry *de;
-    const char *data = NULL;
-    
-    while (1) {
-	size_t offset = file->offset & (BLOCK_SIZE(fs) - 1);
+    uint32_t offset = file->offset;
+    bool more;
+
+    de = iso_next_record(inode, &offset);
+    if (!de)
+	return -1;
 
-	if (!data) {
-	    uint32_t i = file->offset >> BLOCK_SHIFT(fs);
-	    if (i >= inode->blocks)
-		return -1;
-	    data = get_cache(fs->fs_dev, PVT(inode)->lba + i);
-	}
-	de = (const struct iso_dir_entry *)(data + offset);
-	
-	if (de->length < 33 || offset + de->length > BLOCK_SIZE(fs)) {
-	    file->offset = (file->offset + BLOCK_SIZE(fs))
-		& ~(BLOCK_SIZE(fs) - 1); /* Start of the next block */
-	    data = NULL;
-	    continue;
-	}
-	break;
-    }
-    
     dirent->d_ino = 0;           /* Inode number is invalid to ISO fs */
-    dirent->d_off = file->offset;
+    dirent->d_off = offset;
     dirent->d_type = get_inode_mode(de->flags);
     dirent->d_reclen = offsetof(struct dirent, d_name) + 1 +
-	iso_convert_name(dirent->d_name, de->name, de->name_len);
+	iso_get_name(fs, de, dirent->d_name);
+
+    /* A multi-extent file is listed once, for its first record */
+    do {
+	more = de->flags & ISO_FLAG_MULTI_EXTENT;
+	offset += de->length;
+    } while (more && (de = iso_next_record(inode, &offset)));
+
+    file->offset = offset;       /* Update for next reading */
 
-    file->offset += de->length;  /* Update for next reading */
-    
     return 0;
 }
 
+static void iso_free_inode(struct inode *inode)
+{
+    iso_free_index(PVT(inode)->dindex);
+    free(PVT(inode)->link);
+    iso_free_zisofs(PVT(inode)->zf);
+    free(PVT(inode)->extents);
+}
+
 /* Load the config file, return 1 if failed, or 0 */
 static int iso_load_config(void)
 {
@@ -245,12 +996,73 @@ static int iso_load_config(void)
     return search_config(search_directories, filenames);
 }
 
+/*
+ * Look for a Joliet supplementary volume descriptor after the primary
+ * one, and if there is one, copy its root directory record.
+ */
+static bool iso_find_joliet(struct fs_info *fs, uint32_t pvd_lba,
+			    struct iso_dir_entry *root)
+{
+    struct disk *disk = fs->fs_dev->disk;
+    int blktosec = fs->block_shift - fs->sector_shift;
+    char vd[2048];
+    const char *esc;
+    uint32_t lba;
+
+    for (lba = pvd_lba + 1; lba < pvd_lba + ISO_VD_MAX; lba++) {
+	if (!disk->rdwr_sectors(disk, vd, (sector_t)lba << blktosec,
+				1 << blktosec, false))
+	    break;
+	if (memcmp(vd + 1, "CD001", 5) || (uint8_t)vd[0] == ISO_VD_END)
+	    break;
+	if (vd[0] != ISO_VD_SUPPLEMENTARY)
+	    continue;
+
+	/* UCS-2 level 1, 2 or 3 */
+	esc = vd + ISO_VD_ESCAPE_OFFSET;
+	if (esc[0] == '%' && esc[1] == '/' &&
+	    (esc[2] == '@' || esc[2] == 'C' || esc[2] == 'E')) {
+	    memcpy(root, vd + ROOT_DIR_OFFSET, sizeof *root);
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+/*
+ * The "." record of the root directory starts with an SP entry if the
+ * filesystem uses SUSP; Rock Ridge is only looked for if it does.
+ */
+static bool iso_find_rockridge(struct fs_info *fs)
+{
+    struct iso_sb_info *sbi = ISO_SB(fs);
+    const struct iso_dir_entry *de;
+    const uint8_t *sp;
+    const char *data;
+
+    data = get_cache(fs->fs_dev, sbi->root.extent_le);
+    de = (const struct iso_dir_entry *)data;
+    if (de->length < 33 + 1 + 7 || de->name_len != 1)
+	return false;
+
+    sp = (const uint8_t *)de + 34;
+    if (get_le16(sp) != SUSP_SP || sp[2] < 7 ||
+	sp[4] != 0xbe || sp[5] != 0xef)
+	return false;
+
+    sbi->susp_skip = sp[6];
+    return true;
+}
+
 static int iso_fs_init(struct fs_info *fs)
 {
     struct iso_sb_info *sbi;
     char pvd[2048];		/* Primary Volume Descriptor */
     uint32_t pvd_lba;
     struct disk *disk = fs->fs_dev->disk;
+    struct iso_dir_entry joliet_root;
+    bool joliet;
     int blktosec;
 
     sbi = malloc(sizeof(*sbi));
@@ -278,9 +1090,22 @@ static int iso_fs_init(struct fs_info *fs)
 		       1 << blktosec, false);
     memcpy(&sbi->root, pvd + ROOT_DIR_OFFSET, sizeof(sbi->root));
 
+    joliet = iso_find_joliet(fs, pvd_lba, &joliet_root);
+
     /* Initialize the cache */
     cache_init(fs->fs_dev, fs->block_shift);
 
+    /* Prefer Rock Ridge names, then Joliet, then plain ISO 9660 */
+    sbi->names = ISO_NAMES_PLAIN;
+    sbi->susp_skip = 0;
+    if (iso_find_rockridge(fs)) {
+	sbi->names = ISO_NAMES_ROCKRIDGE;
+    } else if (joliet) {
+	sbi->names = ISO_NAMES_JOLIET;
+	sbi->root = joliet_root;
+    }
+    dprintf("iso: names %d\n", sbi->names);
+
     return fs->block_shift;
 }
 
@@ -290,12 +1115,14 @@ const struct fs_ops iso_fs_ops = {
     .fs_flags      = FS_USEMEM | FS_THISIND,
     .fs_init       = iso_fs_init,
     .searchdir     = NULL, 
-    .getfssec      = generic_getfssec,
+    .getfssec      = iso_getfssec,
     .close_file    = generic_close_file,
     .mangle_name   = generic_mangle_name,
     .load_config   = iso_load_config,
     .iget_root     = iso_iget_root,
     .iget          = iso_iget,
+    .readlink      = iso_readlink,
     .readdir       = iso_readdir,
-    .next_extent   = no_next_extent,
+    .next_extent   = iso_next_extent,
+    .free_inode    = iso_free_inode,
 };
@@ -3,6 +3,7 @@
 
 #include <klibc/compiler.h>
 #include <stdint.h>
+#include <zlib.h>
 
 /* Boot info table */
 struct iso_boot_info {
@@ -18,6 +19,13 @@ extern struct iso_boot_info iso_boot_info; /* In isolinux.asm */
 /* The root dir entry offset in the primary volume descriptor */
 #define ROOT_DIR_OFFSET   156
 
+/* Volume descriptors */
+#define ISO_VD_PRIMARY		1
+#define ISO_VD_SUPPLEMENTARY	2
+#define ISO_VD_END		255
+#define ISO_VD_MAX		32	/* Give up looking after this many */
+#define ISO_VD_ESCAPE_OFFSET	88	/* Escape sequences of an SVD */
+
 struct iso_dir_entry {
     uint8_t length;                         /* 00 */
     uint8_t ext_attr_length;                /* 01 */    
@@ -35,8 +43,89 @@ struct iso_dir_entry {
     char    name[0];                        /* 21 */
 } __packed;
 
+/* Directory record flags */
+#define ISO_FLAG_DIR		0x02
+#define ISO_FLAG_MULTI_EXTENT	0x80	/* Not the last record of the file */
+
+/* Which names the directory records are looked up and listed by */
+enum iso_names {
+    ISO_NAMES_PLAIN,		/* ISO 9660 names, case-folded */
+    ISO_NAMES_JOLIET,		/* Joliet UCS-2 names, from the SVD tree */
+    ISO_NAMES_ROCKRIDGE,	/* Rock Ridge NM names, where present */
+};
+
+/* System Use Sharing Protocol and Rock Ridge entries */
+#define SUSP_SIG(a, b)		((a) | ((b) << 8))
+#define SUSP_SP			SUSP_SIG('S', 'P')	/* SUSP indicator */
+#define SUSP_CE			SUSP_SIG('C', 'E')	/* Continuation area */
+#define SUSP_ST			SUSP_SIG('S', 'T')	/* Terminator */
+#define RRIP_NM			SUSP_SIG('N', 'M')	/* Alternate name */
+#define RRIP_SL			SUSP_SIG('S', 'L')	/* Symbolic link */
+#define RRIP_ZF			SUSP_SIG('Z', 'F')	/* zisofs compressed */
+
+#define SUSP_MAX_CE		16	/* Continuation areas followed per record */
+
+/* NM and SL flags, and SL component flags */
+#define RRIP_CONTINUE		0x01
+#define RRIP_CURRENT		0x02
+#define RRIP_PARENT		0x04
+#define RRIP_ROOT		0x08
+
 struct iso_sb_info {
     struct iso_dir_entry root;
+    enum iso_names names;
+    uint8_t susp_skip;		/* Bytes to skip in every System Use area */
+};
+
+/*
+ * Name index of a directory: the directory records in directory order,
+ * and hash chains (in ascending slot order) through them, terminated
+ * by -1.
+ */
+struct iso_dir_slot {
+    uint32_t offset;		/* Byte offset of the record in the directory */
+    uint32_t hash;		/* Hash of the case-folded name */
+    int      next;		/* Next slot on the same chain */
+};
+
+struct iso_dir_index {
+    struct iso_dir_slot *slots;
+    int nslots, maxslots;
+    int *buckets;
+    uint32_t mask;		/* Number of buckets - 1 */
+};
+
+#define ISO_MIN_SLOTS		32	/* Initial size of a slot array */
+#define ISO_INDEX_LOOKUPS	2	/* Index a directory on this lookup */
+
+/*
+ * State of a zisofs compressed file: the block pointers, the last block
+ * decompressed, and a window of compressed data read ahead, so that the
+ * small compressed blocks are fetched with a few large reads.
+ */
+struct iso_zisofs {
+    uint32_t csize;		/* Size of the compressed file on disk */
+    uint32_t nblocks;
+    uint8_t  block_shift;
+    uint32_t *ptrs;		/* nblocks+1 block offsets, once read */
+    uint8_t  *buf;		/* The last block decompressed */
+    int32_t  block;		/* Which block is in buf, or -1 */
+    uint8_t  *cbuf;		/* Compressed data read ahead */
+    uint32_t cstart, clen;	/* File offset and length of cbuf contents */
+    z_stream zs;
+    bool     zs_init;
+};
+
+#define ZISOFS_READAHEAD	(256 << 10)	/* Size of the read-ahead window */
+
+/*
+ * One extent of a file recorded in several directory records, as files
+ * of 4 GiB or more have to be; lstart and len are in sectors.
+ */
+struct iso_extent {
+    uint32_t lstart;
+    uint32_t lba;
+    uint32_t len;
 };
 
 /*
@@ -44,8 +133,20 @@ struct iso_sb_info {
  */
 struct iso9660_pvt_inode {
     uint32_t lba;		/* Starting LBA of file data area*/
+    struct iso_dir_index *dindex; /* Name index, if looked up in twice */
+    int lookups;
+    char *link;			/* Rock Ridge symlink target */
+    struct iso_zisofs *zf;	/* zisofs state, for a compressed file */
+    struct iso_extent *extents;	/* All extents, for a multi-extent file */
+    int nextents;
 };
 
 #define PVT(i) ((struct iso9660_pvt_inode *)((i)->pvt))
 
+/* zisofs.c */
+int zisofs_parse_header(const uint8_t *hdr, uint32_t *size,
+			unsigned int *header_size, unsigned int *block_shift);
+int zisofs_inflate_block(z_stream *zs, const void *in, uint32_t in_len,
+			 void *out, uint32_t out_len);
+
 #endif /* iso9660_fs.h */
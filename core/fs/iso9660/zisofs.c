@@ -0,0 +1,73 @@
+/*
+ * zisofs.c
+ *
+ * Decoding of zisofs ("pz") compressed files, as made by mkzftree and
+ * marked with a Rock Ridge ZF entry.  A compressed file starts with a
+ * 16-byte header, followed by a table of nblocks+1 little-endian file
+ * offsets, one per block of uncompressed data; block i is the zlib
+ * stream between offsets i and i+1, and a zero-length block is all
+ * zeroes.
+ *
+ * These routines only look at the buffers they are handed, so they can
+ * also be built into host-side test programs (see utils/zisofsbench.c).
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+static const uint8_t zisofs_magic[8] = {
+    0x37, 0xe4, 0x53, 0x96, 0xc9, 0xdb, 0xd6, 0x07
+};
+
+/*
+ * Check the header of a compressed file and return its uncompressed
+ * size, the size of the header in bytes and the log2 of the block
+ * size; returns 0 on success or -1 if this is not a usable zisofs file.
+ */
+int zisofs_parse_header(const uint8_t *hdr, uint32_t *size,
+			unsigned int *header_size, unsigned int *block_shift)
+{
+    if (memcmp(hdr, zisofs_magic, sizeof zisofs_magic))
+	return -1;
+
+    *size = hdr[8] + (hdr[9] << 8) + (hdr[10] << 16) +
+	((uint32_t)hdr[11] << 24);
+    *header_size = hdr[12] << 2;
+    *block_shift = hdr[13];
+
+    if (*header_size < 16 || *block_shift < 15 || *block_shift > 17)
+	return -1;
+
+    return 0;
+}
+
+/*
+ * Decompress one block into out_len bytes at out, using a z_stream
+ * set up once with inflateInit(); returns the decompressed length,
+ * which is out_len unless the data is corrupt, or -1.
+ */
+int zisofs_inflate_block(z_stream *zs, const void *in, uint32_t in_len,
+			 void *out, uint32_t out_len)
+{
+    int rv;
+
+    if (!in_len) {
+	memset(out, 0, out_len);
+	return out_len;
+    }
+
+    if (inflateReset(zs) != Z_OK)
+	return -1;
+
+    zs->next_in = (Bytef *)in;
+    zs->avail_in = in_len;
+    zs->next_out = (Bytef *)out;
+    zs->avail_out = out_len;
+
+    rv = inflate(zs, Z_FINISH);
+    if (rv != Z_STREAM_END && zs->avail_out)
+	return -1;
+
+    return out_len - zs->avail_out;
+}
@@ -17,8 +17,6 @@
  * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 */
 
-/* Note: No support for compressed files */
-
 #include <dprintf.h>
 #include <stdio.h>
 #include <string.h>
@@ -30,6 +28,7 @@
 #include <ilog2.h>
 #include <klibc/compiler.h>
 #include <ctype.h>
+#include <minmax.h>
 
 #include "codepage.h"
 #include "ntfs.h"
@@ -299,32 +298,101 @@ static struct ntfs_mft_record *ntfs_mft_record_lookup_3_1(struct fs_info *fs,
     return NULL;
 }
 
-static bool ntfs_filename_cmp(const char *dname, struct ntfs_idx_entry *ie)
+/*
+ * Look up a fixed-up MFT record through the MFT record cache.  Like the
+ * version-dependent lookups, this returns a malloc()ed record which the
+ * caller has to free.
+ */
+static struct ntfs_mft_record *ntfs_mft_record_lookup(struct fs_info *fs,
+                                                uint32_t file, block_t *blk)
 {
-    const uint16_t *entry_fn;
-    uint8_t entry_fn_len;
-    unsigned i;
+    struct ntfs_sb_info *sbi = NTFS_SB(fs);
+    struct ntfs_mft_cache *mc, *victim = sbi->mft_cache;
+    struct ntfs_mft_record *mrec;
+    block_t start_blk = 0;
+    int i;
 
-    dprintf("in %s()\n", __func__);
+    for (i = 0; i < NTFS_MFT_CACHE_ENTRIES; i++) {
+        mc = &sbi->mft_cache[i];
+        if (mc->lru && mc->mft_no == file)
+            goto found;
+        if (mc->lru < victim->lru)
+            victim = mc;
+    }
 
-    entry_fn = ie->key.file_name.file_name;
-    entry_fn_len = ie->key.file_name.file_name_len;
+    mrec = sbi->mft_record_lookup(fs, file, &start_blk);
+    if (!mrec)
+        return NULL;
 
-    if (strlen(dname) != entry_fn_len)
-        return false;
+    /* The cache takes over the record buffer */
+    mc = victim;
+    free(mc->data);
+    mc->data = (uint8_t *)mrec;
+    mc->mft_no = file;
+    mc->blk = start_blk;
 
-    /* Do case-sensitive compares for Posix file names */
-    if (ie->key.file_name.file_name_type == FILE_NAME_POSIX) {
-        for (i = 0; i < entry_fn_len; i++)
-            if (entry_fn[i] != dname[i])
-                return false;
-    } else {
-        for (i = 0; i < entry_fn_len; i++)
-            if (tolower(entry_fn[i]) != tolower(dname[i]))
-                return false;
+found:
+    mc->lru = ++sbi->mft_cache_lru;
+    if (blk)
+        *blk = mc->blk;
+
+    mrec = malloc(sbi->mft_record_size);
+    if (!mrec)
+        malloc_error("MFT record");
+
+    memcpy(mrec, mc->data, sbi->mft_record_size);
+
+    return mrec;
+}
+
+static void ntfs_mft_cache_flush(struct ntfs_sb_info *sbi)
+{
+    int i;
+
+    for (i = 0; i < NTFS_MFT_CACHE_ENTRIES; i++) {
+        free(sbi->mft_cache[i].data);
+        sbi->mft_cache[i].data = NULL;
+        sbi->mft_cache[i].lru = 0;
     }
+}
+
+/* Upcase a UTF-16 character, for collating names in directory indexes */
+static inline uint16_t ntfs_upcase(const struct ntfs_sb_info *sbi, uint16_t c)
+{
+    if (sbi->upcase && c < sbi->upcase_len)
+        return sbi->upcase[c];
 
-    return true;
+    /* Without $UpCase, only fold ASCII */
+    return c < 0x80 ? toupper(c) : c;
+}
+
+/* Compare two UTF-16 names, either ignoring case or by raw character
+ * values, the way the entries of a $FILE_NAME index are sorted.
+ *
+ * return < 0, 0 or > 0 if name a sorts before, equal to or after name b.
+ */
+static int ntfs_collate_names(const struct ntfs_sb_info *sbi,
+                            const uint16_t *a, unsigned a_len,
+                            const uint16_t *b, unsigned b_len,
+                            bool ignore_case)
+{
+    unsigned len = a_len < b_len ? a_len : b_len;
+    uint16_t ca, cb;
+    unsigned i;
+
+    for (i = 0; i < len; i++) {
+        ca = a[i];
+        cb = b[i];
+        if (ignore_case) {
+            ca = ntfs_upcase(sbi, ca);
+            cb = ntfs_upcase(sbi, cb);
+        }
+
+        if (ca != cb)
+            return ca < cb ? -1 : 1;
+    }
+
+    return a_len < b_len ? -1 : a_len > b_len;
 }
 
 static inline uint8_t *mapping_chunk_init(struct ntfs_attr_record *attr,
@@ -352,7 +420,6 @@ static int parse_data_run(const void *stream, uint32_t *offset,
     uint8_t *byte;
     int byte_shift = 8;
     int mask;
-    uint8_t val;
     int64_t res;
 
     (void)attr_len;
@@ -380,12 +447,10 @@ static int parse_data_run(const void *stream, uint32_t *offset,
     byte = (uint8_t *)buf + v;
     count = v;
 
+    /* the length is unsigned */
     res = 0LL;
-    while (count--) {
-        val = *byte--;
-        mask = val >> (byte_shift - 1);
-        res = (res << byte_shift) | ((val + mask) ^ mask);
-    }
+    while (count--)
+        res = (res << byte_shift) | *byte--;
 
     chunk->len = res;   /* get length data */
 
@@ -394,15 +459,17 @@ static int parse_data_run(const void *stream, uint32_t *offset,
 
     mask = 0xFFFFFFFF;
     res = 0LL;
-    if (*byte & 0x80)
+    if (l && (*byte & 0x80))
         res |= (int64_t)mask;   /* sign-extend it */
 
     while (count--)
         res = (res << byte_shift) | *byte--;
 
     chunk->lcn += res;
-    /* are VCNS from cur_vcn to next_vcn - 1 unallocated ? */
-    if (!chunk->lcn)
+    /* a run without an LCN offset is sparse: VCNs from cur_vcn to
+     * next_vcn - 1 are unallocated
+     */
+    if (!l)
         chunk->flags |= MAP_UNALLOCATED;
     else
         chunk->flags |= MAP_ALLOCATED;
@@ -415,6 +482,42 @@ out:
     return -1;
 }
 
+/* Decode the mapping pairs of a non-resident attribute into a runlist.
+ * Sparse runs are kept, with RUNLIST_LCN_HOLE as their LCN.
+ *
+ * return 0 on success or -1 on failure.
+ */
+static int ntfs_decode_runlist(struct ntfs_attr_record *attr,
+                                struct runlist *rlist)
+{
+    uint8_t *attr_len = (uint8_t *)attr + attr->len;
+    struct mapping_chunk chunk;
+    struct runlist_element run;
+    uint32_t offset;
+    uint8_t *stream;
+
+    stream = mapping_chunk_init(attr, &chunk, &offset);
+    for (;;) {
+        if (parse_data_run(stream, &offset, attr_len, &chunk)) {
+            printf("parse_data_run()\n");
+            runlist_free(rlist);
+            return -1;
+        }
+
+        if (chunk.flags & MAP_END)
+            break;
+
+        run.vcn = chunk.vcn;
+        run.lcn = chunk.flags & MAP_ALLOCATED ? chunk.lcn : RUNLIST_LCN_HOLE;
+        run.len = chunk.len;
+        runlist_append(rlist, &run);
+
+        chunk.vcn += chunk.len;     /* update for next VCN */
+    }
+
+    return 0;
+}
+
 static struct ntfs_mft_record *
 ntfs_attr_list_lookup(struct fs_info *fs, struct ntfs_attr_record *attr,
                       uint32_t type, struct ntfs_mft_record *mrec)
@@ -521,7 +624,7 @@ found:
     if (mrec->mft_record_no == attr_entry->mft_ref)
         return mrec;
 
-    retval = NTFS_SB(fs)->mft_record_lookup(fs, attr_entry->mft_ref,
+    retval = ntfs_mft_record_lookup(fs, attr_entry->mft_ref,
                                             &start_blk);
     if (!retval) {
         printf("No MFT record found!\n");
@@ -625,15 +728,10 @@ static int index_inode_setup(struct fs_info *fs, unsigned long mft_no,
     struct ntfs_mft_record *mrec, *lmrec;
     struct ntfs_attr_record *attr;
     enum dirent_type d_type;
-    uint8_t *attr_len;
-    struct mapping_chunk chunk;
-    int err;
-    uint8_t *stream;
-    uint32_t offset;
 
     dprintf("in %s()\n", __func__);
 
-    mrec = NTFS_SB(fs)->mft_record_lookup(fs, mft_no, &start_blk);
+    mrec = ntfs_mft_record_lookup(fs, mft_no, &start_blk);
     if (!mrec) {
         printf("No MFT record found.\n");
         goto out;
@@ -686,35 +784,34 @@ static int index_inode_setup(struct fs_info *fs, unsigned long mft_no,
                 (uint32_t)((uint8_t *)attr + attr->data.resident.value_offset);
             inode->size = attr->data.resident.value_len;
         } else {
-            attr_len = (uint8_t *)attr + attr->len;
-
-            stream = mapping_chunk_init(attr, &chunk, &offset);
-            NTFS_PVT(inode)->data.non_resident.rlist = NULL;
-            for (;;) {
-                err = parse_data_run(stream, &offset, attr_len, &chunk);
-                if (err) {
-                    printf("parse_data_run()\n");
-                    goto out;
-                }
+            if (ntfs_decode_runlist(attr,
+                                    &NTFS_PVT(inode)->data.non_resident.rlist))
+                goto out;
 
-                if (chunk.flags & MAP_UNALLOCATED)
-                    continue;
-                if (chunk.flags & MAP_END)
-                    break;
-                if (chunk.flags &  MAP_ALLOCATED) {
-                    /* append new run to the runlist */
-                    runlist_append(&NTFS_PVT(inode)->data.non_resident.rlist,
-                                    (struct runlist_element *)&chunk);
-                    /* update for next VCN */
-                    chunk.vcn += chunk.len;
-                }
+            if (runlist_is_empty(&NTFS_PVT(inode)->data.non_resident.rlist)) {
+                printf("No mapping found\n");
+                goto out;
             }
 
-            if (runlist_is_empty(NTFS_PVT(inode)->data.non_resident.rlist)) {
-                printf("No mapping found\n");
+            if (attr->flags & ATTR_IS_ENCRYPTED) {
+                printf("Encrypted files are not supported.\n");
                 goto out;
             }
 
+            if ((attr->flags & ATTR_IS_COMPRESSED) &&
+                attr->data.non_resident.compression_unit) {
+                if ((NTFS_SB(fs)->clust_size <<
+                     attr->data.non_resident.compression_unit) >
+                    NTFS_MAX_CU_SIZE) {
+                    printf("Unsupported compression unit size.\n");
+                    goto out;
+                }
+
+                NTFS_PVT(inode)->cu_shift =
+                    attr->data.non_resident.compression_unit;
+                NTFS_PVT(inode)->cu_vcn = -1;
+            }
+
             inode->size = attr->data.non_resident.initialized_size;
         }
     }
@@ -731,31 +828,148 @@ out:
     return -1;
 }
 
+/* Search a single node of a directory index for a name.  The entries
+ * of a node are sorted, so stop at the first one sorting after the name:
+ * if the name is anywhere in the tree below, it is in that entry's child.
+ *
+ * Posix names differing only in case are ordered by their raw characters,
+ * and that order decides where to stop.  A Posix name that only matches
+ * case-insensitively is left in *fold (if *fold is still 0: record 0 is
+ * $MFT, which has no Posix name), for use if no exact match turns up.
+ *
+ * return 1 and the entry in *match if found, 0 and the VCN of the child
+ * node to descend into (or -1 for none) in *vcn if not found, or -1 if
+ * the node is corrupt.
+ */
+static int ntfs_idx_node_search(struct fs_info *fs,
+                                struct ntfs_idx_header *index,
+                                const uint16_t *name, unsigned len,
+                                struct ntfs_idx_entry **match, int64_t *vcn,
+                                uint64_t *fold)
+{
+    const struct ntfs_sb_info *sbi = NTFS_SB(fs);
+    uint8_t *end = (uint8_t *)index + index->index_len;
+    struct ntfs_idx_entry *ie;
+    struct ntfs_filename_attr *fn;
+    const uint16_t *fn_name;
+    int cmp;
+
+    ie = (struct ntfs_idx_entry *)((uint8_t *)index + index->entries_offset);
+    for (;; ie = (struct ntfs_idx_entry *)((uint8_t *)ie + ie->len)) {
+        /* bounds checks */
+        if ((uint8_t *)ie < (uint8_t *)index ||
+            (uint8_t *)ie + sizeof(struct ntfs_idx_entry_header) > end ||
+            ie->len < sizeof(struct ntfs_idx_entry_header) ||
+            (uint8_t *)ie + ie->len > end)
+            return -1;
+
+        /* last entry cannot contain a key. it can however contain
+         * a pointer to a child node in the B+ tree
+         */
+        if (ie->flags & INDEX_ENTRY_END)
+            break;
+
+        fn = &ie->key.file_name;
+        if (ie->len < sizeof(struct ntfs_idx_entry_header) + sizeof *fn ||
+            ie->len < sizeof(struct ntfs_idx_entry_header) + sizeof *fn +
+            (fn->file_name_len << 1))
+            return -1;
+
+        fn_name = (const uint16_t *)(fn + 1);
+        cmp = ntfs_collate_names(sbi, name, len, fn_name, fn->file_name_len,
+                                true);
+        if (!cmp) {
+            if (fn->file_name_type != FILE_NAME_POSIX)
+                goto found;
+
+            cmp = ntfs_collate_names(sbi, name, len, fn_name,
+                                    fn->file_name_len, false);
+            if (!cmp)
+                goto found;
+
+            if (!*fold)
+                *fold = ie->data.dir.indexed_file;
+        }
+
+        if (cmp < 0)
+            break;
+    }
+
+    *vcn = -1;
+    if (ie->flags & INDEX_ENTRY_NODE) {
+        if (ie->len < sizeof(struct ntfs_idx_entry_header) + sizeof *vcn)
+            return -1;
+
+        /* the child node VCN is in the last 8 bytes of the entry */
+        *vcn = *(int64_t *)((uint8_t *)ie + ie->len - sizeof *vcn);
+    }
+
+    return 0;
+
+found:
+    *match = ie;
+
+    return 1;
+}
+
+/* Read the index record at a given LCN.  Index records are one FS block
+ * in size, but are only cluster aligned, so one can straddle two blocks.
+ */
+static int ntfs_read_idx_record(struct fs_info *fs, uint8_t *buf, int64_t lcn)
+{
+    const uint32_t blk_size = BLOCK_SIZE(fs);
+    uint64_t pos = (uint64_t)lcn << NTFS_SB(fs)->clust_byte_shift;
+    block_t blk = pos >> BLOCK_SHIFT(fs);
+    uint32_t offset = pos & (blk_size - 1);
+    const uint8_t *data;
+
+    data = get_cache(fs->fs_dev, blk);
+    if (!data)
+        return -1;
+
+    memcpy(buf, data + offset, blk_size - offset);
+    if (offset) {
+        data = get_cache(fs->fs_dev, blk + 1);
+        if (!data)
+            return -1;
+
+        memcpy(buf + blk_size - offset, data, offset);
+    }
+
+    return 0;
+}
+
 static struct inode *ntfs_index_lookup(const char *dname, struct inode *dir)
 {
     struct fs_info *fs = dir->fs;
     struct ntfs_mft_record *mrec, *lmrec;
-    block_t blk;
-    uint64_t blk_offset;
     struct ntfs_attr_record *attr;
     struct ntfs_idx_root *ir;
     struct ntfs_idx_entry *ie;
     const uint64_t blk_size = UINT64_C(1) << BLOCK_SHIFT(fs);
     uint8_t buf[blk_size];
     struct ntfs_idx_allocation *iblk;
+    uint16_t name[NTFS_MAX_FILE_NAME_LEN];
+    unsigned len;
     int err;
-    uint8_t *stream;
-    uint8_t *attr_len;
-    struct mapping_chunk chunk;
-    uint32_t offset;
+    int depth;
+    struct runlist *rlist;
+    struct runlist_element *run;
     int64_t vcn;
-    int64_t lcn;
-    int64_t last_lcn;
+    uint64_t mft_ref, fold = 0;
     struct inode *inode;
 
     dprintf("in %s()\n", __func__);
 
-    mrec = NTFS_SB(fs)->mft_record_lookup(fs, NTFS_PVT(dir)->mft_no, NULL);
+    /* Convert the name to UTF-16 once, rather than on every compare */
+    for (len = 0; dname[len]; len++) {
+        if (len == NTFS_MAX_FILE_NAME_LEN)
+            return NULL;
+
+        name[len] = codepage.uni[0][(uint8_t)dname[len]];
+    }
+
+    mrec = ntfs_mft_record_lookup(fs, NTFS_PVT(dir)->mft_no, NULL);
     if (!mrec) {
         printf("No MFT record found.\n");
         goto out;
@@ -770,112 +984,81 @@ static struct inode *ntfs_index_lookup(const char *dname, struct inode *dir)
 
     ir = (struct ntfs_idx_root *)((uint8_t *)attr +
                             attr->data.resident.value_offset);
-    ie = (struct ntfs_idx_entry *)((uint8_t *)&ir->index +
-                                ir->index.entries_offset);
-    for (;; ie = (struct ntfs_idx_entry *)((uint8_t *)ie + ie->len)) {
-        /* bounds checks */
-        if ((uint8_t *)ie < (uint8_t *)mrec ||
-            (uint8_t *)ie + sizeof(struct ntfs_idx_entry_header) >
-            (uint8_t *)&ir->index + ir->index.index_len ||
-            (uint8_t *)ie + ie->len >
-            (uint8_t *)&ir->index + ir->index.index_len)
-            goto index_err;
+    if ((uint8_t *)&ir->index + ir->index.index_len >
+        (uint8_t *)attr + attr->len)
+        goto index_err;
 
-        /* last entry cannot contain a key. it can however contain
-         * a pointer to a child node in the B+ tree so we just break out
-         */
-        if (ie->flags & INDEX_ENTRY_END)
-            break;
-
-        if (ntfs_filename_cmp(dname, ie))
-            goto found;
-    }
+    err = ntfs_idx_node_search(fs, &ir->index, name, len, &ie, &vcn, &fold);
+    if (err < 0)
+        goto index_err;
+    if (err)
+        goto found;
 
     /* check for the presence of a child node */
-    if (!(ie->flags & INDEX_ENTRY_NODE)) {
-        printf("No child node, aborting...\n");
-        goto out;
-    }
+    if (vcn < 0)
+        goto not_found;
 
-    /* then descend into child node */
+    /* then descend into child nodes, one index block per tree level */
 
-    attr = ntfs_attr_lookup(fs, NTFS_AT_INDEX_ALLOCATION, &mrec, lmrec);
-    if (!attr) {
-        printf("No attribute found.\n");
-        goto out;
-    }
+    rlist = &NTFS_PVT(dir)->idx_rlist;
+    if (runlist_is_empty(rlist)) {
+        attr = ntfs_attr_lookup(fs, NTFS_AT_INDEX_ALLOCATION, &mrec, lmrec);
+        if (!attr) {
+            printf("No attribute found.\n");
+            goto out;
+        }
 
-    if (!attr->non_resident) {
-        printf("WTF ?! $INDEX_ALLOCATION isn't really resident.\n");
-        goto out;
-    }
+        if (!attr->non_resident) {
+            printf("WTF ?! $INDEX_ALLOCATION isn't really resident.\n");
+            goto out;
+        }
 
-    attr_len = (uint8_t *)attr + attr->len;
-    stream = mapping_chunk_init(attr, &chunk, &offset);
-    do {
-        err = parse_data_run(stream, &offset, attr_len, &chunk);
-        if (err)
-            break;
+        if (ntfs_decode_runlist(attr, rlist))
+            goto out;
+    }
 
-        if (chunk.flags & MAP_UNALLOCATED)
-            continue;
+    iblk = (struct ntfs_idx_allocation *)buf;
+    for (depth = 0; vcn >= 0; depth++) {
+        if (depth == NTFS_MAX_INDEX_DEPTH)
+            goto index_err;
 
-        if (chunk.flags & MAP_ALLOCATED) {
-            dprintf("%d cluster(s) starting at 0x%08llX\n", chunk.len,
-                    chunk.lcn);
+        run = runlist_lookup(rlist, vcn);
+        if (!run)
+            goto index_err;
 
-            vcn = 0;
-            lcn = chunk.lcn;
-            while (vcn < chunk.len) {
-                blk = (lcn + vcn) << NTFS_SB(fs)->clust_shift <<
-                    SECTOR_SHIFT(fs) >> BLOCK_SHIFT(fs);
+        dprintf("Index block VCN 0x%llX at LCN 0x%llX\n", vcn,
+                run->lcn + (vcn - run->vcn));
 
-                blk_offset = 0;
-                last_lcn = lcn;
-                lcn += vcn;
-                err = ntfs_read(fs, &buf, blk_size, blk_size, &blk,
-                                &blk_offset, NULL, (uint64_t *)&lcn);
-                if (err) {
-                    printf("Error while reading from cache.\n");
-                    goto not_found;
-                }
+        if (ntfs_read_idx_record(fs, buf, run->lcn + (vcn - run->vcn))) {
+            printf("Error while reading from cache.\n");
+            goto out;
+        }
 
-                ntfs_fixups_writeback(fs, (struct ntfs_record *)&buf);
+        ntfs_fixups_writeback(fs, (struct ntfs_record *)buf);
 
-                iblk = (struct ntfs_idx_allocation *)&buf;
-                if (iblk->magic != NTFS_MAGIC_INDX) {
-                    printf("Not a valid INDX record.\n");
-                    goto not_found;
-                }
+        if (iblk->magic != NTFS_MAGIC_INDX) {
+            printf("Not a valid INDX record.\n");
+            goto out;
+        }
 
-                ie = (struct ntfs_idx_entry *)((uint8_t *)&iblk->index +
-                                            iblk->index.entries_offset);
-                for (;; ie = (struct ntfs_idx_entry *)((uint8_t *)ie +
-                        ie->len)) {
-                    /* bounds checks */
-                    if ((uint8_t *)ie < (uint8_t *)iblk || (uint8_t *)ie +
-                        sizeof(struct ntfs_idx_entry_header) >
-                        (uint8_t *)&iblk->index + iblk->index.index_len ||
-                        (uint8_t *)ie + ie->len >
-                        (uint8_t *)&iblk->index + iblk->index.index_len)
-                        goto index_err;
-
-                    /* last entry cannot contain a key */
-                    if (ie->flags & INDEX_ENTRY_END)
-                        break;
-
-                    if (ntfs_filename_cmp(dname, ie))
-                        goto found;
-                }
+        if ((uint8_t *)&iblk->index + iblk->index.index_len > buf + blk_size)
+            goto index_err;
 
-                lcn = last_lcn; /* restore the original LCN */
-                /* go to the next VCN */
-                vcn += (blk_size / (1 << NTFS_SB(fs)->clust_byte_shift));
-            }
-        }
-    } while (!(chunk.flags & MAP_END));
+        err = ntfs_idx_node_search(fs, &iblk->index, name, len, &ie, &vcn,
+                                   &fold);
+        if (err < 0)
+            goto index_err;
+        if (err)
+            goto found;
+    }
 
 not_found:
+    /* No exact match: settle for a Posix name differing only in case */
+    if (fold) {
+        mft_ref = fold;
+        goto found_ref;
+    }
+
     dprintf("Index not found\n");
 
 out:
@@ -884,12 +1067,14 @@ out:
     return NULL;
 
 found:
+    mft_ref = ie->data.dir.indexed_file;
+found_ref:
     dprintf("Index found\n");
     inode = new_ntfs_inode(fs);
-    err = index_inode_setup(fs, ie->data.dir.indexed_file, inode);
+    err = index_inode_setup(fs, mft_ref, inode);
     if (err) {
         printf("Error in index_inode_setup()\n");
-        free(inode);
+        put_inode(inode);
         goto out;
     }
 
@@ -926,8 +1111,8 @@ static int ntfs_next_extent(struct inode *inode, uint32_t lstart)
     struct fs_info *fs = inode->fs;
     struct ntfs_sb_info *sbi = NTFS_SB(fs);
     sector_t pstart = 0;
-    struct runlist *rlist;
-    struct runlist *ret;
+    struct runlist_element *run;
+    uint64_t vcn;
     const uint32_t sec_size = SECTOR_SIZE(fs);
     const uint32_t sec_shift = SECTOR_SHIFT(fs);
 
@@ -938,37 +1123,263 @@ static int ntfs_next_extent(struct inode *inode, uint32_t lstart)
                 sec_shift;
         inode->next_extent.len = (inode->size + sec_size - 1) >> sec_shift;
     } else {
-        rlist = NTFS_PVT(inode)->data.non_resident.rlist;
+        vcn = lstart >> sbi->clust_shift;
+        run = runlist_lookup(&NTFS_PVT(inode)->data.non_resident.rlist, vcn);
+        if (!run)
+            goto out;
 
-        if (!lstart || lstart >= NTFS_PVT(inode)->here) {
-            if (runlist_is_empty(rlist))
-                goto out;   /* nothing to do ;-) */
+        /* lstart may be in the middle of a cluster */
+        if (run->lcn == RUNLIST_LCN_HOLE)
+            pstart = EXTENT_ZERO;
+        else
+            pstart = ((run->lcn + (vcn - run->vcn)) << sbi->clust_shift) +
+                    (lstart & sbi->clust_mask);
+        inode->next_extent.len =
+            ((run->vcn + run->len - vcn) << sbi->clust_shift) -
+            (lstart & sbi->clust_mask);
+    }
 
-            ret = runlist_remove(&rlist);
+    inode->next_extent.pstart = pstart;
 
-            NTFS_PVT(inode)->here =
-                ((ret->run.len << sbi->clust_byte_shift) >> sec_shift);
+    return 0;
 
-            pstart = ret->run.lcn << sbi->clust_shift;
-            inode->next_extent.len =
-                ((ret->run.len << sbi->clust_byte_shift) + sec_size - 1) >>
-                sec_shift;
+out:
+    return -1;
+}
+
+/* Decompress LZNT1 data: a sequence of chunks, each with a 16-bit
+ * header holding the chunk's size and whether it is compressed.  Every
+ * chunk but the last decompresses to NTFS_LZNT1_CHUNK_SIZE bytes.
+ *
+ * return the number of bytes decompressed, or -1 if the data is corrupt.
+ */
+static int ntfs_lznt1_decompress(uint8_t *dst, uint32_t dst_len,
+                                const uint8_t *src, uint32_t src_len)
+{
+    const uint8_t *src_end = src + src_len;
+    const uint8_t *chunk_end;
+    uint8_t *out = dst;
+    uint8_t *dst_end = dst + dst_len;
+    uint8_t *chunk_start, *out_end;
+    uint16_t hdr, token;
+    uint8_t tags;
+    unsigned shift, len, disp, pos;
+    int i;
+
+    while (src + 2 <= src_end && out < dst_end) {
+        hdr = src[0] | (src[1] << 8);
+        if (!hdr)
+            break;              /* end of the compressed data */
+
+        src += 2;
+        chunk_end = src + (hdr & 0x0FFF) + 1;
+        if (chunk_end > src_end)
+            return -1;
+
+        chunk_start = out;
+        out_end = min(chunk_start + NTFS_LZNT1_CHUNK_SIZE, dst_end);
+
+        if (!(hdr & 0x8000)) {
+            /* stored uncompressed */
+            len = chunk_end - src;
+            if (len > (unsigned)(out_end - out))
+                return -1;
+
+            memcpy(out, src, len);
+            out += len;
+            src = chunk_end;
+            continue;
+        }
 
-            NTFS_PVT(inode)->data.non_resident.rlist = rlist;
+        while (src < chunk_end) {
+            tags = *src++;
+            for (i = 0; i < 8 && src < chunk_end; i++, tags >>= 1) {
+                if (!(tags & 1)) {
+                    /* a literal byte */
+                    if (out >= out_end)
+                        return -1;
 
-            free(ret);
-            ret = NULL;
+                    *out++ = *src++;
+                    continue;
+                }
+
+                /* a back reference; the further into the chunk, the more
+                 * bits of the token go to the displacement
+                 */
+                if (src + 2 > chunk_end || out == chunk_start)
+                    return -1;
+
+                token = src[0] | (src[1] << 8);
+                src += 2;
+
+                shift = 12;
+                for (pos = out - chunk_start - 1; pos >= 0x10; pos >>= 1)
+                    shift--;
+
+                disp = (token >> shift) + 1;
+                len = (token & ((1 << shift) - 1)) + 3;
+                if (disp > (unsigned)(out - chunk_start) ||
+                    len > (unsigned)(out_end - out))
+                    return -1;
+
+                /* the copy may overlap itself, so go byte by byte */
+                while (len--) {
+                    *out = out[-(int)disp];
+                    out++;
+                }
+            }
         }
+
+        /* a chunk that ends early is padded with zeroes */
+        memset(out, 0, out_end - out);
+        out = out_end;
     }
 
-    inode->next_extent.pstart = pstart;
+    return out - dst;
+}
+
+/* Count the allocated clusters at the start of a compression unit */
+static uint64_t ntfs_cu_allocated(struct inode *inode, uint64_t cu_vcn)
+{
+    struct runlist *rlist = &NTFS_PVT(inode)->data.non_resident.rlist;
+    const uint64_t cu_end = cu_vcn + (1 << NTFS_PVT(inode)->cu_shift);
+    struct runlist_element *run;
+    uint64_t vcn = cu_vcn;
+
+    while (vcn < cu_end) {
+        run = runlist_lookup(rlist, vcn);
+        if (!run || run->lcn == RUNLIST_LCN_HOLE)
+            break;
+
+        vcn = min(run->vcn + run->len, cu_end);
+    }
+
+    return vcn - cu_vcn;
+}
+
+/* Make sure a compression unit is decompressed in the inode's unit
+ * buffer.  The last unit stays there, so sequential reads through it
+ * only decompress it once.  A unit with only some of its clusters
+ * allocated holds LZNT1 data in them; one with none reads as zeroes.
+ */
+static int ntfs_load_cu(struct inode *inode, uint64_t cu_vcn,
+                        uint64_t allocated)
+{
+    struct fs_info *fs = inode->fs;
+    struct ntfs_sb_info *sbi = NTFS_SB(fs);
+    struct ntfs_inode *pvt = NTFS_PVT(inode);
+    struct disk *disk = fs->fs_dev->disk;
+    const uint32_t cu_size = sbi->clust_size << pvt->cu_shift;
+    struct runlist_element *run;
+    uint64_t vcn, n;
+    uint8_t *cbuf = NULL;
+    int len = 0;
+
+    if (pvt->cu_vcn == (int64_t)cu_vcn)
+        return 0;
+
+    if (!pvt->cu_buf) {
+        pvt->cu_buf = malloc(cu_size);
+        if (!pvt->cu_buf)
+            malloc_error("NTFS compression unit buffer");
+    }
+    pvt->cu_vcn = -1;
+
+    if (allocated) {
+        cbuf = malloc(allocated << sbi->clust_byte_shift);
+        if (!cbuf)
+            malloc_error("NTFS compressed data");
+
+        for (vcn = cu_vcn; vcn < cu_vcn + allocated; vcn += n) {
+            run = runlist_lookup(&pvt->data.non_resident.rlist, vcn);
+            n = min(run->vcn + run->len, cu_vcn + allocated) - vcn;
+            if (disk->rdwr_sectors(disk,
+                        cbuf + ((vcn - cu_vcn) << sbi->clust_byte_shift),
+                        (run->lcn + (vcn - run->vcn)) << sbi->clust_shift,
+                        n << sbi->clust_shift, 0) !=
+                (int)(n << sbi->clust_shift))
+                goto err;
+        }
+
+        len = ntfs_lznt1_decompress(pvt->cu_buf, cu_size, cbuf,
+                                    allocated << sbi->clust_byte_shift);
+        if (len < 0) {
+            printf("Corrupt LZNT1 compressed data.\n");
+            goto err;
+        }
+
+        free(cbuf);
+    }
+
+    memset(pvt->cu_buf + len, 0, cu_size - len);
+    pvt->cu_vcn = cu_vcn;
 
     return 0;
 
-out:
+err:
+    free(cbuf);
+
     return -1;
 }
 
+/* Read a compressed $DATA attribute, one compression unit at a time.
+ * Units stored uncompressed are read straight from the disk.
+ */
+static uint32_t ntfs_getfssec_compressed(struct file *file, char *buf,
+                                        int sectors, bool *have_more)
+{
+    struct inode *inode = file->inode;
+    struct fs_info *fs = file->fs;
+    struct ntfs_sb_info *sbi = NTFS_SB(fs);
+    struct disk *disk = fs->fs_dev->disk;
+    const uint32_t sec_shift = SECTOR_SHIFT(fs);
+    const uint64_t cu_clusters = 1 << NTFS_PVT(inode)->cu_shift;
+    struct runlist_element *run;
+    uint64_t vcn, cu_vcn, allocated;
+    uint32_t skip, ret, bytes_read = 0;
+    sector_t pstart;
+
+    dprintf("in %s()\n", __func__);
+
+    while (sectors > 0 && file->offset < inode->size) {
+        vcn = file->offset >> sbi->clust_byte_shift;
+        cu_vcn = vcn & ~(cu_clusters - 1);
+        skip = file->offset - (cu_vcn << sbi->clust_byte_shift);
+        ret = min(inode->size - file->offset, (uint32_t)sectors << sec_shift);
+        ret = min(ret, (uint32_t)(cu_clusters << sbi->clust_byte_shift) - skip);
+
+        allocated = ntfs_cu_allocated(inode, cu_vcn);
+        if (allocated == cu_clusters) {
+            /* stored uncompressed, read up to the end of the run */
+            run = runlist_lookup(&NTFS_PVT(inode)->data.non_resident.rlist,
+                                vcn);
+            ret = min((uint64_t)ret, ((run->vcn + run->len) <<
+                                      sbi->clust_byte_shift) - file->offset);
+            pstart = ((run->lcn + (vcn - run->vcn)) << sbi->clust_shift) +
+                    ((file->offset >> sec_shift) & sbi->clust_mask);
+            if (disk->rdwr_sectors(disk, buf, pstart,
+                                   (ret + SECTOR_SIZE(fs) - 1) >> sec_shift,
+                                   0) <= 0)
+                break;
+        } else {
+            if (ntfs_load_cu(inode, cu_vcn, allocated))
+                break;
+
+            memcpy(buf, NTFS_PVT(inode)->cu_buf + skip, ret);
+        }
+
+        file->offset += ret;
+        buf += ret;
+        bytes_read += ret;
+        sectors -= (ret + SECTOR_SIZE(fs) - 1) >> sec_shift;
+    }
+
+    if (have_more)
+        *have_more = file->offset < inode->size;
+
+    return bytes_read;
+}
+
 static uint32_t ntfs_getfssec(struct file *file, char *buf, int sectors,
                                 bool *have_more)
 {
@@ -984,12 +1395,15 @@ static uint32_t ntfs_getfssec(struct file *file, char *buf, int sectors,
 
     non_resident = NTFS_PVT(inode)->non_resident;
 
+    if (non_resident && NTFS_PVT(inode)->cu_shift)
+        return ntfs_getfssec_compressed(file, buf, sectors, have_more);
+
     ret = generic_getfssec(file, buf, sectors, have_more);
     if (!ret)
         return ret;
 
     if (!non_resident) {
-        mrec = NTFS_SB(fs)->mft_record_lookup(fs, NTFS_PVT(inode)->mft_no,
+        mrec = ntfs_mft_record_lookup(fs, NTFS_PVT(inode)->mft_no,
                                               NULL);
         if (!mrec) {
             printf("No MFT record found.\n");
@@ -1042,17 +1456,15 @@ static int ntfs_readdir(struct file *file, struct dirent *dirent)
     uint8_t buf[BLOCK_SIZE(fs)];
     struct ntfs_idx_allocation *iblk;
     int err;
-    uint8_t *stream;
-    uint8_t *attr_len;
-    struct mapping_chunk chunk;
-    uint32_t offset;
+    struct runlist *rlist;
+    struct runlist_element *run;
     int64_t vcn;
     int64_t lcn;
     char filename[NTFS_MAX_FILE_NAME_LEN + 1];
 
     dprintf("in %s()\n", __func__);
 
-    mrec = NTFS_SB(fs)->mft_record_lookup(fs, NTFS_PVT(inode)->mft_no, NULL);
+    mrec = ntfs_mft_record_lookup(fs, NTFS_PVT(inode)->mft_no, NULL);
     if (!mrec) {
         printf("No MFT record found.\n");
         goto out;
@@ -1075,7 +1487,7 @@ static int ntfs_readdir(struct file *file, struct dirent *dirent)
 
 idx_root_next_entry:
     if (readdir_state->in_idx_root) {
-        ie = (struct ntfs_idx_entry *)(uint8_t *)file->offset;
+        ie = (struct ntfs_idx_entry *)(uintptr_t)file->offset;
         if (ie->flags & INDEX_ENTRY_END) {
             file->offset = 0;
             readdir_state->in_idx_root = false;
@@ -1106,38 +1518,24 @@ descend_into_child_node:
         goto out;
     }
 
-    attr_len = (uint8_t *)attr + attr->len;
+    rlist = &NTFS_PVT(inode)->idx_rlist;
+    if (runlist_is_empty(rlist) && ntfs_decode_runlist(attr, rlist))
+        goto out;
 
 next_run:
-    stream = mapping_chunk_init(attr, &chunk, &offset);
-    count = readdir_state->idx_blks_count;
-    while (count--) {
-        err = parse_data_run(stream, &offset, attr_len, &chunk);
-        if (err) {
-            printf("Error while parsing data runs.\n");
-            goto out;
-        }
-
-        if (chunk.flags & MAP_UNALLOCATED)
-            break;
-        if (chunk.flags & MAP_END)
-            goto out;
-    }
-
-    if (chunk.flags & MAP_UNALLOCATED) {
-       readdir_state->idx_blks_count++;
-       goto next_run;
-    }
+    if (readdir_state->idx_blks_count > rlist->count)
+        goto out;
+    run = &rlist->runs[readdir_state->idx_blks_count - 1];
 
 next_vcn:
     vcn = readdir_state->last_vcn;
-    if (vcn >= chunk.len) {
+    if (vcn >= run->len || run->lcn == RUNLIST_LCN_HOLE) {
         readdir_state->last_vcn = 0;
         readdir_state->idx_blks_count++;
         goto next_run;
     }
 
-    lcn = chunk.lcn;
+    lcn = run->lcn;
     blk = (lcn + vcn) << NTFS_SB(fs)->clust_shift << SECTOR_SHIFT(fs) >>
             BLOCK_SHIFT(fs);
 
@@ -1209,7 +1607,7 @@ done:
 
     free(mrec);
 
-    mrec = NTFS_SB(fs)->mft_record_lookup(fs, ie->data.dir.indexed_file, NULL);
+    mrec = ntfs_mft_record_lookup(fs, ie->data.dir.indexed_file, NULL);
     if (!mrec) {
         printf("No MFT record found.\n");
         goto out;
@@ -1231,11 +1629,87 @@ index_err:
     goto out;
 }
 
+static void ntfs_free_inode(struct inode *inode)
+{
+    if (NTFS_PVT(inode)->non_resident)
+        runlist_free(&NTFS_PVT(inode)->data.non_resident.rlist);
+
+    free(NTFS_PVT(inode)->cu_buf);
+
+    runlist_free(&NTFS_PVT(inode)->idx_rlist);
+}
+
 static inline struct inode *ntfs_iget(const char *dname, struct inode *parent)
 {
     return ntfs_index_lookup(dname, parent);
 }
 
+/* Load the $UpCase table, which directory indexes are collated with */
+static void ntfs_load_upcase(struct fs_info *fs)
+{
+    struct ntfs_sb_info *sbi = NTFS_SB(fs);
+    struct disk *disk = fs->fs_dev->disk;
+    struct ntfs_mft_record *mrec, *lmrec;
+    struct ntfs_attr_record *attr;
+    struct runlist rlist = { NULL, 0, 0 };
+    struct runlist_element *run;
+    uint64_t size, clusters;
+    uint8_t *buf = NULL;
+    size_t sectors;
+
+    dprintf("in %s()\n", __func__);
+
+    mrec = ntfs_mft_record_lookup(fs, FILE_UpCase, NULL);
+    if (!mrec)
+        goto out;
+
+    lmrec = mrec;
+    attr = ntfs_attr_lookup(fs, NTFS_AT_DATA, &mrec, lmrec);
+    if (!attr || !attr->non_resident)
+        goto out;
+
+    /* One entry for each of the 65536 UTF-16 code units */
+    size = attr->data.non_resident.data_size;
+    if (!size || size > 0x10000 << 1)
+        goto out;
+
+    if (ntfs_decode_runlist(attr, &rlist) || runlist_is_empty(&rlist))
+        goto out;
+
+    /* Runs are read in whole clusters, so size the buffer to match */
+    run = &rlist.runs[rlist.count - 1];
+    clusters = run->vcn + run->len;
+    if (clusters << sbi->clust_byte_shift < size)
+        goto out;
+
+    buf = zalloc(clusters << sbi->clust_byte_shift);
+    if (!buf)
+        malloc_error("$UpCase table");
+
+    for (run = rlist.runs; run < rlist.runs + rlist.count; run++) {
+        if (run->lcn == RUNLIST_LCN_HOLE)
+            continue;
+
+        sectors = run->len << sbi->clust_shift;
+        if (disk->rdwr_sectors(disk, buf + (run->vcn << sbi->clust_byte_shift),
+                               run->lcn << sbi->clust_shift, sectors, 0) !=
+            (int)sectors)
+            goto out;
+    }
+
+    sbi->upcase = (uint16_t *)buf;
+    sbi->upcase_len = size >> 1;
+    buf = NULL;
+
+out:
+    if (!sbi->upcase)
+        printf("No $UpCase table, only ASCII names collate correctly.\n");
+
+    free(buf);
+    runlist_free(&rlist);
+    free(mrec);
+}
+
 static struct inode *ntfs_iget_root(struct fs_info *fs)
 {
     uint64_t start_blk;
@@ -1249,7 +1723,7 @@ static struct inode *ntfs_iget_root(struct fs_info *fs)
 
     /* Fetch the $Volume MFT record */
     start_blk = 0;
-    mrec = NTFS_SB(fs)->mft_record_lookup(fs, FILE_Volume, &start_blk);
+    mrec = ntfs_mft_record_lookup(fs, FILE_Volume, &start_blk);
     if (!mrec) {
         printf("Could not fetch $Volume MFT record!\n");
         goto err_mrec;
@@ -1274,6 +1748,12 @@ static struct inode *ntfs_iget_root(struct fs_info *fs)
             mrec->mft_record_no == FILE_Volume)
         NTFS_SB(fs)->mft_record_lookup = ntfs_mft_record_lookup_3_1;
 
+    /* Records cached so far were looked up the 3.0 way */
+    ntfs_mft_cache_flush(NTFS_SB(fs));
+
+    if (!NTFS_SB(fs)->upcase)
+        ntfs_load_upcase(fs);
+
     /* Free MFT record */
     free(mrec);
     mrec = NULL;
@@ -1291,7 +1771,7 @@ static struct inode *ntfs_iget_root(struct fs_info *fs)
 
 err_setup:
 
-    free(inode);
+    put_inode(inode);
 err_attr:
 
     free(mrec);
@@ -1366,6 +1846,14 @@ static int ntfs_fs_init(struct fs_info *fs)
     sbi->minor_ver = 0;
     sbi->mft_record_lookup = ntfs_mft_record_lookup_3_0;
 
+    sbi->mft_cache = zalloc(NTFS_MFT_CACHE_ENTRIES * sizeof *sbi->mft_cache);
+    if (!sbi->mft_cache)
+        malloc_error("MFT record cache");
+    sbi->mft_cache_lru = 0;
+
+    sbi->upcase = NULL;
+    sbi->upcase_len = 0;
+
     /* Initialize the cache */
     cache_init(fs->fs_dev, BLOCK_SHIFT(fs));
 
@@ -1385,4 +1873,5 @@ const struct fs_ops ntfs_fs_ops = {
     .iget_root      = ntfs_iget_root,
     .iget           = ntfs_iget,
     .next_extent    = ntfs_next_extent,
+    .free_inode     = ntfs_free_inode,
 };
@@ -55,6 +55,16 @@ struct ntfs_mft_record;
 typedef struct ntfs_mft_record *f_mft_record_lookup(struct fs_info *,
                                                     uint32_t, block_t *);
 
+/* A fixed-up MFT record in the MFT record cache */
+struct ntfs_mft_cache {
+    unsigned long mft_no;           /* MFT record number */
+    block_t blk;                    /* Block the record starts in */
+    unsigned lru;                   /* Last use, 0 if the slot is empty */
+    uint8_t *data;
+};
+
+#define NTFS_MFT_CACHE_ENTRIES 16
+
 struct ntfs_sb_info {
     block_t mft_blk;                /* The first MFT record block */
     uint64_t mft_lcn;               /* LCN of the first MFT record */
@@ -75,6 +85,14 @@ struct ntfs_sb_info {
 
     /* NTFS-version-dependent MFT record lookup function to use */
     f_mft_record_lookup *mft_record_lookup;
+
+    /* Recently used MFT records (NTFS_MFT_CACHE_ENTRIES of them) */
+    struct ntfs_mft_cache *mft_cache;
+    unsigned mft_cache_lru;
+
+    /* The $UpCase table, used for index collation (NULL if not loaded) */
+    uint16_t *upcase;
+    uint32_t upcase_len;            /* Number of entries in the table */
 } __attribute__((__packed__));
 
 /* The NTFS in-memory inode structure */
@@ -90,9 +108,16 @@ struct ntfs_inode {
             uint32_t offset;    /* Data offset */
         } resident;
         struct {            /* Used only if non_resident is set */
-            struct runlist *rlist;
+            struct runlist rlist;
         } non_resident;
     } data;
+    struct runlist idx_rlist;   /* $INDEX_ALLOCATION runs of a directory */
+    /* Compressed $DATA only: log2 of the clusters per compression unit
+     * (zero if not compressed), and the last unit read, decompressed
+     */
+    uint8_t cu_shift;
+    uint8_t *cu_buf;
+    int64_t cu_vcn;             /* First VCN of the unit in cu_buf, or -1 */
     uint32_t start_cluster; /* Starting cluster address */
     sector_t start;         /* Starting sector */
     sector_t offset;        /* Current sector offset */
@@ -270,6 +295,20 @@ enum {
     ATTR_DEF_ALWAYS_LOG         = 0x80,
 };
 
+/* Attribute flags (16-bit) */
+enum {
+    ATTR_IS_COMPRESSED          = 0x0001,
+    ATTR_COMPRESSION_MASK       = 0x00FF,
+    ATTR_IS_ENCRYPTED           = 0x4000,
+    ATTR_IS_SPARSE              = 0x8000,
+};
+
+/* LZNT1 compresses data in chunks of this many bytes */
+#define NTFS_LZNT1_CHUNK_SIZE 4096
+
+/* Windows only compresses with clusters up to 4 KiB, 16 to a unit */
+#define NTFS_MAX_CU_SIZE (64 << 10)
+
 struct ntfs_attr_record {
     uint32_t type;      /* Attr. type code */
     uint32_t len;
@@ -319,6 +358,9 @@ struct ntfs_attr_list_entry {
 
 #define NTFS_MAX_FILE_NAME_LEN 255
 
+/* Maximum depth of a directory index B+tree we are willing to descend */
+#define NTFS_MAX_INDEX_DEPTH 32
+
 /* Possible namespaces for filenames in ntfs (8-bit) */
 enum {
     FILE_NAME_POSIX             = 0x00,
@@ -20,64 +20,78 @@
 #ifndef _RUNLIST_H_
 #define _RUNLIST_H_
 
+#include <stdint.h>
+#include <string.h>
+#include <core.h>
+#include <fs.h>
+
+#define RUNLIST_MIN_RUNS 8  /* Initial size of a run array */
+#define RUNLIST_LCN_HOLE ((int64_t)-1)  /* LCN of a sparse run */
+
 struct runlist_element {
     uint64_t vcn;
     int64_t lcn;
     uint64_t len;
 };
 
+/* The runs of an attribute, decoded once and sorted by VCN */
 struct runlist {
-    struct runlist_element run;
-    struct runlist *next;
+    struct runlist_element *runs;
+    unsigned count, max;
 };
 
-static struct runlist *tail;
-
-static inline bool runlist_is_empty(struct runlist *rlist)
+static inline bool runlist_is_empty(const struct runlist *rlist)
 {
-    return !rlist;
+    return !rlist->count;
 }
 
-static inline struct runlist *runlist_alloc(void)
+static inline void runlist_append(struct runlist *rlist,
+                                const struct runlist_element *elem)
 {
-    struct runlist *rlist;
-
-    rlist = malloc(sizeof *rlist);
-    if (!rlist)
-        malloc_error("runlist structure");
-
-    rlist->next = NULL;
+    struct runlist_element *runs;
+
+    if (rlist->count == rlist->max) {
+        rlist->max = rlist->max ? rlist->max << 1 : RUNLIST_MIN_RUNS;
+        runs = malloc(rlist->max * sizeof *runs);
+        if (!runs)
+            malloc_error("runlist");
+
+        if (rlist->count)
+            memcpy(runs, rlist->runs, rlist->count * sizeof *runs);
+        free(rlist->runs);
+        rlist->runs = runs;
+    }
 
-    return rlist;
+    rlist->runs[rlist->count++] = *elem;
 }
 
-static inline void runlist_append(struct runlist **rlist,
-                                struct runlist_element *elem)
+/* Find the run containing a VCN, or NULL if it is past the end of the
+ * attribute.  A sparse run has RUNLIST_LCN_HOLE as its LCN.
+ */
+static inline struct runlist_element *runlist_lookup(struct runlist *rlist,
+                                                    uint64_t vcn)
 {
-    struct runlist *n = runlist_alloc();
-
-    n->run = *elem;
-
-    if (runlist_is_empty(*rlist)) {
-        *rlist = n;
-        tail = n;
-    } else {
-        tail->next = n;
-        tail = n;
+    unsigned lo = 0, hi = rlist->count, mid;
+    struct runlist_element *run;
+
+    while (lo < hi) {
+        mid = (lo + hi) >> 1;
+        run = &rlist->runs[mid];
+        if (vcn < run->vcn)
+            hi = mid;
+        else if (vcn >= run->vcn + run->len)
+            lo = mid + 1;
+        else
+            return run;
     }
+
+    return NULL;
 }
 
-static inline struct runlist *runlist_remove(struct runlist **rlist)
+static inline void runlist_free(struct runlist *rlist)
 {
-    struct runlist *ret;
-
-    if (runlist_is_empty(*rlist))
-        return NULL;
-
-    ret = *rlist;
-    *rlist = ret->next;
-
-    return ret;
+    free(rlist->runs);
+    memset(rlist, 0, sizeof *rlist);
 }
 
 #endif /* _RUNLIST_H_ */
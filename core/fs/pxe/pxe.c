@@ -39,11 +39,14 @@ const uint8_t TimeoutTable[] = {
 struct tftp_options {
     const char *str_ptr;        /* string pointer */
     size_t      offset;		/* offset into socket structre */
+    size_t      width;		/* size of that field, 4 or 8 bytes */
 };
 
-#define IFIELD(x)	offsetof(struct inode, x)
+#define IFIELD(x)	offsetof(struct inode, x), \
+			sizeof(((struct inode *)0)->x)
 #define PFIELD(x)	(offsetof(struct inode, pvt) + \
-			 offsetof(struct pxe_pvt_inode, x))
+			 offsetof(struct pxe_pvt_inode, x)), \
+			sizeof(((struct pxe_pvt_inode *)0)->x)
 
 static const struct tftp_options tftp_options[] =
 {
@@ -684,7 +687,8 @@ static void __pxe_searchdir(const char *filename, struct file *file)
     uint16_t opcode;
     uint16_t blk_num;
     uint32_t ip = 0;
-    uint32_t opdata, *opdata_ptr;
+    uint64_t opdata;
+    char *opdata_ptr;
     enum pxe_path_type path_type;
     char fullpath[2*FILENAME_MAX];
     uint16_t server_port = TFTP_PORT;  /* TFTP server port */
@@ -943,7 +947,7 @@ wait_pkt:
 				   no idea what it means ...*/
 
             /* get the address of the filed that we want to write on */
-            opdata_ptr = (uint32_t *)((char *)inode + tftp_opt->offset);
+            opdata_ptr = (char *)inode + tftp_opt->offset;
 	    opdata = 0;
 
             /* do convert a number-string to decimal number, just like atoi */
@@ -956,7 +960,10 @@ wait_pkt:
                     goto err_reply;     /* Not a decimal digit */
                 opdata = opdata*10 + d;
             }
-	    *opdata_ptr = opdata;
+	    if (tftp_opt->width == sizeof(uint64_t))
+		*(uint64_t *)opdata_ptr = opdata;
+	    else
+		*(uint32_t *)opdata_ptr = opdata;
 	}
 	break;
 
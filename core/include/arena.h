@@ -0,0 +1,53 @@
+/*
+ * arena.h
+ *
+ * Arenas: objects with a common owner and lifetime, carved out of
+ * tagged chunks of the core heap and given back all at once.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * This is a temporary hack.  In Syslinux 5 this will be a pointer to
+ * the owner module.
+ */
+typedef size_t malloc_tag_t;
+enum malloc_owner {
+    MALLOC_FREE,
+    MALLOC_HEAD,
+    MALLOC_CORE,
+    MALLOC_MODULE,
+};
+
+#define MEM_ARENA_CHUNK		4096	/* Heap block size of a chunk */
+#define MEM_ARENA_ALIGN		16	/* Allocation unit */
+#define MEM_ARENA_CLASSES	32	/* Freed objects kept for reuse, by size */
+#define MEM_ARENA_MAX		(MEM_ARENA_CLASSES * MEM_ARENA_ALIGN)
+
+struct arena_chunk;
+struct arena_free;
+
+struct mem_arena {
+    malloc_tag_t tag;		/* Owner of the chunks */
+    struct arena_chunk *chunks;	/* Chunks of small objects, newest first */
+    struct arena_chunk *large;	/* Objects over MEM_ARENA_MAX, one each */
+    char *ptr, *end;		/* Unused space in the newest chunk */
+    struct arena_free *recycle[MEM_ARENA_CLASSES];
+    struct mem_arena *next_module;	/* MALLOC_MODULE arenas only */
+};
+
+/* mem/arena.c */
+extern void arena_init(struct mem_arena *, malloc_tag_t);
+extern void *arena_alloc(struct mem_arena *, size_t);
+extern void *arena_zalloc(struct mem_arena *, size_t);
+extern char *arena_strdup(struct mem_arena *, const char *);
+extern void arena_free(struct mem_arena *, void *);
+extern void arena_reset(struct mem_arena *);
+extern void arena_release(struct mem_arena *);
+extern void arena_release_module(void);
+
+#endif /* ARENA_H */
@@ -32,6 +32,7 @@ extern void getoneblk(struct disk *, char *, block_t, int);
 
 /* diskio.c */
 struct disk *disk_init(uint8_t, bool, sector_t, uint16_t, uint16_t, uint32_t);
+struct disk *disk_open(uint8_t, sector_t);
 struct device *device_init(uint8_t, bool, sector_t, uint16_t, uint16_t, uint32_t);
 
 #endif /* DISK_H */
@@ -9,6 +9,7 @@
 #include <sys/dirent.h>
 #include "core.h"
 #include "disk.h"
+#include "arena.h"
 
 /*
  * Maximum number of open files.  This is *currently* constrained by the
@@ -37,6 +38,7 @@ struct fs_info {
     int block_shift, block_size;
     struct inode *root, *cwd;	   	/* Root and current directories */
     char cwd_name[CURRENTDIR_MAX];	/* Current directory by name */
+    struct mem_arena arena;		/* Inodes and their names */
 };
 
 extern struct fs_info *this_fs;
@@ -66,6 +68,7 @@ struct fs_ops {
     struct inode * (*iget_root)(struct fs_info *);
     struct inode * (*iget)(const char *, struct inode *);
     int	     (*readlink)(struct inode *, char *);
+    void     (*free_inode)(struct inode *);	/* Release private data */
 
     /* the _dir_ stuff */
     int	     (*readdir)(struct file *, struct dirent *);
@@ -98,7 +101,7 @@ struct inode {
     const char *name;		/* Name, valid for generic path search only */
     int		 refcnt;
     int          mode;   /* FILE , DIR or SYMLINK */
-    uint32_t     size;
+    uint64_t     size;
     uint32_t	 blocks; /* How many blocks the file take */
     uint32_t     ino;    /* Inode number */
     uint32_t     atime;  /* Access time */
@@ -113,7 +116,7 @@ struct inode {
 
 struct file {
     struct fs_info *fs;
-    uint32_t offset;            /* for next read */
+    uint64_t offset;            /* for next read */
     struct inode *inode;        /* The file-specific information */
 };
 
@@ -149,7 +152,7 @@ static inline bool not_whitespace(char c)
 struct inode *alloc_inode(struct fs_info *fs, uint32_t ino, size_t data);
 static inline void free_inode(struct inode * inode)
 {
-    free(inode);
+    arena_free(&inode->fs->arena, inode);
 }
 
 static inline struct inode *get_inode(struct inode *inode)
@@ -0,0 +1,222 @@
+/*
+ * arena.c
+ *
+ * Arena allocation.  Small objects are handed out with a bump pointer
+ * from chunks taken off the main heap under the arena's tag; a freed
+ * one goes on a per-size list in the arena for the next allocation of
+ * that size.  Larger objects get a heap block each.  Either way the
+ * general free list is only touched once per chunk, and arena_reset()
+ * or arena_release() give everything back without looking at the
+ * individual objects.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <dprintf.h>
+#include "malloc.h"
+
+struct arena_chunk {
+    struct arena_chunk *next, *prev;
+};
+
+/* Every object is preceded by its size, rounded, including this header */
+struct arena_obj {
+    size_t size;
+    size_t _pad;
+};
+
+struct arena_free {
+    struct arena_free *next;
+};
+
+/* Usable bytes of a chunk, so that its heap block is MEM_ARENA_CHUNK */
+#define CHUNK_BYTES	(MEM_ARENA_CHUNK - sizeof(struct arena_header))
+
+/* Arenas owned by the running COM32 module, released when it exits */
+static struct mem_arena *module_arenas;
+
+/*
+ * Set up an arena; this must be done once per arena.  A MALLOC_MODULE
+ * arena is emptied by arena_release_module() when the module exits.
+ */
+void arena_init(struct mem_arena *arena, malloc_tag_t tag)
+{
+    memset(arena, 0, sizeof *arena);
+    arena->tag = tag;
+
+    if (tag == MALLOC_MODULE) {
+	arena->next_module = module_arenas;
+	module_arenas = arena;
+    }
+}
+
+static void *arena_large(struct mem_arena *arena, size_t size)
+{
+    struct arena_chunk *ck;
+
+    ck = _malloc(sizeof *ck + size, HEAP_MAIN, arena->tag);
+    if (!ck)
+	return NULL;
+
+    ck->prev = NULL;
+    ck->next = arena->large;
+    if (ck->next)
+	ck->next->prev = ck;
+    arena->large = ck;
+
+    return ck + 1;
+}
+
+void *arena_alloc(struct mem_arena *arena, size_t size)
+{
+    struct arena_obj *obj;
+    struct arena_chunk *ck;
+    unsigned int class;
+
+    if (size > (size_t)-1 >> 1)
+	return NULL;
+
+    size = (size + sizeof *obj + MEM_ARENA_ALIGN - 1) &
+	~(size_t)(MEM_ARENA_ALIGN - 1);
+
+    if (size > MEM_ARENA_MAX) {
+	obj = arena_large(arena, size);
+	if (!obj)
+	    return NULL;
+    } else {
+	class = size / MEM_ARENA_ALIGN - 1;
+	if (arena->recycle[class]) {
+	    obj = (struct arena_obj *)arena->recycle[class];
+	    arena->recycle[class] = arena->recycle[class]->next;
+	} else {
+	    if ((size_t)(arena->end - arena->ptr) < size) {
+		/* The rest of this chunk is lost, at most MEM_ARENA_MAX */
+		ck = _malloc(CHUNK_BYTES, HEAP_MAIN, arena->tag);
+		if (!ck)
+		    return NULL;
+		ck->next = arena->chunks;
+		arena->chunks = ck;
+		arena->ptr = (char *)(ck + 1);
+		arena->end = (char *)ck + CHUNK_BYTES;
+	    }
+	    obj = (struct arena_obj *)arena->ptr;
+	    arena->ptr += size;
+	}
+    }
+
+    obj->size = size;
+    return obj + 1;
+}
+
+void *arena_zalloc(struct mem_arena *arena, size_t size)
+{
+    void *p = arena_alloc(arena, size);
+
+    if (p)
+	memset(p, 0, size);
+    return p;
+}
+
+char *arena_strdup(struct mem_arena *arena, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *p = arena_alloc(arena, len);
+
+    if (p)
+	memcpy(p, s, len);
+    return p;
+}
+
+/*
+ * Give an object back to its arena.  A small one is kept there for
+ * reuse, and only returns to the heap with the rest of the arena.
+ */
+void arena_free(struct mem_arena *arena, void *ptr)
+{
+    struct arena_obj *obj;
+    struct arena_chunk *ck;
+    struct arena_free *fp;
+    unsigned int class;
+
+    if (!ptr)
+	return;
+
+    obj = (struct arena_obj *)ptr - 1;
+    if (obj->size > MEM_ARENA_MAX) {
+	ck = (struct arena_chunk *)obj - 1;
+	if (ck->next)
+	    ck->next->prev = ck->prev;
+	if (ck->prev)
+	    ck->prev->next = ck->next;
+	else
+	    arena->large = ck->next;
+	free(ck);
+    } else {
+	class = obj->size / MEM_ARENA_ALIGN - 1;
+	fp = (struct arena_free *)obj;
+	fp->next = arena->recycle[class];
+	arena->recycle[class] = fp;
+    }
+}
+
+static void free_chunks(struct arena_chunk *ck)
+{
+    struct arena_chunk *next;
+
+    for (; ck; ck = next) {
+	next = ck->next;
+	free(ck);
+    }
+}
+
+/*
+ * Free every object in the arena, but keep its first chunk, so that an
+ * arena which is reset after each use normally never goes to the heap.
+ */
+void arena_reset(struct mem_arena *arena)
+{
+    struct arena_chunk *ck;
+
+    free_chunks(arena->large);
+    arena->large = NULL;
+
+    /* The oldest chunk is the last one on the list */
+    while ((ck = arena->chunks) && ck->next) {
+	arena->chunks = ck->next;
+	free(ck);
+    }
+
+    if (ck) {
+	arena->ptr = (char *)(ck + 1);
+	arena->end = (char *)ck + CHUNK_BYTES;
+    }
+    memset(arena->recycle, 0, sizeof arena->recycle);
+}
+
+/*
+ * Free the arena and everything in it; it can be used again afterwards.
+ */
+void arena_release(struct mem_arena *arena)
+{
+    dprintf("arena_release(%p) tag %u\n", arena, arena->tag);
+
+    free_chunks(arena->chunks);
+    free_chunks(arena->large);
+    arena->chunks = arena->large = NULL;
+    arena->ptr = arena->end = NULL;
+    memset(arena->recycle, 0, sizeof arena->recycle);
+}
+
+/*
+ * Release every MALLOC_MODULE arena, when a COM32 module exits.  This
+ * costs one free() per chunk, and must come before the heap is swept
+ * for the module's other blocks, which would take the chunks from under
+ * the arenas.
+ */
+void arena_release_module(void)
+{
+    struct mem_arena *arena;
+
+    for (arena = module_arenas; arena; arena = arena->next_module)
+	arena_release(arena);
+}
@@ -150,5 +150,6 @@ void comboot_cleanup_lowmem(com32sys_t *regs)
 {
     (void)regs;
 
+    arena_release_module();
     __free_tagged(MALLOC_MODULE);
 }
@@ -57,7 +57,7 @@ static void *__malloc_from_block(struct free_arena_header *fp,
     return (void *)(&fp->a + 1);
 }
 
-static void *_malloc(size_t size, enum heap heap, malloc_tag_t tag)
+void *_malloc(size_t size, enum heap heap, malloc_tag_t tag)
 {
     struct free_arena_header *fp;
     struct free_arena_header *head = &__malloc_head[heap];
@@ -7,18 +7,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "core.h"
-
-/*
- * This is a temporary hack.  In Syslinux 5 this will be a pointer to
- * the owner module.
- */
-typedef size_t malloc_tag_t;
-enum malloc_owner {
-    MALLOC_FREE,
-    MALLOC_HEAD,
-    MALLOC_CORE,
-    MALLOC_MODULE,
-};
+#include "arena.h"
 
 struct free_arena_header;
 
@@ -80,3 +69,4 @@ struct free_arena_header {
 
 extern struct free_arena_header __malloc_head[NHEAP];
 void __inject_free_block(struct free_arena_header *ah);
+void *_malloc(size_t size, enum heap heap, malloc_tag_t tag);
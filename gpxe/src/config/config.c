@@ -115,6 +115,9 @@ REQUIRE_OBJECT ( http );
 #ifdef DOWNLOAD_PROTO_HTTPS
 REQUIRE_OBJECT ( https );
 #endif
+#ifdef HTTP_ENC_GZIP
+REQUIRE_OBJECT ( httpgzip );
+#endif
 #ifdef DOWNLOAD_PROTO_FTP
 REQUIRE_OBJECT ( ftp );
 #endif
@@ -234,6 +237,9 @@ REQUIRE_OBJECT ( digest_cmd );
 #ifdef PXE_CMD
 REQUIRE_OBJECT ( pxe_cmd );
 #endif
+#ifdef IOBUF_CMD
+REQUIRE_OBJECT ( iobuf_cmd );
+#endif
 
 /*
  * Drag in miscellaneous objects
@@ -0,0 +1,23 @@
+#ifndef CONFIG_CRYPTO_H
+#define CONFIG_CRYPTO_H
+
+/** @file
+ *
+ * Cryptographic configuration
+ *
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+/*
+ * Big integer arithmetic (used for RSA)
+ *
+ * BIGINT_MONTGOMERY selects Montgomery reduction with Comba-style
+ * multiplication and squaring and sliding-window exponentiation.
+ * Undefine it to fall back to the smaller, slower classical
+ * (long division) reduction.
+ *
+ */
+#define	BIGINT_MONTGOMERY
+
+#endif /* CONFIG_CRYPTO_H */
@@ -59,6 +59,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #define	DOWNLOAD_PROTO_FTP	/* File Transfer Protocol */
 #undef	DOWNLOAD_PROTO_TFTM	/* Multicast Trivial File Transfer Protocol */
 #undef	DOWNLOAD_PROTO_SLAM	/* Scalable Local Area Multicast */
+#undef	HTTP_ENC_GZIP		/* gzip Content-Encoding for HTTP */
 
 /*
  * SAN boot protocols
@@ -119,6 +120,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #define LOGIN_CMD		/* Login command */
 #undef	TIME_CMD		/* Time commands */
 #undef	DIGEST_CMD		/* Image crypto digest commands */
+#undef	IOBUF_CMD		/* I/O buffer pool statistics command */
 //#undef	PXE_CMD			/* PXE commands */
 
 /*
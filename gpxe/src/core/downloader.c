@@ -205,6 +205,35 @@ static int downloader_xfer_deliver_iob ( struct xfer_interface *xfer,
 	return rc;
 }
 
+/**
+ * Handle deliver_raw() event received via data transfer interface
+ *
+ * @v xfer		Downloader data transfer interface
+ * @v data		Data
+ * @v len		Length of data
+ * @ret rc		Return status code
+ *
+ * Raw data is always appended at the current position, and is copied
+ * straight into the image buffer rather than via an I/O buffer.
+ */
+static int downloader_xfer_deliver_raw ( struct xfer_interface *xfer,
+					 const void *data, size_t len ) {
+	struct downloader *downloader =
+		container_of ( xfer, struct downloader, xfer );
+	int rc;
+
+	/* Ensure that we have enough buffer space for this data */
+	if ( ( rc = downloader_ensure_size ( downloader,
+					     ( downloader->pos + len ) ) ) != 0 )
+		return rc;
+
+	/* Copy data to buffer and update current buffer position */
+	copy_to_user ( downloader->image->data, downloader->pos, data, len );
+	downloader->pos += len;
+
+	return 0;
+}
+
 /**
  * Handle close() event received via data transfer interface
  *
@@ -230,7 +259,7 @@ static struct xfer_interface_operations downloader_xfer_operations = {
 	.window		= unlimited_xfer_window,
 	.alloc_iob	= default_xfer_alloc_iob,
 	.deliver_iob	= downloader_xfer_deliver_iob,
-	.deliver_raw	= xfer_deliver_as_iob,
+	.deliver_raw	= downloader_xfer_deliver_raw,
 };
 
 /****************************************************************************
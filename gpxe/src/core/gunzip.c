@@ -0,0 +1,347 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <byteswap.h>
+#include <gpxe/xfer.h>
+#include <gpxe/filter.h>
+#include <gpxe/crc32.h>
+#include <gpxe/gunzip.h>
+
+/** @file
+ *
+ * gzip decompression filter (RFC 1952)
+ *
+ * The filter sits between a compressed byte stream (e.g. an HTTP
+ * response body with "Content-Encoding: gzip") and the ultimate
+ * recipient, which sees only the decompressed data.
+ *
+ */
+
+/**
+ * Close gzip filter
+ *
+ * @v gunzip		gzip filter
+ * @v rc		Reason for close
+ */
+static void gunzip_close ( struct gunzip *gunzip, int rc ) {
+
+	/* Close compressed and plaintext streams */
+	xfer_nullify ( &gunzip->gzstream.xfer );
+	xfer_close ( &gunzip->gzstream.xfer, rc );
+	xfer_nullify ( &gunzip->plainstream.xfer );
+	xfer_close ( &gunzip->plainstream.xfer, rc );
+}
+
+/**
+ * Deliver decompressed data
+ *
+ * @v inflate		DEFLATE decompressor
+ * @v data		Decompressed data
+ * @v len		Length of data
+ * @ret rc		Return status code
+ */
+static int gunzip_output ( struct inflate *inflate, const void *data,
+			   size_t len ) {
+	struct gunzip *gunzip =
+		container_of ( inflate, struct gunzip, inflate );
+
+	gunzip->crc = crc32_le ( gunzip->crc, data, len );
+	gunzip->len += len;
+	return xfer_deliver_raw ( &gunzip->plainstream.xfer, data, len );
+}
+
+/**
+ * Move to the next optional header field, or to the compressed data
+ *
+ * @v gunzip		gzip filter
+ */
+static void gunzip_next_field ( struct gunzip *gunzip ) {
+
+	gunzip->buf_len = 0;
+	if ( gunzip->flags & GZIP_FEXTRA ) {
+		gunzip->flags &= ~GZIP_FEXTRA;
+		gunzip->state = GUNZIP_EXTRA_LEN;
+	} else if ( gunzip->flags & GZIP_FNAME ) {
+		gunzip->flags &= ~GZIP_FNAME;
+		gunzip->state = GUNZIP_NAME;
+	} else if ( gunzip->flags & GZIP_FCOMMENT ) {
+		gunzip->flags &= ~GZIP_FCOMMENT;
+		gunzip->state = GUNZIP_COMMENT;
+	} else if ( gunzip->flags & GZIP_FHCRC ) {
+		gunzip->flags &= ~GZIP_FHCRC;
+		gunzip->state = GUNZIP_HCRC;
+	} else {
+		gunzip->state = GUNZIP_DATA;
+	}
+}
+
+/**
+ * Accumulate fixed-length data
+ *
+ * @v gunzip		gzip filter
+ * @v data		Data pointer (updated)
+ * @v len		Length of data (updated)
+ * @v want		Total length required
+ * @ret complete	All required data has been accumulated
+ */
+static int gunzip_fill ( struct gunzip *gunzip, const uint8_t **data,
+			 size_t *len, size_t want ) {
+	size_t frag_len = ( want - gunzip->buf_len );
+
+	if ( frag_len > *len )
+		frag_len = *len;
+	memcpy ( &gunzip->buf[gunzip->buf_len], *data, frag_len );
+	gunzip->buf_len += frag_len;
+	*data += frag_len;
+	*len -= frag_len;
+	return ( gunzip->buf_len == want );
+}
+
+/**
+ * Process received gzip data
+ *
+ * @v gunzip		gzip filter
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @ret rc		Return status code
+ */
+static int gunzip_rx ( struct gunzip *gunzip, const uint8_t *data,
+		       size_t len ) {
+	const uint8_t *end;
+	uint32_t crc;
+	uint32_t isize;
+	size_t used;
+	int rc;
+
+	while ( len ) {
+		switch ( gunzip->state ) {
+		case GUNZIP_HEADER:
+			if ( ! gunzip_fill ( gunzip, &data, &len,
+					     GZIP_HEADER_LEN ) )
+				break;
+			if ( ( gunzip->buf[0] != GZIP_ID1 ) ||
+			     ( gunzip->buf[1] != GZIP_ID2 ) ) {
+				DBGC ( gunzip, "GUNZIP %p bad magic %02x%02x\n",
+				       gunzip, gunzip->buf[0], gunzip->buf[1] );
+				return -EINVAL;
+			}
+			if ( ( gunzip->buf[2] != GZIP_CM_DEFLATE ) ||
+			     ( gunzip->buf[3] & GZIP_FRESERVED ) ) {
+				DBGC ( gunzip, "GUNZIP %p unsupported method "
+				       "%d flags %02x\n", gunzip,
+				       gunzip->buf[2], gunzip->buf[3] );
+				return -ENOTSUP;
+			}
+			gunzip->flags = gunzip->buf[3];
+			gunzip_next_field ( gunzip );
+			break;
+		case GUNZIP_EXTRA_LEN:
+			if ( ! gunzip_fill ( gunzip, &data, &len, 2 ) )
+				break;
+			gunzip->skip = ( gunzip->buf[0] |
+					 ( gunzip->buf[1] << 8 ) );
+			gunzip->state = GUNZIP_EXTRA;
+			break;
+		case GUNZIP_EXTRA:
+			used = ( ( len < gunzip->skip ) ? len : gunzip->skip );
+			data += used;
+			len -= used;
+			gunzip->skip -= used;
+			if ( ! gunzip->skip )
+				gunzip_next_field ( gunzip );
+			break;
+		case GUNZIP_NAME:
+		case GUNZIP_COMMENT:
+			end = memchr ( data, '\0', len );
+			used = ( end ? ( ( size_t ) ( end - data ) + 1 ) : len );
+			data += used;
+			len -= used;
+			if ( end )
+				gunzip_next_field ( gunzip );
+			break;
+		case GUNZIP_HCRC:
+			if ( gunzip_fill ( gunzip, &data, &len, 2 ) )
+				gunzip_next_field ( gunzip );
+			break;
+		case GUNZIP_DATA:
+			if ( ( rc = inflate_data ( &gunzip->inflate, data, len,
+						   &used ) ) != 0 ) {
+				DBGC ( gunzip, "GUNZIP %p could not inflate: "
+				       "%s\n", gunzip, strerror ( rc ) );
+				return rc;
+			}
+			data += used;
+			len -= used;
+			if ( inflate_finished ( &gunzip->inflate ) ) {
+				gunzip->buf_len = 0;
+				gunzip->state = GUNZIP_TRAILER;
+			}
+			break;
+		case GUNZIP_TRAILER:
+			if ( ! gunzip_fill ( gunzip, &data, &len,
+					     GZIP_TRAILER_LEN ) )
+				break;
+			memcpy ( &crc, &gunzip->buf[0], sizeof ( crc ) );
+			memcpy ( &isize, &gunzip->buf[4], sizeof ( isize ) );
+			if ( ( le32_to_cpu ( crc ) != ~gunzip->crc ) ||
+			     ( le32_to_cpu ( isize ) != gunzip->len ) ) {
+				DBGC ( gunzip, "GUNZIP %p trailer mismatch: "
+				       "CRC %08x/%08x length %d/%d\n", gunzip,
+				       le32_to_cpu ( crc ), ~gunzip->crc,
+				       le32_to_cpu ( isize ), gunzip->len );
+				return -EIO;
+			}
+			DBGC ( gunzip, "GUNZIP %p decompressed %d bytes\n",
+			       gunzip, gunzip->len );
+			gunzip->state = GUNZIP_DONE;
+			break;
+		case GUNZIP_DONE:
+			/* Ignore any trailing garbage */
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+ *
+ * Plaintext stream operations
+ *
+ ******************************************************************************
+ */
+
+/**
+ * Close interface
+ *
+ * @v xfer		Plainstream data transfer interface
+ * @v rc		Reason for close
+ */
+static void gunzip_plainstream_close ( struct xfer_interface *xfer, int rc ) {
+	struct gunzip *gunzip =
+		container_of ( xfer, struct gunzip, plainstream.xfer );
+
+	gunzip_close ( gunzip, rc );
+}
+
+/** gzip plaintext stream operations */
+static struct xfer_interface_operations gunzip_plainstream_operations = {
+	.close		= gunzip_plainstream_close,
+	.vredirect	= ignore_xfer_vredirect,
+	.window		= unlimited_xfer_window,
+	.alloc_iob	= default_xfer_alloc_iob,
+	.deliver_iob	= xfer_deliver_as_raw,
+	.deliver_raw	= ignore_xfer_deliver_raw,
+};
+
+/******************************************************************************
+ *
+ * Compressed stream operations
+ *
+ ******************************************************************************
+ */
+
+/**
+ * Close interface
+ *
+ * @v xfer		Compressed stream data transfer interface
+ * @v rc		Reason for close
+ */
+static void gunzip_gzstream_close ( struct xfer_interface *xfer, int rc ) {
+	struct gunzip *gunzip =
+		container_of ( xfer, struct gunzip, gzstream.xfer );
+
+	/* A successful close before the trailer has been verified
+	 * means that the compressed data was truncated.
+	 */
+	if ( ( rc == 0 ) && ( gunzip->state != GUNZIP_DONE ) ) {
+		DBGC ( gunzip, "GUNZIP %p truncated in state %d\n",
+		       gunzip, gunzip->state );
+		rc = -EIO;
+	}
+
+	gunzip_close ( gunzip, rc );
+}
+
+/**
+ * Receive new compressed data
+ *
+ * @v xfer		Compressed stream data transfer interface
+ * @v data		Data
+ * @v len		Length of data
+ * @ret rc		Return status code
+ */
+static int gunzip_gzstream_deliver_raw ( struct xfer_interface *xfer,
+					 const void *data, size_t len ) {
+	struct gunzip *gunzip =
+		container_of ( xfer, struct gunzip, gzstream.xfer );
+	int rc;
+
+	if ( ( rc = gunzip_rx ( gunzip, data, len ) ) != 0 )
+		gunzip_close ( gunzip, rc );
+	return rc;
+}
+
+/** gzip compressed stream operations */
+static struct xfer_interface_operations gunzip_gzstream_operations = {
+	.close		= gunzip_gzstream_close,
+	.vredirect	= filter_vredirect,
+	.window		= filter_window,
+	.alloc_iob	= default_xfer_alloc_iob,
+	.deliver_iob	= xfer_deliver_as_raw,
+	.deliver_raw	= gunzip_gzstream_deliver_raw,
+};
+
+/******************************************************************************
+ *
+ * Instantiator
+ *
+ ******************************************************************************
+ */
+
+/**
+ * Add gzip decompression filter
+ *
+ * @v xfer		Recipient of decompressed data
+ * @v next		Interface to which compressed data should be delivered
+ * @ret rc		Return status code
+ */
+int add_gunzip ( struct xfer_interface *xfer, struct xfer_interface **next ) {
+	struct gunzip *gunzip;
+
+	/* Allocate and initialise structure */
+	gunzip = zalloc ( sizeof ( *gunzip ) );
+	if ( ! gunzip )
+		return -ENOMEM;
+	filter_init ( &gunzip->plainstream, &gunzip_plainstream_operations,
+		      &gunzip->gzstream, &gunzip_gzstream_operations,
+		      &gunzip->refcnt );
+	gunzip->state = GUNZIP_HEADER;
+	gunzip->crc = ~0;
+	inflate_init ( &gunzip->inflate, gunzip_output );
+
+	/* Attach to parent interface, mortalise self, and return */
+	xfer_plug_plug ( &gunzip->plainstream.xfer, xfer );
+	*next = &gunzip->gzstream.xfer;
+	ref_put ( &gunzip->refcnt );
+	return 0;
+}
@@ -0,0 +1,623 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <gpxe/inflate.h>
+
+/** @file
+ *
+ * DEFLATE decompression (RFC 1951)
+ *
+ * The decompressor is fully resumable: input may be supplied in
+ * arbitrarily small pieces, and every state consumes its bits
+ * atomically so that decoding can stop at any point where the input
+ * runs dry.  Input bytes are only pulled into the bit accumulator
+ * when the current state needs them, so that once the final block is
+ * complete the caller can pick up any trailing (e.g. gzip) data from
+ * the byte following the last one consumed.
+ *
+ */
+
+/** Input buffer being consumed */
+struct inflate_input {
+	/** Data */
+	const uint8_t *data;
+	/** Length of data */
+	size_t len;
+	/** Offset of next byte to consume */
+	size_t offset;
+};
+
+/** Base lengths for length symbols 257-285 */
+static const uint16_t inflate_len_base[] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+/** Extra bits for length symbols 257-285 */
+static const uint8_t inflate_len_extra[] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+/** Base distances for distance symbols 0-29 */
+static const uint16_t inflate_dist_base[] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+
+/** Extra bits for distance symbols 0-29 */
+static const uint8_t inflate_dist_extra[] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/** Order in which code length code lengths are transmitted */
+static const uint8_t inflate_clen_order[INFLATE_CLEN_CODES] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/** End-of-block symbol */
+#define INFLATE_END_OF_BLOCK 256
+
+/** Number of valid length symbols */
+#define INFLATE_NUM_LENS \
+	( sizeof ( inflate_len_base ) / sizeof ( inflate_len_base[0] ) )
+
+/** Number of valid distance symbols */
+#define INFLATE_NUM_DISTS \
+	( sizeof ( inflate_dist_base ) / sizeof ( inflate_dist_base[0] ) )
+
+/**
+ * Ensure that bits are available in the accumulator
+ *
+ * @v inflate		Decompressor
+ * @v in		Input buffer
+ * @v len		Number of bits required (at most 32)
+ * @ret ok		Bits are available
+ */
+static int inflate_need ( struct inflate *inflate, struct inflate_input *in,
+			  unsigned int len ) {
+	while ( inflate->bits_len < len ) {
+		if ( in->offset == in->len )
+			return 0;
+		inflate->bits |= ( ( ( uint32_t ) in->data[in->offset++] )
+				   << inflate->bits_len );
+		inflate->bits_len += 8;
+	}
+	return 1;
+}
+
+/**
+ * Consume bits from the accumulator
+ *
+ * @v inflate		Decompressor
+ * @v len		Number of bits (at most 16, and already available)
+ * @ret value		Value of consumed bits
+ */
+static unsigned int inflate_get ( struct inflate *inflate, unsigned int len ) {
+	unsigned int value;
+
+	value = ( inflate->bits & ( ( 1UL << len ) - 1 ) );
+	inflate->bits >>= len;
+	inflate->bits_len -= len;
+	return value;
+}
+
+/**
+ * Construct canonical Huffman code from code lengths
+ *
+ * @v huff		Huffman code to fill in
+ * @v lens		Code lengths
+ * @v count		Number of symbols
+ * @ret rc		Return status code
+ *
+ * Incomplete codes are permitted (as required for single-symbol
+ * distance codes); over-subscribed codes are rejected.
+ */
+static int inflate_build ( struct inflate_huffman *huff, const uint8_t *lens,
+			   unsigned int count ) {
+	uint16_t offsets[INFLATE_MAX_BITS + 1];
+	unsigned int sym;
+	unsigned int len;
+	int left;
+
+	/* Count number of codes of each length */
+	memset ( huff->count, 0, sizeof ( huff->count ) );
+	for ( sym = 0 ; sym < count ; sym++ )
+		huff->count[lens[sym]]++;
+	huff->count[0] = 0;
+
+	/* Check for an over-subscribed code */
+	left = 1;
+	for ( len = 1 ; len <= INFLATE_MAX_BITS ; len++ ) {
+		left <<= 1;
+		left -= huff->count[len];
+		if ( left < 0 )
+			return -EINVAL;
+	}
+
+	/* Sort symbols by code length, then by symbol value */
+	offsets[1] = 0;
+	for ( len = 1 ; len < INFLATE_MAX_BITS ; len++ )
+		offsets[len + 1] = ( offsets[len] + huff->count[len] );
+	for ( sym = 0 ; sym < count ; sym++ ) {
+		if ( lens[sym] )
+			huff->symbol[offsets[lens[sym]]++] = sym;
+	}
+
+	return 0;
+}
+
+/**
+ * Decode a Huffman symbol without consuming it
+ *
+ * @v inflate		Decompressor
+ * @v in		Input buffer
+ * @v huff		Huffman code
+ * @v len		Length of code to consume on success
+ * @ret sym		Symbol, or negative error
+ *
+ * Returns -EINPROGRESS if the input ran out before a complete code
+ * was seen.
+ */
+static int inflate_decode ( struct inflate *inflate, struct inflate_input *in,
+			    struct inflate_huffman *huff, unsigned int *len ) {
+	unsigned int code = 0;
+	unsigned int first = 0;
+	unsigned int index = 0;
+	unsigned int count;
+	unsigned int bits;
+
+	for ( bits = 1 ; bits <= INFLATE_MAX_BITS ; bits++ ) {
+		if ( ! inflate_need ( inflate, in, bits ) )
+			return -EINPROGRESS;
+		code |= ( ( inflate->bits >> ( bits - 1 ) ) & 1 );
+		count = huff->count[bits];
+		if ( ( code - first ) < count ) {
+			*len = bits;
+			return huff->symbol[ index + ( code - first ) ];
+		}
+		index += count;
+		first = ( ( first + count ) << 1 );
+		code <<= 1;
+	}
+
+	return -EINVAL;
+}
+
+/**
+ * Pass any pending window contents to the output function
+ *
+ * @v inflate		Decompressor
+ * @ret rc		Return status code
+ */
+static int inflate_flush ( struct inflate *inflate ) {
+	void *data = &inflate->window[inflate->flushed];
+	size_t len = ( inflate->pos - inflate->flushed );
+	int rc;
+
+	if ( len ) {
+		if ( ( rc = inflate->output ( inflate, data, len ) ) != 0 )
+			return rc;
+	}
+	if ( inflate->pos == INFLATE_WINDOW_SIZE )
+		inflate->pos = 0;
+	inflate->flushed = inflate->pos;
+	return 0;
+}
+
+/**
+ * Account for data written to the window
+ *
+ * @v inflate		Decompressor
+ * @v len		Length of data written at current position
+ * @ret rc		Return status code
+ */
+static int inflate_advance ( struct inflate *inflate, size_t len ) {
+
+	inflate->pos += len;
+	if ( ( inflate->total += len ) > INFLATE_WINDOW_SIZE )
+		inflate->total = INFLATE_WINDOW_SIZE;
+	if ( inflate->pos == INFLATE_WINDOW_SIZE )
+		return inflate_flush ( inflate );
+	return 0;
+}
+
+/**
+ * Write a byte to the window
+ *
+ * @v inflate		Decompressor
+ * @v byte		Byte
+ * @ret rc		Return status code
+ */
+static inline int inflate_put ( struct inflate *inflate, uint8_t byte ) {
+	inflate->window[inflate->pos] = byte;
+	return inflate_advance ( inflate, 1 );
+}
+
+/**
+ * Set up fixed Huffman codes
+ *
+ * @v inflate		Decompressor
+ */
+static void inflate_fixed ( struct inflate *inflate ) {
+	uint8_t *lens = inflate->lens;
+	unsigned int sym;
+
+	for ( sym = 0 ; sym < 144 ; sym++ )
+		lens[sym] = 8;
+	for ( ; sym < 256 ; sym++ )
+		lens[sym] = 9;
+	for ( ; sym < 280 ; sym++ )
+		lens[sym] = 7;
+	for ( ; sym < INFLATE_LITLEN_CODES ; sym++ )
+		lens[sym] = 8;
+	inflate_build ( &inflate->litlen, lens, INFLATE_LITLEN_CODES );
+	for ( sym = 0 ; sym < INFLATE_DIST_CODES ; sym++ )
+		lens[sym] = 5;
+	inflate_build ( &inflate->dist, lens, INFLATE_DIST_CODES );
+}
+
+/**
+ * Read code lengths for a dynamic block
+ *
+ * @v inflate		Decompressor
+ * @v in		Input buffer
+ * @ret rc		Return status code
+ */
+static int inflate_lens ( struct inflate *inflate, struct inflate_input *in ) {
+	unsigned int total = ( inflate->hlit + inflate->hdist );
+	unsigned int len;
+	unsigned int extra;
+	unsigned int repeat;
+	uint8_t value;
+	int sym;
+	int rc;
+
+	while ( inflate->index < total ) {
+
+		/* Decode code length symbol (using the distance code
+		 * slot to hold the code length code)
+		 */
+		sym = inflate_decode ( inflate, in, &inflate->dist, &len );
+		if ( sym < 0 )
+			return sym;
+
+		/* Literal code length */
+		if ( sym < 16 ) {
+			inflate_get ( inflate, len );
+			inflate->lens[inflate->index++] = sym;
+			continue;
+		}
+
+		/* Repeat code: consume symbol and extra bits together */
+		extra = ( ( sym == 16 ) ? 2 : ( ( sym == 17 ) ? 3 : 7 ) );
+		if ( ! inflate_need ( inflate, in, ( len + extra ) ) )
+			return -EINPROGRESS;
+		inflate_get ( inflate, len );
+		repeat = inflate_get ( inflate, extra );
+		if ( sym == 16 ) {
+			if ( inflate->index == 0 )
+				return -EINVAL;
+			value = inflate->lens[inflate->index - 1];
+			repeat += 3;
+		} else {
+			value = 0;
+			repeat += ( ( sym == 17 ) ? 3 : 11 );
+		}
+		if ( ( inflate->index + repeat ) > total )
+			return -EINVAL;
+		memset ( &inflate->lens[inflate->index], value, repeat );
+		inflate->index += repeat;
+	}
+
+	/* A block with no end-of-block code can never terminate */
+	if ( ! inflate->lens[INFLATE_END_OF_BLOCK] )
+		return -EINVAL;
+
+	/* Construct literal/length and distance codes */
+	if ( ( rc = inflate_build ( &inflate->litlen, inflate->lens,
+				    inflate->hlit ) ) != 0 )
+		return rc;
+	if ( ( rc = inflate_build ( &inflate->dist,
+				    &inflate->lens[inflate->hlit],
+				    inflate->hdist ) ) != 0 )
+		return rc;
+
+	return 0;
+}
+
+/**
+ * Copy stored block data
+ *
+ * @v inflate		Decompressor
+ * @v in		Input buffer
+ * @ret rc		Return status code
+ */
+static int inflate_stored ( struct inflate *inflate,
+			    struct inflate_input *in ) {
+	size_t len;
+	int rc;
+
+	while ( inflate->remaining ) {
+
+		/* Drain any whole bytes left in the accumulator */
+		if ( inflate->bits_len >= 8 ) {
+			if ( ( rc = inflate_put ( inflate,
+						  inflate_get ( inflate,
+								8 ) ) ) != 0 )
+				return rc;
+			inflate->remaining--;
+			continue;
+		}
+
+		/* Copy directly from the input buffer */
+		len = ( in->len - in->offset );
+		if ( ! len )
+			return -EINPROGRESS;
+		if ( len > inflate->remaining )
+			len = inflate->remaining;
+		if ( len > ( INFLATE_WINDOW_SIZE - inflate->pos ) )
+			len = ( INFLATE_WINDOW_SIZE - inflate->pos );
+		memcpy ( &inflate->window[inflate->pos],
+			 &in->data[in->offset], len );
+		in->offset += len;
+		inflate->remaining -= len;
+		if ( ( rc = inflate_advance ( inflate, len ) ) != 0 )
+			return rc;
+	}
+
+	return 0;
+}
+
+/**
+ * Copy a match from the window
+ *
+ * @v inflate		Decompressor
+ * @ret rc		Return status code
+ */
+static int inflate_copy ( struct inflate *inflate ) {
+	unsigned int from;
+	int rc;
+
+	while ( inflate->length ) {
+		from = ( ( inflate->pos - inflate->distance ) &
+			 ( INFLATE_WINDOW_SIZE - 1 ) );
+		inflate->length--;
+		if ( ( rc = inflate_put ( inflate,
+					  inflate->window[from] ) ) != 0 )
+			return rc;
+	}
+	return 0;
+}
+
+/**
+ * Run the decompressor until input is exhausted or a block completes
+ *
+ * @v inflate		Decompressor
+ * @v in		Input buffer
+ * @ret rc		Return status code
+ */
+static int inflate_step ( struct inflate *inflate, struct inflate_input *in ) {
+	unsigned int len;
+	unsigned int type;
+	unsigned int nlen;
+	int sym;
+	int rc;
+
+	switch ( inflate->state ) {
+
+	case INFLATE_BLOCK:
+		if ( ! inflate_need ( inflate, in, 3 ) )
+			return -EINPROGRESS;
+		inflate->final = inflate_get ( inflate, 1 );
+		type = inflate_get ( inflate, 2 );
+		switch ( type ) {
+		case 0:
+			/* Stored block: discard to byte boundary */
+			inflate_get ( inflate, ( inflate->bits_len & 7 ) );
+			inflate->state = INFLATE_STORED_LEN;
+			break;
+		case 1:
+			inflate_fixed ( inflate );
+			inflate->state = INFLATE_SYMBOL;
+			break;
+		case 2:
+			inflate->state = INFLATE_DYNAMIC;
+			break;
+		default:
+			return -EINVAL;
+		}
+		return 0;
+
+	case INFLATE_STORED_LEN:
+		if ( ! inflate_need ( inflate, in, 32 ) )
+			return -EINPROGRESS;
+		len = inflate_get ( inflate, 16 );
+		nlen = inflate_get ( inflate, 16 );
+		if ( len != ( ~nlen & 0xffff ) )
+			return -EINVAL;
+		inflate->remaining = len;
+		inflate->state = INFLATE_STORED_DATA;
+		return 0;
+
+	case INFLATE_STORED_DATA:
+		if ( ( rc = inflate_stored ( inflate, in ) ) != 0 )
+			return rc;
+		goto end_of_block;
+
+	case INFLATE_DYNAMIC:
+		if ( ! inflate_need ( inflate, in, 14 ) )
+			return -EINPROGRESS;
+		inflate->hlit = ( inflate_get ( inflate, 5 ) + 257 );
+		inflate->hdist = ( inflate_get ( inflate, 5 ) + 1 );
+		inflate->hclen = ( inflate_get ( inflate, 4 ) + 4 );
+		if ( ( inflate->hlit > 286 ) || ( inflate->hdist > 30 ) )
+			return -EINVAL;
+		memset ( inflate->lens, 0, INFLATE_CLEN_CODES );
+		inflate->index = 0;
+		inflate->state = INFLATE_CLEN;
+		return 0;
+
+	case INFLATE_CLEN:
+		while ( inflate->index < inflate->hclen ) {
+			if ( ! inflate_need ( inflate, in, 3 ) )
+				return -EINPROGRESS;
+			inflate->lens[inflate_clen_order[inflate->index++]] =
+				inflate_get ( inflate, 3 );
+		}
+		if ( ( rc = inflate_build ( &inflate->dist, inflate->lens,
+					    INFLATE_CLEN_CODES ) ) != 0 )
+			return rc;
+		inflate->index = 0;
+		inflate->state = INFLATE_LENS;
+		return 0;
+
+	case INFLATE_LENS:
+		if ( ( rc = inflate_lens ( inflate, in ) ) != 0 )
+			return rc;
+		inflate->state = INFLATE_SYMBOL;
+		return 0;
+
+	case INFLATE_SYMBOL:
+		/* Literals are by far the most common case; handle
+		 * them without returning to the caller.
+		 */
+		while ( 1 ) {
+			sym = inflate_decode ( inflate, in, &inflate->litlen,
+					       &len );
+			if ( sym < 0 )
+				return sym;
+			inflate_get ( inflate, len );
+			if ( sym >= INFLATE_END_OF_BLOCK )
+				break;
+			if ( ( rc = inflate_put ( inflate, sym ) ) != 0 )
+				return rc;
+		}
+		if ( sym == INFLATE_END_OF_BLOCK )
+			goto end_of_block;
+		sym -= ( INFLATE_END_OF_BLOCK + 1 );
+		if ( ( unsigned int ) sym >= INFLATE_NUM_LENS )
+			return -EINVAL;
+		inflate->length = inflate_len_base[sym];
+		inflate->index = inflate_len_extra[sym];
+		inflate->state = INFLATE_LEN_EXTRA;
+		return 0;
+
+	case INFLATE_LEN_EXTRA:
+		if ( ! inflate_need ( inflate, in, inflate->index ) )
+			return -EINPROGRESS;
+		inflate->length += inflate_get ( inflate, inflate->index );
+		inflate->state = INFLATE_DIST;
+		return 0;
+
+	case INFLATE_DIST:
+		sym = inflate_decode ( inflate, in, &inflate->dist, &len );
+		if ( sym < 0 )
+			return sym;
+		inflate_get ( inflate, len );
+		if ( ( unsigned int ) sym >= INFLATE_NUM_DISTS )
+			return -EINVAL;
+		inflate->distance = inflate_dist_base[sym];
+		inflate->index = inflate_dist_extra[sym];
+		inflate->state = INFLATE_DIST_EXTRA;
+		return 0;
+
+	case INFLATE_DIST_EXTRA:
+		if ( ! inflate_need ( inflate, in, inflate->index ) )
+			return -EINPROGRESS;
+		inflate->distance += inflate_get ( inflate, inflate->index );
+		if ( inflate->distance > inflate->total )
+			return -EINVAL;
+		inflate->state = INFLATE_COPY;
+		return 0;
+
+	case INFLATE_COPY:
+		if ( ( rc = inflate_copy ( inflate ) ) != 0 )
+			return rc;
+		inflate->state = INFLATE_SYMBOL;
+		return 0;
+
+	case INFLATE_DONE:
+		return -EINPROGRESS;
+	}
+
+	return -EINVAL;
+
+ end_of_block:
+	inflate->state = ( inflate->final ? INFLATE_DONE : INFLATE_BLOCK );
+	return 0;
+}
+
+/**
+ * Initialise decompressor
+ *
+ * @v inflate		Decompressor
+ * @v output		Output function
+ */
+void inflate_init ( struct inflate *inflate,
+		    int ( * output ) ( struct inflate *inflate,
+				       const void *data, size_t len ) ) {
+	memset ( inflate, 0, sizeof ( *inflate ) );
+	inflate->state = INFLATE_BLOCK;
+	inflate->output = output;
+}
+
+/**
+ * Decompress data
+ *
+ * @v inflate		Decompressor
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v used		Length of compressed data consumed
+ * @ret rc		Return status code
+ *
+ * Decompressed data is passed to the output function in
+ * window-sized pieces, with the remainder being passed on once the
+ * final block is complete.  Input is consumed until it is exhausted
+ * or the final block is complete; in the latter case @c used
+ * indicates where any trailing data starts.
+ */
+int inflate_data ( struct inflate *inflate, const void *data, size_t len,
+		   size_t *used ) {
+	struct inflate_input in = {
+		.data = data,
+		.len = len,
+		.offset = 0,
+	};
+	int rc;
+
+	do {
+		rc = inflate_step ( inflate, &in );
+	} while ( rc == 0 );
+	*used = in.offset;
+	if ( rc != -EINPROGRESS ) {
+		DBGC ( inflate, "INFLATE %p corrupt data at state %d: %s\n",
+		       inflate, inflate->state, strerror ( rc ) );
+		return rc;
+	}
+
+	/* Output is otherwise only passed on when the window wraps */
+	if ( inflate_finished ( inflate ) )
+		return inflate_flush ( inflate );
+	return 0;
+}
@@ -29,6 +29,84 @@ FILE_LICENCE ( GPL2_OR_LATER );
  *
  */
 
+/**
+ * I/O buffer pools
+ *
+ * Received frames and full-sized TCP segments all come from one of
+ * two size classes: standard Ethernet MTU (which, with the
+ * descriptor, fits in a single IOB_ALIGN block) and jumbo frames.
+ * Recycling these avoids a trip through malloc_dma() for every
+ * packet, and stops the heap being fragmented by short-lived
+ * packet-sized holes.
+ *
+ * Pooled buffers are memory held back from the rest of gPXE: up to
+ * 104kB of the heap when both pools are full.  They are given back
+ * whenever an allocation from the heap would otherwise fail.
+ */
+struct io_buffer_pool iob_pools[IOB_NUM_POOLS] = {
+	{
+		.size = IOB_ALIGN,
+		.max = 32,
+		.free = LIST_HEAD_INIT ( iob_pools[0].free ),
+	},
+	{
+		.size = ( 5 * IOB_ALIGN ),
+		.max = 4,
+		.free = LIST_HEAD_INIT ( iob_pools[1].free ),
+	},
+};
+
+/**
+ * Find I/O buffer pool for a given allocation size
+ *
+ * @v size	Total allocation size (data plus descriptor)
+ * @ret pool	I/O buffer pool, or NULL
+ *
+ * Allocations are only pooled if they would waste no more than half
+ * of the pooled buffer; small buffers (ACKs, ARP replies, etc.) go
+ * straight to the heap as before.
+ */
+static struct io_buffer_pool * iob_pool ( size_t size ) {
+	struct io_buffer_pool *pool;
+	unsigned int i;
+
+	for ( i = 0 ; i < IOB_NUM_POOLS ; i++ ) {
+		pool = &iob_pools[i];
+		if ( ( size <= pool->size ) && ( size > ( pool->size / 2 ) ) )
+			return pool;
+	}
+	return NULL;
+}
+
+/**
+ * Release all pooled I/O buffers back to the heap
+ *
+ * @ret discarded	Number of buffers released
+ */
+unsigned int iob_pool_flush ( void ) {
+	struct io_buffer_pool *pool;
+	struct io_buffer *iobuf;
+	struct io_buffer *tmp;
+	unsigned int discarded = 0;
+	unsigned int i;
+
+	for ( i = 0 ; i < IOB_NUM_POOLS ; i++ ) {
+		pool = &iob_pools[i];
+		list_for_each_entry_safe ( iobuf, tmp, &pool->free, list ) {
+			list_del ( &iobuf->list );
+			free_dma ( iobuf->head, pool->size );
+		}
+		discarded += pool->count;
+		pool->count = 0;
+	}
+	return discarded;
+}
+
+/** Pooled I/O buffers are released when the heap runs out */
+struct cache_discarder iob_pool_discarder __cache_discarder = {
+	.discard = iob_pool_flush,
+};
+
 /**
  * Allocate I/O buffer
  *
@@ -39,6 +117,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
  * @c IOBUF_SIZE.
  */
 struct io_buffer * alloc_iob ( size_t len ) {
+	struct io_buffer_pool *pool;
 	struct io_buffer *iobuf = NULL;
 	void *data;
 
@@ -49,7 +128,23 @@ struct io_buffer * alloc_iob ( size_t len ) {
 	/* Align buffer length */
 	len = ( len + __alignof__( *iobuf ) - 1 ) &
 		~( __alignof__( *iobuf ) - 1 );
-	
+
+	/* Use a recycled buffer if this size class is pooled */
+	pool = iob_pool ( len + sizeof ( *iobuf ) );
+	if ( pool ) {
+		len = ( pool->size - sizeof ( *iobuf ) );
+		if ( ! list_empty ( &pool->free ) ) {
+			iobuf = list_entry ( pool->free.next,
+					     struct io_buffer, list );
+			list_del ( &iobuf->list );
+			pool->count--;
+			pool->hits++;
+			iobuf->data = iobuf->tail = iobuf->head;
+			return iobuf;
+		}
+		pool->misses++;
+	}
+
 	/* Allocate memory for buffer plus descriptor */
 	data = malloc_dma ( len + sizeof ( *iobuf ), IOB_ALIGN );
 	if ( ! data )
@@ -67,12 +162,26 @@ struct io_buffer * alloc_iob ( size_t len ) {
  * @v iobuf	I/O buffer
  */
 void free_iob ( struct io_buffer *iobuf ) {
+	struct io_buffer_pool *pool;
+	size_t size;
+
 	if ( iobuf ) {
 		assert ( iobuf->head <= iobuf->data );
 		assert ( iobuf->data <= iobuf->tail );
 		assert ( iobuf->tail <= iobuf->end );
-		free_dma ( iobuf->head,
-			   ( iobuf->end - iobuf->head ) + sizeof ( *iobuf ) );
+		size = ( ( iobuf->end - iobuf->head ) + sizeof ( *iobuf ) );
+
+		/* Recycle into the matching pool, if there is room */
+		pool = iob_pool ( size );
+		if ( pool && ( size == pool->size ) &&
+		     ( pool->count < pool->max ) ) {
+			list_add ( &iobuf->list, &pool->free );
+			pool->count++;
+			pool->recycled++;
+			return;
+		}
+
+		free_dma ( iobuf->head, size );
 	}
 }
 
@@ -85,6 +85,20 @@ size_t freemem;
 /** The heap itself */
 static char heap[HEAP_SIZE] __attribute__ (( aligned ( __alignof__(void *) )));
 
+/**
+ * Discard some cached data
+ *
+ * @ret discarded	Number of cached items discarded
+ */
+static unsigned int discard_cache ( void ) {
+	struct cache_discarder *discarder;
+	unsigned int discarded = 0;
+
+	for_each_table_entry ( discarder, CACHE_DISCARDERS )
+		discarded += discarder->discard();
+	return discarded;
+}
+
 /**
  * Allocate a memory block
  *
@@ -96,6 +110,9 @@ static char heap[HEAP_SIZE] __attribute__ (( aligned ( __alignof__(void *) )));
  * guarantees are provided for the alignment of the virtual address.
  *
  * @c align must be a power of two.  @c size may not be zero.
+ *
+ * If no free block is large enough, cached data is discarded and the
+ * search retried, until there is nothing left to discard.
  */
 void * alloc_memblock ( size_t size, size_t align ) {
 	struct memory_block *block;
@@ -114,6 +131,7 @@ void * alloc_memblock ( size_t size, size_t align ) {
 	DBG ( "Allocating %#zx (aligned %#zx)\n", size, align );
 
 	/* Search through blocks for the first one with enough space */
+ retry:
 	list_for_each_entry ( block, &free_blocks, list ) {
 		pre_size = ( - virt_to_phys ( block ) ) & align_mask;
 		post_size = block->size - pre_size - size;
@@ -159,6 +177,10 @@ void * alloc_memblock ( size_t size, size_t align ) {
 		}
 	}
 
+	/* Try again once some cached data has been freed */
+	if ( discard_cache() )
+		goto retry;
+
 	DBG ( "Failed to allocate %#zx (aligned %#zx)\n", size, align );
 	return NULL;
 }
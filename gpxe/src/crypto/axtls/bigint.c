@@ -767,6 +767,66 @@ void bi_free_mod(BI_CTX *ctx, int mod_offset)
     bi_free(ctx, ctx->bi_normalised_mod[mod_offset]);
 }
 
+#ifdef CONFIG_BIGINT_COMBA
+/*
+ * Add a double precision value into a three component column accumulator.
+ */
+#define COMBA_ADD(c0, c1, c2, p)                                        \
+    do                                                                  \
+    {                                                                   \
+        long_comp _t = (long_comp)c0 + (comp)(p);                       \
+        c0 = (comp)_t;                                                  \
+        _t = (long_comp)c1 + (comp)((p) >> COMP_BIT_SIZE) +             \
+                                    (_t >> COMP_BIT_SIZE);              \
+        c1 = (comp)_t;                                                  \
+        c2 += (comp)(_t >> COMP_BIT_SIZE);                              \
+    } while (0)
+
+/** 
+ * Perform a standard multiplication between two bigints.
+ *
+ * This is Comba's method: the result is built up one column at a time in a
+ * three component accumulator, so each result component is written exactly
+ * once and no carries ripple back through memory.
+ */
+static bigint *regular_multiply(BI_CTX *ctx, bigint *bia, bigint *bib)
+{
+    int i, k, i_min, i_max;
+    int n = bia->size; 
+    int t = bib->size;
+    bigint *biR = alloc(ctx, n + t);
+    comp *sr = biR->comps;
+    comp *sa = bia->comps;
+    comp *sb = bib->comps;
+    comp c0 = 0, c1 = 0, c2 = 0;
+
+    check(bia);
+    check(bib);
+
+    for (k = 0; k < n + t - 1; k++)
+    {
+        i_min = (k < t) ? 0 : k - t + 1;
+        i_max = (k < n) ? k : n - 1;
+
+        for (i = i_min; i <= i_max; i++)
+        {
+            long_comp p = (long_comp)sa[i]*sb[k - i];
+            COMBA_ADD(c0, c1, c2, p);
+        }
+
+        sr[k] = c0;
+        c0 = c1;
+        c1 = c2;
+        c2 = 0;
+    }
+
+    sr[k] = c0;
+
+    bi_free(ctx, bia);
+    bi_free(ctx, bib);
+    return trim(biR);
+}
+#else
 /** 
  * Perform a standard multiplication between two bigints.
  */
@@ -809,6 +869,8 @@ static bigint *regular_multiply(BI_CTX *ctx, bigint *bia, bigint *bib)
     return trim(biR);
 }
 
+#endif
+
 #ifdef CONFIG_BIGINT_KARATSUBA
 /*
  * Karatsuba improves on regular multiplication due to only 3 multiplications 
@@ -891,6 +953,51 @@ bigint *bi_multiply(BI_CTX *ctx, bigint *bia, bigint *bib)
 }
 
 #ifdef CONFIG_BIGINT_SQUARE
+#ifdef CONFIG_BIGINT_COMBA
+/*
+ * Perform the actual square operation, using Comba's method. Each product of
+ * two different components appears twice in a column, so it is only
+ * calculated once.
+ */
+static bigint *regular_square(BI_CTX *ctx, bigint *bi)
+{
+    int t = bi->size;
+    int i, j, k;
+    bigint *biR = alloc(ctx, t*2);
+    comp *w = biR->comps;
+    comp *x = bi->comps;
+    comp c0 = 0, c1 = 0, c2 = 0;
+
+    for (k = 0; k < 2*t - 1; k++)
+    {
+        i = (k < t) ? 0 : k - t + 1;
+        j = k - i;
+
+        for (; i < j; i++, j--)
+        {
+            long_comp p = (long_comp)x[i]*x[j];
+            COMBA_ADD(c0, c1, c2, p);
+            COMBA_ADD(c0, c1, c2, p);
+        }
+
+        if (i == j)
+        {
+            long_comp p = (long_comp)x[i]*x[i];
+            COMBA_ADD(c0, c1, c2, p);
+        }
+
+        w[k] = c0;
+        c0 = c1;
+        c1 = c2;
+        c2 = 0;
+    }
+
+    w[k] = c0;
+
+    bi_free(ctx, bi);
+    return trim(biR);
+}
+#else
 /*
  * Perform the actual square operion. It takes into account overflow.
  */
@@ -945,6 +1052,8 @@ static bigint *regular_square(BI_CTX *ctx, bigint *bi)
     return trim(biR);
 }
 
+#endif
+
 /**
  * @brief Perform a square operation on a bigint.
  * @param ctx [in]  The bigint session context.
@@ -1092,7 +1201,7 @@ static int find_max_exp_index(bigint *biexp)
         }
 
         shift >>= 1;
-    } while (--i != 0);
+    } while (--i >= 0);
 
     return -1;      /* error - must have been a leading 0 */
 }
@@ -1163,10 +1272,11 @@ static bigint *trim(bigint *bi)
  */
 bigint *bi_mont(BI_CTX *ctx, bigint *bixy)
 {
-    int i = 0, n;
+    int i, j, n;
     uint8_t mod_offset = ctx->mod_offset;
     bigint *bim = ctx->bi_mod[mod_offset];
     comp mod_inv = ctx->N0_dash[mod_offset];
+    comp *t, *m;
 
     check(bixy);
 
@@ -1176,14 +1286,39 @@ bigint *bi_mont(BI_CTX *ctx, bigint *bixy)
     }
 
     n = bim->size;
+    m = bim->comps;
 
-    do
+    /* room for the full product plus a final carry */
+    if (bixy->size < 2*n + 1)
+    {
+        more_comps(bixy, 2*n + 1);
+    }
+
+    t = bixy->comps;
+
+    /* add multiples of the modulus, in place, to clear the low n comps */
+    for (i = 0; i < n; i++)
     {
-        bixy = bi_add(ctx, bixy, comp_left_shift(
-                    bi_int_multiply(ctx, bim, bixy->comps[i]*mod_inv), i));
-    } while (++i < n);
+        comp u = t[i]*mod_inv;
+        comp carry = 0;
+
+        for (j = 0; j < n; j++)
+        {
+            long_comp tmp = (long_comp)u*m[j] + t[i+j] + carry;
+            t[i+j] = (comp)tmp;
+            carry = (comp)(tmp >> COMP_BIT_SIZE);
+        }
+
+        for (j = i + n; carry; j++)
+        {
+            long_comp tmp = (long_comp)t[j] + carry;
+            t[j] = (comp)tmp;
+            carry = (comp)(tmp >> COMP_BIT_SIZE);
+        }
+    }
 
     comp_right_shift(bixy, n);
+    trim(bixy);
 
     if (bi_compare(bixy, bim) >= 0)
     {
@@ -1410,13 +1545,11 @@ bigint *bi_mod_power(BI_CTX *ctx, bigint *bi, bigint *biexp)
             int l = i-window_size+1;
             int part_exp = 0;
 
-            if (l < 0)  /* LSB of exponent will always be 1 */
+            if (l < 0)
                 l = 0;
-            else
-            {
-                while (exp_bit_is_one(biexp, l) == 0)
-                    l++;    /* go back up */
-            }
+
+            while (exp_bit_is_one(biexp, l) == 0)
+                l++;    /* go back up */
 
             /* build up the section of the exponent */
             for (j = i; j >= l; j--)
@@ -13,6 +13,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <byteswap.h>
+#include <config/crypto.h>
 
 #define STDCALL
 #define EXP_FUNC
@@ -56,6 +57,15 @@ static inline int fclose ( FILE *stream __unused ) {
 #define CONFIG_X509_MAX_CA_CERTS 1
 #define CONFIG_SSL_EXPIRY_TIME 24
 #define CONFIG_SSL_ENABLE_CLIENT 1
+
+/** Big integer reduction technique; see config/crypto.h */
+#ifdef BIGINT_MONTGOMERY
+#define CONFIG_BIGINT_MONTGOMERY 1
+#define CONFIG_BIGINT_SLIDING_WINDOW 1
+#define CONFIG_BIGINT_SQUARE 1
+#define CONFIG_BIGINT_COMBA 1
+#else
 #define CONFIG_BIGINT_CLASSICAL 1
+#endif
 
 #endif 
@@ -19,289 +19,647 @@
  *
  */
 
-#include "etherboot.h"
-#include "nic.h"
+FILE_LICENCE ( GPL2_OR_LATER );
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <gpxe/io.h>
+#include <gpxe/iobuf.h>
+#include <gpxe/netdevice.h>
+#include <gpxe/pci.h>
+#include <gpxe/if_ether.h>
+#include <gpxe/ethernet.h>
+#include <gpxe/tcpip.h>
 #include "gpxe/virtio-ring.h"
 #include "gpxe/virtio-pci.h"
 #include "virtio-net.h"
 
-#define BUG() do { \
-   printf("BUG: failure at %s:%d/%s()!\n", \
-          __FILE__, __LINE__, __FUNCTION__); \
-   while(1); \
-} while (0)
-#define BUG_ON(condition) do { if (condition) BUG(); } while (0)
-
-/* Ethernet header */
-
-struct eth_hdr {
-   unsigned char dst_addr[ETH_ALEN];
-   unsigned char src_addr[ETH_ALEN];
-   unsigned short type;
-};
-
-struct eth_frame {
-   struct eth_hdr hdr;
-   unsigned char data[ETH_FRAME_LEN];
-};
-
-/* TX: virtio header and eth buffer */
-
-static struct virtio_net_hdr tx_virtio_hdr;
-static struct eth_frame tx_eth_frame;
-
-/* RX: virtio headers and buffers */
-
-#define RX_BUF_NB  6
-static struct virtio_net_hdr rx_hdr[RX_BUF_NB];
-static unsigned char rx_buffer[RX_BUF_NB][ETH_FRAME_LEN];
+/** @file
+ *
+ * Virtio network interface
+ *
+ * Receive buffers are kept posted to the device in a deep ring of
+ * I/O buffers, so that bursts of incoming frames (e.g. a TFTP or
+ * HTTP window) can be absorbed by the host without waiting for us
+ * to poll.  Completed buffers are harvested in batches and the ring
+ * is refilled with a single notification.  Several transmissions may
+ * be in flight at any one time.
+ *
+ * If the host offers them, mergeable receive buffers and guest
+ * checksum handling are used; both may be disabled at build time by
+ * editing VIRTNET_FEATURES.
+ */
 
 /* virtio queues and vrings */
 
 enum {
-   RX_INDEX = 0,
-   TX_INDEX,
-   QUEUE_NB
+	RX_INDEX = 0,
+	TX_INDEX,
+	QUEUE_NB
 };
 
-static struct vring_virtqueue virtqueue[QUEUE_NB];
+/** Features we are willing to negotiate with the host */
+#define VIRTNET_FEATURES ( ( 1 << VIRTIO_NET_F_MAC ) |		\
+			   ( 1 << VIRTIO_NET_F_MRG_RXBUF ) |	\
+			   ( 1 << VIRTIO_NET_F_GUEST_CSUM ) )
+
+/** Maximum number of posted receive buffers */
+#define VIRTNET_RX_MAX_FILL 64
+
+/** Maximum number of in-flight transmissions */
+#define VIRTNET_TX_MAX_FILL 16
+
+/** Receive buffer payload size (Ethernet frame plus VLAN tag) */
+#define VIRTNET_RX_BUF_SIZE ( ETH_FRAME_LEN + 4 )
+
+/** A virtio network interface */
+struct virtnet_nic {
+	/** Base I/O address */
+	unsigned long ioaddr;
+	/** RX and TX virtqueues */
+	struct vring_virtqueue *virtqueue;
+	/** Negotiated features */
+	u32 features;
+	/** Length of the virtio header in use */
+	size_t hdr_len;
+
+	/** Posted receive buffers, indexed by token */
+	struct io_buffer *rx_iobuf[VIRTNET_RX_MAX_FILL];
+	/** Receive headers, indexed by token (non-mergeable mode only) */
+	struct virtio_net_hdr_mrg_rxbuf rx_hdr[VIRTNET_RX_MAX_FILL];
+	/** Number of receive buffers to keep posted */
+	unsigned int rx_fill;
+	/** Number of receive buffers currently posted */
+	unsigned int rx_num;
+	/** Frame being assembled from mergeable receive buffers */
+	struct io_buffer *rx_merge;
+	/** Number of mergeable receive buffers still to come */
+	unsigned int rx_merge_remaining;
+
+	/** In-flight transmissions, indexed by token */
+	struct io_buffer *tx_iobuf[VIRTNET_TX_MAX_FILL];
+	/** Maximum number of in-flight transmissions */
+	unsigned int tx_fill;
+	/** Shared (empty) transmit header */
+	struct virtio_net_hdr_mrg_rxbuf tx_hdr;
+};
 
-/*
- * virtnet_disable
- *
- * Turn off ethernet interface
+/**
+ * Check whether or not a feature has been negotiated
  *
+ * @v virtnet		Virtio NIC
+ * @v feature		Feature bit number
+ * @ret present		Feature is in use
  */
-
-static void virtnet_disable(struct nic *nic)
-{
-   int i;
-
-   for (i = 0; i < QUEUE_NB; i++) {
-           vring_disable_cb(&virtqueue[i]);
-           vp_del_vq(nic->ioaddr, i);
-   }
-   vp_reset(nic->ioaddr);
+static inline int virtnet_has ( struct virtnet_nic *virtnet,
+				unsigned int feature ) {
+	return ( virtnet->features & ( 1 << feature ) );
 }
 
-/*
- * virtnet_poll
+/**
+ * Post receive buffers until the RX ring is full
  *
- * Wait for a frame
- *
- * return true if there is a packet ready to read
- *
- * nic->packet should contain data on return
- * nic->packetlen should contain length of data
+ * @v netdev		Network device
  *
+ * All new buffers are made visible to the host with a single kick.
  */
-static int virtnet_poll(struct nic *nic, int retrieve)
-{
-   unsigned int len;
-   u16 token;
-   struct virtio_net_hdr *hdr;
-   struct vring_list list[2];
-
-   if (!vring_more_used(&virtqueue[RX_INDEX]))
-           return 0;
-
-   if (!retrieve)
-           return 1;
-
-   token = vring_get_buf(&virtqueue[RX_INDEX], &len);
-
-   BUG_ON(len > sizeof(struct virtio_net_hdr) + ETH_FRAME_LEN);
-
-   hdr = &rx_hdr[token];   /* FIXME: check flags */
-   len -= sizeof(struct virtio_net_hdr);
-
-   nic->packetlen = len;
-   memcpy(nic->packet, (char *)rx_buffer[token], nic->packetlen);
-
-   /* add buffer to desc */
-
-   list[0].addr = (char*)&rx_hdr[token];
-   list[0].length = sizeof(struct virtio_net_hdr);
-   list[1].addr = (char*)&rx_buffer[token];
-   list[1].length = ETH_FRAME_LEN;
-
-   vring_add_buf(&virtqueue[RX_INDEX], list, 0, 2, token, 0);
-   vring_kick(nic->ioaddr, &virtqueue[RX_INDEX], 1);
-
-   return 1;
+static void virtnet_refill_rx ( struct net_device *netdev ) {
+	struct virtnet_nic *virtnet = netdev->priv;
+	struct vring_virtqueue *vq = &virtnet->virtqueue[RX_INDEX];
+	struct vring_list list[2];
+	struct io_buffer *iobuf;
+	unsigned int mrg = virtnet_has ( virtnet, VIRTIO_NET_F_MRG_RXBUF );
+	unsigned int added = 0;
+	unsigned int token;
+
+	for ( token = 0 ; ( ( token < virtnet->rx_fill ) &&
+			    ( virtnet->rx_num < virtnet->rx_fill ) ) ;
+	      token++ ) {
+		if ( virtnet->rx_iobuf[token] )
+			continue;
+
+		iobuf = alloc_iob ( virtnet->hdr_len + VIRTNET_RX_BUF_SIZE );
+		if ( ! iobuf ) {
+			/* Try again on the next poll */
+			break;
+		}
+
+		if ( mrg ) {
+			/* Header is placed in-line by the host */
+			list[0].addr = iobuf->data;
+			list[0].length = ( virtnet->hdr_len +
+					   VIRTNET_RX_BUF_SIZE );
+			vring_add_buf ( vq, list, 0, 1, token, added );
+		} else {
+			list[0].addr = ( char * ) &virtnet->rx_hdr[token];
+			list[0].length = virtnet->hdr_len;
+			list[1].addr = iobuf->data;
+			list[1].length = VIRTNET_RX_BUF_SIZE;
+			vring_add_buf ( vq, list, 0, 2, token, added );
+		}
+
+		virtnet->rx_iobuf[token] = iobuf;
+		virtnet->rx_num++;
+		added++;
+	}
+
+	if ( added ) {
+		DBGC2 ( virtnet, "VIRTIO-NET %p posted %d RX buffers\n",
+			virtnet, added );
+		vring_kick ( virtnet->ioaddr, vq, added );
+	}
 }
 
-/*
- *
- * virtnet_transmit
+/**
+ * Complete a partially-checksummed received frame
  *
- * Transmit a frame
+ * @v virtnet		Virtio NIC
+ * @v hdr		Virtio header
+ * @v iobuf		I/O buffer
+ * @ret rc		Return status code
  *
+ * With VIRTIO_NET_F_GUEST_CSUM, the host may hand us frames whose
+ * transport checksum field holds only the pseudo-header sum.  The
+ * network stack always verifies checksums, so we fill in the rest.
  */
+static int virtnet_fix_csum ( struct virtnet_nic *virtnet,
+			      struct virtio_net_hdr *hdr,
+			      struct io_buffer *iobuf ) {
+	size_t len = iob_len ( iobuf );
+	size_t start = hdr->csum_start;
+	size_t offset = ( start + hdr->csum_offset );
+	uint16_t *csum;
+
+	if ( ! ( hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM ) )
+		return 0;
+
+	if ( ( start > len ) || ( ( offset + sizeof ( *csum ) ) > len ) ) {
+		DBGC ( virtnet, "VIRTIO-NET %p bad checksum location "
+		       "%zd+%zd (len %zd)\n", virtnet, start,
+		       ( offset - start ), len );
+		return -EINVAL;
+	}
+
+	csum = ( iobuf->data + offset );
+	*csum = tcpip_chksum ( ( iobuf->data + start ), ( len - start ) );
+	return 0;
+}
 
-static void virtnet_transmit(struct nic *nic, const char *destaddr,
-        unsigned int type, unsigned int len, const char *data)
-{
-   struct vring_list list[2];
-
-   /*
-    * from http://www.etherboot.org/wiki/dev/devmanual :
-    *     "You do not need more than one transmit buffer."
-    */
-
-   /* FIXME: initialize header according to vp_get_features() */
-
-   tx_virtio_hdr.flags = 0;
-   tx_virtio_hdr.csum_offset = 0;
-   tx_virtio_hdr.csum_start = 0;
-   tx_virtio_hdr.gso_type = VIRTIO_NET_HDR_GSO_NONE;
-   tx_virtio_hdr.gso_size = 0;
-   tx_virtio_hdr.hdr_len = 0;
-
-   /* add ethernet frame into vring */
-
-   BUG_ON(len > sizeof(tx_eth_frame.data));
-
-   memcpy(tx_eth_frame.hdr.dst_addr, destaddr, ETH_ALEN);
-   memcpy(tx_eth_frame.hdr.src_addr, nic->node_addr, ETH_ALEN);
-   tx_eth_frame.hdr.type = htons(type);
-   memcpy(tx_eth_frame.data, data, len);
-
-   list[0].addr = (char*)&tx_virtio_hdr;
-   list[0].length = sizeof(struct virtio_net_hdr);
-   list[1].addr = (char*)&tx_eth_frame;
-   list[1].length = ETH_FRAME_LEN;
+/**
+ * Hand a completed frame to the network stack
+ *
+ * @v netdev		Network device
+ * @v hdr		Virtio header
+ * @v iobuf		I/O buffer
+ */
+static void virtnet_rx_frame ( struct net_device *netdev,
+			       struct virtio_net_hdr *hdr,
+			       struct io_buffer *iobuf ) {
+	struct virtnet_nic *virtnet = netdev->priv;
+	int rc;
+
+	if ( ( rc = virtnet_fix_csum ( virtnet, hdr, iobuf ) ) != 0 ) {
+		netdev_rx_err ( netdev, iobuf, rc );
+		return;
+	}
+
+	DBGC2 ( virtnet, "VIRTIO-NET %p RX %p+%zx\n",
+		virtnet, iobuf->data, iob_len ( iobuf ) );
+	netdev_rx ( netdev, iobuf );
+}
 
-   vring_add_buf(&virtqueue[TX_INDEX], list, 2, 0, 0, 0);
+/**
+ * Process a completed mergeable receive buffer
+ *
+ * @v netdev		Network device
+ * @v iobuf		I/O buffer (already trimmed to the used length)
+ */
+static void virtnet_rx_mrg ( struct net_device *netdev,
+			     struct io_buffer *iobuf ) {
+	struct virtnet_nic *virtnet = netdev->priv;
+	struct virtio_net_hdr_mrg_rxbuf *hdr;
+	struct io_buffer *frame;
+	size_t len = iob_len ( iobuf );
+	unsigned int num_buffers;
+
+	if ( virtnet->rx_merge ) {
+		/* Continuation of a multi-buffer frame */
+		frame = virtnet->rx_merge;
+		if ( len > iob_tailroom ( frame ) ) {
+			/* Drop the whole frame, and any remaining pieces */
+			netdev_rx_err ( netdev, iobuf, -EINVAL );
+			free_iob ( frame );
+			virtnet->rx_merge = NULL;
+			virtnet->rx_merge_remaining--;
+			return;
+		}
+		memcpy ( iob_put ( frame, len ), iobuf->data, len );
+		free_iob ( iobuf );
+		if ( --virtnet->rx_merge_remaining )
+			return;
+		virtnet->rx_merge = NULL;
+		hdr = frame->head;
+		virtnet_rx_frame ( netdev, &hdr->hdr, frame );
+		return;
+	}
+
+	if ( len < virtnet->hdr_len ) {
+		netdev_rx_err ( netdev, iobuf, -EINVAL );
+		return;
+	}
+	hdr = iobuf->data;
+	num_buffers = hdr->num_buffers;
+	iob_pull ( iobuf, virtnet->hdr_len );
+
+	if ( num_buffers <= 1 ) {
+		virtnet_rx_frame ( netdev, &hdr->hdr, iobuf );
+		return;
+	}
+
+	/* Frame spans several buffers: gather into one I/O buffer,
+	 * keeping a copy of the header at its head.
+	 */
+	virtnet->rx_merge_remaining = ( num_buffers - 1 );
+	frame = alloc_iob ( virtnet->hdr_len +
+			    ( num_buffers * VIRTNET_RX_BUF_SIZE ) );
+	if ( ! frame ) {
+		netdev_rx_err ( netdev, iobuf, -ENOMEM );
+		return;
+	}
+	memcpy ( iob_put ( frame, virtnet->hdr_len ), hdr, virtnet->hdr_len );
+	iob_pull ( frame, virtnet->hdr_len );
+	memcpy ( iob_put ( frame, iob_len ( iobuf ) ), iobuf->data,
+		 iob_len ( iobuf ) );
+	free_iob ( iobuf );
+	virtnet->rx_merge = frame;
+}
 
-   vring_kick(nic->ioaddr, &virtqueue[TX_INDEX], 1);
+/**
+ * Harvest completed receive buffers
+ *
+ * @v netdev		Network device
+ */
+static void virtnet_process_rx ( struct net_device *netdev ) {
+	struct virtnet_nic *virtnet = netdev->priv;
+	struct vring_virtqueue *vq = &virtnet->virtqueue[RX_INDEX];
+	struct io_buffer *iobuf;
+	unsigned int quota = virtnet->rx_fill;
+	unsigned int token;
+	unsigned int len;
+
+	while ( quota-- && vring_more_used ( vq ) ) {
+		token = vring_get_buf ( vq, &len );
+		iobuf = virtnet->rx_iobuf[token];
+		virtnet->rx_iobuf[token] = NULL;
+		virtnet->rx_num--;
+
+		if ( virtnet_has ( virtnet, VIRTIO_NET_F_MRG_RXBUF ) ) {
+			if ( len > ( virtnet->hdr_len +
+				     VIRTNET_RX_BUF_SIZE ) ) {
+				netdev_rx_err ( netdev, iobuf, -EINVAL );
+				if ( virtnet->rx_merge_remaining ) {
+					/* Lose the rest of this frame too */
+					virtnet->rx_merge_remaining--;
+					free_iob ( virtnet->rx_merge );
+					virtnet->rx_merge = NULL;
+				}
+				continue;
+			}
+			iob_put ( iobuf, len );
+			if ( virtnet->rx_merge_remaining &&
+			     ! virtnet->rx_merge ) {
+				/* Tail of a frame we could not assemble */
+				virtnet->rx_merge_remaining--;
+				free_iob ( iobuf );
+				continue;
+			}
+			virtnet_rx_mrg ( netdev, iobuf );
+		} else {
+			if ( ( len < virtnet->hdr_len ) ||
+			     ( len > ( virtnet->hdr_len +
+				       VIRTNET_RX_BUF_SIZE ) ) ) {
+				netdev_rx_err ( netdev, iobuf, -EINVAL );
+				continue;
+			}
+			iob_put ( iobuf, ( len - virtnet->hdr_len ) );
+			virtnet_rx_frame ( netdev,
+					   &virtnet->rx_hdr[token].hdr,
+					   iobuf );
+		}
+	}
+}
 
-   /*
-    * http://www.etherboot.org/wiki/dev/devmanual
-    *
-    *   "You should ensure the packet is fully transmitted
-    *    before returning from this routine"
-    */
+/**
+ * Harvest completed transmissions
+ *
+ * @v netdev		Network device
+ */
+static void virtnet_process_tx ( struct net_device *netdev ) {
+	struct virtnet_nic *virtnet = netdev->priv;
+	struct vring_virtqueue *vq = &virtnet->virtqueue[TX_INDEX];
+	unsigned int token;
+
+	while ( vring_more_used ( vq ) ) {
+		token = vring_get_buf ( vq, NULL );
+		DBGC2 ( virtnet, "VIRTIO-NET %p TX id %d complete\n",
+			virtnet, token );
+		netdev_tx_complete ( netdev, virtnet->tx_iobuf[token] );
+		virtnet->tx_iobuf[token] = NULL;
+	}
+}
 
-   while (!vring_more_used(&virtqueue[TX_INDEX])) {
-           mb();
-           udelay(10);
-   }
+/**
+ * Free all receive buffers and any partially-assembled frame
+ *
+ * @v virtnet		Virtio NIC
+ */
+static void virtnet_free_rx ( struct virtnet_nic *virtnet ) {
+	unsigned int token;
+
+	for ( token = 0 ; token < VIRTNET_RX_MAX_FILL ; token++ ) {
+		free_iob ( virtnet->rx_iobuf[token] );
+		virtnet->rx_iobuf[token] = NULL;
+	}
+	virtnet->rx_num = 0;
+	free_iob ( virtnet->rx_merge );
+	virtnet->rx_merge = NULL;
+	virtnet->rx_merge_remaining = 0;
+}
 
-   /* free desc */
+/**
+ * Open NIC
+ *
+ * @v netdev		Net device
+ * @ret rc		Return status code
+ */
+static int virtnet_open ( struct net_device *netdev ) {
+	struct virtnet_nic *virtnet = netdev->priv;
+	unsigned long ioaddr = virtnet->ioaddr;
+	struct vring_virtqueue *vq;
+	unsigned int per_rx;
+	int i;
+
+	/* Reset the device and acknowledge it */
+	vp_reset ( ioaddr );
+	vp_set_status ( ioaddr, ( VIRTIO_CONFIG_S_ACKNOWLEDGE |
+				  VIRTIO_CONFIG_S_DRIVER ) );
+
+	/* Negotiate features */
+	virtnet->features = ( vp_get_features ( ioaddr ) & VIRTNET_FEATURES );
+	vp_set_features ( ioaddr, virtnet->features );
+	virtnet->hdr_len = ( virtnet_has ( virtnet, VIRTIO_NET_F_MRG_RXBUF ) ?
+			     sizeof ( struct virtio_net_hdr_mrg_rxbuf ) :
+			     sizeof ( struct virtio_net_hdr ) );
+	DBGC ( virtnet, "VIRTIO-NET %p features %08x (%s%s)\n", virtnet,
+	       virtnet->features,
+	       ( virtnet_has ( virtnet, VIRTIO_NET_F_MRG_RXBUF ) ?
+		 "mrg_rxbuf " : "" ),
+	       ( virtnet_has ( virtnet, VIRTIO_NET_F_GUEST_CSUM ) ?
+		 "guest_csum" : "" ) );
+
+	/* Allocate and register the virtqueues */
+	virtnet->virtqueue = zalloc ( QUEUE_NB * sizeof ( *vq ) );
+	if ( ! virtnet->virtqueue ) {
+		vp_reset ( ioaddr );
+		return -ENOMEM;
+	}
+	for ( i = 0 ; i < QUEUE_NB ; i++ ) {
+		vq = &virtnet->virtqueue[i];
+		if ( vp_find_vq ( ioaddr, i, vq ) == -1 ) {
+			DBGC ( virtnet, "VIRTIO-NET %p cannot register "
+			       "queue %d\n", virtnet, i );
+			goto err_find_vq;
+		}
+	}
+
+	/* Size the rings to what the host gave us */
+	per_rx = ( virtnet_has ( virtnet, VIRTIO_NET_F_MRG_RXBUF ) ? 1 : 2 );
+	virtnet->rx_fill = ( virtnet->virtqueue[RX_INDEX].vring.num / per_rx );
+	if ( virtnet->rx_fill > VIRTNET_RX_MAX_FILL )
+		virtnet->rx_fill = VIRTNET_RX_MAX_FILL;
+	virtnet->tx_fill = ( virtnet->virtqueue[TX_INDEX].vring.num / 2 );
+	if ( virtnet->tx_fill > VIRTNET_TX_MAX_FILL )
+		virtnet->tx_fill = VIRTNET_TX_MAX_FILL;
+	DBGC ( virtnet, "VIRTIO-NET %p using %d RX and %d TX slots\n",
+	       virtnet, virtnet->rx_fill, virtnet->tx_fill );
+
+	/* We poll; do not ask for interrupts */
+	vring_disable_cb ( &virtnet->virtqueue[RX_INDEX] );
+	vring_disable_cb ( &virtnet->virtqueue[TX_INDEX] );
+
+	/* Provide receive buffers and tell the host we are ready */
+	virtnet_refill_rx ( netdev );
+	vp_set_status ( ioaddr, ( VIRTIO_CONFIG_S_ACKNOWLEDGE |
+				  VIRTIO_CONFIG_S_DRIVER |
+				  VIRTIO_CONFIG_S_DRIVER_OK ) );
+	return 0;
+
+ err_find_vq:
+	while ( --i >= 0 )
+		vp_del_vq ( ioaddr, i );
+	vp_reset ( ioaddr );
+	free ( virtnet->virtqueue );
+	virtnet->virtqueue = NULL;
+	return -ENOENT;
+}
 
-   (void)vring_get_buf(&virtqueue[TX_INDEX], NULL);
+/**
+ * Close NIC
+ *
+ * @v netdev		Net device
+ */
+static void virtnet_close ( struct net_device *netdev ) {
+	struct virtnet_nic *virtnet = netdev->priv;
+	unsigned int token;
+	int i;
+
+	/* Stop the device before touching any buffers it may own */
+	vp_reset ( virtnet->ioaddr );
+	for ( i = 0 ; i < QUEUE_NB ; i++ )
+		vp_del_vq ( virtnet->ioaddr, i );
+
+	virtnet_free_rx ( virtnet );
+	for ( token = 0 ; token < VIRTNET_TX_MAX_FILL ; token++ ) {
+		if ( virtnet->tx_iobuf[token] ) {
+			netdev_tx_complete_err ( netdev,
+						 virtnet->tx_iobuf[token],
+						 -ECANCELED );
+			virtnet->tx_iobuf[token] = NULL;
+		}
+	}
+
+	free ( virtnet->virtqueue );
+	virtnet->virtqueue = NULL;
 }
 
-static void virtnet_irq(struct nic *nic __unused, irq_action_t action)
-{
-   switch ( action ) {
-   case DISABLE :
-           vring_disable_cb(&virtqueue[RX_INDEX]);
-           vring_disable_cb(&virtqueue[TX_INDEX]);
-           break;
-   case ENABLE :
-           vring_enable_cb(&virtqueue[RX_INDEX]);
-           vring_enable_cb(&virtqueue[TX_INDEX]);
-           break;
-   case FORCE :
-           break;
-   }
+/**
+ * Transmit packet
+ *
+ * @v netdev	Network device
+ * @v iobuf	I/O buffer
+ * @ret rc	Return status code
+ */
+static int virtnet_transmit ( struct net_device *netdev,
+			      struct io_buffer *iobuf ) {
+	struct virtnet_nic *virtnet = netdev->priv;
+	struct vring_virtqueue *vq = &virtnet->virtqueue[TX_INDEX];
+	struct vring_list list[2];
+	unsigned int token;
+
+	/* Reclaim anything the host has finished with */
+	virtnet_process_tx ( netdev );
+
+	/* Find a free slot */
+	for ( token = 0 ; token < virtnet->tx_fill ; token++ ) {
+		if ( ! virtnet->tx_iobuf[token] )
+			break;
+	}
+	if ( token == virtnet->tx_fill ) {
+		DBGC ( virtnet, "VIRTIO-NET %p TX overflow\n", virtnet );
+		return -ENOBUFS;
+	}
+
+	iob_pad ( iobuf, ETH_ZLEN );
+
+	/* The header is never written by the host, so one will do */
+	list[0].addr = ( char * ) &virtnet->tx_hdr;
+	list[0].length = virtnet->hdr_len;
+	list[1].addr = iobuf->data;
+	list[1].length = iob_len ( iobuf );
+
+	DBGC2 ( virtnet, "VIRTIO-NET %p TX id %d at %p+%zx\n",
+		virtnet, token, iobuf->data, iob_len ( iobuf ) );
+	virtnet->tx_iobuf[token] = iobuf;
+	vring_add_buf ( vq, list, 2, 0, token, 0 );
+	vring_kick ( virtnet->ioaddr, vq, 1 );
+
+	return 0;
 }
 
-static void provide_buffers(struct nic *nic)
-{
-   int i;
-   struct vring_list list[2];
+/**
+ * Poll for completed and received packets
+ *
+ * @v netdev	Network device
+ */
+static void virtnet_poll ( struct net_device *netdev ) {
+	struct virtnet_nic *virtnet = netdev->priv;
 
-   for (i = 0; i < RX_BUF_NB; i++) {
-           list[0].addr = (char*)&rx_hdr[i];
-           list[0].length = sizeof(struct virtio_net_hdr);
-           list[1].addr = (char*)&rx_buffer[i];
-           list[1].length = ETH_FRAME_LEN;
-           vring_add_buf(&virtqueue[RX_INDEX], list, 0, 2, i, i);
-   }
+	/* Acknowledge any pending interrupt */
+	( void ) inb ( virtnet->ioaddr + VIRTIO_PCI_ISR );
 
-   /* nofify */
+	virtnet_process_tx ( netdev );
+	virtnet_process_rx ( netdev );
+	virtnet_refill_rx ( netdev );
+}
 
-   vring_kick(nic->ioaddr, &virtqueue[RX_INDEX], i);
+/**
+ * Enable/disable interrupts
+ *
+ * @v netdev	Network device
+ * @v enable	Interrupts should be enabled
+ */
+static void virtnet_irq ( struct net_device *netdev, int enable ) {
+	struct virtnet_nic *virtnet = netdev->priv;
+	int i;
+
+	if ( ! virtnet->virtqueue )
+		return;
+
+	for ( i = 0 ; i < QUEUE_NB ; i++ ) {
+		if ( enable )
+			vring_enable_cb ( &virtnet->virtqueue[i] );
+		else
+			vring_disable_cb ( &virtnet->virtqueue[i] );
+	}
 }
 
-static struct nic_operations virtnet_operations = {
-	.connect = dummy_connect,
-	.poll = virtnet_poll,
-	.transmit = virtnet_transmit,
-	.irq = virtnet_irq,
+/** Virtio net device operations */
+static struct net_device_operations virtnet_operations = {
+	.open		= virtnet_open,
+	.close		= virtnet_close,
+	.transmit	= virtnet_transmit,
+	.poll		= virtnet_poll,
+	.irq		= virtnet_irq,
 };
 
-/*
- * virtnet_probe
- *
- * Look for a virtio network adapter
+/**
+ * Probe PCI device
  *
+ * @v pci	PCI device
+ * @v id	PCI ID
+ * @ret rc	Return status code
  */
+static int virtnet_probe ( struct pci_device *pci,
+			   const struct pci_device_id *id __unused ) {
+	struct net_device *netdev;
+	struct virtnet_nic *virtnet;
+	unsigned long ioaddr = pci->ioaddr;
+	int rc;
+
+	/* Allocate net device */
+	netdev = alloc_etherdev ( sizeof ( *virtnet ) );
+	if ( ! netdev )
+		return -ENOMEM;
+	netdev_init ( netdev, &virtnet_operations );
+	virtnet = netdev->priv;
+	pci_set_drvdata ( pci, netdev );
+	netdev->dev = &pci->dev;
+	memset ( virtnet, 0, sizeof ( *virtnet ) );
+	virtnet->ioaddr = ioaddr;
+
+	DBGC ( virtnet, "VIRTIO-NET %p busaddr=%s ioaddr=%#lx irq=%d\n",
+	       virtnet, pci->dev.name, ioaddr, pci->irq );
+
+	/* Fix up PCI device */
+	adjust_pci_device ( pci );
+
+	/* Reset the device and read the MAC address */
+	vp_reset ( ioaddr );
+	if ( vp_get_features ( ioaddr ) & ( 1 << VIRTIO_NET_F_MAC ) ) {
+		vp_get ( ioaddr, offsetof ( struct virtio_net_config, mac ),
+			 netdev->hw_addr, ETH_ALEN );
+		DBGC ( virtnet, "VIRTIO-NET %p mac=%s\n", virtnet,
+		       eth_ntoa ( netdev->hw_addr ) );
+	}
+
+	/* Mark as link up; we don't yet handle link state */
+	netdev_link_up ( netdev );
+
+	/* Register network device */
+	if ( ( rc = register_netdev ( netdev ) ) != 0 )
+		goto err_register_netdev;
+
+	return 0;
+
+ err_register_netdev:
+	vp_reset ( ioaddr );
+	netdev_nullify ( netdev );
+	netdev_put ( netdev );
+	return rc;
+}
 
-static int virtnet_probe(struct nic *nic, struct pci_device *pci)
-{
-   u32 features;
-   int i;
-
-   /* Mask the bit that says "this is an io addr" */
-
-   nic->ioaddr = pci->ioaddr & ~3;
-
-   /* Copy IRQ from PCI information */
-
-   nic->irqno = pci->irq;
-
-   printf("I/O address 0x%08x, IRQ #%d\n", nic->ioaddr, nic->irqno);
-
-   adjust_pci_device(pci);
-
-   vp_reset(nic->ioaddr);
-
-   features = vp_get_features(nic->ioaddr);
-   if (features & (1 << VIRTIO_NET_F_MAC)) {
-           vp_get(nic->ioaddr, offsetof(struct virtio_net_config, mac),
-                  nic->node_addr, ETH_ALEN);
-           printf("MAC address ");
-	   for (i = 0; i < ETH_ALEN; i++) {
-                   printf("%02x%c", nic->node_addr[i],
-                          (i == ETH_ALEN - 1) ? '\n' : ':');
-           }
-   }
-
-   /* initialize emit/receive queue */
-
-   for (i = 0; i < QUEUE_NB; i++) {
-           virtqueue[i].free_head = 0;
-           virtqueue[i].last_used_idx = 0;
-           memset((char*)&virtqueue[i].queue, 0, sizeof(virtqueue[i].queue));
-           if (vp_find_vq(nic->ioaddr, i, &virtqueue[i]) == -1)
-                   printf("Cannot register queue #%d\n", i);
-   }
-
-   /* provide some receive buffers */
-
-    provide_buffers(nic);
-
-   /* define NIC interface */
-
-    nic->nic_op = &virtnet_operations;
-
-   /* driver is ready */
-
-   vp_set_features(nic->ioaddr, features & (1 << VIRTIO_NET_F_MAC));
-   vp_set_status(nic->ioaddr, VIRTIO_CONFIG_S_DRIVER | VIRTIO_CONFIG_S_DRIVER_OK);
+/**
+ * Remove PCI device
+ *
+ * @v pci	PCI device
+ */
+static void virtnet_remove ( struct pci_device *pci ) {
+	struct net_device *netdev = pci_get_drvdata ( pci );
 
-   return 1;
+	unregister_netdev ( netdev );
+	netdev_nullify ( netdev );
+	netdev_put ( netdev );
 }
 
 static struct pci_device_id virtnet_nics[] = {
 PCI_ROM(0x1af4, 0x1000, "virtio-net",              "Virtio Network Interface", 0),
 };
 
-PCI_DRIVER ( virtnet_driver, virtnet_nics, PCI_NO_CLASS );
-
-DRIVER ( "VIRTIO-NET", nic_driver, pci_driver, virtnet_driver,
-	 virtnet_probe, virtnet_disable );
+struct pci_driver virtnet_driver __pci_driver = {
+	.ids = virtnet_nics,
+	.id_count = ( sizeof ( virtnet_nics ) / sizeof ( virtnet_nics[0] ) ),
+	.probe = virtnet_probe,
+	.remove = virtnet_remove,
+};
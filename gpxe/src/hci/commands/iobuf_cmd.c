@@ -0,0 +1,95 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+#include <stdio.h>
+#include <getopt.h>
+#include <gpxe/command.h>
+#include <gpxe/iobuf.h>
+
+/** @file
+ *
+ * I/O buffer pool statistics command
+ *
+ */
+
+/**
+ * "iobstat" command syntax message
+ *
+ * @v argv		Argument list
+ */
+static void iobstat_syntax ( char **argv ) {
+	printf ( "Usage:\n"
+		 "  %s\n"
+		 "\n"
+		 "Displays I/O buffer pool statistics\n",
+		 argv[0] );
+}
+
+/**
+ * The "iobstat" command
+ *
+ * @v argc		Argument count
+ * @v argv		Argument list
+ * @ret rc		Exit code
+ */
+static int iobstat_exec ( int argc, char **argv ) {
+	static struct option longopts[] = {
+		{ "help", 0, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	struct io_buffer_pool *pool;
+	unsigned long total;
+	unsigned int i;
+	int c;
+
+	/* Parse options */
+	while ( ( c = getopt_long ( argc, argv, "h", longopts, NULL ) ) >= 0 ){
+		switch ( c ) {
+		case 'h':
+			/* Display help text */
+		default:
+			/* Unrecognised/invalid option */
+			iobstat_syntax ( argv );
+			return 1;
+		}
+	}
+
+	if ( optind != argc ) {
+		iobstat_syntax ( argv );
+		return 1;
+	}
+
+	for ( i = 0 ; i < IOB_NUM_POOLS ; i++ ) {
+		pool = &iob_pools[i];
+		total = ( pool->hits + pool->misses );
+		printf ( "%5zd-byte pool: %d/%d free, %ld hits, %ld misses "
+			 "(%ld%%), %ld recycled\n", pool->size, pool->count,
+			 pool->max, pool->hits, pool->misses,
+			 ( total ? ( ( pool->hits * 100 ) / total ) : 0 ),
+			 pool->recycled );
+	}
+	return 0;
+}
+
+/** I/O buffer pool commands */
+struct command iobuf_commands[] __command = {
+	{
+		.name = "iobstat",
+		.exec = iobstat_exec,
+	},
+};
@@ -0,0 +1,92 @@
+#ifndef _GPXE_GUNZIP_H
+#define _GPXE_GUNZIP_H
+
+/** @file
+ *
+ * gzip decompression filter
+ *
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+#include <stdint.h>
+#include <gpxe/refcnt.h>
+#include <gpxe/filter.h>
+#include <gpxe/inflate.h>
+
+/** gzip magic bytes */
+#define GZIP_ID1 0x1f
+#define GZIP_ID2 0x8b
+
+/** gzip "deflate" compression method */
+#define GZIP_CM_DEFLATE 8
+
+/** gzip header flags */
+#define GZIP_FHCRC	0x02	/**< Header CRC present */
+#define GZIP_FEXTRA	0x04	/**< Extra field present */
+#define GZIP_FNAME	0x08	/**< Original file name present */
+#define GZIP_FCOMMENT	0x10	/**< File comment present */
+#define GZIP_FRESERVED	0xe0	/**< Reserved flags */
+
+/** Length of fixed gzip header */
+#define GZIP_HEADER_LEN 10
+
+/** Length of gzip trailer (CRC32 and ISIZE) */
+#define GZIP_TRAILER_LEN 8
+
+/** gzip decompressor state */
+enum gunzip_state {
+	/** Reading fixed header */
+	GUNZIP_HEADER = 0,
+	/** Reading length of extra field */
+	GUNZIP_EXTRA_LEN,
+	/** Skipping extra field */
+	GUNZIP_EXTRA,
+	/** Skipping original file name */
+	GUNZIP_NAME,
+	/** Skipping file comment */
+	GUNZIP_COMMENT,
+	/** Skipping header CRC */
+	GUNZIP_HCRC,
+	/** Decompressing data */
+	GUNZIP_DATA,
+	/** Reading trailer */
+	GUNZIP_TRAILER,
+	/** Trailer verified */
+	GUNZIP_DONE,
+};
+
+/** A gzip decompression filter */
+struct gunzip {
+	/** Reference counter */
+	struct refcnt refcnt;
+
+	/** Plaintext stream */
+	struct xfer_filter_half plainstream;
+	/** Compressed stream */
+	struct xfer_filter_half gzstream;
+
+	/** Current state */
+	enum gunzip_state state;
+	/** Header flags not yet processed */
+	uint8_t flags;
+	/** Accumulated fixed-length header or trailer */
+	uint8_t buf[GZIP_HEADER_LEN];
+	/** Length of accumulated data */
+	size_t buf_len;
+	/** Remaining length of extra field */
+	size_t skip;
+
+	/** CRC32 of decompressed data */
+	uint32_t crc;
+	/** Length of decompressed data (modulo 2^32) */
+	uint32_t len;
+
+	/** DEFLATE decompressor */
+	struct inflate inflate;
+};
+
+extern int add_gunzip ( struct xfer_interface *xfer,
+			struct xfer_interface **next );
+
+#endif /* _GPXE_GUNZIP_H */
@@ -9,6 +9,11 @@
 
 FILE_LICENCE ( GPL2_OR_LATER );
 
+#include <gpxe/tables.h>
+
+struct xfer_interface;
+struct uri;
+
 /** HTTP default port */
 #define HTTP_PORT 80
 
@@ -20,4 +25,25 @@ extern int http_open_filter ( struct xfer_interface *xfer, struct uri *uri,
 			      int ( * filter ) ( struct xfer_interface *,
 						 struct xfer_interface ** ) );
 
+/** An HTTP content encoding */
+struct http_content_encoding {
+	/** Name (e.g. "gzip") */
+	const char *name;
+	/** Add decoding filter
+	 *
+	 * @v xfer	Recipient of decoded data
+	 * @v next	Interface to which encoded data should be delivered
+	 * @ret rc	Return status code
+	 */
+	int ( * filter ) ( struct xfer_interface *xfer,
+			   struct xfer_interface **next );
+};
+
+/** HTTP content encoding table */
+#define HTTP_CONTENT_ENCODINGS \
+	__table ( struct http_content_encoding, "http_content_encodings" )
+
+/** Declare an HTTP content encoding */
+#define __http_content_encoding __table_entry ( HTTP_CONTENT_ENCODINGS, 01 )
+
 #endif /* _GPXE_HTTP_H */
@@ -0,0 +1,137 @@
+#ifndef _GPXE_INFLATE_H
+#define _GPXE_INFLATE_H
+
+/** @file
+ *
+ * DEFLATE decompression
+ *
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Maximum length of a Huffman code */
+#define INFLATE_MAX_BITS 15
+
+/** Number of literal/length symbols */
+#define INFLATE_LITLEN_CODES 288
+
+/** Number of distance symbols */
+#define INFLATE_DIST_CODES 32
+
+/** Number of code length symbols */
+#define INFLATE_CLEN_CODES 19
+
+/** Size of the sliding window */
+#define INFLATE_WINDOW_SIZE 32768
+
+/** A canonical Huffman code */
+struct inflate_huffman {
+	/** Number of codes of each length */
+	uint16_t count[INFLATE_MAX_BITS + 1];
+	/** Symbols, ordered by code */
+	uint16_t symbol[INFLATE_LITLEN_CODES];
+};
+
+/** DEFLATE decompressor state */
+enum inflate_state {
+	/** Expecting a block header */
+	INFLATE_BLOCK = 0,
+	/** Expecting a stored block length */
+	INFLATE_STORED_LEN,
+	/** Copying stored block data */
+	INFLATE_STORED_DATA,
+	/** Expecting a dynamic block header */
+	INFLATE_DYNAMIC,
+	/** Reading code length code lengths */
+	INFLATE_CLEN,
+	/** Reading literal/length and distance code lengths */
+	INFLATE_LENS,
+	/** Expecting a literal/length symbol */
+	INFLATE_SYMBOL,
+	/** Expecting length extra bits */
+	INFLATE_LEN_EXTRA,
+	/** Expecting a distance symbol */
+	INFLATE_DIST,
+	/** Expecting distance extra bits */
+	INFLATE_DIST_EXTRA,
+	/** Copying a match from the window */
+	INFLATE_COPY,
+	/** Final block complete */
+	INFLATE_DONE,
+};
+
+/** A DEFLATE decompressor */
+struct inflate {
+	/** Current state */
+	enum inflate_state state;
+	/** Bit accumulator (least significant bit first) */
+	uint32_t bits;
+	/** Number of valid bits in accumulator */
+	unsigned int bits_len;
+	/** Current block is the final block */
+	int final;
+
+	/** Remaining length of stored block */
+	unsigned int remaining;
+	/** Match length */
+	unsigned int length;
+	/** Match distance */
+	unsigned int distance;
+
+	/** Number of literal/length codes in dynamic header */
+	unsigned int hlit;
+	/** Number of distance codes in dynamic header */
+	unsigned int hdist;
+	/** Number of code length codes in dynamic header */
+	unsigned int hclen;
+	/** Index of next code length to be read */
+	unsigned int index;
+	/** Code lengths being read */
+	uint8_t lens[INFLATE_LITLEN_CODES + INFLATE_DIST_CODES];
+
+	/** Literal/length code */
+	struct inflate_huffman litlen;
+	/** Distance (or code length) code */
+	struct inflate_huffman dist;
+
+	/** Sliding window */
+	uint8_t window[INFLATE_WINDOW_SIZE];
+	/** Write position within window */
+	unsigned int pos;
+	/** Start of data not yet passed to output() */
+	unsigned int flushed;
+	/** Total amount of data decompressed (saturating at window size) */
+	unsigned int total;
+
+	/** Deliver decompressed data
+	 *
+	 * @v inflate		Decompressor
+	 * @v data		Decompressed data
+	 * @v len		Length of data
+	 * @ret rc		Return status code
+	 */
+	int ( * output ) ( struct inflate *inflate, const void *data,
+			   size_t len );
+};
+
+extern void inflate_init ( struct inflate *inflate,
+			   int ( * output ) ( struct inflate *inflate,
+					      const void *data,
+					      size_t len ) );
+extern int inflate_data ( struct inflate *inflate, const void *data,
+			  size_t len, size_t *used );
+
+/**
+ * Check whether or not decompression is complete
+ *
+ * @v inflate		Decompressor
+ * @ret done		Final block has been decompressed
+ */
+static inline int inflate_finished ( struct inflate *inflate ) {
+	return ( inflate->state == INFLATE_DONE );
+}
+
+#endif /* _GPXE_INFLATE_H */
@@ -221,9 +221,39 @@ static inline void iob_populate ( struct io_buffer *iobuf,
 	(iobuf) = NULL;					\
 	__iobuf; } )
 
+/**
+ * A recycling pool of I/O buffers of a single size class
+ *
+ * Buffers freed via free_iob() whose allocation exactly matches the
+ * pool's size are kept on the pool's free list (up to a limit) and
+ * handed straight back out by alloc_iob(), bypassing malloc_dma().
+ */
+struct io_buffer_pool {
+	/** Total allocation size (data plus descriptor) */
+	size_t size;
+	/** Maximum number of buffers to hold on the free list */
+	unsigned int max;
+	/** Number of buffers currently on the free list */
+	unsigned int count;
+	/** Free list */
+	struct list_head free;
+	/** Allocations satisfied from the free list */
+	unsigned long hits;
+	/** Allocations that fell through to malloc_dma() */
+	unsigned long misses;
+	/** Frees that were returned to the free list */
+	unsigned long recycled;
+};
+
+/** Number of I/O buffer pools */
+#define IOB_NUM_POOLS 2
+
+extern struct io_buffer_pool iob_pools[IOB_NUM_POOLS];
+
 extern struct io_buffer * __malloc alloc_iob ( size_t len );
 extern void free_iob ( struct io_buffer *iobuf );
 extern void iob_pad ( struct io_buffer *iobuf, size_t min_len );
 extern int iob_ensure_headroom ( struct io_buffer *iobuf, size_t len );
+extern unsigned int iob_pool_flush ( void );
 
 #endif /* _GPXE_IOBUF_H */
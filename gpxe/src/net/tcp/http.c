@@ -44,6 +44,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <gpxe/linebuf.h>
 #include <gpxe/features.h>
 #include <gpxe/base64.h>
+#include <gpxe/vsprintf.h>
 #include <gpxe/http.h>
 
 FEATURE ( FEATURE_PROTOCOL, "HTTP", DHCP_EB_FEATURE_HTTP, 1 );
@@ -78,6 +79,8 @@ struct http_request {
 	unsigned int response;
 	/** HTTP Content-Length */
 	size_t content_length;
+	/** Content is encoded (e.g. compressed) */
+	int encoded;
 	/** Received length */
 	size_t rx_len;
 	/** RX state */
@@ -224,13 +227,47 @@ static int http_rx_content_length ( struct http_request *http,
 		return -EIO;
 	}
 
-	/* Use seek() to notify recipient of filesize */
-	xfer_seek ( &http->xfer, http->content_length, SEEK_SET );
-	xfer_seek ( &http->xfer, 0, SEEK_SET );
-
 	return 0;
 }
 
+/**
+ * Handle HTTP Content-Encoding header
+ *
+ * @v http		HTTP request
+ * @v value		HTTP header value
+ * @ret rc		Return status code
+ */
+static int http_rx_content_encoding ( struct http_request *http,
+				      const char *value ) {
+	struct http_content_encoding *encoding;
+	struct xfer_interface *dest;
+	struct xfer_interface *next;
+	int rc;
+
+	/* Identity encoding requires no decoding */
+	if ( strcasecmp ( value, "identity" ) == 0 )
+		return 0;
+
+	for_each_table_entry ( encoding, HTTP_CONTENT_ENCODINGS ) {
+		if ( strcasecmp ( value, encoding->name ) != 0 )
+			continue;
+
+		/* Splice decoding filter in front of the recipient */
+		DBGC ( http, "HTTP %p decoding %s content\n", http, value );
+		dest = xfer_get_dest ( &http->xfer );
+		if ( ( rc = encoding->filter ( dest, &next ) ) == 0 ) {
+			xfer_plug_plug ( &http->xfer, next );
+			http->encoded = 1;
+		}
+		xfer_put ( dest );
+		return rc;
+	}
+
+	DBGC ( http, "HTTP %p unsupported Content-Encoding \"%s\"\n",
+	       http, value );
+	return -ENOTSUP;
+}
+
 /** An HTTP header handler */
 struct http_header_handler {
 	/** Name (e.g. "Content-Length") */
@@ -256,6 +293,10 @@ static struct http_header_handler http_header_handlers[] = {
 		.header = "Content-Length",
 		.rx = http_rx_content_length,
 	},
+	{
+		.header = "Content-Encoding",
+		.rx = http_rx_content_encoding,
+	},
 	{ NULL, NULL }
 };
 
@@ -277,6 +318,16 @@ static int http_rx_header ( struct http_request *http, char *header ) {
 		DBGC ( http, "HTTP %p start of data\n", http );
 		empty_line_buffer ( &http->linebuf );
 		http->rx_state = HTTP_RX_DATA;
+
+		/* Use seek() to notify recipient of filesize.  The
+		 * Content-Length of encoded content is not the size
+		 * that the recipient will see, so omit it.
+		 */
+		if ( http->content_length && ! http->encoded ) {
+			xfer_seek ( &http->xfer, http->content_length,
+				    SEEK_SET );
+			xfer_seek ( &http->xfer, 0, SEEK_SET );
+		}
 		return 0;
 	}
 
@@ -409,6 +460,24 @@ static int http_socket_deliver_iob ( struct xfer_interface *socket,
 	return rc;
 }
 
+/**
+ * Construct list of supported content encodings
+ *
+ * @v buf		Buffer to fill in
+ * @v len		Length of buffer
+ * @ret len		Length of list (excluding NUL)
+ */
+static size_t http_accept_encoding ( char *buf, size_t len ) {
+	struct http_content_encoding *encoding;
+	size_t used = 0;
+
+	for_each_table_entry ( encoding, HTTP_CONTENT_ENCODINGS ) {
+		used += ssnprintf ( ( buf + used ), ( len - used ), "%s%s",
+				    ( used ? ", " : "" ), encoding->name );
+	}
+	return used;
+}
+
 /**
  * HTTP process
  *
@@ -426,6 +495,7 @@ static void http_step ( struct process *process ) {
 	size_t user_pw_base64_len = base64_encoded_len ( user_pw_len );
 	char user_pw[ user_pw_len + 1 /* NUL */ ];
 	char user_pw_base64[ user_pw_base64_len + 1 /* NUL */ ];
+	char accept[ http_accept_encoding ( NULL, 0 ) + 1 /* NUL */ ];
 	int rc;
 	int request_len = unparse_uri ( NULL, 0, http->uri,
 					URI_PATH_BIT | URI_QUERY_BIT );
@@ -450,11 +520,15 @@ static void http_step ( struct process *process ) {
 			base64_encode ( user_pw, user_pw_base64 );
 		}
 
+		/* Construct list of acceptable content encodings */
+		http_accept_encoding ( accept, sizeof ( accept ) );
+
 		/* Send GET request */
 		if ( ( rc = xfer_printf ( &http->socket,
 					  "GET %s%s HTTP/1.0\r\n"
 					  "User-Agent: gPXE/" VERSION "\r\n"
 					  "%s%s%s"
+					  "%s%s%s"
 					  "Host: %s\r\n"
 					  "\r\n",
 					  http->uri->path ? "" : "/",
@@ -463,6 +537,10 @@ static void http_step ( struct process *process ) {
 					    "Authorization: Basic " : "" ),
 					  ( user ? user_pw_base64 : "" ),
 					  ( user ? "\r\n" : "" ),
+					  ( accept[0] ?
+					    "Accept-Encoding: " : "" ),
+					  accept,
+					  ( accept[0] ? "\r\n" : "" ),
 					  host ) ) != 0 ) {
 			http_done ( http, rc );
 		}
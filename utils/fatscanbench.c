@@ -0,0 +1,234 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * fatscanbench.c
+ *
+ * Host-side benchmark for the bulk FAT run scanner in core/fs/fat.
+ * Loads the FAT of a real FAT16 or FAT32 image and splits it into runs
+ * of contiguous clusters twice: once decoding one entry per sector
+ * lookup, as get_next_cluster() does, and once with the bulk scanner.
+ * Both must find the same runs.
+ *
+ * Usage: fatscanbench <image> [iterations]
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../core/fs/fat/fatscan.c"
+
+static const uint8_t *fat;	/* In-memory copy of the active FAT */
+static uint32_t sector_shift;
+static uint32_t clusters;
+static bool fat32;
+static unsigned long lookups;
+
+static inline uint16_t get16(const uint8_t *p)
+{
+    return p[0] + (p[1] << 8);
+}
+
+static inline uint32_t get32(const uint8_t *p)
+{
+    return get16(p) + ((uint32_t)get16(p + 2) << 16);
+}
+
+/* Stand-in for the disk cache lookup done by get_fat_sector() */
+static __attribute__((noinline)) const uint8_t *fat_sector(uint32_t sector)
+{
+    lookups++;
+    return fat + (sector << sector_shift);
+}
+
+/* The one-entry-at-a-time path */
+static uint32_t next_cluster(uint32_t cluster)
+{
+    uint32_t mask = (1 << sector_shift) - 1;
+    uint32_t offset = cluster << (fat32 ? 2 : 1);
+    const uint8_t *data = fat_sector(offset >> sector_shift);
+
+    offset &= mask;
+    if (fat32)
+	return *(const uint32_t *)(data + offset) & 0x0fffffff;
+    else
+	return *(const uint16_t *)(data + offset);
+}
+
+static uint32_t run_single(uint32_t pcluster, uint32_t max)
+{
+    uint32_t len = 1;
+
+    while (len < max && next_cluster(pcluster + len - 1) == pcluster + len)
+	len++;
+    return len;
+}
+
+/* The bulk path, mirroring fat_run_length() in core/fs/fat/fat.c */
+static uint32_t run_bulk(uint32_t pcluster, uint32_t max)
+{
+    int shift = fat32 ? 2 : 1;
+    uint32_t mask = (1 << sector_shift) - 1;
+    uint32_t len = 1;
+    uint32_t cluster, offset, index, n, m;
+    const uint8_t *data;
+
+    while (len < max) {
+	cluster = pcluster + len - 1;
+	offset = cluster << shift;
+	data = fat_sector(offset >> sector_shift);
+	index = (offset & mask) >> shift;
+	n = ((mask + 1) >> shift) - index;
+	if (n > max - len)
+	    n = max - len;
+
+	if (fat32)
+	    m = fat32_scan_run((const uint32_t *)data + index, n, cluster + 1);
+	else
+	    m = fat16_scan_run((const uint16_t *)data + index, n, cluster + 1);
+
+	len += m;
+	if (m < n)
+	    break;
+    }
+    return len;
+}
+
+/*
+ * Split the whole FAT into runs; returns the number of runs and a
+ * checksum of their lengths.
+ */
+static uint32_t split(uint32_t (*run)(uint32_t, uint32_t), uint64_t *csum)
+{
+    uint32_t cluster = 2, end = clusters + 2;
+    uint32_t nruns = 0, len;
+
+    *csum = 0;
+    while (cluster < end) {
+	len = run(cluster, end - cluster);
+	*csum = *csum * 31 + len;
+	nruns++;
+	cluster += len;
+    }
+    return nruns;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double bench(const char *name, uint32_t (*run)(uint32_t, uint32_t),
+		    int iterations, uint32_t *nruns, uint64_t *csum)
+{
+    double t0, t;
+    int i;
+
+    lookups = 0;
+    t0 = now();
+    for (i = 0; i < iterations; i++)
+	*nruns = split(run, csum);
+    t = (now() - t0) / iterations;
+
+    printf("%-8s %10" PRIu32 " runs %10.3f ms %8.2f ns/cluster "
+	   "%10lu sector lookups\n", name, *nruns, t * 1e3,
+	   t * 1e9 / clusters, lookups / iterations);
+    return t;
+}
+
+int main(int argc, char *argv[])
+{
+    uint8_t bpb[512];
+    uint32_t sector_size, reserved, fat_sectors, total_sectors, data;
+    uint32_t nruns_single, nruns_bulk;
+    uint64_t csum_single, csum_bulk;
+    uint8_t *buf;
+    double t_single, t_bulk;
+    int iterations;
+    FILE *f;
+
+    if (argc < 2) {
+	fprintf(stderr, "Usage: %s image [iterations]\n", argv[0]);
+	return 1;
+    }
+    iterations = (argc > 2) ? atoi(argv[2]) : 20;
+    if (iterations < 1)
+	iterations = 1;
+
+    f = fopen(argv[1], "rb");
+    if (!f || fread(bpb, 1, sizeof bpb, f) != sizeof bpb) {
+	perror(argv[1]);
+	return 1;
+    }
+
+    sector_size = get16(bpb + 11);
+    if (sector_size < 512 || (sector_size & (sector_size - 1)) ||
+	!bpb[13] || !get16(bpb + 14) || !bpb[16]) {
+	fprintf(stderr, "%s: not a FAT filesystem\n", argv[1]);
+	return 1;
+    }
+    sector_shift = __builtin_ctz(sector_size);
+
+    reserved      = get16(bpb + 14);
+    fat_sectors   = get16(bpb + 22) ? : get32(bpb + 36);
+    total_sectors = get16(bpb + 19) ? : get32(bpb + 32);
+    data = reserved + fat_sectors * bpb[16] +
+	((get16(bpb + 17) * 32 + sector_size - 1) >> sector_shift);
+    clusters = (total_sectors - data) / bpb[13];
+
+    if (clusters <= 0xff4) {
+	fprintf(stderr, "%s: FAT12 is not scanned in bulk\n", argv[1]);
+	return 1;
+    }
+    fat32 = clusters > 0xfff4;
+    if (fat32 && clusters > 0x0ffffff4)
+	clusters = 0x0ffffff4;
+    if (fat32 && (bpb[40] & 0x80))
+	reserved += (bpb[40] & 0x0f) * fat_sectors;
+
+    /* The scanner relies on FAT entries being naturally aligned */
+    buf = malloc((size_t)fat_sectors << sector_shift);
+    if (!buf) {
+	perror("malloc");
+	return 1;
+    }
+    if (fseeko(f, (off_t)reserved << sector_shift, SEEK_SET) ||
+	fread(buf, 1, (size_t)fat_sectors << sector_shift, f) !=
+	(size_t)fat_sectors << sector_shift) {
+	perror(argv[1]);
+	return 1;
+    }
+    fclose(f);
+    fat = buf;
+
+    printf("%s: FAT%d, %" PRIu32 " clusters, %" PRIu32
+	   "-byte sectors, %d iterations\n", argv[1], fat32 ? 32 : 16,
+	   clusters, sector_size, iterations);
+
+    t_single = bench("single", run_single, iterations,
+		     &nruns_single, &csum_single);
+    t_bulk   = bench("bulk", run_bulk, iterations,
+		     &nruns_bulk, &csum_bulk);
+
+    if (nruns_single != nruns_bulk || csum_single != csum_bulk) {
+	fprintf(stderr, "MISMATCH between single and bulk scans\n");
+	return 1;
+    }
+    printf("speedup  %.1fx\n", t_single / t_bulk);
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,397 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * mallocbench.c
+ *
+ * Host-side benchmark for the com32 malloc()/free()/realloc() in
+ * com32/lib.  The allocator is built in here under other names and run
+ * over a private arena, replaying allocation traces shaped like those
+ * of real modules:
+ *
+ *   menu  - menu.c32 parsing a large config: a struct and a few
+ *           strdup()ed strings per entry, kept, plus line buffers
+ *   png   - libpng decoding a series of splash images: zlib state and
+ *           window, row buffers and one big image buffer per image
+ *   lua   - lua.c32 running a script: heavy churn of small objects with
+ *           short lifetimes, and tables grown with realloc()
+ *   hdt   - hdt.c32 building its PCI and DMI trees: many small long-
+ *           lived nodes and strings, with scratch buffers in between
+ *
+ * A recorded trace can be replayed instead, one operation per line:
+ * "m <id> <size>", "r <id> <size>" or "f <id>", with ids below 65536.
+ *
+ * Usage: mallocbench [iterations] [trace-file...]
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ARENA_BYTES	(64 << 20)
+#define MAX_IDS		65536
+
+/* The allocator under test, renamed out of the way of the host's */
+#define malloc	com32_malloc
+#define free	com32_free
+#define realloc	com32_realloc
+#include "../com32/lib/malloc.c"
+#include "../com32/lib/free.c"
+#include "../com32/lib/realloc.c"
+#undef malloc
+#undef free
+#undef realloc
+
+/* Stand-in for com32/lib/meminit.c */
+struct free_arena_header __malloc_head;
+struct free_arena_header __malloc_bins[MALLOC_BINS];
+size_t __malloc_bin_map;
+
+static char *arena;
+
+static void arena_init(void)
+{
+    struct free_arena_header *fp;
+
+    memset(&__malloc_head, 0, sizeof __malloc_head);
+    __malloc_head.a.type = ARENA_TYPE_HEAD;
+    __malloc_head.a.next = __malloc_head.a.prev = &__malloc_head;
+    __malloc_head.next_free = __malloc_head.prev_free = &__malloc_head;
+    __malloc_bin_map = 0;
+
+    fp = (struct free_arena_header *)ARENA_ALIGN_UP(arena);
+    fp->a.size = (size_t)ARENA_ALIGN_DOWN(arena + ARENA_BYTES) - (size_t)fp;
+    __inject_free_block(fp);
+}
+
+/* A trace is a list of operations on numbered objects */
+enum op_type { OP_MALLOC, OP_REALLOC, OP_FREE };
+
+struct op {
+    uint8_t type;
+    uint16_t id;
+    uint32_t size;
+};
+
+struct trace {
+    const char *name;
+    struct op *ops;
+    size_t nops, maxops;
+    uint32_t sizes[MAX_IDS];	/* Live size of each id while generating */
+    int nextid;
+    int maxid;			/* Highest id used */
+};
+
+static void emit(struct trace *t, int type, int id, uint32_t size)
+{
+    if (t->nops == t->maxops) {
+	t->maxops = t->maxops ? t->maxops * 2 : 4096;
+	t->ops = realloc(t->ops, t->maxops * sizeof *t->ops);
+	if (!t->ops) {
+	    perror("realloc");
+	    exit(1);
+	}
+    }
+    t->ops[t->nops].type = type;
+    t->ops[t->nops].id = id;
+    t->ops[t->nops].size = size;
+    t->nops++;
+    t->sizes[id] = (type == OP_FREE) ? 0 : size;
+    if (id > t->maxid)
+	t->maxid = id;
+}
+
+/* Allocate a fresh id; ids are recycled only once freed */
+static int t_malloc(struct trace *t, uint32_t size)
+{
+    int id, n;
+
+    for (n = 0; n < MAX_IDS; n++) {
+	id = t->nextid++ & (MAX_IDS - 1);
+	if (!t->sizes[id] && id)
+	    break;
+    }
+    emit(t, OP_MALLOC, id, size);
+    return id;
+}
+
+static void t_free(struct trace *t, int id)
+{
+    if (id && t->sizes[id])
+	emit(t, OP_FREE, id, 0);
+}
+
+static void t_realloc(struct trace *t, int id, uint32_t size)
+{
+    emit(t, OP_REALLOC, id, size);
+}
+
+static void t_free_all(struct trace *t)
+{
+    int id;
+
+    for (id = 1; id < MAX_IDS; id++)
+	t_free(t, id);
+}
+
+static uint32_t rnd_state = 12345;
+
+static uint32_t rnd(uint32_t n)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state % n;
+}
+
+static void gen_menu(struct trace *t)
+{
+    int i, line;
+
+    for (i = 0; i < 600; i++) {
+	line = t_malloc(t, 256);		/* getline() buffer */
+	t_malloc(t, 96 + rnd(64));		/* struct menu_entry */
+	t_malloc(t, 8 + rnd(40));		/* label */
+	t_malloc(t, 12 + rnd(60));		/* kernel */
+	if (rnd(3))
+	    t_malloc(t, 40 + rnd(200));		/* append */
+	if (!rnd(4))
+	    t_malloc(t, 20 + rnd(80));		/* menu label / help */
+	t_free(t, line);
+    }
+    t_free_all(t);
+}
+
+static void gen_png(struct trace *t)
+{
+    int img, row, width, height, id[8];
+    int image;
+
+    for (img = 0; img < 12; img++) {
+	width = 640 + 160 * rnd(5);
+	height = width * 3 / 4;
+	id[0] = t_malloc(t, 1040);		/* png_struct */
+	id[1] = t_malloc(t, 288);		/* png_info */
+	id[2] = t_malloc(t, 7160);		/* inflate state */
+	id[3] = t_malloc(t, 32768);		/* inflate window */
+	id[4] = t_malloc(t, width * 4 + 1);	/* row buffer */
+	id[5] = t_malloc(t, width * 4 + 1);	/* previous row */
+	image = t_malloc(t, width * height * 4);
+	for (row = 0; row < 40; row++) {	/* Chunk and text buffers */
+	    id[6] = t_malloc(t, 8192);
+	    id[7] = t_malloc(t, 16 + rnd(64));
+	    t_free(t, id[6]);
+	    t_free(t, id[7]);
+	}
+	for (row = 0; row < 6; row++)
+	    t_free(t, id[row]);
+	if (img & 1)				/* Keep every other image */
+	    t_free(t, image);
+    }
+    t_free_all(t);
+}
+
+static void gen_lua(struct trace *t)
+{
+    static int live[4096];
+    int tables[32], tsize[32];
+    int i, j;
+
+    memset(live, 0, sizeof live);
+    for (j = 0; j < 32; j++) {
+	tsize[j] = 64;
+	tables[j] = t_malloc(t, tsize[j]);
+    }
+    for (i = 0; i < 200000; i++) {
+	j = rnd(4096);
+	t_free(t, live[j]);			/* Garbage collected */
+	live[j] = t_malloc(t, 16 + 8 * rnd(rnd(8) ? 6 : 40));
+	if (!rnd(500)) {			/* Grow a table */
+	    j = rnd(32);
+	    if (tsize[j] < 65536) {
+		tsize[j] *= 2;
+		t_realloc(t, tables[j], tsize[j]);
+	    }
+	}
+    }
+    t_free_all(t);
+}
+
+static void gen_hdt(struct trace *t)
+{
+    int i, scratch;
+
+    for (i = 0; i < 400; i++) {		/* PCI devices */
+	scratch = t_malloc(t, 4096);		/* pci.ids line buffer */
+	t_malloc(t, 200 + rnd(40));		/* struct pci_device */
+	t_malloc(t, 16 + rnd(64));		/* vendor name */
+	t_malloc(t, 16 + rnd(96));		/* product name */
+	if (!rnd(3))
+	    t_malloc(t, 32 + rnd(32));		/* kernel module name */
+	t_free(t, scratch);
+    }
+    for (i = 0; i < 120; i++) {		/* DMI structures */
+	scratch = t_malloc(t, 1024 + rnd(3072));
+	t_malloc(t, 64 + rnd(256));
+	t_malloc(t, 8 + rnd(56));
+	t_free(t, scratch);
+    }
+    t_free_all(t);
+}
+
+static int read_trace(struct trace *t, const char *file)
+{
+    char line[128];
+    unsigned int id, size;
+    FILE *f;
+
+    f = fopen(file, "r");
+    if (!f) {
+	perror(file);
+	return -1;
+    }
+    while (fgets(line, sizeof line, f)) {
+	if (sscanf(line, "m %u %u", &id, &size) == 2 && id < MAX_IDS)
+	    emit(t, OP_MALLOC, id, size);
+	else if (sscanf(line, "r %u %u", &id, &size) == 2 && id < MAX_IDS)
+	    emit(t, OP_REALLOC, id, size);
+	else if (sscanf(line, "f %u", &id) == 1 && id < MAX_IDS)
+	    emit(t, OP_FREE, id, 0);
+    }
+    fclose(f);
+    t->name = file;
+    return 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *ptrs[MAX_IDS];
+static size_t live_size[MAX_IDS];
+
+/*
+ * Replay a trace; returns the number of failed allocations, and the
+ * peak of live bytes and of the arena span used.
+ */
+static unsigned long replay(const struct trace *t, size_t *peak_live,
+			    size_t *peak_span)
+{
+    const struct op *op;
+    unsigned long failed = 0;
+    size_t live = 0, span;
+    char *p;
+
+    /* Only clear what the trace uses, so as not to time a 1 MB memset */
+    memset(ptrs, 0, (t->maxid + 1) * sizeof *ptrs);
+    memset(live_size, 0, (t->maxid + 1) * sizeof *live_size);
+    *peak_live = *peak_span = 0;
+
+    for (op = t->ops; op < t->ops + t->nops; op++) {
+	if (op->type != OP_REALLOC || !op->size) {
+	    com32_free(ptrs[op->id]);
+	    ptrs[op->id] = NULL;
+	    live -= live_size[op->id];
+	    live_size[op->id] = 0;
+	}
+	if (op->type == OP_FREE || !op->size)
+	    continue;
+
+	if (op->type == OP_MALLOC)
+	    p = com32_malloc(op->size);
+	else
+	    p = com32_realloc(ptrs[op->id], op->size);
+	if (!p) {
+	    failed++;
+	    continue;
+	}
+
+	p[0] = p[op->size - 1] = op->id;	/* Touch it */
+	ptrs[op->id] = p;
+	live += op->size - live_size[op->id];
+	live_size[op->id] = op->size;
+	if (live > *peak_live)
+	    *peak_live = live;
+	span = p + op->size - arena;
+	if (span > *peak_span)
+	    *peak_span = span;
+    }
+    return failed;
+}
+
+static void bench(const struct trace *t, int iterations)
+{
+    size_t peak_live, peak_span;
+    unsigned long failed = 0;
+    double t0, dt;
+    int i;
+
+    t0 = now();
+    for (i = 0; i < iterations; i++) {
+	arena_init();
+	failed = replay(t, &peak_live, &peak_span);
+    }
+    dt = (now() - t0) / iterations;
+
+    printf("%-8s %9zu ops %9.3f ms %7.1f ns/op %8zu KB live "
+	   "%8zu KB span %5.2fx %lu failed\n", t->name, t->nops, dt * 1e3,
+	   dt * 1e9 / t->nops, peak_live >> 10, peak_span >> 10,
+	   (double)peak_span / peak_live, failed);
+}
+
+int main(int argc, char *argv[])
+{
+    static void (*const gens[])(struct trace *) = {
+	gen_menu, gen_png, gen_lua, gen_hdt
+    };
+    static const char *const names[] = { "menu", "png", "lua", "hdt" };
+    struct trace *t;
+    int iterations, i;
+
+    iterations = (argc > 1) ? atoi(argv[1]) : 20;
+    if (iterations < 1)
+	iterations = 1;
+
+    arena = malloc(ARENA_BYTES);
+    t = calloc(1, sizeof *t);
+    if (!arena || !t) {
+	perror("malloc");
+	return 1;
+    }
+
+    printf("%d iterations, %d MB arena\n", iterations, ARENA_BYTES >> 20);
+    if (argc > 2) {
+	for (i = 2; i < argc; i++) {
+	    memset(t, 0, sizeof *t);
+	    if (!read_trace(t, argv[i]))
+		bench(t, iterations);
+	    free(t->ops);
+	}
+    } else {
+	for (i = 0; i < (int)(sizeof gens / sizeof gens[0]); i++) {
+	    memset(t, 0, sizeof *t);
+	    t->name = names[i];
+	    gens[i](t);
+	    bench(t, iterations);
+	    free(t->ops);
+	}
+    }
+
+    free(t);
+    return 0;
+}
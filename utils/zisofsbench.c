@@ -0,0 +1,223 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * zisofsbench.c
+ *
+ * Host-side benchmark for the zisofs decoder in core/fs/iso9660.
+ * Compresses a file the way mkzftree does, checks that the core decoder
+ * gives it back unchanged, and times the decoding.  From that it works
+ * out how long loading the file takes from media of a few speeds, read
+ * as is or compressed and then inflated, since on slow media reading
+ * fewer bytes is worth more than the CPU time spent inflating them.
+ *
+ * Usage: zisofsbench <file> [block_shift [iterations]]
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../core/fs/iso9660/zisofs.c"
+
+/* Media speeds to model, in MB/s */
+static const struct {
+    const char *name;
+    double mbps;
+} media[] = {
+    { "CD 1x", 0.15 },
+    { "CD 8x", 1.2 },
+    { "BMC virtual media", 3.0 },
+    { "CD 32x", 4.8 },
+    { "DVD 16x", 22.0 },
+    { "USB 2.0", 30.0 },
+    { "SATA SSD", 400.0 },
+};
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] + (p[1] << 8) + (p[2] << 16) + ((uint32_t)p[3] << 24);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Build the zisofs image of data: a header, the block pointers, then
+ * each block deflated on its own, with all-zero blocks left empty.
+ */
+static uint8_t *zisofs_compress(const uint8_t *data, uint32_t size,
+				unsigned int block_shift, uint32_t *csize)
+{
+    uint32_t block_size = 1 << block_shift;
+    uint32_t nblocks = (size + block_size - 1) >> block_shift;
+    uint32_t i, len, offset;
+    uLongf clen;
+    uint8_t *out;
+    bool zero;
+
+    out = malloc(16 + 4 * (nblocks + 1) + compressBound(block_size) *
+		 (size_t)nblocks);
+    if (!out)
+	return NULL;
+
+    memcpy(out, zisofs_magic, sizeof zisofs_magic);
+    put_le32(out + 8, size);
+    out[12] = 16 >> 2;
+    out[13] = block_shift;
+    out[14] = out[15] = 0;
+
+    offset = 16 + 4 * (nblocks + 1);
+    for (i = 0; i < nblocks; i++) {
+	put_le32(out + 16 + 4 * i, offset);
+	len = size - (i << block_shift);
+	if (len > block_size)
+	    len = block_size;
+
+	zero = !data[i << block_shift] &&
+	    !memcmp(data + (i << block_shift),
+		    data + (i << block_shift) + 1, len - 1);
+	if (zero)
+	    continue;
+
+	clen = compressBound(block_size);
+	if (compress2(out + offset, &clen, data + (i << block_shift), len,
+		      9) != Z_OK) {
+	    free(out);
+	    return NULL;
+	}
+	offset += clen;
+    }
+    put_le32(out + 16 + 4 * nblocks, offset);
+
+    *csize = offset;
+    return out;
+}
+
+/* Decode the whole image as iso_getfssec() would; returns 0 if it's OK */
+static int zisofs_decode(z_stream *zs, const uint8_t *zf, uint8_t *out)
+{
+    uint32_t size, nblocks, i, len, start, end;
+    unsigned int header_size, block_shift;
+
+    if (zisofs_parse_header(zf, &size, &header_size, &block_shift))
+	return -1;
+
+    nblocks = (size + (1 << block_shift) - 1) >> block_shift;
+    for (i = 0; i < nblocks; i++) {
+	start = get_le32(zf + header_size + 4 * i);
+	end = get_le32(zf + header_size + 4 * (i + 1));
+	len = size - (i << block_shift);
+	if (len > 1U << block_shift)
+	    len = 1 << block_shift;
+
+	if (zisofs_inflate_block(zs, zf + start, end - start,
+				 out + (i << block_shift), len) != (int)len)
+	    return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int block_shift;
+    uint32_t size, csize;
+    uint8_t *data, *zf, *out;
+    double t0, t, t_raw, t_zf;
+    int iterations, i;
+    z_stream zs;
+    long len;
+    FILE *f;
+
+    if (argc < 2) {
+	fprintf(stderr, "Usage: %s file [block_shift [iterations]]\n",
+		argv[0]);
+	return 1;
+    }
+    block_shift = (argc > 2) ? atoi(argv[2]) : 15;
+    if (block_shift < 15 || block_shift > 17) {
+	fprintf(stderr, "%s: block_shift must be 15, 16 or 17\n", argv[0]);
+	return 1;
+    }
+    iterations = (argc > 3) ? atoi(argv[3]) : 10;
+    if (iterations < 1)
+	iterations = 1;
+
+    f = fopen(argv[1], "rb");
+    if (!f || fseek(f, 0, SEEK_END) || (len = ftell(f)) <= 0 ||
+	len > 0xffffffffL || fseek(f, 0, SEEK_SET)) {
+	perror(argv[1]);
+	return 1;
+    }
+    size = len;
+    data = malloc(size);
+    out = malloc(size);
+    if (!data || !out || fread(data, 1, size, f) != size) {
+	perror(argv[1]);
+	return 1;
+    }
+    fclose(f);
+
+    zf = zisofs_compress(data, size, block_shift, &csize);
+    if (!zf) {
+	fprintf(stderr, "%s: compression failed\n", argv[1]);
+	return 1;
+    }
+
+    memset(&zs, 0, sizeof zs);
+    if (inflateInit(&zs) != Z_OK)
+	return 1;
+
+    memset(out, 0xaa, size);
+    if (zisofs_decode(&zs, zf, out) || memcmp(out, data, size)) {
+	fprintf(stderr, "MISMATCH after decoding\n");
+	return 1;
+    }
+
+    t0 = now();
+    for (i = 0; i < iterations; i++)
+	zisofs_decode(&zs, zf, out);
+    t = (now() - t0) / iterations;
+    inflateEnd(&zs);
+
+    printf("%s: %" PRIu32 " bytes, %" PRIu32 " compressed (%.1f%%), "
+	   "%u-byte blocks\n", argv[1], size, csize, 100.0 * csize / size,
+	   1 << block_shift);
+    printf("inflate  %10.3f ms %8.1f MB/s\n", t * 1e3, size / t / 1e6);
+    printf("\n%-18s %12s %12s %8s\n", "media", "plain ms", "zisofs ms",
+	   "speedup");
+    for (i = 0; i < (int)(sizeof media / sizeof media[0]); i++) {
+	t_raw = size / (media[i].mbps * 1e6);
+	t_zf = csize / (media[i].mbps * 1e6) + t;
+	printf("%-18s %12.1f %12.1f %7.2fx\n", media[i].name,
+	       t_raw * 1e3, t_zf * 1e3, t_raw / t_zf);
+    }
+    printf("\nzisofs wins below %.1f MB/s\n", (size - csize) / t / 1e6);
+
+    free(zf);
+    free(data);
+    free(out);
+    return 0;
+}